@@ -21,6 +21,7 @@ typedef void (*PFN_CODEC_CALLBACK)(void *ctxt, void *buf[8], int len[8]);
     uint8_t vpsinfo[256]; \
     uint8_t spsinfo[256]; \
     uint8_t ppsinfo[256]; \
+    char    tiles  [64];  \
     void (*uninit  )(void *ctxt); \
     void (*write   )(void *ctxt, void *buf[8], int len[8]); \
     int  (*read    )(void *ctxt, void *buf, int len, int *fsize, int *key, uint32_t *pts, int timeout); \
@@ -36,6 +37,8 @@ CODEC* alawenc_init(void);
 CODEC* aacenc_init (int channels, int samplerate, int bitrate);
 CODEC* h264enc_init(int frate, int w, int h, int bitrate);
 CODEC* h265enc_init(int frate, int w, int h, int bitrate);
+CODEC* tileenc_init(int frate, int w, int h, int bitrate, int tiles, int h265);
+CODEC* scrnenc_init(int frate, int w, int h, int bitrate);
 
 #define codec_uninit(codec)                             (codec)->uninit(codec)
 #define codec_write(codec, buf, len)                    (codec)->write(codec, buf, len)
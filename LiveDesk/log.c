@@ -1,6 +1,9 @@
 /* ͷļ */
+#ifdef WIN32
 #include <windows.h>
+#endif
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include "log.h"
@@ -15,7 +18,7 @@
 #define LOG_MODE_DEBUGER  2
 
 static FILE *s_log_fp = NULL;
-static DWORD s_log_mode = LOG_MODE_DISABLE;
+static int   s_log_mode = LOG_MODE_DISABLE;
 
 /* ʵ */
 void log_init(char *file)
@@ -13,6 +13,7 @@
 #include "avkcps.h"
 #include "avkcpc.h"
 #include "ffrdps.h"
+#include "ffrdp.h"
 #include "log.h"
 
 #ifdef WIN32
@@ -48,16 +49,24 @@ int main(int argc, char *argv[])
     int       avkcpport= 8000;
     int       ffrdpport= 8000;
     int       ffrdpauto= 0; // ffrdp auto bitrate (adaptive bitrate)
+    int       ffrdpfec = 0; // ffrdp fec, FFRDP_FEC(k, m)
+    int       ffrdpdl  = 0; // ffrdp deadline of video frames in ms, 0 to disable
+    int       ffrdpst  = 0; // ffrdp streams for audio, video and input
     char      recpath[256] = "livedesk";
     void     *avkcpc = NULL;
     char      ffrdptxkey[32] = {0};
     char      ffrdprxkey[32] = {0};
+    int       region[4] = {0}, vsizeset = 0;
+    int       tiles    = 1; // split frame into tiles encoded in parallel, only for avkcps & ffrdps
+    char      window[256] = "";
 
     for (i=1; i<argc; i++) {
         if (strcmp(argv[i], "--aac") == 0) {
             aenctype = 1;
         } else if (strcmp(argv[i], "--h265") == 0) {
             venctype = 1;
+        } else if (strcmp(argv[i], "--scrn") == 0) {
+            venctype = 2;
         } else if (strstr(argv[i], "--channels=") == argv[i]) {
             channels = atoi(argv[i] + 11);
         } else if (strstr(argv[i], "--samplerate=") == argv[i]) {
@@ -65,9 +74,9 @@ int main(int argc, char *argv[])
         } else if (strstr(argv[i], "--abitrate=") == argv[i]) {
             abitrate = atoi(argv[i] + 11);
         } else if (strstr(argv[i], "--vwidth=") == argv[i]) {
-            vwidth = atoi(argv[i] + 9);
+            vwidth = atoi(argv[i] + 9); vsizeset = 1;
         } else if (strstr(argv[i], "--vheight=") == argv[i]) {
-            vheight = atoi(argv[i] + 10);
+            vheight = atoi(argv[i] + 10); vsizeset = 1;
         } else if (strstr(argv[i], "--framerate=") == argv[i]) {
             framerate = atoi(argv[i] + 12);
         } else if (strstr(argv[i], "--vbitrate=") == argv[i]) {
@@ -88,20 +97,40 @@ int main(int argc, char *argv[])
             rectype = 4; avkcpport = atoi(argv[i] + 9);
         } else if (strstr(argv[i], "--ffrdps=") == argv[i]) {
             rectype = 5; ffrdpport = atoi(argv[i] + 9);
+        } else if (strstr(argv[i], "--ffrdpsfec=") == argv[i]) {
+            int k = 0, m = 0; sscanf(argv[i] + 12, "%d,%d", &k, &m); ffrdpfec = k > 0 && m > 0 ? FFRDP_FEC(k, m) : 0;
+        } else if (strstr(argv[i], "--ffrdpsdeadline=") == argv[i]) {
+            ffrdpdl = atoi(argv[i] + 17);
+        } else if (strstr(argv[i], "--ffrdpsstreams=") == argv[i]) {
+            ffrdpst = atoi(argv[i] + 16);
         } else if (strstr(argv[i], "--ffrdpstxkey=") == argv[i]) {
             strncpy(ffrdptxkey, argv[i] + 14, sizeof(ffrdptxkey));
         } else if (strstr(argv[i], "--ffrdpsrxkey=") == argv[i]) {
             strncpy(ffrdprxkey, argv[i] + 14, sizeof(ffrdprxkey));
         } else if (strstr(argv[i], "--duration=") == argv[i]) {
             duration = atoi(argv[i] + 11);
+        } else if (strstr(argv[i], "--tiles=") == argv[i]) {
+            tiles = atoi(argv[i] + 8);
+        } else if (strstr(argv[i], "--region=") == argv[i]) {
+            sscanf(argv[i] + 9, "%d,%d,%d,%d", &region[0], &region[1], &region[2], &region[3]);
+        } else if (strstr(argv[i], "--window=") == argv[i]) {
+            strncpy(window, argv[i] + 9, sizeof(window) - 1);
         }
     }
+    if (region[2] > 0 && region[3] > 0 && !vsizeset) { // encode region at its own size instead of scaling it to full screen size
+        vwidth  = region[2] & ~1;
+        vheight = region[3] & ~1;
+    }
     if (rectype == 2) {
         aenctype = 0;
     }
     if (rectype == 3) {
         aenctype = 1;
     }
+    if (rectype != 4 && rectype != 5) {
+        tiles = 1; // tiled stream can only be reassembled by avkcp & ffrdp clients
+        if (venctype == 2) venctype = 0; // so does scrnenc stream
+    }
     if (aenctype == 0) {
         channels   = 1;
         samplerate = 8000;
@@ -114,22 +143,36 @@ int main(int argc, char *argv[])
     printf("ffrdpport : %d\n", ffrdpport);
     printf("ffrdptxkey: %s\n", ffrdptxkey);
     printf("ffrdprxkey: %s\n", ffrdprxkey);
+    printf("ffrdpfec  : %d,%d\n", ffrdpfec & 0xFF, ffrdpfec >> 8);
+    printf("ffrdpdl   : %d\n", ffrdpdl);
+    printf("ffrdpst   : %d\n", ffrdpst);
     printf("aenctype  : %s\n", aenctype ? "aac" : "alaw");
     printf("channels  : %d\n", channels);
     printf("samplerate: %d\n", samplerate);
     printf("abitrate  : %d\n", abitrate);
-    printf("venctype  : %s\n", venctype ? "h265" : "h264");
+    printf("venctype  : %s\n", venctype == 2 ? "scrn" : venctype ? "h265" : "h264");
     printf("vwidth    : %d\n", vwidth);
     printf("vheight   : %d\n", vheight);
     printf("framerate : %d\n", framerate);
     printf("vbitrate  : %d\n", vbitrate);
+    printf("tiles     : %d\n", tiles);
+    printf("region    : %d,%d,%d,%d\n", region[0], region[1], region[2], region[3]);
+    printf("window    : %s\n", window);
     printf("\n\n");
 
     log_init("DEBUGER");
     live->adev = adev_init(channels, samplerate);
     live->vdev = vdev_init(framerate, vwidth, vheight);
+    vdev_set_region(live->vdev, region[0], region[1], region[2], region[3]);
+    if (window[0]) vdev_set_window(live->vdev, window);
     live->aenc = aenctype ? aacenc_init(channels, samplerate, abitrate) : alawenc_init();
-    live->venc = venctype ? h265enc_init(framerate, vwidth, vheight, vbitrate) : h264enc_init(framerate, vwidth, vheight, vbitrate);
+    if (venctype == 2) {
+        live->venc = scrnenc_init(framerate, vwidth, vheight, vbitrate);
+    } else if (tiles > 1) {
+        live->venc = tileenc_init(framerate, vwidth, vheight, vbitrate, tiles, venctype);
+    } else {
+        live->venc = venctype ? h265enc_init(framerate, vwidth, vheight, vbitrate) : h264enc_init(framerate, vwidth, vheight, vbitrate);
+    }
     adev_set_callback(live->adev, live->aenc->write, live->aenc);
     vdev_set_callback(live->vdev, live->venc->write, live->venc);
 
@@ -139,14 +182,15 @@ int main(int argc, char *argv[])
     case 2: live->rec   = ffrecorder_init(recpath, "avi", duration, channels, samplerate, vwidth, vheight, framerate, live->adev, live->vdev, live->aenc, live->venc); break;
     case 3: live->rec   = ffrecorder_init(recpath, "mp4", duration, channels, samplerate, vwidth, vheight, framerate, live->adev, live->vdev, live->aenc, live->venc); break;
     case 4: live->avkcps= avkcps_init(avkcpport, channels, samplerate, vwidth, vheight, framerate, live->adev, live->vdev, live->aenc, live->venc); break;
-    case 5: live->ffrdps= ffrdps_init(ffrdpport, ffrdptxkey, ffrdprxkey, channels, samplerate, vwidth, vheight, framerate, live->adev, live->vdev, live->aenc, live->venc); break;
+    case 5: live->ffrdps= ffrdps_init(ffrdpport, ffrdptxkey, ffrdprxkey, ffrdpfec, channels, samplerate, vwidth, vheight, framerate, live->adev, live->vdev, live->aenc, live->venc); break;
     }
 
-    if (rectype == 5 && ffrdpauto) { // setup adaptive bitrate list
-        int blist[16] = { 250000, 500000, 1000000, 1200000, 1400000, 1600000, 1800000, 2000000, 2100000, 2200000, 2300000, 2400000, 2500000, 2600000, 2700000 };
-        ffrdps_adaptive_bitrate_setup (live->ffrdps, blist, 15);
+    if (rectype == 5 && ffrdpauto) { // setup adaptive bitrate range
+        ffrdps_adaptive_bitrate_setup (live->ffrdps, 250000, 8000000);
         ffrdps_adaptive_bitrate_enable(live->ffrdps, 1);
     }
+    if (rectype == 5) ffrdps_set_deadline(live->ffrdps, ffrdpdl);
+    if (rectype == 5) ffrdps_set_streams (live->ffrdps, ffrdpst);
 
     printf("\n\ntype help for more infomation and command.\n\n");
     while (!(live->status & TS_EXIT)) {
@@ -175,6 +219,12 @@ int main(int argc, char *argv[])
         } else if (rectype == 5 && stricmp(cmd, "ffrdps_reconfig_bitrate") == 0) {
             int val; scanf("%d", &val);
             if (live->ffrdps) ffrdps_reconfig_bitrate(live->ffrdps, val);
+        } else if (stricmp(cmd, "vdev_region") == 0) {
+            int x, y, w, h; scanf("%d %d %d %d", &x, &y, &w, &h);
+            vdev_set_region(live->vdev, x, y, w, h);
+        } else if (stricmp(cmd, "vdev_window") == 0) {
+            char title[256] = ""; scanf(" %255[^\n]", title);
+            vdev_set_window(live->vdev, stricmp(title, "none") == 0 ? NULL : title);
         } else if (stricmp(cmd, "help") == 0) {
             printf("\nlivedesk v1.0.0\n\n");
             printf("available commmand:\n");
@@ -184,7 +234,9 @@ int main(int argc, char *argv[])
             printf("- record_pause: pause recording screen to files.\n");
             printf("- rtmp_start  : start rtmp push.\n");
             printf("- rtmp_pause  : pause rtmp push.\n");
-            printf("- ffrdps_dump : dump ffrdps server.\n\n");
+            printf("- ffrdps_dump : dump ffrdps server.\n");
+            printf("- vdev_region : capture screen region, vdev_region x y w h, w or h 0 means full screen.\n");
+            printf("- vdev_window : capture and follow window, vdev_window title, none means full screen.\n\n");
         }
     }
 
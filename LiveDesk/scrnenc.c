@@ -0,0 +1,521 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "stdafx.h"
+#include "ringbuf.h"
+#include "codec.h"
+#include "log.h"
+
+#include "libavutil/time.h"
+
+#ifdef WIN32
+#define timespec timespec32
+#endif
+
+/*
+ scrnenc is a lossless screen codec, it sends only the 64x64 tiles which differ from what the client has.
+ every output frame starts with one byte of type:
+ 'S' frame: u8 'S', u8 flags, u16 width, u16 height, u16 tile number, then tiles:
+            u8 tile column, u8 tile row, u8 tile type, then data of the type:
+            TILE_RAW    : u16 cache slot, tw * th * 3 bytes BGR
+            TILE_SOLID  : 3 bytes BGR
+            TILE_PALETTE: u16 cache slot, u8 color number - 1, colors * 3 bytes BGR, then runs of [u8 index, varint length - 1]
+            TILE_CACHE  : u16 cache slot, the tile is a copy of the slot
+            TILE_COPY   : s16 dy, the tile is a copy of previous frame at (x, y - dy), used for scrolling
+            tw and th are 64 except for the last column and row, cache slot 0xFFFF means don't store the tile.
+            COPY tiles always read the frame before this one, they come first in the frame.
+            FRAME_KEY clears canvas and cache, FRAME_H264_LEAVE makes client ignore 'H' frames until FRAME_H264_ENTER.
+ 'H' frame: u8 'H', then h264 frame of the fallback encoder, used for high motion content and scaled to canvas size.
+ tiles which don't fit in FRAME_BUDGET are sent with the following frames.
+*/
+
+#define TILE_SIZE          64
+#define CACHE_SLOTS        1024
+#define OUT_BUF_SIZE      (4 * 1024 * 1024)
+#define FRAME_BUDGET      (512 * 1024)
+#define TILE_MAX_SIZE     (8 + TILE_SIZE * TILE_SIZE * 3)
+#define H264_ENTER_RATIO   40 // enter h264 mode if more than 40% of tiles need real encoding
+#define H264_ENTER_FRAMES  3  // for 3 frames in a row
+#define H264_LEAVE_RATIO   5  // leave h264 mode if less than 5% of tiles change
+#define H264_LEAVE_FRAMES  10 // for 10 frames in a row
+
+enum { TILE_RAW, TILE_SOLID, TILE_PALETTE, TILE_CACHE, TILE_COPY };
+enum { FRAME_KEY = (1 << 0), FRAME_H264_ENTER = (1 << 1), FRAME_H264_LEAVE = (1 << 2) };
+
+typedef struct {
+    CODEC_INTERFACE_FUNCS
+
+    CODEC   *h264;
+    int      iw;
+    int      ih;
+    int      cols;
+    int      rows;
+
+    uint8_t *prev;          // frame content client has, iw * 4 stride
+    uint64_t*hash_client;   // hash of every tile client has
+    uint64_t*hash_last;     // hash of every tile in last input frame
+    uint64_t*hash_cur;
+    uint8_t *stale;         // tile content on client is unknown
+    int16_t *copy_dy;       // tile can be copied from previous frame with this offset
+    uint64_t*rowhash_prev;  // hash of every tile wide row span, cols * ih
+    uint64_t*rowhash_cur;
+    uint8_t *rowflat;       // row span has only one color, useless for scroll detection
+    int     *dylist;
+    int     *rowmap;        // hash table of prev row spans for scroll detection
+    int      rowmap_size;
+    uint64_t cache[CACHE_SLOTS];
+    uint32_t tile[TILE_SIZE * TILE_SIZE];
+    uint8_t  fbuff[FRAME_BUDGET + TILE_MAX_SIZE];
+
+    uint8_t  obuff[OUT_BUF_SIZE];
+    int      ohead;
+    int      otail;
+    int      osize;
+
+    #define TS_START       (1 << 0)
+    #define TS_REQUEST_KEY (1 << 1)
+    #define TS_H264        (1 << 2)
+    int      status;
+    int      cnt_motion;
+    int      cnt_still;
+
+    pthread_mutex_t omutex;
+    pthread_cond_t  ocond;
+} SCRNENC;
+
+static void scrnenc_free_buffers(SCRNENC *enc)
+{
+    free(enc->prev        ); enc->prev         = NULL;
+    free(enc->hash_client ); enc->hash_client  = NULL;
+    free(enc->hash_last   ); enc->hash_last    = NULL;
+    free(enc->hash_cur    ); enc->hash_cur     = NULL;
+    free(enc->stale       ); enc->stale        = NULL;
+    free(enc->copy_dy     ); enc->copy_dy      = NULL;
+    free(enc->rowhash_prev); enc->rowhash_prev = NULL;
+    free(enc->rowhash_cur ); enc->rowhash_cur  = NULL;
+    free(enc->rowflat     ); enc->rowflat      = NULL;
+    free(enc->dylist      ); enc->dylist       = NULL;
+    free(enc->rowmap      ); enc->rowmap       = NULL;
+    enc->iw = enc->ih = 0;
+}
+
+static int scrnenc_alloc_buffers(SCRNENC *enc, int w, int h)
+{
+    int n;
+    scrnenc_free_buffers(enc);
+    enc->cols = (w + TILE_SIZE - 1) / TILE_SIZE;
+    enc->rows = (h + TILE_SIZE - 1) / TILE_SIZE;
+    n = enc->cols * enc->rows;
+    for (enc->rowmap_size = 1; enc->rowmap_size < 2 * h; enc->rowmap_size <<= 1);
+    enc->prev         = calloc(1, w * h * 4);
+    enc->hash_client  = calloc(n, sizeof(uint64_t));
+    enc->hash_last    = calloc(n, sizeof(uint64_t));
+    enc->hash_cur     = calloc(n, sizeof(uint64_t));
+    enc->stale        = calloc(n, sizeof(uint8_t ));
+    enc->copy_dy      = calloc(n, sizeof(int16_t ));
+    enc->rowhash_prev = calloc(enc->cols * h, sizeof(uint64_t));
+    enc->rowhash_cur  = calloc(enc->cols * h, sizeof(uint64_t));
+    enc->rowflat      = calloc(enc->cols * h, sizeof(uint8_t ));
+    enc->dylist       = calloc(h, sizeof(int));
+    enc->rowmap       = calloc(enc->rowmap_size, sizeof(int));
+    if (!enc->prev || !enc->hash_client || !enc->hash_last || !enc->hash_cur || !enc->stale || !enc->copy_dy
+        || !enc->rowhash_prev || !enc->rowhash_cur || !enc->rowflat || !enc->dylist || !enc->rowmap) {
+        log_printf("scrnenc failed to allocate buffers !\n");
+        scrnenc_free_buffers(enc);
+        return -1;
+    }
+    enc->iw = w;
+    enc->ih = h;
+    return 0;
+}
+
+// hash every tile wide row span, tile hash is made of its row hashes
+static void scrnenc_hash(SCRNENC *enc, uint8_t *data, int stride)
+{
+    uint32_t *src;
+    uint64_t  hash;
+    int       c, r, x, y, tw, th, flat;
+    for (c=0; c<enc->cols; c++) {
+        tw = MIN(TILE_SIZE, enc->iw - c * TILE_SIZE);
+        for (y=0; y<enc->ih; y++) {
+            src  = (uint32_t*)(data + y * stride) + c * TILE_SIZE;
+            hash = 14695981039346656037ULL;
+            flat = 1;
+            for (x=0; x<tw; x++) {
+                hash = (hash ^ (src[x] & 0xFFFFFF)) * 1099511628211ULL;
+                flat&= ((src[x] ^ src[0]) & 0xFFFFFF) == 0;
+            }
+            enc->rowhash_cur[c * enc->ih + y] = hash;
+            enc->rowflat    [c * enc->ih + y] = flat;
+        }
+        for (r=0; r<enc->rows; r++) {
+            th   = MIN(TILE_SIZE, enc->ih - r * TILE_SIZE);
+            hash = 14695981039346656037ULL;
+            for (y=0; y<th; y++) hash = (hash ^ enc->rowhash_cur[c * enc->ih + r * TILE_SIZE + y]) * 1099511628211ULL;
+            enc->hash_cur[r * enc->cols + c] = hash | 1; // 0 is empty cache slot
+        }
+    }
+}
+
+static int cmp_int(const void *a, const void *b) { return *(int*)a - *(int*)b; }
+
+// find vertical scroll offset of every tile column by matching row spans against previous frame, then verify changed tiles
+static void scrnenc_detect_scroll(SCRNENC *enc, uint8_t *data, int stride)
+{
+    uint64_t hash;
+    int      c, r, y, i, n, best, cnt, bestcnt, tw, th, sy, ok;
+    for (c=0; c<enc->cols; c++) {
+        for (r=0, ok=0; r<enc->rows; r++) {
+            enc->copy_dy[r * enc->cols + c] = 0;
+            ok |= enc->stale[r * enc->cols + c] || enc->hash_cur[r * enc->cols + c] != enc->hash_client[r * enc->cols + c];
+        }
+        if (!ok) continue;
+
+        memset(enc->rowmap, 0, enc->rowmap_size * sizeof(int));
+        for (y=0; y<enc->ih; y++) { // rowmap holds y + 1 of unique prev row spans, -(y + 1) for duplicated ones
+            hash = enc->rowhash_prev[c * enc->ih + y];
+            for (i=(int)(hash & (enc->rowmap_size - 1)); enc->rowmap[i]; i=(i+1) & (enc->rowmap_size - 1)) {
+                if (enc->rowhash_prev[c * enc->ih + abs(enc->rowmap[i]) - 1] == hash) { enc->rowmap[i] = -abs(enc->rowmap[i]); break; }
+            }
+            if (!enc->rowmap[i]) enc->rowmap[i] = y + 1;
+        }
+        for (y=0, n=0; y<enc->ih; y++) {
+            if (enc->rowflat[c * enc->ih + y]) continue;
+            hash = enc->rowhash_cur[c * enc->ih + y];
+            if (hash == enc->rowhash_prev[c * enc->ih + y]) continue;
+            for (i=(int)(hash & (enc->rowmap_size - 1)); enc->rowmap[i]; i=(i+1) & (enc->rowmap_size - 1)) {
+                if (enc->rowhash_prev[c * enc->ih + abs(enc->rowmap[i]) - 1] != hash) continue;
+                if (enc->rowmap[i] > 0) enc->dylist[n++] = y - (enc->rowmap[i] - 1);
+                break;
+            }
+        }
+        if (n < TILE_SIZE / 2) continue;
+        qsort(enc->dylist, n, sizeof(int), cmp_int);
+        for (i=0, best=0, bestcnt=0, cnt=0; i<n; i++) {
+            cnt = (i > 0 && enc->dylist[i] == enc->dylist[i - 1]) ? cnt + 1 : 1;
+            if (cnt > bestcnt) { bestcnt = cnt; best = enc->dylist[i]; }
+        }
+        if (bestcnt < TILE_SIZE / 2 || best == 0) continue;
+
+        tw = MIN(TILE_SIZE, enc->iw - c * TILE_SIZE);
+        for (r=0; r<enc->rows; r++) {
+            if (!enc->stale[r * enc->cols + c] && enc->hash_cur[r * enc->cols + c] == enc->hash_client[r * enc->cols + c]) continue;
+            th = MIN(TILE_SIZE, enc->ih - r * TILE_SIZE);
+            sy = r * TILE_SIZE - best;
+            if (sy < 0 || sy + th > enc->ih) continue;
+            if (enc->stale[(sy / TILE_SIZE) * enc->cols + c] || enc->stale[((sy + th - 1) / TILE_SIZE) * enc->cols + c]) continue;
+            for (y=0, ok=1; y<th && ok; y++) {
+                ok = memcmp(data + (r * TILE_SIZE + y) * stride + c * TILE_SIZE * 4, enc->prev + ((sy + y) * enc->iw + c * TILE_SIZE) * 4, tw * 4) == 0;
+            }
+            if (ok) enc->copy_dy[r * enc->cols + c] = best;
+        }
+    }
+}
+
+static int put_varint(uint8_t *dst, int val)
+{
+    int n = 0;
+    while (val >= 0x80) { dst[n++] = (val & 0x7F) | 0x80; val >>= 7; }
+    dst[n++] = val;
+    return n;
+}
+
+// encode tile pixels as solid, palette + rle or raw, returns bytes written after tile header
+static int scrnenc_encode_tile(SCRNENC *enc, uint8_t *dst, int *type, int slot, int tw, int th)
+{
+    uint32_t  table[512], color;
+    uint8_t   index[512];
+    uint8_t  *p;
+    int       npix = tw * th, ncolor = 0, rawsize = 3 * tw * th, i, j, k, run;
+
+    memset(table, 0, sizeof(table));
+    for (i=0; i<npix && ncolor<=256; i++) {
+        color = enc->tile[i] | 0xFF000000; // 0 is empty table entry
+        for (j=(color * 2654435761u) >> 23; table[j] && table[j] != color; j=(j+1) & 511);
+        if (!table[j]) { table[j] = color; index[j] = ncolor++; }
+    }
+
+    if (ncolor == 1) {
+        *type  = TILE_SOLID;
+        dst[0] = (enc->tile[0] >> 0 ) & 0xFF;
+        dst[1] = (enc->tile[0] >> 8 ) & 0xFF;
+        dst[2] = (enc->tile[0] >> 16) & 0xFF;
+        return 3;
+    }
+
+    if (ncolor <= 256) {
+        p = dst + 3;
+        for (j=0; j<512; j++) {
+            if (!table[j]) continue;
+            k = index[j];
+            p[k * 3 + 0] = (table[j] >> 0 ) & 0xFF;
+            p[k * 3 + 1] = (table[j] >> 8 ) & 0xFF;
+            p[k * 3 + 2] = (table[j] >> 16) & 0xFF;
+        }
+        p += ncolor * 3;
+        for (i=0; i<npix && p - dst < rawsize; i+=run) {
+            color = enc->tile[i] | 0xFF000000;
+            for (run=1; i+run<npix && enc->tile[i+run] == enc->tile[i]; run++);
+            for (j=(color * 2654435761u) >> 23; table[j] != color; j=(j+1) & 511);
+            *p++ = index[j];
+            p   += put_varint(p, run - 1);
+        }
+        if (i == npix && p - dst < rawsize) {
+            *type = TILE_PALETTE;
+            *(uint16_t*)dst = slot;
+            dst[2] = ncolor - 1;
+            return (int)(p - dst);
+        }
+    }
+
+    *type = TILE_RAW;
+    *(uint16_t*)dst = slot;
+    for (i=0, p=dst+2; i<npix; i++) {
+        *p++ = (enc->tile[i] >> 0 ) & 0xFF;
+        *p++ = (enc->tile[i] >> 8 ) & 0xFF;
+        *p++ = (enc->tile[i] >> 16) & 0xFF;
+    }
+    return 2 + rawsize;
+}
+
+static int scrnenc_output(SCRNENC *enc, uint8_t *buf, int len, int key)
+{
+    uint32_t timestamp = get_tick_count();
+    uint32_t typelen   = (key ? 'V' : 'v') | (len << 8);
+    int      ret       = 0;
+    pthread_mutex_lock(&enc->omutex);
+    if (sizeof(uint32_t) + sizeof(uint32_t) + len <= sizeof(enc->obuff) - enc->osize) {
+        enc->otail = ringbuf_write(enc->obuff, sizeof(enc->obuff), enc->otail, (uint8_t*)&timestamp, sizeof(timestamp));
+        enc->otail = ringbuf_write(enc->obuff, sizeof(enc->obuff), enc->otail, (uint8_t*)&typelen  , sizeof(typelen  ));
+        enc->otail = ringbuf_write(enc->obuff, sizeof(enc->obuff), enc->otail, buf, len);
+        enc->osize+= sizeof(timestamp) + sizeof(typelen) + len;
+        pthread_cond_signal(&enc->ocond);
+    } else {
+        log_printf("scrnenc frame dropped !\n");
+        ret = -1;
+    }
+    pthread_mutex_unlock(&enc->omutex);
+    return ret;
+}
+
+static void scrnenc_write(void *ctxt, void *buf[8], int len[8])
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    uint8_t *data, *p;
+    int      stride, flags = 0, ntiles, motion, expensive, pass, type, size, slot, c, r, x, y, tw, th, i, n;
+    if (!ctxt) return;
+
+    data = buf[0]; stride = len[3];
+    if (enc->iw != len[1] || enc->ih != len[2]) {
+        if (scrnenc_alloc_buffers(enc, len[1], len[2]) != 0) return;
+        enc->status |= TS_REQUEST_KEY;
+    }
+    n = enc->cols * enc->rows;
+    if (enc->status & TS_REQUEST_KEY) {
+        enc->status &= ~TS_REQUEST_KEY;
+        memset(enc->cache, 0, sizeof(enc->cache));
+        memset(enc->stale, 1, n);
+        flags |= FRAME_KEY;
+        if (enc->status & TS_H264) {
+            enc->status &= ~TS_H264;
+            flags |= FRAME_H264_LEAVE;
+        }
+        enc->cnt_motion = enc->cnt_still = 0;
+    }
+
+    scrnenc_hash(enc, data, stride);
+    for (i=0, motion=0; i<n; i++) motion += enc->hash_cur[i] != enc->hash_last[i];
+    memcpy(enc->hash_last, enc->hash_cur, n * sizeof(uint64_t));
+
+    if (enc->status & TS_H264) {
+        enc->cnt_still = motion * 100 < H264_LEAVE_RATIO * n ? enc->cnt_still + 1 : 0;
+        if (enc->cnt_still < H264_LEAVE_FRAMES) {
+            codec_write(enc->h264, buf, len);
+            return;
+        }
+        enc->status &= ~TS_H264;
+        flags |= FRAME_H264_LEAVE;
+        memset(enc->stale, 1, n); // canvas of client has been drawn by h264
+        codec_reset(enc->h264, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF);
+    }
+
+    scrnenc_detect_scroll(enc, data, stride);
+
+    p = enc->fbuff + 8; ntiles = 0; expensive = 0;
+    for (pass=0; pass<2; pass++) { // copy tiles first, they read frame before this one
+        for (r=0; r<enc->rows; r++) {
+            for (c=0; c<enc->cols; c++) {
+                i = r * enc->cols + c;
+                if (!enc->stale[i] && enc->hash_cur[i] == enc->hash_client[i]) continue;
+                if ((pass == 0) != (enc->copy_dy[i] != 0)) continue;
+                if (p - enc->fbuff > FRAME_BUDGET) continue; // left for next frame
+
+                tw = MIN(TILE_SIZE, enc->iw - c * TILE_SIZE);
+                th = MIN(TILE_SIZE, enc->ih - r * TILE_SIZE);
+                slot = (int)(enc->hash_cur[i] % CACHE_SLOTS);
+                if (pass == 0) {
+                    type = TILE_COPY; *(int16_t*)(p + 3) = enc->copy_dy[i]; size = 2;
+                } else if (enc->cache[slot] == enc->hash_cur[i]) {
+                    type = TILE_CACHE; *(uint16_t*)(p + 3) = slot; size = 2;
+                } else {
+                    for (y=0; y<th; y++) memcpy(enc->tile + y * tw, data + (r * TILE_SIZE + y) * stride + c * TILE_SIZE * 4, tw * 4);
+                    for (x=0; x<tw*th; x++) enc->tile[x] &= 0xFFFFFF;
+                    size = scrnenc_encode_tile(enc, p + 3, &type, slot, tw, th);
+                    if (type != TILE_SOLID) { enc->cache[slot] = enc->hash_cur[i]; expensive += !enc->stale[i]; } // a refresh is no motion
+                }
+                p[0] = c; p[1] = r; p[2] = type;
+                p   += 3 + size;
+                ntiles++;
+
+                for (y=0; y<th; y++) {
+                    memcpy(enc->prev + ((r * TILE_SIZE + y) * enc->iw + c * TILE_SIZE) * 4, data + (r * TILE_SIZE + y) * stride + c * TILE_SIZE * 4, tw * 4);
+                    enc->rowhash_prev[c * enc->ih + r * TILE_SIZE + y] = enc->rowhash_cur[c * enc->ih + r * TILE_SIZE + y];
+                }
+                enc->hash_client[i] = enc->hash_cur[i];
+                enc->stale[i] = 0;
+            }
+        }
+    }
+    if (ntiles == 0 && flags == 0) return;
+
+    enc->fbuff[0] = 'S';
+    enc->fbuff[1] = flags;
+    *(uint16_t*)(enc->fbuff + 2) = enc->iw;
+    *(uint16_t*)(enc->fbuff + 4) = enc->ih;
+    *(uint16_t*)(enc->fbuff + 6) = ntiles;
+    if (scrnenc_output(enc, enc->fbuff, (int)(p - enc->fbuff), flags & FRAME_KEY) != 0) {
+        enc->status |= TS_REQUEST_KEY; // client cache is out of sync now
+        return;
+    }
+
+    enc->cnt_motion = expensive * 100 > H264_ENTER_RATIO * n ? enc->cnt_motion + 1 : 0;
+    if (enc->h264 && enc->cnt_motion >= H264_ENTER_FRAMES) {
+        enc->status   |= TS_H264;
+        enc->cnt_motion= enc->cnt_still = 0;
+        enc->fbuff[1]  = FRAME_H264_ENTER;
+        *(uint16_t*)(enc->fbuff + 6) = 0;
+        codec_reset(enc->h264, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF|CODEC_REQUEST_IDR);
+        if (scrnenc_output(enc, enc->fbuff, 8, 0) == 0) codec_write(enc->h264, buf, len);
+        else enc->status = (enc->status & ~TS_H264) | TS_REQUEST_KEY;
+    }
+}
+
+static int scrnenc_read(void *ctxt, void *buf, int len, int *fsize, int *key, uint32_t *pts, int timeout)
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    uint32_t timestamp = 0;
+    int32_t  typelen = 0, framesize = 0, readsize = 0, ret = 0;
+    struct   timespec ts;
+    if (!ctxt) return 0;
+
+    pthread_mutex_lock(&enc->omutex);
+    if (enc->osize <= 0 && (enc->status & TS_H264) && len > 1) { // h264 frames are only taken while nothing of our own is pending
+        pthread_mutex_unlock(&enc->omutex);
+        readsize = codec_read(enc->h264, (uint8_t*)buf + 1, len - 1, &framesize, key, pts, timeout);
+        if (readsize <= 0) {
+            if (fsize) *fsize = 0;
+            return 0;
+        }
+        *(uint8_t*)buf = 'H';
+        if (fsize) *fsize = framesize + 1;
+        return readsize + 1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += timeout*1000*1000;
+    ts.tv_sec  += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    while (timeout && enc->osize <= 0 && (enc->status & TS_START) && ret != ETIMEDOUT) ret = pthread_cond_timedwait(&enc->ocond, &enc->omutex, &ts);
+    if (enc->osize > 0) {
+        enc->ohead = ringbuf_read(enc->obuff, sizeof(enc->obuff), enc->ohead, (uint8_t*)&timestamp, sizeof(timestamp));
+        enc->ohead = ringbuf_read(enc->obuff, sizeof(enc->obuff), enc->ohead, (uint8_t*)&typelen  , sizeof(typelen  ));
+        enc->osize-= sizeof(timestamp) + sizeof(typelen);
+        framesize  = ((uint32_t)typelen >> 8);
+        readsize   = MIN(len, framesize);
+        enc->ohead = ringbuf_read(enc->obuff, sizeof(enc->obuff), enc->ohead,  buf , readsize);
+        enc->ohead = ringbuf_read(enc->obuff, sizeof(enc->obuff), enc->ohead,  NULL, framesize - readsize);
+        enc->osize-= framesize;
+    }
+    if (pts  ) *pts   = timestamp;
+    if (fsize) *fsize = framesize;
+    if (key  ) *key   = ((typelen & 0xFF) == 'V');
+    pthread_mutex_unlock(&enc->omutex);
+    return readsize;
+}
+
+static void scrnenc_start(void *ctxt, int start)
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    if (!ctxt) return;
+    if (enc->h264) codec_start(enc->h264, start);
+    if (start) {
+        enc->status |= TS_START;
+    } else {
+        pthread_mutex_lock(&enc->omutex);
+        enc->status &= ~TS_START;
+        pthread_cond_signal(&enc->ocond);
+        pthread_mutex_unlock(&enc->omutex);
+    }
+}
+
+static void scrnenc_reset(void *ctxt, int type)
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    if (!ctxt) return;
+    if (type & CODEC_CLEAR_OUTBUF) {
+        pthread_mutex_lock(&enc->omutex);
+        enc->ohead = enc->otail = enc->osize = 0;
+        pthread_mutex_unlock(&enc->omutex);
+    }
+    if (type & CODEC_REQUEST_IDR) { // next frame resends the whole screen, and leaves h264 mode
+        enc->status |= TS_REQUEST_KEY;
+    }
+    if (enc->h264) codec_reset(enc->h264, type & ~CODEC_REQUEST_IDR);
+}
+
+static void scrnenc_reconfig(void *ctxt, int bitrate)
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    if (!ctxt) return;
+    if (enc->h264) codec_reconfig(enc->h264, bitrate);
+}
+
+static void scrnenc_uninit(void *ctxt)
+{
+    SCRNENC *enc = (SCRNENC*)ctxt;
+    if (!ctxt) return;
+    if (enc->h264) codec_uninit(enc->h264);
+    scrnenc_free_buffers(enc);
+    pthread_mutex_destroy(&enc->omutex);
+    pthread_cond_destroy (&enc->ocond );
+    free(enc);
+}
+
+CODEC* scrnenc_init(int frate, int w, int h, int bitrate)
+{
+    SCRNENC *enc = calloc(1, sizeof(SCRNENC));
+    if (!enc) return NULL;
+
+    strncpy(enc->name, "scrnenc", sizeof(enc->name));
+    enc->uninit   = scrnenc_uninit;
+    enc->write    = scrnenc_write;
+    enc->read     = scrnenc_read;
+    enc->start    = scrnenc_start;
+    enc->reset    = scrnenc_reset;
+    enc->reconfig = scrnenc_reconfig;
+
+    pthread_mutex_init(&enc->omutex, NULL);
+    pthread_cond_init (&enc->ocond , NULL);
+
+    enc->h264 = h264enc_init(frate, w, h, bitrate);
+    if (enc->h264) { // sps/pps of fallback encoder
+        memcpy(enc->spsinfo, enc->h264->spsinfo, sizeof(enc->spsinfo));
+        memcpy(enc->ppsinfo, enc->h264->ppsinfo, sizeof(enc->ppsinfo));
+    } else {
+        log_printf("scrnenc failed to create h264 fallback encoder, high motion content is sent losslessly !\n");
+    }
+    return (CODEC*)enc;
+}
@@ -0,0 +1,281 @@
+// loopback test of scrnenc.c: frames go through a reference decoder of the bitstream documented in scrnenc.c,
+// and the canvas it draws must equal the input frame, bit exactly. covers key frames, scrolling (copy tiles),
+// cache hits, the switch to h264 and back (FRAME_H264_ENTER / FRAME_H264_LEAVE) and IDR requests.
+// the h264 fallback is a stub here, its 'H' frames are only counted
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "stdafx.h"
+#include "codec.h"
+#include "log.h"
+
+#define TEST_W        1000 // not a multiple of tile size, so the last column and row are partial
+#define TEST_H        700
+#define TILE_SIZE     64
+#define CACHE_SLOTS   1024
+#define SETTLE_FRAMES 8    // frames of the same image until canvas is complete, tiles over the frame budget come later
+
+enum { TILE_RAW, TILE_SOLID, TILE_PALETTE, TILE_CACHE, TILE_COPY };
+enum { FRAME_KEY = (1 << 0), FRAME_H264_ENTER = (1 << 1), FRAME_H264_LEAVE = (1 << 2) };
+
+typedef struct {
+    CODEC_INTERFACE_FUNCS
+    int pending; // frames written and not read yet
+} STUBH264;
+
+static void stub_uninit  (void *ctxt) { free(ctxt); }
+static void stub_write   (void *ctxt, void *buf[8], int len[8]) { ((STUBH264*)ctxt)->pending++; }
+static void stub_start   (void *ctxt, int start) {}
+static void stub_reset   (void *ctxt, int type ) { if (type & CODEC_CLEAR_INBUF) ((STUBH264*)ctxt)->pending = 0; }
+static void stub_reconfig(void *ctxt, int bitrate) {}
+static int  stub_read    (void *ctxt, void *buf, int len, int *fsize, int *key, uint32_t *pts, int timeout)
+{
+    STUBH264 *enc = (STUBH264*)ctxt;
+    if (!enc->pending || len < 16) { if (fsize) *fsize = 0; return 0; }
+    enc->pending--;
+    memset(buf, 0x5A, 16);
+    if (fsize) *fsize = 16;
+    if (key  ) *key   = 0;
+    if (pts  ) *pts   = 0;
+    return 16;
+}
+
+CODEC* h264enc_init(int frate, int w, int h, int bitrate) // scrnenc takes this as its fallback encoder
+{
+    STUBH264 *enc = calloc(1, sizeof(STUBH264));
+    if (!enc) return NULL;
+    strncpy(enc->name, "stub", sizeof(enc->name));
+    enc->uninit   = stub_uninit;
+    enc->write    = stub_write;
+    enc->read     = stub_read;
+    enc->start    = stub_start;
+    enc->reset    = stub_reset;
+    enc->reconfig = stub_reconfig;
+    return (CODEC*)enc;
+}
+
+typedef struct {
+    uint32_t canvas[TEST_W * TEST_H];
+    uint32_t prev  [TEST_W * TEST_H]; // canvas before current frame, source of copy tiles
+    uint32_t cache [CACHE_SLOTS][TILE_SIZE * TILE_SIZE];
+    int      h264;    // between FRAME_H264_ENTER and FRAME_H264_LEAVE
+    int      tiles[5];
+    int      keys, enters, leaves, hframes;
+} DECODER;
+
+static uint32_t get_bgr(uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16); }
+
+static int get_varint(uint8_t **p)
+{
+    int v = 0, s = 0;
+    uint8_t b;
+    do { b = *(*p)++; v |= (b & 0x7F) << s; s += 7; } while (b & 0x80);
+    return v;
+}
+
+// returns 0 if frame is well formed
+static int decode(DECODER *dec, uint8_t *buf, int len)
+{
+    uint32_t tile[TILE_SIZE * TILE_SIZE], pal[256];
+    uint8_t *p = buf + 8, *end = buf + len;
+    int      ntiles, flags, c, r, type, tw, th, slot, n, idx, run, i, x, y, dy;
+    if (buf[0] == 'H') {
+        if (!dec->h264) { printf("'H' frame out of h264 mode !\n"); return -1; }
+        dec->hframes++;
+        return 0;
+    }
+    if (len < 8 || buf[0] != 'S' || *(uint16_t*)(buf + 2) != TEST_W || *(uint16_t*)(buf + 4) != TEST_H) { printf("bad frame header !\n"); return -1; }
+    flags  = buf[1];
+    ntiles = *(uint16_t*)(buf + 6);
+    if (flags & FRAME_KEY) { memset(dec->canvas, 0, sizeof(dec->canvas)); memset(dec->cache, 0, sizeof(dec->cache)); dec->keys++; }
+    if (flags & FRAME_H264_LEAVE) { dec->h264 = 0; dec->leaves++; }
+    if (flags & FRAME_H264_ENTER) { dec->h264 = 1; dec->enters++; }
+    memcpy(dec->prev, dec->canvas, sizeof(dec->prev));
+    for (i=0; i<ntiles; i++) {
+        if (end - p < 3) return -1;
+        c = p[0]; r = p[1]; type = p[2]; p += 3;
+        tw = MIN(TILE_SIZE, TEST_W - c * TILE_SIZE);
+        th = MIN(TILE_SIZE, TEST_H - r * TILE_SIZE);
+        if (tw <= 0 || th <= 0 || type > TILE_COPY) { printf("bad tile %d,%d type %d !\n", c, r, type); return -1; }
+        slot = -1;
+        switch (type) {
+        case TILE_COPY:
+            dy = *(int16_t*)p; p += 2;
+            if (r * TILE_SIZE - dy < 0 || r * TILE_SIZE - dy + th > TEST_H) { printf("copy tile out of frame !\n"); return -1; }
+            for (y=0; y<th; y++) memcpy(tile + y * tw, dec->prev + (r * TILE_SIZE + y - dy) * TEST_W + c * TILE_SIZE, tw * 4);
+            break;
+        case TILE_CACHE:
+            memcpy(tile, dec->cache[*(uint16_t*)p % CACHE_SLOTS], tw * th * 4); p += 2;
+            break;
+        case TILE_SOLID:
+            for (x=0; x<tw*th; x++) tile[x] = get_bgr(p);
+            p += 3;
+            break;
+        case TILE_RAW:
+            slot = *(uint16_t*)p; p += 2;
+            for (x=0; x<tw*th; x++, p+=3) tile[x] = get_bgr(p);
+            break;
+        case TILE_PALETTE:
+            slot = *(uint16_t*)p; p += 2;
+            n = *p++ + 1;
+            for (x=0; x<n; x++, p+=3) pal[x] = get_bgr(p);
+            for (x=0; x<tw*th; ) {
+                idx = *p++;
+                run = get_varint(&p) + 1;
+                if (idx >= n || x + run > tw * th) { printf("bad palette run !\n"); return -1; }
+                while (run--) tile[x++] = pal[idx];
+            }
+            break;
+        }
+        if (slot >= 0 && slot != 0xFFFF) memcpy(dec->cache[slot % CACHE_SLOTS], tile, tw * th * 4);
+        for (y=0; y<th; y++) memcpy(dec->canvas + (r * TILE_SIZE + y) * TEST_W + c * TILE_SIZE, tile + y * tw, tw * 4);
+        dec->tiles[type]++;
+    }
+    if (p != end) { printf("%d bytes left after tiles !\n", (int)(end - p)); return -1; }
+    return 0;
+}
+
+typedef struct {
+    CODEC   *enc;
+    DECODER *dec;
+    uint32_t*img;
+    int      frames, bytes;
+} TEST;
+
+static void draw_text(uint32_t *img, int y1, int y2, int seed) // rows of glyph like blocks on white, like a terminal or a page
+{
+    int x, y;
+    for (y=y1; y<y2; y++) {
+        for (x=0; x<TEST_W; x++) {
+            uint32_t cell = (uint32_t)(x / 7) * 2654435761u ^ (uint32_t)(y / 13 + seed) * 40503u;
+            img[y * TEST_W + x] = (cell >> 7) % 3 == 0 && x % 7 < 5 && y % 13 < 10 && (x * 7 + y * 3) % 4 ? 0xFF000000 | (((cell >> 3) ^ y) & 0x3F) : 0xFFFFFFFF; // antialiased glyphs make rows unique
+        }
+    }
+}
+
+static void draw_motion(uint32_t *img) // 4x4 blocks of 16 colors, too much change for tiles, still a palette per tile
+{
+    uint32_t colors[16];
+    int      x, y, i;
+    for (i=0; i<16; i++) colors[i] = 0xFF000000 | (rand() & 0xFFFFFF);
+    for (y=0; y<TEST_H; y+=4) {
+        for (x=0; x<TEST_W; x+=4) {
+            uint32_t c = colors[rand() & 15];
+            for (i=0; i<16; i++) if (y + i / 4 < TEST_H && x + i % 4 < TEST_W) img[(y + i / 4) * TEST_W + x + i % 4] = c;
+        }
+    }
+}
+
+static int test_frame(TEST *test) // encodes img and decodes everything scrnenc outputs for it
+{
+    static uint8_t buf[8 * 1024 * 1024];
+    void *data[8] = { test->img };
+    int   len [8] = { TEST_W * TEST_H * 4, TEST_W, TEST_H, TEST_W * 4 };
+    int   fsize, key, n;
+    uint32_t pts;
+    codec_write(test->enc, data, len);
+    while ((n = codec_read(test->enc, buf, sizeof(buf), &fsize, &key, &pts, 0)) > 0) {
+        if (n != fsize || decode(test->dec, buf, n) != 0) return -1;
+        test->bytes += n;
+    }
+    test->frames++;
+    return 0;
+}
+
+static int test_diff(TEST *test) // pixels of canvas different from img
+{
+    int i, n = 0;
+    for (i=0; i<TEST_W*TEST_H; i++) n += ((test->dec->canvas[i] ^ test->img[i]) & 0xFFFFFF) != 0;
+    return n;
+}
+
+static int test_settle(TEST *test) // same img until canvas is exact, returns frames taken or -1
+{
+    int i;
+    for (i=1; i<=SETTLE_FRAMES; i++) {
+        if (test_frame(test) != 0) return -1;
+        if (!test->dec->h264 && test_diff(test) == 0) return i;
+    }
+    printf("canvas differs in %d pixels after %d frames !\n", test_diff(test), SETTLE_FRAMES);
+    return -1;
+}
+
+static void test_report(TEST *test, char *name, int *tiles)
+{
+    printf("%-8s: %3d frames %8d bytes, tiles raw %4d solid %4d palette %4d cache %4d copy %4d\n", name, test->frames, test->bytes,
+        test->dec->tiles[TILE_RAW] - tiles[TILE_RAW], test->dec->tiles[TILE_SOLID] - tiles[TILE_SOLID], test->dec->tiles[TILE_PALETTE] - tiles[TILE_PALETTE],
+        test->dec->tiles[TILE_CACHE] - tiles[TILE_CACHE], test->dec->tiles[TILE_COPY] - tiles[TILE_COPY]);
+    memcpy(tiles, test->dec->tiles, sizeof(test->dec->tiles));
+    test->frames = test->bytes = 0;
+}
+
+#define CHECK(cond, msg) do { if (!(cond)) { printf("%s !\n", msg); goto done; } } while (0)
+
+int main(void)
+{
+    static DECODER dec;
+    static uint32_t img[TEST_W * TEST_H], saved[TEST_W * TEST_H];
+    TEST test = { NULL, &dec, img };
+    int  tiles[5] = {0}, ret = -1, i, x, y;
+
+    log_init("DEBUGER");
+    srand(1);
+    CHECK(test.enc = scrnenc_init(30, TEST_W, TEST_H, 2000000), "scrnenc_init failed");
+    codec_start(test.enc, 1);
+
+    draw_text(img, 0, TEST_H, 0);
+    CHECK(test_settle(&test) > 0 && dec.keys == 1, "first frame is not a complete key frame");
+    test_report(&test, "key", tiles);
+
+    for (i=0; i<5; i++) { // scroll up 16 lines, new text comes in at the bottom
+        memmove(img + 100 * TEST_W, img + 116 * TEST_W, (TEST_H - 116) * TEST_W * 4);
+        draw_text(img, TEST_H - 16, TEST_H, 100 + i);
+        CHECK(test_settle(&test) == 1, "scrolled frame is not complete at once");
+    }
+    CHECK(dec.tiles[TILE_COPY] - tiles[TILE_COPY] >= 5 * 100, "scroll is not sent as copy tiles");
+    test_report(&test, "scroll", tiles);
+
+    draw_text(img, 0, TEST_H, 3); // new page, copy tiles have no cache slot so the window has to open over tiles sent as pixels
+    CHECK(test_settle(&test) > 0, "new page is not complete");
+    memcpy(saved, img, sizeof(img)); // a window opens and closes again, its tiles come back from cache
+    for (y=200; y<456; y++) for (x=128; x<640; x++) img[y * TEST_W + x] = 0xFF000000 | ((x / 8 + y / 8) % 5) * 0x203040;
+    CHECK(test_settle(&test) > 0, "window frame is not complete");
+    memcpy(img, saved, sizeof(img));
+    CHECK(test_settle(&test) > 0, "frame after window is not complete");
+    CHECK(dec.tiles[TILE_CACHE] - tiles[TILE_CACHE] >= 8 * 4, "tiles under window do not come from cache");
+    test_report(&test, "cache", tiles);
+
+    for (i=0; i<8 && !dec.h264; i++) { // high motion goes to h264
+        draw_motion(img);
+        CHECK(test_frame(&test) == 0, "bad frame of motion");
+    }
+    CHECK(dec.h264 && dec.enters == 1 && i == 3, "no FRAME_H264_ENTER after 3 frames of high motion");
+    for (i=0; i<5; i++) {
+        draw_motion(img);
+        CHECK(test_frame(&test) == 0, "bad frame in h264 mode");
+    }
+    CHECK(dec.hframes >= 5, "no 'H' frames in h264 mode");
+    test_report(&test, "h264", tiles);
+
+    draw_text(img, 0, TEST_H, 7); // still content again, leaves h264 with a lossless refresh
+    for (i=0; i<20 && dec.h264; i++) CHECK(test_frame(&test) == 0, "bad frame leaving h264 mode");
+    CHECK(!dec.h264 && dec.leaves == 1, "no FRAME_H264_LEAVE for still content");
+    CHECK(test_settle(&test) > 0, "canvas is not refreshed after h264 mode");
+    test_report(&test, "leave", tiles);
+
+    codec_reset(test.enc, CODEC_REQUEST_IDR);
+    CHECK(test_settle(&test) > 0 && dec.keys == 2, "IDR request does not give a complete key frame");
+    for (i=0; i<8 && !dec.h264; i++) { draw_motion(img); CHECK(test_frame(&test) == 0, "bad frame of motion"); }
+    CHECK(dec.h264 && i == 3, "key frame is taken as motion, or no h264 mode for second motion");
+    codec_reset(test.enc, CODEC_REQUEST_IDR); // in h264 mode, key frame leaves it at once
+    draw_text(img, 0, TEST_H, 9);
+    CHECK(test_settle(&test) > 0 && dec.keys == 3 && dec.leaves == 2, "IDR request in h264 mode does not leave it with a key frame");
+    test_report(&test, "idr", tiles);
+    ret = 0;
+
+done:
+    if (test.enc) codec_uninit(test.enc);
+    printf("scrntest %s\n", ret == 0 ? "passed" : "failed !");
+    return ret == 0 ? 0 : 1;
+}
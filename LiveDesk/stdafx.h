@@ -1,16 +1,30 @@
 #ifndef __STDAFX_H__
 #define __STDAFX_H__
 
+#ifdef WIN32
 #include <windows.h>
-
 #define usleep(t)      Sleep((t) / 1000)
 #define get_tick_count GetTickCount
+#else
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+static inline uint32_t get_tick_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#endif
+
 #define ARRAY_SIZE(a)  (sizeof(a) / sizeof(a[0]))
 #define ALIGN(x, y)    ((x + y - 1) & ~(y - 1))
 #define MIN(a, b)      ((a) < (b) ? (a) : (b))
 #define MAX(a, b)      ((a) < (b) ? (a) : (b))
 
 // disable warnings
+#ifdef _MSC_VER
 #pragma warning(disable:4996)
+#endif
 
 #endif
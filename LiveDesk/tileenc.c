@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "stdafx.h"
+#include "codec.h"
+#include "log.h"
+
+// tileenc splits the frame into vertical strips, each one is encoded by its own h264enc/h265enc instance (and encode thread),
+// every output frame is prefixed with one byte of tile index, the layout is reported in tiles[] as strip widths: "1920+1920".
+// key is reported per tile, after CODEC_REQUEST_IDR a new viewer can decode a tile only from its own key frame on
+#define MAX_TILE_NUM  8
+typedef struct {
+    CODEC_INTERFACE_FUNCS
+
+    CODEC   *tiles_enc[MAX_TILE_NUM];
+    int      tiles_x  [MAX_TILE_NUM];
+    int      tiles_w  [MAX_TILE_NUM];
+    int      tiles_num;
+    int      tiles_idx; // next tile to read
+    int      ow;
+    int      oh;
+
+    uint8_t *prev_buf;  // last encoded content of every tile, to find unchanged tiles when capture gives no dirty rects
+    int      prev_size;
+
+    #define TS_REQUEST_ALL (1 << 0)
+    int      status;
+    pthread_mutex_t mutex; // status, tileenc_reset comes from another thread than tileenc_write
+} TILEENC;
+
+static void tileenc_uninit(void *ctxt)
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    int      i;
+    if (!ctxt) return;
+    for (i=0; i<enc->tiles_num; i++) codec_uninit(enc->tiles_enc[i]);
+    free(enc->prev_buf);
+    pthread_mutex_destroy(&enc->mutex);
+    free(enc);
+}
+
+static int tile_changed(TILEENC *enc, uint8_t *data, int stride, int h, int sx, int sw, int *rects, int nrects)
+{
+    int i;
+    if (rects && nrects > 0) {
+        for (i=0; i<nrects; i++) {
+            if (rects[i * 4 + 0] < sx + sw && rects[i * 4 + 0] + rects[i * 4 + 2] > sx) return 1;
+        }
+        return 0;
+    }
+    for (i=0; i<h; i++) { // no dirty rects from capture, compare with last encoded content
+        if (memcmp(enc->prev_buf + i * stride + sx * 4, data + i * stride + sx * 4, sw * 4) != 0) return 1;
+    }
+    return 0;
+}
+
+static void tileenc_write(void *ctxt, void *buf[8], int len[8])
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    uint8_t *data;
+    int      iw, ih, stride, sx, sw, all, i, y;
+    if (!ctxt) return;
+
+    data = buf[0]; iw = len[1]; ih = len[2]; stride = len[3];
+    pthread_mutex_lock(&enc->mutex); // take the request and clear it at once, a new one is kept for the next frame
+    all  = (enc->status & TS_REQUEST_ALL);
+    enc->status &= ~TS_REQUEST_ALL;
+    pthread_mutex_unlock(&enc->mutex);
+    if (enc->prev_size != stride * ih) { // frame size changed, previous frame is useless
+        free(enc->prev_buf);
+        enc->prev_size = stride * ih;
+        enc->prev_buf  = malloc(enc->prev_size);
+        all = 1;
+    }
+    if (!enc->prev_buf) { enc->prev_size = 0; all = 1; }
+
+    for (i=0; i<enc->tiles_num; i++) {
+        sx = enc->tiles_x[i] * iw / enc->ow;
+        sw = (enc->tiles_x[i] + enc->tiles_w[i]) * iw / enc->ow - sx;
+        if (all || tile_changed(enc, data, stride, ih, sx, sw, buf[1], len[4])) {
+            void *tbuf[8] = { data + sx * 4 };
+            int   tlen[8] = { stride * ih, sw, ih, stride };
+            for (y=0; enc->prev_buf && y<ih; y++) memcpy(enc->prev_buf + y * stride + sx * 4, data + y * stride + sx * 4, sw * 4);
+            codec_write(enc->tiles_enc[i], tbuf, tlen);
+        }
+    }
+}
+
+static int tileenc_read(void *ctxt, void *buf, int len, int *fsize, int *key, uint32_t *pts, int timeout)
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    int      ret = 0, i, idx;
+    if (!ctxt || len < 1) return 0;
+    for (i=0; i<enc->tiles_num && ret <= 0; i++) {
+        idx = (enc->tiles_idx + i) % enc->tiles_num;
+        ret = codec_read(enc->tiles_enc[idx], (uint8_t*)buf + 1, len - 1, fsize, key, pts, i == enc->tiles_num - 1 ? timeout : 0);
+    }
+    if (ret <= 0) {
+        if (fsize) *fsize = 0;
+        return 0;
+    }
+    enc->tiles_idx = (idx + 1) % enc->tiles_num;
+    *(uint8_t*)buf = idx;
+    if (fsize) *fsize += 1;
+    return ret + 1;
+}
+
+static void tileenc_start(void *ctxt, int start)
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    int      i;
+    if (!ctxt) return;
+    for (i=0; i<enc->tiles_num; i++) codec_start(enc->tiles_enc[i], start);
+}
+
+static void tileenc_reset(void *ctxt, int type)
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    int      i;
+    if (!ctxt) return;
+    for (i=0; i<enc->tiles_num; i++) codec_reset(enc->tiles_enc[i], type);
+    if (type & CODEC_REQUEST_IDR) { // new client needs all tiles
+        pthread_mutex_lock(&enc->mutex);
+        enc->status |= TS_REQUEST_ALL;
+        pthread_mutex_unlock(&enc->mutex);
+    }
+}
+
+static void tileenc_reconfig(void *ctxt, int bitrate)
+{
+    TILEENC *enc = (TILEENC*)ctxt;
+    int      i;
+    if (!ctxt) return;
+    for (i=0; i<enc->tiles_num; i++) codec_reconfig(enc->tiles_enc[i], (int)((int64_t)bitrate * enc->tiles_w[i] / enc->ow));
+}
+
+CODEC* tileenc_init(int frate, int w, int h, int bitrate, int tiles, int h265)
+{
+    TILEENC *enc = calloc(1, sizeof(TILEENC));
+    char     str[16];
+    int      x, i;
+    if (!enc) return NULL;
+    pthread_mutex_init(&enc->mutex, NULL);
+
+    enc->uninit   = tileenc_uninit;
+    enc->write    = tileenc_write;
+    enc->read     = tileenc_read;
+    enc->start    = tileenc_start;
+    enc->reset    = tileenc_reset;
+    enc->reconfig = tileenc_reconfig;
+
+    tiles = tiles < 1 ? 1 : tiles > MAX_TILE_NUM ? MAX_TILE_NUM : tiles;
+    enc->ow = w;
+    enc->oh = h;
+    for (i=0, x=0; i<tiles; i++) {
+        enc->tiles_x[i] = x;
+        enc->tiles_w[i] = i < tiles - 1 ? (w / tiles) & ~15 : w - x; // keep strips macroblock aligned
+        x += enc->tiles_w[i];
+        enc->tiles_enc[i] = h265 ? h265enc_init(frate, enc->tiles_w[i], h, (int)((int64_t)bitrate * enc->tiles_w[i] / w))
+                                 : h264enc_init(frate, enc->tiles_w[i], h, (int)((int64_t)bitrate * enc->tiles_w[i] / w));
+        if (!enc->tiles_enc[i]) {
+            log_printf("tileenc failed to create encoder for tile %d !\n", i);
+            tileenc_uninit(enc);
+            return NULL;
+        }
+        enc->tiles_num++;
+        sprintf(str, i ? "+%d" : "%d", enc->tiles_w[i]);
+        strncat(enc->tiles, str, sizeof(enc->tiles) - strlen(enc->tiles) - 1);
+    }
+
+    // tiles are normal h264/h265 streams, headers are repeated in key frames of each tile
+    memcpy(enc->name   , enc->tiles_enc[0]->name   , sizeof(enc->name   ));
+    memcpy(enc->vpsinfo, enc->tiles_enc[0]->vpsinfo, sizeof(enc->vpsinfo));
+    memcpy(enc->spsinfo, enc->tiles_enc[0]->spsinfo, sizeof(enc->spsinfo));
+    memcpy(enc->ppsinfo, enc->tiles_enc[0]->ppsinfo, sizeof(enc->ppsinfo));
+    return (CODEC*)enc;
+}
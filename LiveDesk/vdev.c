@@ -26,16 +26,126 @@ typedef struct {
 
     void    *codec;
     PFN_CODEC_CALLBACK callback;
+
+    pthread_mutex_t mutex;
+    int      region_x;      // requested capture region, region_width <= 0 means full screen
+    int      region_y;
+    int      region_width;
+    int      region_height;
+    HWND     region_hwnd;   // window to follow, overrides region
+    int      cap_x;         // rect actually captured, updated by capture thread every frame
+    int      cap_y;
+    int      cap_width;
+    int      cap_height;
+
+    HDC      cursor_hdc;
+    HCURSOR  cursor_handle;
+    uint32_t cursor_id;
+    int      cursor_width;
+    int      cursor_height;
+    int      cursor_xhot;
+    int      cursor_yhot;
+    int      cursor_draw;
+    uint32_t cursor_bits[VDEV_CURSOR_MAX_SIZE * VDEV_CURSOR_MAX_SIZE];
+    uint32_t cursor_mask[VDEV_CURSOR_MAX_SIZE * VDEV_CURSOR_MAX_SIZE * 2];
 } VDEV;
 
+static uint32_t cursor_hash(uint32_t hash, uint8_t *buf, int len)
+{
+    while (len-- > 0) hash = (hash ^ *buf++) * 16777619;
+    return hash;
+}
+
+static int cursor_bitmap(HDC hdc, HBITMAP hbitmap, int w, int h, uint32_t *bits)
+{
+    BITMAPINFO bmpinfo = {0};
+    bmpinfo.bmiHeader.biSize        =  sizeof(BITMAPINFOHEADER);
+    bmpinfo.bmiHeader.biWidth       =  w;
+    bmpinfo.bmiHeader.biHeight      = -h;
+    bmpinfo.bmiHeader.biPlanes      =  1;
+    bmpinfo.bmiHeader.biBitCount    =  32;
+    bmpinfo.bmiHeader.biCompression =  BI_RGB;
+    return GetDIBits(hdc, hbitmap, 0, h, bits, &bmpinfo, DIB_RGB_COLORS) == h;
+}
+
+// must be called with mutex locked, rebuild BGRA cursor shape only when cursor handle changed
+static void vdev_update_cursor(VDEV *vdev, HCURSOR hcursor)
+{
+    uint32_t *mask   = vdev->cursor_mask;
+    ICONINFO icoinfo = {0};
+    BITMAP   bitmap  = {0};
+    int      w, h, alpha = 0, i;
+    if (hcursor == vdev->cursor_handle) return;
+    vdev->cursor_handle = hcursor;
+    vdev->cursor_id     = 0;
+    if (!hcursor || !GetIconInfo(hcursor, &icoinfo)) return;
+
+    GetObject(icoinfo.hbmMask, sizeof(BITMAP), &bitmap);
+    w = bitmap.bmWidth;
+    h = icoinfo.hbmColor ? bitmap.bmHeight : bitmap.bmHeight / 2; // monochrome cursor has AND mask and XOR mask in one bitmap
+    if (w <= 0 || h <= 0 || w > VDEV_CURSOR_MAX_SIZE || h > VDEV_CURSOR_MAX_SIZE) goto done;
+    if (!cursor_bitmap(vdev->cursor_hdc, icoinfo.hbmMask, w, icoinfo.hbmColor ? h : h * 2, mask)) goto done;
+
+    if (icoinfo.hbmColor) {
+        if (!cursor_bitmap(vdev->cursor_hdc, icoinfo.hbmColor, w, h, vdev->cursor_bits)) goto done;
+        for (i=0; i<w*h; i++) alpha |= vdev->cursor_bits[i] >> 24;
+        if (!alpha) { // no alpha channel, take transparency from AND mask
+            for (i=0; i<w*h; i++) vdev->cursor_bits[i] |= (mask[i] & 0xFFFFFF) ? 0 : 0xFF000000;
+        }
+    } else {
+        for (i=0; i<w*h; i++) { // AND 0 XOR 0: black, AND 0 XOR 1: white, AND 1 XOR 0: transparent, AND 1 XOR 1: invert (drawn as black)
+            if (!(mask[i] & 0xFFFFFF)) vdev->cursor_bits[i] = 0xFF000000 | (mask[w * h + i] & 0xFFFFFF);
+            else vdev->cursor_bits[i] = (mask[w * h + i] & 0xFFFFFF) ? 0xFF000000 : 0;
+        }
+    }
+
+    vdev->cursor_width  = w;
+    vdev->cursor_height = h;
+    vdev->cursor_xhot   = icoinfo.xHotspot;
+    vdev->cursor_yhot   = icoinfo.yHotspot;
+    vdev->cursor_id     = cursor_hash(2166136261, (uint8_t*)&vdev->cursor_width, 4 * sizeof(int));
+    vdev->cursor_id     = cursor_hash(vdev->cursor_id, (uint8_t*)vdev->cursor_bits, w * h * sizeof(uint32_t));
+    vdev->cursor_id    |= 1; // 0 is reserved for hidden cursor
+
+done:
+    if (icoinfo.hbmColor) DeleteObject(icoinfo.hbmColor);
+    if (icoinfo.hbmMask ) DeleteObject(icoinfo.hbmMask );
+}
+
+static void vdev_update_rect(VDEV *vdev)
+{
+    RECT rect;
+    int  x, y, w, h;
+    pthread_mutex_lock(&vdev->mutex);
+    if (vdev->region_hwnd) {
+        if (!IsWindow(vdev->region_hwnd)) {
+            log_printf("captured window has gone, capture full screen !\n");
+            vdev->region_hwnd = NULL;
+            x = y = w = h = 0;
+        } else if (IsIconic(vdev->region_hwnd) || !GetWindowRect(vdev->region_hwnd, &rect)) {
+            pthread_mutex_unlock(&vdev->mutex);
+            return; // minimized, keep last rect
+        } else {
+            x = rect.left; y = rect.top; w = rect.right - rect.left; h = rect.bottom - rect.top;
+        }
+    } else {
+        x = vdev->region_x; y = vdev->region_y; w = vdev->region_width; h = vdev->region_height;
+    }
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > vdev->screen_width ) w = vdev->screen_width  - x;
+    if (y + h > vdev->screen_height) h = vdev->screen_height - y;
+    if (w < 2 || h < 2) { x = y = 0; w = vdev->screen_width; h = vdev->screen_height; }
+    vdev->cap_x = x; vdev->cap_y = y; vdev->cap_width = w; vdev->cap_height = h;
+    pthread_mutex_unlock(&vdev->mutex);
+}
+
 static void* vdev_capture_thread_proc(void *param)
 {
     VDEV      *vdev    = (VDEV*)param;
     uint32_t   tickcur = 0, ticknext = 0;
     int32_t    period  = 1000 / vdev->frame_rate, ticksleep = 0;
     CURSORINFO curinfo = {0};
-    ICONINFO   icoinfo = {0};
-    HCURSOR    hcursor = NULL;
 
     while (!(vdev->status & TS_EXIT)) {
         if (!(vdev->status & TS_START)) {
@@ -45,15 +155,21 @@ static void* vdev_capture_thread_proc(void *param)
         ticknext  =(ticknext ? ticknext : tickcur) + period;
         ticksleep = (int32_t)ticknext - (int32_t)tickcur;
 
-        BitBlt(vdev->hdcdst, 0, 0, vdev->screen_width, vdev->screen_height, vdev->hdcsrc, 0, 0, SRCCOPY|CAPTUREBLT);
-        curinfo.cbSize = sizeof(CURSORINFO);
-        GetCursorInfo(&curinfo);
-        GetIconInfo(curinfo.hCursor, &icoinfo);
-        DrawIcon(vdev->hdcdst, curinfo.ptScreenPos.x - icoinfo.xHotspot, curinfo.ptScreenPos.y - icoinfo.xHotspot, curinfo.hCursor);
+        vdev_update_rect(vdev); // only the captured rect is blitted and handed to encoder, the rest of bmp_buffer is unused
+        BitBlt(vdev->hdcdst, 0, 0, vdev->cap_width, vdev->cap_height, vdev->hdcsrc, vdev->cap_x, vdev->cap_y, SRCCOPY|CAPTUREBLT);
+        if (vdev->cursor_draw) {
+            curinfo.cbSize = sizeof(CURSORINFO);
+            if (GetCursorInfo(&curinfo) && (curinfo.flags & CURSOR_SHOWING)) {
+                pthread_mutex_lock(&vdev->mutex);
+                vdev_update_cursor(vdev, curinfo.hCursor);
+                DrawIcon(vdev->hdcdst, curinfo.ptScreenPos.x - vdev->cap_x - vdev->cursor_xhot, curinfo.ptScreenPos.y - vdev->cap_y - vdev->cursor_yhot, curinfo.hCursor);
+                pthread_mutex_unlock(&vdev->mutex);
+            }
+        }
 
         if (vdev->callback) {
             void *data[8] = { vdev->bmp_buffer };
-            int   len [8] = { vdev->bmp_stride * vdev->screen_height, vdev->screen_width, vdev->screen_height, vdev->bmp_stride };
+            int   len [8] = { vdev->bmp_stride * vdev->cap_height, vdev->cap_width, vdev->cap_height, vdev->bmp_stride };
             vdev->callback(vdev->codec, data, len);
         }
         if (ticksleep > 0) usleep(ticksleep * 1000);
@@ -71,10 +187,13 @@ void* vdev_init(int frate, int w, int h)
 
     vdev->hdcsrc = GetDC(NULL);
     vdev->hdcdst = CreateCompatibleDC(NULL);
+    vdev->cursor_hdc = CreateCompatibleDC(NULL);
 
     vdev->screen_width  = GetSystemMetrics(SM_CXSCREEN);
     vdev->screen_height = GetSystemMetrics(SM_CYSCREEN);
     vdev->frame_rate    = frate;
+    vdev->cap_width     = vdev->screen_width;
+    vdev->cap_height    = vdev->screen_height;
 
     bmpinfo.bmiHeader.biSize        =  sizeof(BITMAPINFOHEADER);
     bmpinfo.bmiHeader.biWidth       =  vdev->screen_width;
@@ -86,7 +205,9 @@ void* vdev_init(int frate, int w, int h)
     GetObject(vdev->hbitmap, sizeof(BITMAP), &bitmap);
     SelectObject(vdev->hdcdst, vdev->hbitmap);
     vdev->bmp_stride  = bitmap.bmWidthBytes;
+    vdev->cursor_draw = 1;
 
+    pthread_mutex_init(&vdev->mutex, NULL);
     pthread_create(&vdev->thread, NULL, vdev_capture_thread_proc, vdev);
     return vdev;
 }
@@ -102,6 +223,8 @@ void vdev_free(void *ctxt)
     ReleaseDC(NULL, vdev->hdcsrc);
     DeleteDC(vdev->hdcdst);
     DeleteObject(vdev->hbitmap);
+    DeleteDC(vdev->cursor_hdc);
+    pthread_mutex_destroy(&vdev->mutex);
     free(vdev);
 }
 
@@ -123,3 +246,76 @@ void vdev_set_callback(void *ctxt, PFN_CODEC_CALLBACK callback, void *codec)
     vdev->codec    = codec;
     vdev->callback = callback;
 }
+
+void vdev_draw_cursor(void *ctxt, int draw)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    vdev->cursor_draw = draw;
+}
+
+uint32_t vdev_cursor_pos(void *ctxt, int *x, int *y, int *w, int *h)
+{
+    VDEV      *vdev    = (VDEV*)ctxt;
+    CURSORINFO curinfo = {0};
+    uint32_t   id;
+    if (!vdev) return 0;
+    curinfo.cbSize = sizeof(CURSORINFO);
+    if (!GetCursorInfo(&curinfo) || !(curinfo.flags & CURSOR_SHOWING)) return 0;
+    pthread_mutex_lock(&vdev->mutex);
+    vdev_update_cursor(vdev, curinfo.hCursor);
+    id = vdev->cursor_id;
+    if (x) *x = curinfo.ptScreenPos.x - vdev->cap_x;
+    if (y) *y = curinfo.ptScreenPos.y - vdev->cap_y;
+    if (w) *w = vdev->cap_width;
+    if (h) *h = vdev->cap_height;
+    pthread_mutex_unlock(&vdev->mutex);
+    return id;
+}
+
+int vdev_cursor_shape(void *ctxt, uint32_t id, uint8_t *buf, int len)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    int   size = 0;
+    if (!vdev) return 0;
+    pthread_mutex_lock(&vdev->mutex);
+    if (id && id == vdev->cursor_id && (size = 12 + vdev->cursor_width * vdev->cursor_height * 4) <= len) {
+        *(uint32_t*)(buf + 0 ) = vdev->cursor_id;
+        *(uint16_t*)(buf + 4 ) = vdev->cursor_width;
+        *(uint16_t*)(buf + 6 ) = vdev->cursor_height;
+        *(uint16_t*)(buf + 8 ) = vdev->cursor_xhot;
+        *(uint16_t*)(buf + 10) = vdev->cursor_yhot;
+        memcpy(buf + 12, vdev->cursor_bits, size - 12);
+    } else size = 0;
+    pthread_mutex_unlock(&vdev->mutex);
+    return size;
+}
+
+void vdev_set_region(void *ctxt, int x, int y, int w, int h)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    pthread_mutex_lock(&vdev->mutex);
+    vdev->region_x      = x;
+    vdev->region_y      = y;
+    vdev->region_width  = w;
+    vdev->region_height = h;
+    vdev->region_hwnd   = NULL;
+    pthread_mutex_unlock(&vdev->mutex);
+}
+
+int vdev_set_window(void *ctxt, char *title)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    HWND  hwnd = NULL;
+    if (!vdev) return -1;
+    if (title && title[0] && !(hwnd = FindWindowA(NULL, title))) {
+        log_printf("vdev_set_window can't find window: %s !\n", title);
+        return -1;
+    }
+    pthread_mutex_lock(&vdev->mutex);
+    vdev->region_hwnd = hwnd;
+    if (!hwnd) vdev->region_width = vdev->region_height = 0;
+    pthread_mutex_unlock(&vdev->mutex);
+    return 0;
+}
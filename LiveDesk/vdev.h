@@ -10,8 +10,25 @@ extern "C" {
 void* vdev_init (int frate, int w, int h);
 void  vdev_free (void *ctxt);
 void  vdev_start(void *ctxt, int start);
+
+// callback gets buf[0]: BGRA pixels, len[0]: buffer size, len[1]: width, len[2]: height, len[3]: stride
+// buf[1]: dirty rects (int x, y, w, h), len[4]: dirty rect number, 0 means the whole frame may have changed
 void  vdev_set_callback(void *ctxt, PFN_CODEC_CALLBACK callback, void *codec);
 
+// capture only a sub rectangle of the screen (w or h <= 0 means full screen), or follow the window with given title
+// (NULL title stops following). the rect can be changed at runtime, frames handed to callback just change their size.
+void  vdev_set_region(void *ctxt, int x, int y, int w, int h);
+int   vdev_set_window(void *ctxt, char *title);
+
+// cursor is drawn into captured frames by default, sinks sending it as metadata call vdev_draw_cursor(ctxt, 0).
+// vdev_cursor_pos returns current cursor shape id (0 if cursor is hidden), cursor position relative to the captured rect and its size,
+// vdev_cursor_shape copies the shape of id into buf: uint32_t id, uint16_t w, h, xhot, yhot, then w * h BGRA pixels.
+#define VDEV_CURSOR_MAX_SIZE  128
+#define VDEV_CURSOR_BUF_SIZE (12 + VDEV_CURSOR_MAX_SIZE * VDEV_CURSOR_MAX_SIZE * 4)
+void     vdev_draw_cursor (void *ctxt, int draw);
+uint32_t vdev_cursor_pos  (void *ctxt, int *x, int *y, int *w, int *h);
+int      vdev_cursor_shape(void *ctxt, uint32_t id, uint8_t *buf, int len);
+
 #ifdef __cplusplus
 }
 #endif
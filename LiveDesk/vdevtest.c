@@ -0,0 +1,184 @@
+// capture test of vdevx11.c, run it on an x server nobody else draws on, "make test" starts one with Xvfb.
+// it fills rects of known color on the root window and checks the dirty rects and pixels of the frames vdev delivers
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <X11/Xlib.h>
+#include "vdev.h"
+#include "log.h"
+
+#define TEST_WAIT_FRAME  2000 // ms
+#define TEST_MAX_RECTS   64
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t *pixels; // copy of last frame, packed rows
+    int       width;
+    int       height;
+    int       rects[TEST_MAX_RECTS * 4];
+    int       nrects;
+    int       frames;
+} TEST;
+
+static void test_callback(void *ctxt, void *buf[8], int len[8]) // called by capture thread
+{
+    TEST *test = (TEST*)ctxt;
+    int   y;
+    pthread_mutex_lock(&test->mutex);
+    if (test->width != len[1] || test->height != len[2]) {
+        free(test->pixels);
+        test->pixels = malloc(len[1] * len[2] * 4);
+        test->width  = len[1];
+        test->height = len[2];
+    }
+    for (y=0; test->pixels && y<len[2]; y++) memcpy(test->pixels + y * len[1], (uint8_t*)buf[0] + y * len[3], len[1] * 4);
+    test->nrects = len[4] < TEST_MAX_RECTS ? len[4] : TEST_MAX_RECTS;
+    memcpy(test->rects, buf[1], test->nrects * 4 * sizeof(int));
+    test->frames++;
+    pthread_cond_signal(&test->cond);
+    pthread_mutex_unlock(&test->mutex);
+}
+
+// waits for a frame after frame number last, returns with mutex locked, -1 on timeout
+static int test_wait(TEST *test, int last, int timeout)
+{
+    struct timespec ts;
+    int ret = 0;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += timeout / 1000;
+    ts.tv_nsec += timeout % 1000 * 1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    pthread_mutex_lock(&test->mutex);
+    while (test->frames <= last && ret == 0) ret = pthread_cond_timedwait(&test->cond, &test->mutex, &ts);
+    return test->frames > last ? 0 : -1;
+}
+
+// fills x, y, w, h of root with color, then checks the frame that reports it. (cx, cy) is the captured rect origin
+static int test_fill(TEST *test, Display *display, GC gc, int x, int y, int w, int h, uint32_t color, int cx, int cy)
+{
+    uint32_t *before;
+    int       last, covered, i, j, rx, ry;
+    pthread_mutex_lock(&test->mutex);
+    last   = test->frames;
+    before = malloc(test->width * test->height * 4);
+    memcpy(before, test->pixels, test->width * test->height * 4);
+    pthread_mutex_unlock(&test->mutex);
+
+    XSetForeground(display, gc, color);
+    XFillRectangle(display, DefaultRootWindow(display), gc, x, y, w, h);
+    XSync(display, False);
+    x -= cx; y -= cy; // in captured rect now, clipped to it
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    for (;;) { // damage of one fill may come in more than one frame
+        if (test_wait(test, last, TEST_WAIT_FRAME) != 0) { printf("no frame for fill %d,%d %dx%d !\n", x, y, w, h); goto failed; }
+        last = test->frames;
+        if (test->nrects == 0) { pthread_mutex_unlock(&test->mutex); continue; } // periodic refresh
+        for (i=0; i<test->nrects; i++) { // dirty rects are inside captured rect and inside what was drawn
+            int *r = test->rects + i * 4;
+            if (r[0] < x || r[1] < y || r[0] + r[2] > x + w || r[1] + r[3] > y + h || r[0] + r[2] > test->width || r[1] + r[3] > test->height) {
+                printf("dirty rect %d,%d %dx%d is outside of fill %d,%d %dx%d !\n", r[0], r[1], r[2], r[3], x, y, w, h);
+                goto failed;
+            }
+        }
+        for (ry=y,covered=1; ry<y+h && ry<test->height && covered; ry++) {
+            for (rx=x; rx<x+w && rx<test->width && covered; rx++) {
+                for (i=0,covered=0; i<test->nrects && !covered; i++) {
+                    int *r = test->rects + i * 4;
+                    covered = rx >= r[0] && rx < r[0] + r[2] && ry >= r[1] && ry < r[1] + r[3];
+                }
+            }
+        }
+        if (covered) break;
+        pthread_mutex_unlock(&test->mutex);
+    }
+    for (j=0; j<test->height; j++) { // fill has its color, the rest of the frame has not changed
+        for (i=0; i<test->width; i++) {
+            uint32_t expect = i >= x && i < x + w && j >= y && j < y + h ? color : before[j * test->width + i];
+            if (((test->pixels[j * test->width + i] ^ expect) & 0xFFFFFF) == 0) continue;
+            printf("pixel %d,%d is %06x, expected %06x !\n", i, j, test->pixels[j * test->width + i] & 0xFFFFFF, expect & 0xFFFFFF);
+            goto failed;
+        }
+    }
+    pthread_mutex_unlock(&test->mutex);
+    free(before);
+    return 0;
+
+failed:
+    pthread_mutex_unlock(&test->mutex);
+    free(before);
+    return -1;
+}
+
+int main(void)
+{
+    static TEST test;
+    Display *display;
+    GC       gc;
+    void    *vdev;
+    int      sw, sh, last, region, ret = -1;
+
+    log_init("DEBUGER");
+    pthread_mutex_init(&test.mutex, NULL);
+    pthread_cond_init (&test.cond , NULL);
+    if (!(display = XOpenDisplay(NULL))) { printf("failed to open x11 display, DISPLAY=%s !\n", getenv("DISPLAY")); return 1; }
+    sw = DisplayWidth (display, DefaultScreen(display));
+    sh = DisplayHeight(display, DefaultScreen(display));
+    gc = XCreateGC(display, DefaultRootWindow(display), 0, NULL);
+    XSetSubwindowMode(display, gc, IncludeInferiors);
+    XSetForeground(display, gc, 0x000000);
+    XFillRectangle(display, DefaultRootWindow(display), gc, 0, 0, sw, sh);
+    XSync(display, False);
+
+    if (!(vdev = vdev_init(30, sw, sh))) { printf("vdev_init failed !\n"); goto done; }
+    vdev_draw_cursor(vdev, 0); // pointer would be blended into the pixels checked
+    vdev_set_callback(vdev, test_callback, &test);
+    vdev_start(vdev, 1);
+    if (test_wait(&test, 0, TEST_WAIT_FRAME) != 0) { pthread_mutex_unlock(&test.mutex); printf("no first frame !\n"); goto done; }
+    printf("first frame %dx%d, %d rects\n", test.width, test.height, test.nrects);
+    if (test.width != sw || test.height != sh) { pthread_mutex_unlock(&test.mutex); printf("frame is not screen size %dx%d !\n", sw, sh); goto done; }
+    pthread_mutex_unlock(&test.mutex);
+
+    if (test_fill(&test, display, gc, 10, 20, 100, 50, 0xFF0000, 0, 0) != 0) goto done;
+    if (test_fill(&test, display, gc, sw - 64, sh - 33, 64, 33, 0x00FF80, 0, 0) != 0) goto done; // bottom right corner
+    if (test_fill(&test, display, gc, 200, 100, 1, 1, 0x123456, 0, 0) != 0) goto done;
+    printf("full screen fills ok\n");
+
+    usleep(300 * 1000); // idle screen, only periodic refresh frames without rects
+    pthread_mutex_lock(&test.mutex);
+    last = test.frames;
+    pthread_mutex_unlock(&test.mutex);
+    usleep(1500 * 1000);
+    pthread_mutex_lock(&test.mutex);
+    if (test.frames - last > 2 || (test.frames > last && test.nrects)) { pthread_mutex_unlock(&test.mutex); printf("%d frames of idle screen !\n", test.frames - last); goto done; }
+    pthread_mutex_unlock(&test.mutex);
+    printf("idle screen ok, %d refresh frames in 1.5s\n", test.frames - last);
+
+    vdev_set_region(vdev, 100, 80, 320, 240);
+    pthread_mutex_lock(&test.mutex);
+    last = test.frames;
+    pthread_mutex_unlock(&test.mutex);
+    do { // the new rect is captured at once, its frames just have the new size
+        if (test_wait(&test, last, TEST_WAIT_FRAME) != 0) { pthread_mutex_unlock(&test.mutex); printf("no frame after vdev_set_region !\n"); goto done; }
+        last   = test.frames;
+        region = test.width == 320 && test.height == 240;
+        pthread_mutex_unlock(&test.mutex);
+    } while (!region);
+    if (test_fill(&test, display, gc, 50, 60, 100, 40, 0x0000FF, 100, 80) != 0) goto done; // partly outside, clipped to region
+    if (test_fill(&test, display, gc, 150, 130, 20, 30, 0xFFFF00, 100, 80) != 0) goto done;
+    printf("region fills ok\n");
+    ret = 0;
+
+done:
+    vdev_free(vdev);
+    XFreeGC(display, gc);
+    XCloseDisplay(display);
+    free(test.pixels);
+    printf("vdevtest %s\n", ret == 0 ? "passed" : "failed !");
+    return ret == 0 ? 0 : 1;
+}
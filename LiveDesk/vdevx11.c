@@ -0,0 +1,475 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xdamage.h>
+#include "vdev.h"
+#include "log.h"
+
+#define VDEV_MAX_DIRTY_RECTS  64
+#define VDEV_REFRESH_PERIOD   1000 // deliver a full frame at least once per second, even if nothing changed
+
+static uint32_t get_tick_count()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+typedef struct {
+    Display        *display;
+    Window          root;
+    XImage         *ximage;
+    XShmSegmentInfo shminfo;
+    Damage          damage;
+    XserverRegion   region;
+    int             damage_event;
+    int             fixes_event;
+    int             frame_rate;
+    int             screen_width;
+    int             screen_height;
+    uint32_t        tick_frame;
+    int             rects[VDEV_MAX_DIRTY_RECTS * 4];
+
+    #define TS_EXIT    (1 << 0)
+    #define TS_START   (1 << 1)
+    #define TS_REFRESH (1 << 2)
+    int       status;
+    pthread_t thread;
+
+    void    *codec;
+    PFN_CODEC_CALLBACK callback;
+
+    pthread_mutex_t mutex;
+    int      region_x;      // requested capture region, region_width <= 0 means full screen
+    int      region_y;
+    int      region_width;
+    int      region_height;
+    Window   region_window; // window to follow, overrides region
+    int      cap_x;         // rect actually captured, updated by capture thread every frame
+    int      cap_y;
+    int      cap_width;
+    int      cap_height;
+
+    unsigned long   cursor_serial;
+    int      cursor_dirty;  // set by XFixesCursorNotify, cursor image is fetched again only then
+    uint32_t cursor_id;
+    int      cursor_width;
+    int      cursor_height;
+    int      cursor_xhot;
+    int      cursor_yhot;
+    int      cursor_draw;
+    uint32_t cursor_bits[VDEV_CURSOR_MAX_SIZE * VDEV_CURSOR_MAX_SIZE];
+} VDEV;
+
+static uint32_t cursor_hash(uint32_t hash, uint8_t *buf, int len)
+{
+    while (len-- > 0) hash = (hash ^ *buf++) * 16777619;
+    return hash;
+}
+
+// must be called with mutex locked, position is queried every time, BGRA cursor shape is rebuilt only after cursor changed
+static int vdev_update_cursor(VDEV *vdev, int *x, int *y)
+{
+    XFixesCursorImage *image;
+    XEvent             event;
+    Window             root, child;
+    int                rx, ry, wx, wy, i;
+    unsigned int       mask;
+    if (!XQueryPointer(vdev->display, vdev->root, &root, &child, &rx, &ry, &wx, &wy, &mask)) return -1; // pointer is on another screen
+    if (x) *x = rx;
+    if (y) *y = ry;
+    if (!vdev->fixes_event) return 0;
+    while (XCheckTypedEvent(vdev->display, vdev->fixes_event + XFixesCursorNotify, &event)) vdev->cursor_dirty = 1;
+    if (!vdev->cursor_dirty || !(image = XFixesGetCursorImage(vdev->display))) return 0;
+    vdev->cursor_dirty = 0;
+    if (image->cursor_serial != vdev->cursor_serial) {
+        vdev->cursor_serial = image->cursor_serial;
+        vdev->cursor_id     = 0;
+        if (image->width <= VDEV_CURSOR_MAX_SIZE && image->height <= VDEV_CURSOR_MAX_SIZE) {
+            for (i=0; i<image->width*image->height; i++) vdev->cursor_bits[i] = (uint32_t)image->pixels[i]; // pixels are unsigned long ARGB
+            vdev->cursor_width  = image->width;
+            vdev->cursor_height = image->height;
+            vdev->cursor_xhot   = image->xhot;
+            vdev->cursor_yhot   = image->yhot;
+            vdev->cursor_id     = cursor_hash(2166136261, (uint8_t*)&vdev->cursor_width, 4 * sizeof(int));
+            vdev->cursor_id     = cursor_hash(vdev->cursor_id, (uint8_t*)vdev->cursor_bits, image->width * image->height * sizeof(uint32_t));
+            vdev->cursor_id    |= 1; // 0 is reserved for hidden cursor
+        }
+    }
+    XFree(image);
+    return 0;
+}
+
+static void vdev_blend_cursor(VDEV *vdev, int x, int y)
+{
+    uint32_t *src, *dst, a;
+    int       sx, sy, dx, dy;
+    x -= vdev->cursor_xhot;
+    y -= vdev->cursor_yhot;
+    for (sy=0; sy<vdev->cursor_height; sy++) {
+        dy = y + sy;
+        if (dy < 0 || dy >= vdev->cap_height) continue;
+        src = vdev->cursor_bits + sy * vdev->cursor_width;
+        dst = (uint32_t*)(vdev->ximage->data + dy * vdev->ximage->bytes_per_line);
+        for (sx=0; sx<vdev->cursor_width; sx++) {
+            dx = x + sx;
+            if (dx < 0 || dx >= vdev->cap_width || !(a = src[sx] >> 24)) continue;
+            dst[dx] = (src[sx] & 0xFFFFFF) // xfixes pixels are premultiplied
+                    + (((((dst[dx] & 0xFF00FF) * (255 - a)) >> 8) & 0xFF00FF) | ((((dst[dx] & 0x00FF00) * (255 - a)) >> 8) & 0x00FF00));
+        }
+    }
+}
+
+// returns the number of dirty rects saved in vdev->rects, 0 means nothing changed
+static int vdev_fetch_damage(VDEV *vdev)
+{
+    XRectangle *rects;
+    XEvent      event;
+    int         damaged = 0, x1, y1, x2, y2, n, i;
+
+    while (XPending(vdev->display)) {
+        XNextEvent(vdev->display, &event);
+        if (vdev->damage && event.type == vdev->damage_event + XDamageNotify) damaged = 1;
+        if (vdev->fixes_event && event.type == vdev->fixes_event + XFixesCursorNotify) {
+            pthread_mutex_lock(&vdev->mutex);
+            vdev->cursor_dirty = 1;
+            pthread_mutex_unlock(&vdev->mutex);
+        }
+    }
+    if (!damaged) return 0;
+
+    XDamageSubtract(vdev->display, vdev->damage, None, vdev->region);
+    rects = XFixesFetchRegion(vdev->display, vdev->region, &n);
+    if (!rects) return 0;
+    if (n > VDEV_MAX_DIRTY_RECTS) { // too many rects, merge them to bounding box
+        x1 = rects[0].x; y1 = rects[0].y; x2 = x1 + rects[0].width; y2 = y1 + rects[0].height;
+        for (i=1; i<n; i++) {
+            if (x1 > rects[i].x) x1 = rects[i].x;
+            if (y1 > rects[i].y) y1 = rects[i].y;
+            if (x2 < rects[i].x + rects[i].width ) x2 = rects[i].x + rects[i].width ;
+            if (y2 < rects[i].y + rects[i].height) y2 = rects[i].y + rects[i].height;
+        }
+        vdev->rects[0] = x1; vdev->rects[1] = y1; vdev->rects[2] = x2 - x1; vdev->rects[3] = y2 - y1;
+        n = 1;
+    } else {
+        for (i=0; i<n; i++) {
+            vdev->rects[i * 4 + 0] = rects[i].x;
+            vdev->rects[i * 4 + 1] = rects[i].y;
+            vdev->rects[i * 4 + 2] = rects[i].width;
+            vdev->rects[i * 4 + 3] = rects[i].height;
+        }
+    }
+    XFree(rects);
+    return n;
+}
+
+static int vdev_error_handler(Display *display, XErrorEvent *event)
+{
+    log_printf("x11 error: %d, request: %d !\n", event->error_code, event->request_code); // followed window may be destroyed at any time
+    return 0;
+}
+
+static Window vdev_find_window(Display *display, Window window, char *title, int depth)
+{
+    Window  root, parent, *children = NULL, found = None;
+    char   *name = NULL;
+    unsigned int n, i;
+    if (XFetchName(display, window, &name) && name) {
+        if (strcmp(name, title) == 0) found = window;
+        XFree(name);
+        if (found) return found;
+    }
+    if (depth > 0 && XQueryTree(display, window, &root, &parent, &children, &n)) { // client windows are children of window manager frames
+        for (i=0; i<n && !found; i++) found = vdev_find_window(display, children[i], title, depth - 1);
+        if (children) XFree(children);
+    }
+    return found;
+}
+
+// returns 1 if captured rect has changed
+static int vdev_update_rect(VDEV *vdev)
+{
+    XWindowAttributes attrs;
+    Window child;
+    int    x, y, w, h, changed;
+    pthread_mutex_lock(&vdev->mutex);
+    if (vdev->region_window) {
+        if (!XGetWindowAttributes(vdev->display, vdev->region_window, &attrs)) {
+            log_printf("captured window has gone, capture full screen !\n");
+            vdev->region_window = None;
+            x = y = w = h = 0;
+        } else if (attrs.map_state != IsViewable || !XTranslateCoordinates(vdev->display, vdev->region_window, vdev->root, 0, 0, &x, &y, &child)) {
+            pthread_mutex_unlock(&vdev->mutex);
+            return 0; // minimized, keep last rect
+        } else {
+            w = attrs.width; h = attrs.height;
+        }
+    } else {
+        x = vdev->region_x; y = vdev->region_y; w = vdev->region_width; h = vdev->region_height;
+    }
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > vdev->screen_width ) w = vdev->screen_width  - x;
+    if (y + h > vdev->screen_height) h = vdev->screen_height - y;
+    if (w < 2 || h < 2) { x = y = 0; w = vdev->screen_width; h = vdev->screen_height; }
+    changed = x != vdev->cap_x || y != vdev->cap_y || w != vdev->cap_width || h != vdev->cap_height;
+    vdev->cap_x = x; vdev->cap_y = y; vdev->cap_width = w; vdev->cap_height = h;
+    pthread_mutex_unlock(&vdev->mutex);
+    return changed;
+}
+
+// translate dirty rects to captured rect coordinates and drop the ones outside of it
+static int vdev_clip_rects(VDEV *vdev, int n)
+{
+    int i, j, x1, y1, x2, y2;
+    for (i=0, j=0; i<n; i++) {
+        x1 = vdev->rects[i * 4 + 0] - vdev->cap_x; x2 = x1 + vdev->rects[i * 4 + 2];
+        y1 = vdev->rects[i * 4 + 1] - vdev->cap_y; y2 = y1 + vdev->rects[i * 4 + 3];
+        if (x1 < 0) x1 = 0;
+        if (y1 < 0) y1 = 0;
+        if (x2 > vdev->cap_width ) x2 = vdev->cap_width;
+        if (y2 > vdev->cap_height) y2 = vdev->cap_height;
+        if (x1 >= x2 || y1 >= y2) continue;
+        vdev->rects[j * 4 + 0] = x1; vdev->rects[j * 4 + 1] = y1;
+        vdev->rects[j * 4 + 2] = x2 - x1; vdev->rects[j * 4 + 3] = y2 - y1;
+        j++;
+    }
+    return j;
+}
+
+static void* vdev_capture_thread_proc(void *param)
+{
+    VDEV     *vdev    = (VDEV*)param;
+    uint32_t  tickcur = 0, ticknext = 0;
+    int32_t   period  = 1000 / vdev->frame_rate, ticksleep = 0, nrects;
+
+    while (!(vdev->status & TS_EXIT)) {
+        if (!(vdev->status & TS_START)) {
+            ticknext = 0; usleep(100*1000); continue;
+        }
+        tickcur   = get_tick_count();
+        ticknext  =(ticknext ? ticknext : tickcur) + period;
+        ticksleep = (int32_t)ticknext - (int32_t)tickcur;
+
+        if (vdev_update_rect(vdev)) vdev->status |= TS_REFRESH;
+        nrects = vdev_fetch_damage(vdev); // also takes cursor events nobody else has taken
+        nrects = nrects > 0 ? vdev_clip_rects(vdev, nrects) : 0;
+        if (  nrects > 0 || !vdev->damage || (vdev->status & TS_REFRESH)
+           || (int32_t)tickcur - (int32_t)vdev->tick_frame > VDEV_REFRESH_PERIOD) {
+            vdev->status &= ~TS_REFRESH;
+            vdev->tick_frame = tickcur;
+            vdev->ximage->width          = vdev->cap_width; // only the captured rect is transferred, rows are packed in shm
+            vdev->ximage->height         = vdev->cap_height;
+            vdev->ximage->bytes_per_line = vdev->cap_width * 4;
+            XShmGetImage(vdev->display, vdev->root, vdev->ximage, vdev->cap_x, vdev->cap_y, AllPlanes);
+            if (vdev->cursor_draw) {
+                int x, y;
+                pthread_mutex_lock(&vdev->mutex);
+                if (vdev_update_cursor(vdev, &x, &y) == 0 && vdev->cursor_id) vdev_blend_cursor(vdev, x - vdev->cap_x, y - vdev->cap_y);
+                pthread_mutex_unlock(&vdev->mutex);
+            }
+            if (vdev->callback) {
+                void *data[8] = { vdev->ximage->data, vdev->rects };
+                int   len [8] = { vdev->ximage->bytes_per_line * vdev->cap_height, vdev->cap_width, vdev->cap_height, vdev->ximage->bytes_per_line, nrects };
+                vdev->callback(vdev->codec, data, len);
+            }
+        }
+        if (ticksleep > 0) usleep(ticksleep * 1000);
+    }
+
+    return NULL;
+}
+
+void* vdev_init(int frate, int w, int h)
+{
+    int   screen, event_base, error_base;
+    VDEV *vdev = calloc(1, sizeof(VDEV));
+    if (!vdev) return NULL;
+
+    vdev->shminfo.shmid   = -1;
+    vdev->shminfo.shmaddr = (char*)-1;
+    vdev->cursor_draw     = 1;
+    pthread_mutex_init(&vdev->mutex, NULL);
+
+    XInitThreads(); // cursor is queried from sink threads
+    vdev->display = XOpenDisplay(NULL);
+    if (!vdev->display) {
+        log_printf("failed to open x11 display !\n");
+        goto failed;
+    }
+    if (!XShmQueryExtension(vdev->display)) {
+        log_printf("x11 display has no MIT-SHM extension !\n");
+        goto failed;
+    }
+
+    screen = DefaultScreen(vdev->display);
+    vdev->root          = RootWindow(vdev->display, screen);
+    vdev->screen_width  = DisplayWidth (vdev->display, screen);
+    vdev->screen_height = DisplayHeight(vdev->display, screen);
+    vdev->frame_rate    = frate;
+    vdev->cap_width     = vdev->screen_width;
+    vdev->cap_height    = vdev->screen_height;
+    XSetErrorHandler(vdev_error_handler);
+
+    vdev->ximage = XShmCreateImage(vdev->display, DefaultVisual(vdev->display, screen), DefaultDepth(vdev->display, screen),
+                                   ZPixmap, NULL, &vdev->shminfo, vdev->screen_width, vdev->screen_height);
+    if (!vdev->ximage || vdev->ximage->bits_per_pixel != 32) {
+        log_printf("unsupported x11 visual, only 32bpp is supported !\n");
+        goto failed;
+    }
+    vdev->shminfo.shmid = shmget(IPC_PRIVATE, vdev->ximage->bytes_per_line * vdev->ximage->height, IPC_CREAT|0600);
+    if (vdev->shminfo.shmid == -1) {
+        log_printf("failed to create shared memory !\n");
+        goto failed;
+    }
+    vdev->shminfo.shmaddr  = vdev->ximage->data = shmat(vdev->shminfo.shmid, NULL, 0);
+    vdev->shminfo.readOnly = False;
+    if (vdev->shminfo.shmaddr == (char*)-1 || !XShmAttach(vdev->display, &vdev->shminfo)) {
+        log_printf("failed to attach shared memory !\n");
+        goto failed;
+    }
+    XSync(vdev->display, False);
+    shmctl(vdev->shminfo.shmid, IPC_RMID, NULL); // segment is destroyed automatically after last detach
+
+    if (XFixesQueryExtension(vdev->display, &event_base, &error_base)) {
+        XFixesSelectCursorInput(vdev->display, vdev->root, XFixesDisplayCursorNotifyMask);
+        vdev->fixes_event  = event_base;
+        vdev->cursor_dirty = 1;
+        if (XDamageQueryExtension(vdev->display, &vdev->damage_event, &error_base)) {
+            vdev->damage = XDamageCreate(vdev->display, vdev->root, XDamageReportNonEmpty);
+            vdev->region = XFixesCreateRegion(vdev->display, NULL, 0);
+        }
+    }
+    if (!vdev->damage) log_printf("x11 display has no DAMAGE extension, capture every frame !\n");
+
+    pthread_create(&vdev->thread, NULL, vdev_capture_thread_proc, vdev);
+    return vdev;
+
+failed:
+    if (vdev->shminfo.shmid != -1) shmctl(vdev->shminfo.shmid, IPC_RMID, NULL);
+    vdev_free(vdev);
+    return NULL;
+}
+
+void vdev_free(void *ctxt)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+
+    if (vdev->thread) {
+        vdev->status |= TS_EXIT;
+        pthread_join(vdev->thread, NULL);
+    }
+
+    if (vdev->region) XFixesDestroyRegion(vdev->display, vdev->region);
+    if (vdev->damage) XDamageDestroy(vdev->display, vdev->damage);
+    if (vdev->shminfo.shmaddr != (char*)-1) {
+        XShmDetach(vdev->display, &vdev->shminfo);
+        shmdt(vdev->shminfo.shmaddr);
+    }
+    if (vdev->ximage) {
+        vdev->ximage->data = NULL;
+        XDestroyImage(vdev->ximage);
+    }
+    if (vdev->display) XCloseDisplay(vdev->display);
+    pthread_mutex_destroy(&vdev->mutex);
+    free(vdev);
+}
+
+void vdev_start(void *ctxt, int start)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    if (start) {
+        vdev->status |= TS_START|TS_REFRESH;
+    } else {
+        vdev->status &=~TS_START;
+    }
+}
+
+void vdev_set_callback(void *ctxt, PFN_CODEC_CALLBACK callback, void *codec)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    vdev->codec    = codec;
+    vdev->callback = callback;
+}
+
+void vdev_draw_cursor(void *ctxt, int draw)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    vdev->cursor_draw = draw;
+}
+
+uint32_t vdev_cursor_pos(void *ctxt, int *x, int *y, int *w, int *h)
+{
+    VDEV    *vdev = (VDEV*)ctxt;
+    uint32_t id   = 0;
+    if (!vdev) return 0;
+    pthread_mutex_lock(&vdev->mutex);
+    if (vdev_update_cursor(vdev, x, y) == 0) id = vdev->cursor_id;
+    if (x) *x -= vdev->cap_x;
+    if (y) *y -= vdev->cap_y;
+    if (w) *w  = vdev->cap_width;
+    if (h) *h  = vdev->cap_height;
+    pthread_mutex_unlock(&vdev->mutex);
+    return id;
+}
+
+int vdev_cursor_shape(void *ctxt, uint32_t id, uint8_t *buf, int len)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    int   size = 0;
+    if (!vdev) return 0;
+    pthread_mutex_lock(&vdev->mutex);
+    if (id && id == vdev->cursor_id && (size = 12 + vdev->cursor_width * vdev->cursor_height * 4) <= len) {
+        *(uint32_t*)(buf + 0 ) = vdev->cursor_id;
+        *(uint16_t*)(buf + 4 ) = vdev->cursor_width;
+        *(uint16_t*)(buf + 6 ) = vdev->cursor_height;
+        *(uint16_t*)(buf + 8 ) = vdev->cursor_xhot;
+        *(uint16_t*)(buf + 10) = vdev->cursor_yhot;
+        memcpy(buf + 12, vdev->cursor_bits, size - 12);
+    } else size = 0;
+    pthread_mutex_unlock(&vdev->mutex);
+    return size;
+}
+
+void vdev_set_region(void *ctxt, int x, int y, int w, int h)
+{
+    VDEV *vdev = (VDEV*)ctxt;
+    if (!vdev) return;
+    pthread_mutex_lock(&vdev->mutex);
+    vdev->region_x      = x;
+    vdev->region_y      = y;
+    vdev->region_width  = w;
+    vdev->region_height = h;
+    vdev->region_window = None;
+    pthread_mutex_unlock(&vdev->mutex);
+}
+
+int vdev_set_window(void *ctxt, char *title)
+{
+    VDEV  *vdev   = (VDEV*)ctxt;
+    Window window = None;
+    if (!vdev) return -1;
+    if (title && title[0] && !(window = vdev_find_window(vdev->display, vdev->root, title, 2))) {
+        log_printf("vdev_set_window can't find window: %s !\n", title);
+        return -1;
+    }
+    pthread_mutex_lock(&vdev->mutex);
+    vdev->region_window = window;
+    if (!window) vdev->region_width = vdev->region_height = 0;
+    pthread_mutex_unlock(&vdev->mutex);
+    return 0;
+}
@@ -1,9 +1,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 #include "ringbuf.h"
 #include "ikcp.h"
+#include "udpbatch.h"
 #include "avkcpc.h"
 
 #ifdef WIN32
@@ -48,12 +50,13 @@ typedef struct {
     int       tail;
     int       size;
     uint8_t   buff[2 * 1024 * 1024];
+    UDPBATCH  udp; // kcp output is batched per update
 } AVKCPC;
 
 static int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
     AVKCPC *avkcpc = (AVKCPC*)user;
-    return sendto(avkcpc->client_fd, buf, len, 0, (struct sockaddr*)&avkcpc->server_addr, sizeof(avkcpc->server_addr));
+    return udpbatch_send(&avkcpc->udp, buf, len, &avkcpc->server_addr);
 }
 
 static void avkcpc_ikcp_update(AVKCPC *avkcpc)
@@ -62,6 +65,7 @@ static void avkcpc_ikcp_update(AVKCPC *avkcpc)
     if ((int32_t)tickcur - (int32_t)avkcpc->tick_kcp_update >= 0) {
         ikcp_update(avkcpc->ikcp, tickcur);
         avkcpc->tick_kcp_update = ikcp_check(avkcpc->ikcp, get_tick_count());
+        udpbatch_flush(&avkcpc->udp);
     }
 }
 
@@ -69,7 +73,7 @@ static void* avkcpc_thread_proc(void *argv)
 {
     AVKCPC  *avkcpc = (AVKCPC*)argv;
     struct   sockaddr_in fromaddr;
-    int      addrlen = sizeof(fromaddr), ret;
+    int      ret;
     uint32_t tickheartbeat = 0, tickstart = 0, tickgetframe = 0;
     uint64_t recvncur = 0, recvntotal = 0;
     uint8_t  buffer[1500];
@@ -95,6 +99,7 @@ static void* avkcpc_thread_proc(void *argv)
 #else
                 fcntl(avkcpc->client_fd, F_SETFL, fcntl(avkcpc->client_fd, F_GETFL, 0) | O_NONBLOCK);  // setup non-block io mode
 #endif
+                udpbatch_open(&avkcpc->udp, avkcpc->client_fd);
             } else {
                 printf("failed to open socket !\n");
                 usleep(100*1000); continue;
@@ -122,7 +127,7 @@ static void* avkcpc_thread_proc(void *argv)
         }
 
         while (1) {
-            if ((ret = recvfrom(avkcpc->client_fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&fromaddr, &addrlen)) <= 0) break;
+            if ((ret = udpbatch_recv(&avkcpc->udp, (char*)buffer, sizeof(buffer), &fromaddr)) <= 0) break;
             ikcp_input(avkcpc->ikcp, (char*)buffer, ret);
         }
 
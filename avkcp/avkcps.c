@@ -1,11 +1,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 #include "adev.h"
 #include "vdev.h"
 #include "codec.h"
 #include "ikcp.h"
+#include "udpbatch.h"
 #include "avkcps.h"
 
 #define AVKCP_CONV (('A' << 0) | ('V' << 8) | ('K' << 16) | ('C' << 24))
@@ -50,14 +52,24 @@ typedef struct {
     struct    sockaddr_in client_addr;
     int       client_connected;
     SOCKET    server_fd;
-    char      avinfostr[256];
+    char      avinfostr[1024]; // vps/sps/pps hex strings and tiles layout
     uint8_t   buff[2 * 1024 * 1024];
+
+    #define CURSOR_UPDATE_PERIOD  10 // ms
+    #define CURSOR_SENT_CACHE     16
+    uint32_t  cursor_sent_ids[CURSOR_SENT_CACHE]; // shapes already sent to client, client keeps them by id
+    int       cursor_sent_idx;
+    uint32_t  cursor_last_id;
+    int32_t   cursor_last_x, cursor_last_y;
+    uint32_t  tick_cursor_check;
+    uint8_t   cursor[2 * sizeof(uint32_t) + VDEV_CURSOR_BUF_SIZE];
+    UDPBATCH  udp; // kcp output is batched per update
 } AVKCPS;
 
 static int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
     AVKCPS *avkcps = (AVKCPS*)user;
-    return sendto(avkcps->server_fd, buf, len, 0, (struct sockaddr*)&avkcps->client_addr, sizeof(avkcps->client_addr));
+    return udpbatch_send(&avkcps->udp, buf, len, &avkcps->client_addr);
 }
 
 static void avkcps_ikcp_update(AVKCPS *avkcps)
@@ -66,6 +78,7 @@ static void avkcps_ikcp_update(AVKCPS *avkcps)
     if ((int32_t)tickcur - (int32_t)avkcps->tick_kcp_update >= 0) {
         ikcp_update(avkcps->ikcp, tickcur);
         avkcps->tick_kcp_update = ikcp_check(avkcps->ikcp, get_tick_count());
+        udpbatch_flush(&avkcps->udp);
     }
 }
 
@@ -81,6 +94,38 @@ static void ikcp_send_packet(AVKCPS *avkcps, char type, uint8_t *buf, int len, u
     } while (remaining > 0);
 }
 
+// 'C' packet carries a cursor shape (see vdev_cursor_shape), 'P' packet: int16_t x, y, screen w, h, uint32_t shape id
+static void avkcps_send_cursor(AVKCPS *avkcps)
+{
+    int      x = 0, y = 0, w = 0, h = 0, len, i;
+    uint32_t id;
+    if ((int32_t)get_tick_count() - (int32_t)avkcps->tick_cursor_check < CURSOR_UPDATE_PERIOD) return;
+    avkcps->tick_cursor_check = get_tick_count();
+
+    id = vdev_cursor_pos(avkcps->vdev, &x, &y, &w, &h);
+    if (id == avkcps->cursor_last_id && x == avkcps->cursor_last_x && y == avkcps->cursor_last_y) return;
+
+    if (id) {
+        for (i=0; i<CURSOR_SENT_CACHE && avkcps->cursor_sent_ids[i] != id; i++);
+        if (i == CURSOR_SENT_CACHE) {
+            len = vdev_cursor_shape(avkcps->vdev, id, avkcps->cursor + 2 * sizeof(uint32_t), VDEV_CURSOR_BUF_SIZE);
+            if (len <= 0) return;
+            ikcp_send_packet(avkcps, 'C', avkcps->cursor, len, get_tick_count());
+            avkcps->cursor_sent_ids[avkcps->cursor_sent_idx++ % CURSOR_SENT_CACHE] = id;
+        }
+    }
+
+    ((int16_t *)(avkcps->cursor + 2 * sizeof(uint32_t)))[0] = x;
+    ((int16_t *)(avkcps->cursor + 2 * sizeof(uint32_t)))[1] = y;
+    ((int16_t *)(avkcps->cursor + 2 * sizeof(uint32_t)))[2] = w;
+    ((int16_t *)(avkcps->cursor + 2 * sizeof(uint32_t)))[3] = h;
+    ((uint32_t*)(avkcps->cursor + 2 * sizeof(uint32_t)))[2] = id;
+    ikcp_send_packet(avkcps, 'P', avkcps->cursor, 12, get_tick_count());
+    avkcps->cursor_last_id = id;
+    avkcps->cursor_last_x  = x;
+    avkcps->cursor_last_y  = y;
+}
+
 static int avkcps_do_connect(AVKCPS *avkcps)
 {
     avkcps->ikcp = ikcp_create(AVKCP_CONV, avkcps);
@@ -121,7 +166,7 @@ static void* avkcps_thread_proc(void *argv)
 {
     AVKCPS  *avkcps = (AVKCPS*)argv;
     struct   sockaddr_in fromaddr;
-    int      addrlen = sizeof(fromaddr), ret;
+    int      ret;
     uint32_t tickheartbeat = 0;
     uint8_t  buffer[1500];
     unsigned long opt;
@@ -151,6 +196,7 @@ static void* avkcps_thread_proc(void *argv)
 #else
     fcntl(avkcps->server_fd, F_SETFL, fcntl(avkcps->server_fd, F_GETFL, 0) | O_NONBLOCK);  // setup non-block io mode
 #endif
+    udpbatch_open(&avkcps->udp, avkcps->server_fd);
 
     while (!(avkcps->status & TS_EXIT)) {
         if (!(avkcps->status & TS_START)) { usleep(100*1000); continue; }
@@ -162,6 +208,7 @@ static void* avkcps_thread_proc(void *argv)
         if (avkcps->client_connected) {
             if (ikcp_waitsnd(avkcps->ikcp) < 2000) {
                 int readsize, framesize; uint32_t pts;
+                avkcps_send_cursor(avkcps); // before the frames, so pointer does not wait for them
                 readsize = codec_read(avkcps->aenc, avkcps->buff + 2 * sizeof(int32_t), sizeof(avkcps->buff) - 2 * sizeof(int32_t), &framesize, NULL, &pts, 0);
                 if (readsize > 0 && readsize == framesize && readsize <= 0xFFFFFF) {
                     ikcp_send_packet(avkcps, 'A', avkcps->buff, framesize, pts);
@@ -177,7 +224,7 @@ static void* avkcps_thread_proc(void *argv)
         }
 
         while (1) {
-            if ((ret = recvfrom(avkcps->server_fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&fromaddr, &addrlen)) <= 0) break;
+            if ((ret = udpbatch_recv(&avkcps->udp, (char*)buffer, sizeof(buffer), &fromaddr)) <= 0) break;
             if (avkcps->client_connected == 0) {
                 char vpsstr[256] = "", spsstr[256] = "", ppsstr[256] = "";
                 memcpy(&avkcps->client_addr, &fromaddr, sizeof(avkcps->client_addr));
@@ -191,9 +238,12 @@ static void* avkcps_thread_proc(void *argv)
                 buf2hexstr(spsstr, sizeof(spsstr), avkcps->venc->spsinfo + 1, avkcps->venc->spsinfo[0]);
                 buf2hexstr(ppsstr, sizeof(ppsstr), avkcps->venc->ppsinfo + 1, avkcps->venc->ppsinfo[0]);
                 snprintf(avkcps->avinfostr + 2 * sizeof(uint32_t), sizeof(avkcps->avinfostr) - 2 * sizeof(uint32_t),
-                    "aenc=%s,channels=%d,samprate=%d;venc=%s,width=%d,height=%d,frate=%d,vps=%s,sps=%s,pps=%s;",
-                    avkcps->aenc->name, avkcps->channels, avkcps->samprate, avkcps->venc->name, avkcps->width, avkcps->height, avkcps->frate, vpsstr, spsstr, ppsstr);
+                    "aenc=%s,channels=%d,samprate=%d;venc=%s,width=%d,height=%d,frate=%d,vps=%s,sps=%s,pps=%s%s%s;",
+                    avkcps->aenc->name, avkcps->channels, avkcps->samprate, avkcps->venc->name, avkcps->width, avkcps->height, avkcps->frate, vpsstr, spsstr, ppsstr,
+                    avkcps->venc->tiles[0] ? ",tiles=" : "", avkcps->venc->tiles);
                 ikcp_send_packet(avkcps, 'I', avkcps->avinfostr, (int)strlen(avkcps->avinfostr + 2 * sizeof(uint32_t)) + 1, 0);
+                memset(avkcps->cursor_sent_ids, 0, sizeof(avkcps->cursor_sent_ids));
+                avkcps->cursor_last_id = 0; avkcps->cursor_last_x = avkcps->cursor_last_y = -1;
                 tickheartbeat = get_tick_count();
                 avkcps->client_connected = 1;
                 printf("===ck=== client connected !\n");
@@ -248,6 +298,7 @@ void* avkcps_init(int port, int channels, int samprate, int width, int height, i
     avkcps->width    = width;
     avkcps->height   = height;
     avkcps->frate    = frate;
+    vdev_draw_cursor(vdev, 0);
 
     // create server thread
     pthread_create(&avkcps->pthread, NULL, avkcps_thread_proc, avkcps);
@@ -0,0 +1,127 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sendmmsg, recvmmsg
+#endif
+#include <stdint.h>
+#include <string.h>
+#include "udpbatch.h"
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#endif
+
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT      103
+#endif
+#define UDPBATCH_GSO_MAX_SIZE  65000
+#endif
+
+void udpbatch_open(UDPBATCH *ub, SOCKET fd)
+{
+#ifdef __linux__
+    socklen_t optlen;
+    int       gso;
+    ub->txb_num = ub->rxb_num = ub->rxb_idx = 0;
+    optlen  = sizeof(gso);
+    ub->gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, (char*)&gso, &optlen) == 0; // kernel supports udp gso
+#endif
+    ub->fd  = fd;
+}
+
+int udpbatch_send(UDPBATCH *ub, const char *buf, int len, struct sockaddr_in *dstaddr)
+{
+#ifdef __linux__
+    int off;
+    if (len > UDPBATCH_PACKET) return -1;
+    if (ub->txb_num == UDPBATCH_SIZE || (ub->txb_num && memcmp(&ub->txb_addr, dstaddr, sizeof(ub->txb_addr)) != 0)) udpbatch_flush(ub);
+    off = ub->txb_num ? ub->txb_off[ub->txb_num - 1] + ub->txb_len[ub->txb_num - 1] : 0;
+    memcpy(ub->txb_data + off, buf, len);
+    ub->txb_addr = *dstaddr;
+    ub->txb_off[ub->txb_num] = off;
+    ub->txb_len[ub->txb_num] = len;
+    ub->txb_num++;
+    return len;
+#else
+    return sendto(ub->fd, buf, len, 0, (struct sockaddr*)dstaddr, sizeof(*dstaddr));
+#endif
+}
+
+// datagrams of the same size (only the last one may be shorter) go in one UDP_SEGMENT message. when sendmmsg stops
+// early its error is lost, so the rest is sent again to learn it, a gso message the nic or route refuses turns gso off
+void udpbatch_flush(UDPBATCH *ub)
+{
+#ifdef __linux__
+    struct mmsghdr  msgs[UDPBATCH_SIZE];
+    struct iovec    iovs[UDPBATCH_SIZE];
+    struct cmsghdr *cmsg;
+    char ctrl[UDPBATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+    int  first[UDPBATCH_SIZE], start = 0, nmsg, size, total, ret, i, j;
+    while (start < ub->txb_num) {
+        memset(msgs, 0, sizeof(msgs));
+        for (nmsg=0,i=start; i<ub->txb_num; i=j,nmsg++) {
+            size = total = ub->txb_len[i];
+            for (j=i+1; ub->gso && j<ub->txb_num && ub->txb_len[j]<=size && total+ub->txb_len[j]<=UDPBATCH_GSO_MAX_SIZE; ) {
+                total += ub->txb_len[j];
+                if (ub->txb_len[j++] < size) break;
+            }
+            first[nmsg] = i;
+            iovs[nmsg].iov_base = ub->txb_data + ub->txb_off[i];
+            iovs[nmsg].iov_len  = total;
+            msgs[nmsg].msg_hdr.msg_name    = &ub->txb_addr;
+            msgs[nmsg].msg_hdr.msg_namelen = sizeof(ub->txb_addr);
+            msgs[nmsg].msg_hdr.msg_iov     = &iovs[nmsg];
+            msgs[nmsg].msg_hdr.msg_iovlen  = 1;
+            if (j - i > 1) {
+                msgs[nmsg].msg_hdr.msg_control    = ctrl[nmsg];
+                msgs[nmsg].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsg = CMSG_FIRSTHDR(&msgs[nmsg].msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type  = UDP_SEGMENT;
+                cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t*)CMSG_DATA(cmsg) = size;
+            }
+        }
+        ret = sendmmsg(ub->fd, msgs, nmsg, 0);
+        if (ret >= nmsg) break;
+        if (ret > 0) { start = first[ret]; continue; }
+        if (!msgs[0].msg_hdr.msg_controllen || (errno != EIO && errno != EINVAL)) break; // socket buffer full or other error
+        ub->gso = 0; // no gso support of nic or route, send them again one by one
+    }
+    ub->txb_num = 0;
+#endif
+}
+
+int udpbatch_recv(UDPBATCH *ub, char *buf, int len, struct sockaddr_in *from)
+{
+#ifdef __linux__
+    struct mmsghdr msgs[UDPBATCH_SIZE];
+    struct iovec   iovs[UDPBATCH_SIZE];
+    int            n, i;
+    if (ub->rxb_idx == ub->rxb_num) {
+        memset(msgs, 0, sizeof(msgs));
+        for (i=0; i<UDPBATCH_SIZE; i++) {
+            iovs[i].iov_base = ub->rxb_data[i];
+            iovs[i].iov_len  = UDPBATCH_PACKET;
+            msgs[i].msg_hdr.msg_name    = &ub->rxb_addr[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(ub->rxb_addr[i]);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+        ub->rxb_idx = ub->rxb_num = 0;
+        if ((n = recvmmsg(ub->fd, msgs, UDPBATCH_SIZE, MSG_DONTWAIT, NULL)) <= 0) return -1;
+        for (i=0; i<n; i++) ub->rxb_len[i] = msgs[i].msg_len;
+        ub->rxb_num = n;
+    }
+    i   = ub->rxb_idx++;
+    len = len < ub->rxb_len[i] ? len : ub->rxb_len[i];
+    memcpy(buf, ub->rxb_data[i], len);
+    *from = ub->rxb_addr[i];
+    return len;
+#else
+    int addrlen = sizeof(*from);
+    return recvfrom(ub->fd, buf, len, 0, (struct sockaddr*)from, &addrlen);
+#endif
+}
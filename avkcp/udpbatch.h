@@ -0,0 +1,39 @@
+#ifndef __UDPBATCH_H__
+#define __UDPBATCH_H__
+
+#include <stdint.h>
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#define SOCKET int
+#endif
+
+// udp output of kcp: on linux the datagrams queued by udpbatch_send go out in one sendmmsg at udpbatch_flush, runs of
+// datagrams of the same size as one UDP_SEGMENT (gso) message if the kernel supports it, and udpbatch_recv reads up to
+// UDPBATCH_SIZE datagrams with one recvmmsg. other systems send and receive them one by one
+#define UDPBATCH_SIZE    32
+#define UDPBATCH_PACKET  1500
+typedef struct {
+    SOCKET    fd;
+    int       gso; // kernel supports UDP_SEGMENT, cleared if nic or route can't do it
+#ifdef __linux__
+    struct    sockaddr_in txb_addr; // destination of all datagrams queued
+    uint8_t   txb_data[UDPBATCH_SIZE * UDPBATCH_PACKET];
+    uint16_t  txb_off [UDPBATCH_SIZE];
+    uint16_t  txb_len [UDPBATCH_SIZE];
+    int       txb_num;
+    uint8_t   rxb_data[UDPBATCH_SIZE][UDPBATCH_PACKET];
+    uint16_t  rxb_len [UDPBATCH_SIZE];
+    struct    sockaddr_in rxb_addr[UDPBATCH_SIZE];
+    int       rxb_num;
+    int       rxb_idx;
+#endif
+} UDPBATCH;
+
+void udpbatch_open (UDPBATCH *ub, SOCKET fd); // for a new socket, drops what is queued or received and probes gso
+int  udpbatch_send (UDPBATCH *ub, const char *buf, int len, struct sockaddr_in *dstaddr); // returns len, -1 on error
+void udpbatch_flush(UDPBATCH *ub); // datagrams not taken by the socket are lost, kcp resends them
+int  udpbatch_recv (UDPBATCH *ub, char *buf, int len, struct sockaddr_in *from); // returns len, <= 0 if nothing received
+
+#endif
@@ -1,19 +1,36 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sendmmsg, recvmmsg
+#endif
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
 #include "ffrdp.h"
+#include "rsfec.h"
 
 #ifdef CONFIG_ENABLE_AES256
-#include <openssl/aes.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #endif
 
 #ifdef WIN32
 #include <winsock2.h>
 #define usleep(t) Sleep((t) / 1000)
 #define get_tick_count GetTickCount
+#define atomic_add(p, v) (InterlockedExchangeAdd((p), (v)) + (v))
 #pragma warning(disable:4996) // disable warnings
+#ifndef IP_DONTFRAGMENT
+#define IP_DONTFRAGMENT 14 // ws2ipdef.h
+#endif
+static uint32_t get_tick_us()
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER        now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint32_t)(now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
 #else
 #include <time.h>
 #include <unistd.h>
@@ -22,8 +39,15 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 #define SOCKET int
 #define closesocket close
+#define atomic_add(p, v) __sync_add_and_fetch((p), (v))
 #define stricmp strcasecmp
 #define strtok_s strtok_r
 static uint32_t get_tick_count()
@@ -32,25 +56,98 @@ static uint32_t get_tick_count()
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
+static uint32_t get_tick_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
 #endif
 
+#ifdef CONFIG_FFRDP_JUMBO // every frame buffer takes the max size, so only for lans with jumbo frames
+#define FFRDP_MAX_MSS       (9000 - 28 - 8)
+#else
 #define FFRDP_MAX_MSS       (1500 - 8) // should align to 4 bytes and <= 1500 - 8
+#endif
 #define FFRDP_MIN_RTO        50
 #define FFRDP_MAX_RTO        2000
 #define FFRDP_MAX_WAITSND    2048
 #define FFRDP_QUERY_CYCLE    500
-#define FFRDP_FLUSH_TIMEOUT  500
-#define FFRDP_DEAD_TIMEOUT   5000
+#define FFRDP_FLUSH_TIMEOUT  500  // ms, default FFRDP_OPT_COALESCE
+#define FFRDP_DEAD_TIMEOUT   5000 // ms without any frame from remote, or peer not taken by ffrdp_accept
+#define FFRDP_KEEPALIVE      1000 // ms without any frame from remote, then idle side sends queries, which get an ack
 #define FFRDP_MIN_CWND_SIZE  1
 #define FFRDP_DEF_CWND_SIZE  32
 #define FFRDP_MAX_CWND_SIZE  64
 #define FFRDP_RECVBUF_SIZE  (128 * (FFRDP_MAX_MSS + 0))
-#define FFRDP_UDPSBUF_SIZE  (64  * (FFRDP_MAX_MSS + 6))
-#define FFRDP_UDPRBUF_SIZE  (128 * (FFRDP_MAX_MSS + 6))
+#define FFRDP_UDPSBUF_SIZE  (64  * (FFRDP_MAX_MSS + 8))
+#define FFRDP_UDPRBUF_SIZE  (128 * (FFRDP_MAX_MSS + 8))
 #define FFRDP_SELECT_SLEEP   1
-#define FFRDP_SELECT_TIMEOUT 10000
+#define FFRDP_SELECT_TIMEOUT 10   // ms, default max wait of ffrdp_update for data
 #define FFRDP_USLEEP_TIMEOUT 1000
+#define FFRDP_MAX_PEERS      256  // per listener, every shard of ffrdp_listen_shard has its own
+#define FFRDP_PEER_HASH      64   // power of 2, buckets of peers of a listener by source address
+#define FFRDP_SEND_RING      FFRDP_MAX_WAITSND // power of 2, holds every frame waiting for ack
+#define FFRDP_RECV_RING      2048 // power of 2, frames further ahead of recv_seq are dropped and resent later
+#define FFRDP_BATCH_SIZE     32   // datagrams per sendmmsg/recvmmsg
+#define FFRDP_MIN_REF        256  // bytes of ffrdp_sendv buffer referred by a frame instead of being copied
+#define FFRDP_MAX_TIMEOUT    100  // ms, max ffrdp_next_timeout, so callers still check ffrdp_isdead when idle
+#define FFRDP_RTT_MIN_WIN    10000 // ms of min rtt filter
+#define FFRDP_MAX_GAPS       16    // dropped messages not read by receiver yet
+#define FFRDP_MSG_MAX_FRAMES FFRDP_RECV_RING // frames a stream in message mode holds, taken by ffrdp_msg_recv or not
+#define FFRDP_BBR_MAX_CWND  (FFRDP_RECVBUF_SIZE / FFRDP_MAX_MSS)
+#define FFRDP_BBR_BW_WIN     10    // rounds of bottleneck bandwidth max filter
+
+// extended mode, for paths with a large bandwidth-delay product. a side that supports it appends FFRDP_CAP_EXT to its
+// acks and queries, old peers ignore the extra byte. a sender seeing it in an ack answers with a query carrying it, from
+// then on the receiver sends FFRDP_FRAME_TYPE_ACKX: 16 bits window and up to FFRDP_SACK_BLOCKS ranges of frames received
+// after una, so sender can have FFRDP_EXT_MAX_CWND frames in flight and resend any of them. receive buffer and socket
+// buffers grow to the larger window once it is negotiated
+#define FFRDP_CAP_EXT        (1 << 0)
+#define FFRDP_SACK_BLOCKS    16
+#define FFRDP_EXT_MAX_CWND  (FFRDP_RECV_RING / 2)
+#define FFRDP_EXT_RECVBUF_SIZE (FFRDP_EXT_MAX_CWND * FFRDP_MAX_MSS)
+#define FFRDP_EXT_UDPBUF_SIZE  (FFRDP_EXT_MAX_CWND * (FFRDP_MAX_MSS + 8)) // linux caps it at net.core.[rw]mem_max
+
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT          103
+#endif
+#define FFRDP_GSO_MAX_SIZE   65000
+#define FFRDP_GSO_MAX_SEGS   64
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT         15
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#endif
+
+// fec frames carry a 4 bytes trailer: u16 group, u8 index in group, u8 (k - 1) | (m << 5). index [0, k) are the
+// data frames, [k, k + m) are reed-solomon parity frames over bytes [1, 4 + mss) of the data frames (type byte excluded).
+// groups are made of transmissions, so a resent frame joins the current group, a group is closed early when send queue
+// is empty so that the tail of a video frame does not wait for the next one
+#define FFRDP_FEC_TRAILER    4
+#define FFRDP_AEAD_OVERHEAD  24 // nonce counter and gcm tag after an encrypted frame
+#define FFRDP_REPLAY_WIN     1024 // nonces, older ones and the ones already received are dropped
+#define FFRDP_FEC_MAX_M      7    // m is 3 bits in trailer, 0 still sends the trailer so that receiver can measure loss
 
+// receiver reports loss of closed fec groups every FFRDP_LOSS_CYCLE, sender picks the smallest m that keeps the
+// group failure probability (binomial model over loss bursts) under fec_target, plus a bias learned from failed groups
+#define FFRDP_LOSS_CYCLE     500
+#define FFRDP_FEC_TARGET     1000 // ppm
+
+// path mtu discovery (datagram plpmtud of rfc 8899): data frames start at FFRDP_PMTU_BASE bytes datagrams, padded probe
+// frames sent with don't fragment look for the largest size the path takes, the receiver echoes the size it got and the
+// largest datagram it can take. each size gets FFRDP_PMTU_TRIES probes, smss follows the largest size acked. a peer that
+// answers no probe keeps smss of ffrdp_init. frames above base lost for FFRDP_PMTU_BLACKHOLE timeout passes in a row
+// mean a black hole, search starts again from base, a finished search retries the larger sizes every FFRDP_PMTU_RAISE ms
+#define FFRDP_PMTU_BASE      1200 // datagram bytes
+#define FFRDP_PMTU_TRIES     3
+#define FFRDP_PMTU_TIMEOUT   200  // ms, a probe is lost if not acked in srtt + this
+#define FFRDP_PMTU_STEP      16   // search ends when largest acked and smallest lost sizes are this close
+#define FFRDP_PMTU_RAISE     600000
+#define FFRDP_PMTU_BLACKHOLE 4
 #define MIN(a, b)               ((a) < (b) ? (a) : (b))
 #define MAX(a, b)               ((a) > (b) ? (a) : (b))
 #define GET_FRAME_SEQ(f)        (*(uint32_t*)(f)->data >> 8)
@@ -59,10 +156,14 @@ static uint32_t get_tick_count()
 enum {
     FFRDP_FRAME_TYPE_FULL,       // full  frame
     FFRDP_FRAME_TYPE_SHORT,      // short frame
-    FFRDP_FRAME_TYPE_FEC2,       // fec2  frame
-    FFRDP_FRAME_TYPE_FEC32 = 32, // fec32 frame
+    FFRDP_FRAME_TYPE_FEC,        // fec   frame, full frame or parity frame with fec trailer
+    FFRDP_FRAME_TYPE_GAP,        // gap   frame, takes the seq of a frame of a dropped message, payload is the seq of its last frame
     FFRDP_FRAME_TYPE_ACK   = 33, // ack   frame
     FFRDP_FRAME_TYPE_QUERY = 34, // query frame
+    FFRDP_FRAME_TYPE_LOSS  = 35, // loss  report
+    FFRDP_FRAME_TYPE_ACKX  = 36, // extended ack frame, ranged selective ack
+    FFRDP_FRAME_TYPE_PROBE = 37, // path mtu probe: u16 its size, padded with zeros
+    FFRDP_FRAME_TYPE_PROBEACK = 38, // probe ack: u16 size received, u16 max datagram size of receiver
 };
 
 typedef struct tagFFRDP_FRAME_NODE {
@@ -73,52 +174,211 @@ typedef struct tagFFRDP_FRAME_NODE {
     #define FLAG_FIRST_SEND     (1 << 0) // after frame first send, this flag will be set
     #define FLAG_TIMEOUT_RESEND (1 << 1) // data frame wait ack timeout and be resend
     #define FLAG_FAST_RESEND    (1 << 2) // data frame need fast resend when next update
+    #define FLAG_RESENT         (1 << 3) // its ack gives no rtt and delivery rate sample to congestion control
+    #define FLAG_DROPPABLE      (1 << 4) // frame of a message that is dropped if not acked by tick_deadline
+    #define FLAG_COVERED        (1 << 5) // frame of a dropped message after its gap frame, never sent
+    #define FLAG_SACKED         (1 << 6) // got selective ack, freed by next ffrdp_process_ack
+    #define FLAG_URGENT         (1 << 7) // frame of a FFRDP_PRIO_URGENT message, first sent ahead of older frames
     uint32_t flags;        // frame flags
     uint32_t tick_1sts;    // frame first time send tick
     uint32_t tick_send;    // frame send tick
     uint32_t tick_timeout; // frame ack timeout tick
+    uint32_t tick_last;    // frame last send tick, fast resend is done once per rtt
+    uint32_t delivered;      // bytes acked when frame was sent
+    uint32_t tick_delivered; // tick of last ack when frame was sent
+    uint32_t tick_deadline;
+    uint32_t msg_last;       // seq of the last frame of its message
+    uint32_t wire_size;      // bytes of it put on wire, a dropped frame may have been sent as data before its gap
+    uint32_t tx_order;       // tx_count of its last transmission, urgent frames go out of seq order
+    FFRDP_BUF *ref;          // buffer of ffrdp_sendv the frame ends with, ref_len bytes at ref_data, fec trailer stays in data
+    uint8_t   *ref_data;
+    uint32_t   ref_len;
 } FFRDP_FRAME_NODE;
 
+// frame nodes are taken from a freelist and never returned to the heap until ffrdp_free, all nodes have the max frame size,
+// the pool grows by one window of nodes when it is empty, so there is no malloc/free in steady state
+#define FFRDP_NODE_SIZE   ((sizeof(FFRDP_FRAME_NODE) + 4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER + 7) & ~7)
+#define FFRDP_POOL_GROW     FFRDP_MAX_CWND_SIZE
+typedef struct {
+    FFRDP_FRAME_NODE *free_list; // linked by next
+    void             *slab_list; // first pointer of each slab links the next slab
+    uint32_t          node_num;
+    uint32_t          free_num;
+} FFRDP_NODE_POOL;
+
+// congestion control, sets cwnd (frames) and pace_rate (bytes per second, 0 for no pacing) of context
+struct tagFFRDPCONTEXT;
 typedef struct {
-    uint8_t  recv_buff[FFRDP_RECVBUF_SIZE];
-    int32_t  recv_size, recv_head, recv_tail;
+    char *name;
+    void (*init    )(struct tagFFRDPCONTEXT *ffrdp);
+    void (*on_ack  )(struct tagFFRDPCONTEXT *ffrdp, int frames, int rtt, uint32_t rate); // rtt -1, rate 0 if no sample
+    void (*on_event)(struct tagFFRDPCONTEXT *ffrdp, int event);
+    uint32_t (*bwe )(struct tagFFRDPCONTEXT *ffrdp); // bandwidth estimate in bytes per second on the wire, 0 if unknown
+} FFRDP_CC;
+
+// in streams mode data frames start with a stream header: u8 stream, u8 flags, u16 frame counter of the stream.
+// a gap frame keeps the header of the frame it replaces, the seq of the last frame of its message follows it.
+// FFRDP_SFLAG_END is set on the last frame of a message of ffrdp_stream_send, older senders leave flags 0
+#define FFRDP_SFLAG_END (1 << 0)
+#define FFRDP_STREAM_HDR(ffrdp) ((ffrdp)->flags & FLAG_STREAMS ? 4 : 0)
+#define FFRDP_GAP_LAST(ffrdp, f) (*(uint32_t*)((f)->data + 4 + FFRDP_STREAM_HDR(ffrdp)))
+
+// datagram bytes of a frame besides its payload, and of a frame on the wire
+#define FFRDP_SEAL_SIZE(ffrdp)     ((ffrdp)->flags & FLAG_TX_AES256 ? FFRDP_AEAD_OVERHEAD : 0)
+#define FFRDP_OPEN_SIZE(ffrdp)     ((ffrdp)->flags & FLAG_RX_AES256 ? FFRDP_AEAD_OVERHEAD : 0)
+#define FFRDP_FRAME_OVERHEAD(ffrdp) (4 + ((ffrdp)->fec_k ? FFRDP_FEC_TRAILER : 0) + FFRDP_SEAL_SIZE(ffrdp))
+#define FRAME_WIRE_SIZE(ffrdp, f)  ((f)->size + FFRDP_SEAL_SIZE(ffrdp))
+
+typedef struct { // receive queue of a stream, stream 0 is the only one without streams mode
+    uint8_t *buff; // allocated on first data
+    int32_t  bsize; // FFRDP_RECVBUF_SIZE, grows up to FFRDP_EXT_RECVBUF_SIZE in extended mode
+    int32_t  size, head, tail;
+    uint32_t rpos, wpos; // bytes read from and written to buff since start
+    uint32_t gaps[FFRDP_MAX_GAPS]; // wpos of the dropped messages not read yet
+    int32_t  gap_head, gap_num;
+    uint16_t next; // counter of the next frame to deliver, streams mode only
+    FFRDP_FRAME_NODE *msg_head, *msg_tail, *msg_last; // message mode: frames not taken yet, msg_last ends the last complete message
+    int32_t  msg_frames; // message mode: frames held by stream and by messages not freed yet
+} FFRDP_STREAM;
+
+typedef struct tagFFRDPCONTEXT {
+    FFRDP_STREAM rx[FFRDP_MAX_STREAMS];
+    uint16_t tx_sseq   [FFRDP_MAX_STREAMS]; // frame counter of next new frame of each stream
+    uint32_t tx_dropped[FFRDP_MAX_STREAMS]; // messages dropped by deadline
+    uint32_t recv_skip_end; // frames up to this seq belong to a dropped message
+    uint32_t recv_max;      // seq after the highest one received, streams mode delivers frames up to it
+    uint32_t msg_streams;   // bit mask of streams in message mode
+    FFRDP_FRAME_NODE *msg_freed; // frames of ffrdp_msg_free, back to pool in next update
     #define FLAG_SERVER    (1 << 0)
     #define FLAG_CONNECTED (1 << 1)
     #define FLAG_FLUSH     (1 << 2)
     #define FLAG_TX_AES256 (1 << 3)
     #define FLAG_RX_AES256 (1 << 4)
+    #define FLAG_LISTEN    (1 << 5) // listener, its socket is shared by all peers
+    #define FLAG_PEER      (1 << 6) // peer of a listener, server_addr is the remote address
+    #define FLAG_ACCEPT    (1 << 7) // peer is waiting for ffrdp_accept
+    #define FLAG_GOT_DATA  (1 << 8)
+    #define FLAG_GOT_QUERY (1 << 9)
+    #define FLAG_PACED     (1 << 10) // pacer has frames waiting for tokens
+    #define FLAG_NO_PACING (1 << 11)
+    #define FLAG_RECV_SKIP (1 << 12) // dropping frames up to recv_skip_end
+    #define FLAG_EXT_OFF   (1 << 13) // extended mode disabled by FFRDP_OPT_EXTENDED
+    #define FLAG_EXT_TX    (1 << 14) // remote receiver sends extended acks
+    #define FLAG_EXT_RX    (1 << 15) // remote sender takes extended acks
+    #define FLAG_EXT_ASK   (1 << 16) // remote receiver supports extended acks, tell it we do too
+    #define FLAG_STREAMS   (1 << 17)
+    #define FLAG_PMTU_ACK  (1 << 18) // remote answers path mtu probes
     uint32_t flags;
     SOCKET   udp_fd;
     struct   sockaddr_in server_addr;
     pthread_mutex_t lock;
 
-    FFRDP_FRAME_NODE *send_list_head;
-    FFRDP_FRAME_NODE *send_list_tail;
-    FFRDP_FRAME_NODE *recv_list_head;
-    FFRDP_FRAME_NODE *recv_list_tail;
+    struct tagFFRDPCONTEXT *listener;  // listener of a peer
+    struct tagFFRDPCONTEXT *peer_next; // peer list of a listener
+    struct tagFFRDPCONTEXT *peer_hash[FFRDP_PEER_HASH]; // peers of a listener by ffrdp_addr_hash
+    struct tagFFRDPCONTEXT *peer_hnext;
+    int      peer_num;
+    int      shard, nshards; // of ffrdp_listen_shard
+    int      steering; // 1: datagrams go to shard by the bpf program, 0: by the hash of kernel
+    int32_t  ack_una;  // acks received since last update
+    uint32_t ack_maxack; // highest seq got selective ack, send_una - 1 for none
+    uint32_t ack_maxorder; // highest tx_order acked, frames sent before it and not acked are lost
+    uint32_t tx_count;     // data frame transmissions
+
+    FFRDP_FRAME_NODE *send_ring[FFRDP_SEND_RING]; // indexed by seq, NULL after acked
+    FFRDP_FRAME_NODE *recv_ring[FFRDP_RECV_RING]; // indexed by seq, NULL if not received
+    uint32_t          recv_bits[FFRDP_RECV_RING / 32]; // bitmap of recv_ring, for selective ack
     FFRDP_FRAME_NODE *cur_new_node;
-    uint32_t          cur_new_size;
-    uint32_t          cur_new_tick;
+    FFRDP_NODE_POOL   tx_pool; // nodes of send list, only used with lock held
+    FFRDP_NODE_POOL   rx_pool; // nodes of recv list, only used by update thread, peers use the pool of listener
+    uint32_t          cur_new_size; // stream header included
+    uint32_t          cur_new_us; // get_tick_us when the partial frame got its first byte
+    uint32_t          coalesce_us; // max wait of the partial frame for more data, 0 to close it at the end of ffrdp_send
+    uint32_t          urgent_end;  // seq after the last urgent frame queued
+    uint32_t          urgent_scan; // urgent frames before it are all sent, only used by update thread
     uint32_t send_seq; // send seq
-    uint32_t recv_seq; // send seq
+    uint32_t send_una; // oldest frame not acked, send_ring holds [send_una, send_seq)
+    uint32_t recv_seq; // recv seq
     uint32_t wait_snd; // data frame number wait to send
     uint32_t rttm, rtts, rttd, rto;
+    uint32_t rtt_min, rtt_min_tick; // min rtt of last FFRDP_RTT_MIN_WIN ms, the propagation delay
     uint32_t rmss, smss, swnd, cwnd, ssthresh;
+    #define PMTU_OFF    0 // smss fixed at the max
+    #define PMTU_BASE   1 // confirming FFRDP_PMTU_BASE
+    #define PMTU_SEARCH 2
+    #define PMTU_DONE   3 // waiting for raise timer
+    int      pmtu_state, pmtu_tries;
+    uint32_t pmtu_max;  // datagram bytes of smss of ffrdp_init, lowered to the max of remote receiver
+    uint32_t pmtu_low;  // largest datagram acked, smss is taken from it
+    uint32_t pmtu_high; // smallest datagram lost
+    uint32_t pmtu_probe;// size of probe in flight, 0 for none
+    uint32_t pmtu_lost; // timeout passes losing frames above base since one of them got ack
+    uint32_t tick_pmtu; // probe timeout, or raise timer
+    uint32_t inflight;    // frames sent and not acked
+    uint32_t delivered;   // bytes acked
+    uint32_t tick_delivered;
+    int      app_limited; // last update sent everything queued
+
+    FFRDP_CC *cc;
+    uint32_t pace_rate;   // bytes per second
+    int32_t  pace_tokens; // bytes
+    uint32_t pace_tick;
+
+    uint32_t bbr_bw[FFRDP_BBR_BW_WIN]; // delivery rate of last rounds
+    uint32_t bbr_bwidx, bbr_btlbw;
+    uint32_t bbr_round_tick, bbr_round_bw;
+    int      bbr_round_applimited;
+    uint32_t bbr_full_bw;
+    int      bbr_full_cnt;
+    #define BBR_STARTUP  0
+    #define BBR_DRAIN    1
+    #define BBR_PROBE_BW 2
+    int      bbr_state, bbr_cycle;
+    uint32_t bbr_cycle_tick;
     uint32_t tick_recv_ack;
+    uint32_t tick_recv;   // last frame from remote, its creation for a new context
+    uint32_t tick_create;
     uint32_t tick_send_query;
+    uint32_t tick_ext_query;
     uint32_t tick_ffrdp_dump;
+    uint32_t update_wait; // ms, max wait of ffrdp_update for data, 0 if caller polls ffrdp_get_fd itself
 
-    uint8_t  fec_txbuf[4 + FFRDP_MAX_MSS + 2];
-    uint8_t  fec_rxbuf[4 + FFRDP_MAX_MSS + 2];
-    uint8_t  fec_txredundancy, fec_rxredundancy;
-    uint16_t fec_txseq;
-    uint16_t fec_rxseq;
-    uint16_t fec_rxcnt;
-    uint32_t fec_rxmask;
+    uint8_t  fec_txbuf[RSFEC_MAX_M][4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER]; // parity frames being encoded
+    uint8_t  fec_rxbuf[RSFEC_MAX_K + RSFEC_MAX_M][4 + FFRDP_MAX_MSS]; // frames of current rx group, parity at RSFEC_MAX_K
+    uint8_t  fec_k, fec_m;      // tx data and parity frames per group, fec_k 0 for no fec
+    uint8_t  fec_mnext;         // m of next group, chosen by fec_auto
+    uint8_t  fec_rxk, fec_rxm;  // rx group layout, known after its first parity frame
+    uint16_t fec_txgroup, fec_txidx, fec_txsize; // frames of a group have one size, smss may change between groups
+    uint16_t fec_rxgroup, fec_rxsize;
+    uint64_t fec_rxmask;        // bit i for data frame i, bit RSFEC_MAX_K + j for parity frame j
+    uint64_t fec_rxseen;        // bit i for frame of index i in group, for loss measurement
+    int      fec_rxdone;
+    int      fec_auto;          // adapt m by loss reports
+    uint32_t fec_target;        // max group failure probability in ppm
+    uint32_t fec_lossppm;       // smoothed loss rate reported by receiver
+    uint32_t fec_burst;         // smoothed loss burst length x 100
+    int      fec_bias;          // extra parity frames added after failed groups
+
+    uint16_t loss_groups, loss_total, loss_lost, loss_bursts, loss_failed; // rx loss since last report
+    uint32_t tick_loss_report;
 
 #ifdef CONFIG_ENABLE_AES256
-    AES_KEY  aes_encrypt_key;
-    AES_KEY  aes_decrypt_key;
+    EVP_CIPHER_CTX *aead_tx; // peers use the ones of listener
+    EVP_CIPHER_CTX *aead_rx;
+    uint64_t        aead_nonce; // next tx nonce counter, starts at random
+    uint64_t        replay_max; // highest rx nonce, of this peer as every sender has its own counter
+    uint64_t        replay_win[FFRDP_REPLAY_WIN / 64]; // bit of nonce n at n % FFRDP_REPLAY_WIN
+    int             replay_set;
+#endif
+
+#ifdef __linux__ // data frames of one update are copied here and sent with one sendmmsg
+    uint8_t  txb_data[FFRDP_BATCH_SIZE * (4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER + FFRDP_AEAD_OVERHEAD)]; // sealed frames and parity frames
+    struct iovec txb_iov[FFRDP_BATCH_SIZE * 3]; // plain data frames are sent from their nodes and buffers of ffrdp_sendv
+    uint32_t txb_iovi[FFRDP_BATCH_SIZE]; // first iov of datagram
+    uint32_t txb_len [FFRDP_BATCH_SIZE];
+    FFRDP_FRAME_NODE *txb_node[FFRDP_BATCH_SIZE]; // frame sent for the first time, NULL for resend or fec frame
+    int      txb_num, txb_niov, txb_used;
+    int      txb_gso; // kernel supports UDP_SEGMENT
 #endif
 
     #define DEADLINK_SENDERR_THRESHOLD 300
@@ -127,6 +387,7 @@ typedef struct {
     uint32_t counter_recv_bytes;
     uint32_t counter_send_1sttime;
     uint32_t counter_send_failed;
+    uint32_t counter_msg_dropped;
     uint32_t counter_send_query;
     uint32_t counter_resend_fast;
     uint32_t counter_resend_rto;
@@ -137,6 +398,8 @@ typedef struct {
     uint32_t counter_fec_rx;
     uint32_t counter_fec_ok;
     uint32_t counter_fec_failed;
+    uint32_t counter_rxforged; // frames failed authentication
+    uint32_t counter_rxreplay; // authentic frames with a nonce seen before or too old
     uint32_t reserved;
 } FFRDPCONTEXT;
 
@@ -170,329 +433,494 @@ static int seq_distance(uint32_t seq1, uint32_t seq2) // calculate seq distance
     else return c;
 }
 
-static FFRDP_FRAME_NODE* frame_node_new(int type, int size) // create a new frame node
+static void node_pool_free(FFRDP_NODE_POOL *pool)
+{
+    void *slab;
+    while ((slab = pool->slab_list)) {
+        pool->slab_list = *(void**)slab;
+        free(slab);
+    }
+    memset(pool, 0, sizeof(FFRDP_NODE_POOL));
+}
+
+static FFRDP_FRAME_NODE* frame_node_new(FFRDP_NODE_POOL *pool, int type, int size) // create a new frame node
 {
-    FFRDP_FRAME_NODE *node = malloc(sizeof(FFRDP_FRAME_NODE) + 4 + size + (type <= FFRDP_FRAME_TYPE_SHORT ? 0 : 2));
-    if (!node) return NULL;
+    FFRDP_FRAME_NODE *node;
+    uint8_t          *slab;
+    int               i;
+    if (!pool->free_list) {
+        if (!(slab = malloc(8 + FFRDP_POOL_GROW * FFRDP_NODE_SIZE))) return NULL;
+        *(void**)slab = pool->slab_list; pool->slab_list = slab;
+        for (i=0; i<FFRDP_POOL_GROW; i++) {
+            node = (FFRDP_FRAME_NODE*)(slab + 8 + i * FFRDP_NODE_SIZE);
+            node->next = pool->free_list; pool->free_list = node;
+        }
+        pool->node_num += FFRDP_POOL_GROW; pool->free_num += FFRDP_POOL_GROW;
+    }
+    node = pool->free_list; pool->free_list = node->next; pool->free_num--;
     memset(node, 0, sizeof(FFRDP_FRAME_NODE));
-    node->size    = 4 + size + (type <= FFRDP_FRAME_TYPE_SHORT ? 0 : 2);
+    node->size    = 4 + size + (type <= FFRDP_FRAME_TYPE_SHORT ? 0 : FFRDP_FEC_TRAILER);
     node->data    = (uint8_t*)node + sizeof(FFRDP_FRAME_NODE);
     node->data[0] = type;
     return node;
 }
 
 #ifdef CONFIG_ENABLE_AES256
-static void frame_node_encrypt(FFRDP_FRAME_NODE *node, AES_KEY *key, int enc)
+// aes-256-gcm per datagram: the 4 bytes frame header is authenticated in clear, the rest is encrypted and followed by the
+// 8 bytes nonce counter and the 16 bytes tag. every datagram gets a new nonce, resends, gap and control frames included
+static int frame_seal(EVP_CIPHER_CTX *ctx, uint64_t nonce, uint8_t *dst, FFRDP_IOVEC *iov, int niov) // iov[0] starts with the header
 {
-    uint8_t *pdata = node->data + 4, *pend = node->data + node->size - (node->data[0] <= FFRDP_FRAME_TYPE_SHORT ? 0 : 2) - AES_BLOCK_SIZE;
-    while (pdata <= pend) {
-        AES_ecb_encrypt(pdata, pdata, key, enc);
-        pdata += AES_BLOCK_SIZE;
+    uint8_t iv[12] = {0};
+    int     len = 4, n, i;
+    memcpy(iv + 4, &nonce, 8);
+    memcpy(dst, iov[0].buf, 4);
+    if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) || !EVP_EncryptUpdate(ctx, NULL, &n, iov[0].buf, 4)) return -1;
+    for (i=0; i<niov; i++) { // gcm output is as long as its input
+        if (!EVP_EncryptUpdate(ctx, dst + len, &n, (uint8_t*)iov[i].buf + (i ? 0 : 4), iov[i].len - (i ? 0 : 4))) return -1;
+        len += n;
     }
+    if (!EVP_EncryptFinal_ex(ctx, dst + len, &n)) return -1;
+    memcpy(dst + len, &nonce, 8);
+    return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, dst + len + 8) ? len + FFRDP_AEAD_OVERHEAD : -1;
+}
+
+static int frame_open(EVP_CIPHER_CTX *ctx, uint8_t *data, int len) // decrypt in place, returns the plain size, -1 if forged or broken. nonce stays after the plain frame
+{
+    uint8_t iv[12] = {0};
+    int     n;
+    if ((len -= FFRDP_AEAD_OVERHEAD) < 4) return -1;
+    memcpy(iv + 4, data + len, 8);
+    if (  !EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) || !EVP_DecryptUpdate(ctx, NULL, &n, data, 4)
+        || !EVP_DecryptUpdate(ctx, data + 4, &n, data + 4, len - 4) || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, data + len + 8)
+        || EVP_DecryptFinal_ex(ctx, data + 4 + n, &n) <= 0) return -1;
+    return len;
+}
+
+static EVP_CIPHER_CTX* aead_new(char *key, int enc)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int             ret = 0;
+    if (ctx) ret = enc ? EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, (uint8_t*)key, NULL) : EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, (uint8_t*)key, NULL);
+    if (ret != 1) { EVP_CIPHER_CTX_free(ctx); ctx = NULL; }
+    return ctx;
+}
+
+static int ffrdp_replayed(FFRDPCONTEXT *ffrdp, uint64_t nonce) // sliding window of FFRDP_REPLAY_WIN nonces, marks nonce as received
+{
+    uint64_t *win = ffrdp->replay_win, n;
+    if (!ffrdp->replay_set || (int64_t)(nonce - ffrdp->replay_max) > 0) { // window moves up, bits of the skipped nonces are cleared
+        if (!ffrdp->replay_set || nonce - ffrdp->replay_max >= FFRDP_REPLAY_WIN) memset(ffrdp->replay_win, 0, sizeof(ffrdp->replay_win));
+        else for (n=ffrdp->replay_max+1; n!=nonce; n++) win[n % FFRDP_REPLAY_WIN / 64] &= ~(1ULL << (n % 64));
+        ffrdp->replay_max = nonce; ffrdp->replay_set = 1;
+    } else if (ffrdp->replay_max - nonce >= FFRDP_REPLAY_WIN || (win[nonce % FFRDP_REPLAY_WIN / 64] & (1ULL << (nonce % 64)))) return 1;
+    win[nonce % FFRDP_REPLAY_WIN / 64] |= 1ULL << (nonce % 64);
+    return 0;
 }
 #endif
 
-static int frame_payload_size(FFRDP_FRAME_NODE *node) {
-    return  node->size - 4 - (node->data[0] <= FFRDP_FRAME_TYPE_SHORT ? 0 : 2);
+static int ffrdp_seal(FFRDPCONTEXT *ffrdp, uint8_t *buf, FFRDP_IOVEC *iov, int niov) // datagram size put in buf, 0 if not encrypted, -1 on error
+{
+#ifdef CONFIG_ENABLE_AES256
+    FFRDPCONTEXT *owner = ffrdp->listener ? ffrdp->listener : ffrdp; // peers share key and nonce counter of listener
+    if (ffrdp->flags & FLAG_TX_AES256) return frame_seal(owner->aead_tx, owner->aead_nonce++, buf, iov, niov);
+#endif
+    return 0;
 }
 
-static void list_enqueue(FFRDP_FRAME_NODE **head, FFRDP_FRAME_NODE **tail, FFRDP_FRAME_NODE *node)
+static int ffrdp_sendto(FFRDPCONTEXT *ffrdp, uint8_t *data, int len, struct sockaddr_in *dstaddr) // control frame, sealed like data frames
 {
-    FFRDP_FRAME_NODE *p;
-    uint32_t seqnew, seqcur;
-    int      dist;
-    if (*head == NULL) {
-        *head = node;
-        *tail = node;
-    } else {
-        seqnew = GET_FRAME_SEQ(node);
-        for (p=*tail; p; p=p->prev) {
-            seqcur = GET_FRAME_SEQ(p);
-            dist   = seq_distance(seqnew, seqcur);
-            if (dist == 0) return;
-            if (dist >  0) {
-                if (p->next) p->next->prev = node;
-                else *tail = node;
-                node->next = p->next;
-                node->prev = p;
-                p->next    = node;
-                return;
-            }
-        }
-        node->next = *head;
-        node->next->prev = node;
-        *head = node;
-    }
+    uint8_t     buf[4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER + FFRDP_AEAD_OVERHEAD], hdr[4] = {0};
+    FFRDP_IOVEC iov = { data, len, NULL };
+    int         ret;
+    if (len < 4) { memcpy(hdr, data, len); iov.buf = hdr; iov.len = 4; } // sealed frame has a full header, receivers check the min size only
+    if ((ret = ffrdp_seal(ffrdp, buf, &iov, 1)) < 0) return -1;
+    return sendto(ffrdp->udp_fd, ret ? buf : data, ret ? ret : len, 0, (struct sockaddr*)dstaddr, sizeof(struct sockaddr_in));
 }
 
-static void list_remove(FFRDP_FRAME_NODE **head, FFRDP_FRAME_NODE **tail, FFRDP_FRAME_NODE *node)
+static int frame_payload_size(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *node) {
+    if (node->data[0] == FFRDP_FRAME_TYPE_GAP) return 0;
+    return  node->size - 4 - FFRDP_STREAM_HDR(ffrdp) - (node->data[0] <= FFRDP_FRAME_TYPE_SHORT ? 0 : FFRDP_FEC_TRAILER);
+}
+
+static int frame_iov(FFRDP_FRAME_NODE *node, FFRDP_IOVEC iov[3]) // parts of the frame on the wire: bytes in node, bytes referred, fec trailer
 {
-    if (node->next) node->next->prev = node->prev;
-    else *tail = node->prev;
-    if (node->prev) node->prev->next = node->next;
-    else *head = node->next;
-    free(node);
+    int tlen = node->data[0] == FFRDP_FRAME_TYPE_FEC ? FFRDP_FEC_TRAILER : 0, n = 0;
+    iov[n].buf = node->data; iov[n++].len = node->size - node->ref_len - tlen;
+    if (node->ref_len) { iov[n].buf = node->ref_data; iov[n++].len = node->ref_len; }
+    if (tlen) { iov[n].buf = node->data + iov[0].len; iov[n++].len = tlen; }
+    return n;
 }
 
-static void list_free(FFRDP_FRAME_NODE **head, FFRDP_FRAME_NODE **tail)
+static void frame_unref(FFRDP_FRAME_NODE *node) // frame no longer carries the referred bytes
 {
-    while (*head) list_remove(head, tail, *head);
+    if (node->ref) ffrdp_buf_unref(node->ref);
+    node->ref = NULL; node->ref_data = NULL; node->ref_len = 0;
 }
 
-static int ffrdp_sleep(FFRDPCONTEXT *ffrdp, int flag)
+static void frame_node_free(FFRDP_NODE_POOL *pool, FFRDP_FRAME_NODE *node)
 {
-    if (ffrdp->flags & FLAG_FLUSH) { ffrdp->flags &= ~FLAG_FLUSH; return 0; }
-    if (flag) {
-        struct timeval tv;
-        fd_set  rs;
-        FD_ZERO(&rs);
-        FD_SET(ffrdp->udp_fd, &rs);
-        tv.tv_sec  = 0;
-        tv.tv_usec = FFRDP_SELECT_TIMEOUT;
-        if (select((int)ffrdp->udp_fd + 1, &rs, NULL, NULL, &tv) <= 0) return -1;
-    } else usleep(FFRDP_USLEEP_TIMEOUT);
-    return 0;
+    frame_unref(node);
+    node->next = pool->free_list; pool->free_list = node; pool->free_num++;
 }
 
-static int ffrdp_send_data_frame(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *frame, struct sockaddr_in *dstaddr)
+#define SEND_SLOT(ffrdp, seq) ((ffrdp)->send_ring[(seq) & (FFRDP_SEND_RING - 1)])
+#define RECV_SLOT(ffrdp, seq) ((ffrdp)->recv_ring[(seq) & (FFRDP_RECV_RING - 1)])
+#define SACK_SPAN(ffrdp) ((ffrdp)->flags & FLAG_EXT_TX ? FFRDP_RECV_RING - 1 : 24) // frames after una that selective ack can reach
+
+static uint32_t recv_bits_get(FFRDPCONTEXT *ffrdp, uint32_t seq) // get 32 received bits from seq
+{
+    uint32_t idx = seq & (FFRDP_RECV_RING - 1), w = idx / 32, b = idx % 32;
+    uint32_t val = ffrdp->recv_bits[w] >> b;
+    if (b) val |= ffrdp->recv_bits[(w + 1) % (FFRDP_RECV_RING / 32)] << (32 - b);
+    return val;
+}
+
+static void recv_bits_set(FFRDPCONTEXT *ffrdp, uint32_t seq, int set)
 {
-    switch (frame->size - ffrdp->smss) {
-    case 6 : ffrdp->counter_fec_tx ++; *(uint16_t*)(frame->data + 4 + ffrdp->smss) = ffrdp->fec_txseq++; break; // tx fec frame
-    case 4 : ffrdp->counter_txfull ++; break; // tx full  frame
-    default: ffrdp->counter_txshort++; break; // tx short frame
+    uint32_t idx = seq & (FFRDP_RECV_RING - 1);
+    if (set) ffrdp->recv_bits[idx / 32] |=  (1 << (idx % 32));
+    else     ffrdp->recv_bits[idx / 32] &= ~(1 << (idx % 32));
+}
+
+static FFRDP_FRAME_NODE* send_head(FFRDPCONTEXT *ffrdp) // oldest frame not acked
+{
+    return ffrdp->send_una != ffrdp->send_seq ? SEND_SLOT(ffrdp, ffrdp->send_una) : NULL;
+}
+
+static void send_sack(FFRDPCONTEXT *ffrdp, uint32_t seq, int num) // frames [seq, seq + num) got selective ack, seq is the 24 bits one of wire
+{
+    FFRDP_FRAME_NODE *p;
+    seq = ffrdp->send_una + seq_distance(seq & 0xFFFFFF, ffrdp->send_una & 0xFFFFFF);
+    for (; num > 0 && (int32_t)(seq - ffrdp->send_una) < FFRDP_SEND_RING; seq++, num--) {
+        if ((int32_t)(seq - ffrdp->send_una) < 0 || !(p = SEND_SLOT(ffrdp, seq)) || !(p->flags & FLAG_FIRST_SEND)) continue; // slots not sent yet are never reported
+        p->flags |= FLAG_SACKED;
+        if ((int32_t)(seq - ffrdp->ack_maxack) > 0) ffrdp->ack_maxack = seq;
+        if ((int32_t)(p->tx_order - ffrdp->ack_maxorder) > 0) ffrdp->ack_maxorder = p->tx_order;
     }
-    if (sendto(ffrdp->udp_fd, frame->data, frame->size, 0, (struct sockaddr*)dstaddr, sizeof(struct sockaddr_in)) != frame->size) { ffrdp->counter_udpsenderr++; return -1; }
-    else ffrdp->counter_udpsenderr = 0;
-    if (frame->size == 4 + ffrdp->smss + 2) { // fec frame
-        uint32_t *psrc = (uint32_t*)frame->data, *pdst = (uint32_t*)ffrdp->fec_txbuf, i;
-        for (i=0; i<(4+ffrdp->smss)/sizeof(uint32_t); i++) *pdst++ ^= *psrc++; // make xor fec frame
-        if (ffrdp->fec_txseq % ffrdp->fec_txredundancy == ffrdp->fec_txredundancy - 1) {
-            *(uint16_t*)(ffrdp->fec_txbuf + 4 + ffrdp->smss) = ffrdp->fec_txseq++; ffrdp->fec_txbuf[0] = ffrdp->fec_txredundancy;
-            sendto(ffrdp->udp_fd, ffrdp->fec_txbuf, frame->size, 0, (struct sockaddr*)dstaddr, sizeof(struct sockaddr_in)); // send fec frame
-            memset(ffrdp->fec_txbuf, 0, sizeof(ffrdp->fec_txbuf)); // clear tx_fecbuf
-            ffrdp->counter_fec_tx++;
+}
+
+static void send_enqueue(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *node) // called with lock held
+{
+    SEND_SLOT(ffrdp, ffrdp->send_seq) = node;
+    ffrdp->send_seq++; ffrdp->wait_snd++;
+}
+
+static void send_close_tail(FFRDPCONTEXT *ffrdp) // queue the partly filled frame as a short frame, called with lock held
+{
+    if (!ffrdp->cur_new_node) return;
+    ffrdp->cur_new_node->data[0] = FFRDP_FRAME_TYPE_SHORT;
+    ffrdp->cur_new_node->size    = 4 + ffrdp->cur_new_size;
+    send_enqueue(ffrdp, ffrdp->cur_new_node);
+    ffrdp->cur_new_node = NULL;
+    ffrdp->cur_new_size = 0;
+}
+
+static void send_drop_msg(FFRDPCONTEXT *ffrdp, uint32_t seq) // an expired message becomes one gap frame at its first frame not acked
+{
+    FFRDP_FRAME_NODE *p;
+    uint32_t last = SEND_SLOT(ffrdp, seq)->msg_last, first = seq;
+    int      stream = FFRDP_STREAM_HDR(ffrdp) ? SEND_SLOT(ffrdp, seq)->data[4] : 0;
+    for (; seq != last + 1; seq++) {
+        if (!(p = SEND_SLOT(ffrdp, seq))) continue; // acked
+        if (!(p->flags & FLAG_FIRST_SEND)) p->wire_size = 0;
+        frame_unref(p);
+        p->data[0] = FFRDP_FRAME_TYPE_GAP; SET_FRAME_SEQ(p, seq);
+        FFRDP_GAP_LAST(ffrdp, p) = last & 0xFFFFFF;
+        p->size    = 8 + FFRDP_STREAM_HDR(ffrdp);
+        if ((p->flags & FLAG_FIRST_SEND) && !(p->flags & FLAG_COVERED)) ffrdp->inflight--;
+        p->flags  &= ~(FLAG_FIRST_SEND|FLAG_TIMEOUT_RESEND|FLAG_FAST_RESEND|FLAG_DROPPABLE);
+        p->flags  |= FLAG_RESENT; // sent again as a new frame, its ack may be for the old one
+        if (seq != first && !(ffrdp->flags & FLAG_STREAMS)) { // covered by the gap frame, acked when receiver skips to the last one.
+            // in streams mode every one is a gap frame, its stream may already have the first one and must not wait for una to move
+            p->flags    |= FLAG_FIRST_SEND|FLAG_COVERED;
+            p->tick_1sts = get_tick_count();
         }
     }
-    return 0;
+    ffrdp->counter_msg_dropped++;
+    ffrdp->tx_dropped[stream]++;
 }
 
-static int ffrdp_recv_data_frame(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *frame)
+#define RX_POOL(ffrdp) ((ffrdp)->listener ? &(ffrdp)->listener->rx_pool : &(ffrdp)->rx_pool)
+
+// ms until ffrdp_send_frames of this context has something to do: pacer tokens, flush of the partial frame,
+// resend timers, message deadlines and window query. called by the update thread, which is the only one freeing frames
+static int ffrdp_timeout(FFRDPCONTEXT *ffrdp, uint32_t now)
 {
-    uint32_t fecseq, fecrdc, *psrc, *pdst, type, i;
-    switch (frame->data[0]) {
-    case FFRDP_FRAME_TYPE_SHORT: ffrdp->counter_rxshort++; return 0; // short frame
-    case FFRDP_FRAME_TYPE_FULL : ffrdp->counter_rxfull ++; ffrdp->rmss = frame->size - 4; return 0; // full frame
-    default:                     ffrdp->counter_fec_rx ++; ffrdp->rmss = frame->size - 6; break;    // fec  frame
-    }
-    fecseq = *(uint16_t*)(frame->data + frame->size - 2);
-    fecrdc = frame->data[0];
-    if (fecseq / fecrdc != ffrdp->fec_rxseq / fecrdc || ffrdp->fec_rxredundancy != fecrdc) { // group changed or fec_rxredundancy changed
-        memcpy(ffrdp->fec_rxbuf, frame->data, frame->size);
-        ffrdp->fec_rxseq = fecseq; ffrdp->fec_rxmask = 1 << (fecseq % fecrdc); ffrdp->fec_rxcnt = 1; ffrdp->fec_rxredundancy = fecrdc;
-        return fecseq % fecrdc != fecrdc - 1 ? 0 : -1;
-    } else ffrdp->fec_rxseq = fecseq; // group not changed
-    if (fecseq % fecrdc == fecrdc - 1) { // it's redundance frame
-        if (ffrdp->fec_rxcnt == fecrdc - 1) return -1;
-        if (ffrdp->fec_rxcnt != fecrdc - 2) { ffrdp->counter_fec_failed++; return -1; }
-        type = frame->data[0];
-        psrc = (uint32_t*)ffrdp->fec_rxbuf; pdst = (uint32_t*)frame->data;
-        for (i=0; i<(frame->size-2)/sizeof(uint32_t); i++) *pdst++ ^= *psrc++;
-        frame->data[0] = type;
-        ffrdp->counter_fec_ok++;
-    } else if (!(ffrdp->fec_rxmask & (1 << (fecseq % fecrdc)))) { // update fec_rxbuf
-        psrc = (uint32_t*)frame->data; pdst = (uint32_t*)ffrdp->fec_rxbuf;
-        for (i=0; i<(frame->size-2)/sizeof(uint32_t); i++) *pdst++ ^= *psrc++;
-        ffrdp->fec_rxmask |= 1 << (fecseq % fecrdc); ffrdp->fec_rxcnt++;
+    FFRDP_FRAME_NODE *p;
+    uint32_t seq, end;
+    int32_t  wait = FFRDP_MAX_TIMEOUT, i;
+    int64_t  tokens;
+    if (ffrdp->flags & FLAG_FLUSH) return 0;
+    if (ffrdp->pmtu_state != PMTU_OFF && (ffrdp->flags & FLAG_CONNECTED)) wait = MIN(wait, (int32_t)(ffrdp->tick_pmtu - now));
+    pthread_mutex_lock(&ffrdp->lock);
+    if (ffrdp->cur_new_node) wait = MIN(wait, (int32_t)(ffrdp->coalesce_us - (get_tick_us() - ffrdp->cur_new_us) + 999) / 1000);
+    if ((int32_t)(ffrdp->urgent_end - ffrdp->urgent_scan) > 0 && ffrdp->swnd > 0 && (int32_t)(ffrdp->urgent_scan - ffrdp->send_una) < FFRDP_RECV_RING) wait = 0;
+    end = ffrdp->send_seq;
+    pthread_mutex_unlock(&ffrdp->lock);
+    for (i=0,seq=ffrdp->send_una; i<(int32_t)ffrdp->cwnd&&seq!=end&&wait>0; seq++) {
+        if (!(p = SEND_SLOT(ffrdp, seq)) || (p->flags & (FLAG_COVERED|FLAG_SACKED))) continue;
+        i++;
+        if ((p->flags & FLAG_DROPPABLE) && !(p->flags & FLAG_FIRST_SEND)) wait = MIN(wait, (int32_t)(p->tick_deadline - now) + 1); // sent ones wait for resend
+        if (!(p->flags & FLAG_FIRST_SEND)) {
+            if (ffrdp->swnd == 0) wait = MIN(wait, ffrdp->tick_send_query ? (int32_t)(ffrdp->tick_send_query + FFRDP_QUERY_CYCLE - now) + 1 : 0);
+            else if (ffrdp->flags & FLAG_PACED) { // frames wait for tokens, one update per ms at most
+                tokens = ffrdp->pace_tokens + (int64_t)ffrdp->pace_rate * (uint32_t)((int32_t)now - (int32_t)ffrdp->pace_tick) / 1000;
+                wait   = MIN(wait, tokens > 0 ? 0 : (int32_t)MIN(-tokens * 1000 / MAX(ffrdp->pace_rate, 1) + 1, FFRDP_MAX_TIMEOUT));
+            } else wait = 0;
+            break; // frames after it are not sent either
+        }
+        if (p->flags & FLAG_FAST_RESEND) wait = 0;
+        else if (seq - ffrdp->send_una <= (uint32_t)SACK_SPAN(ffrdp)) wait = MIN(wait, (int32_t)(p->tick_timeout - now) + 1);
     }
+    return MAX(wait, 0);
+}
+
+static int stream_grow(FFRDP_STREAM *s) // doubles buffer of stream up to FFRDP_EXT_RECVBUF_SIZE
+{
+    uint8_t *buf;
+    int32_t  size = MIN(s->bsize * 2, FFRDP_EXT_RECVBUF_SIZE);
+    if (size <= s->bsize || !(buf = malloc(size))) return -1;
+    ringbuf_read(s->buff, s->bsize, s->head, buf, s->size);
+    free(s->buff);
+    s->buff  = buf;
+    s->bsize = size;
+    s->head  = 0;
+    s->tail  = s->size;
     return 0;
 }
 
-void* ffrdp_init(char *ip, int port, char *txkey, char *rxkey, int server, int smss, int sfec)
+static int stream_write(FFRDPCONTEXT *ffrdp, FFRDP_STREAM *s, uint8_t *data, int size) // called with lock held, -1 if stream is full
 {
-    FFRDPCONTEXT *ffrdp = NULL;
-    unsigned long opt;
-#ifdef WIN32
-    WSADATA wsaData;
-    timeBeginPeriod(1);
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        printf("WSAStartup failed !\n");
-        return NULL;
+    if (!s->buff) {
+        if (!(s->buff = malloc(FFRDP_RECVBUF_SIZE))) return -1;
+        s->bsize = FFRDP_RECVBUF_SIZE;
     }
-#endif
-
-    if (!(ffrdp = calloc(1, sizeof(FFRDPCONTEXT)))) return NULL;
-    ffrdp->swnd     = FFRDP_DEF_CWND_SIZE;
-    ffrdp->cwnd     = FFRDP_DEF_CWND_SIZE;
-    ffrdp->ssthresh = FFRDP_DEF_CWND_SIZE;
-    ffrdp->rtts     = (uint32_t) -1;
-    ffrdp->rto      = FFRDP_MIN_RTO;
-    ffrdp->rmss     = FFRDP_MAX_MSS;
-    ffrdp->smss     = MAX(1, MIN(smss, FFRDP_MAX_MSS));
-    ffrdp->fec_txredundancy = MAX(0, MIN(sfec, FFRDP_FRAME_TYPE_FEC32));
-    ffrdp->tick_ffrdp_dump  = get_tick_count();
-
-    ffrdp->server_addr.sin_family      = AF_INET;
-    ffrdp->server_addr.sin_port        = htons(port);
-    ffrdp->server_addr.sin_addr.s_addr = inet_addr(ip);
-    ffrdp->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (ffrdp->udp_fd < 0) {
-        printf("failed to open socket !\n");
-        goto failed;
+    while (size > s->bsize - s->size) { // a large window is released at once when its hole is filled
+        if (!(ffrdp->flags & FLAG_EXT_RX) || stream_grow(s) != 0) return -1;
     }
+    s->tail = ringbuf_write(s->buff, s->bsize, s->tail, data, size);
+    s->size+= size; s->wpos += size;
+    return 0;
+}
 
-#ifdef WIN32
-    opt = 1; ioctlsocket(ffrdp->udp_fd, FIONBIO, &opt); // setup non-block io mode
-#else
-    fcntl(ffrdp->udp_fd, F_SETFL, fcntl(ffrdp->udp_fd, F_GETFL, 0) | O_NONBLOCK);  // setup non-block io mode
-#endif
-    opt = FFRDP_UDPSBUF_SIZE; setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_SNDBUF   , (char*)&opt, sizeof(int)); // setup udp send buffer size
-    opt = FFRDP_UDPRBUF_SIZE; setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_RCVBUF   , (char*)&opt, sizeof(int)); // setup udp recv buffer size
-    opt = 1;                  setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(int)); // setup reuse addr
+static int stream_gap(FFRDP_STREAM *s) // a dropped message at current end of stream, -1 if application has not read the older ones
+{
+    if (s->gap_num == FFRDP_MAX_GAPS) return -1;
+    s->gaps[(s->gap_head + s->gap_num++) % FFRDP_MAX_GAPS] = s->wpos;
+    return 0;
+}
 
-    if (server) {
-        ffrdp->flags |= FLAG_SERVER;
-        if (bind(ffrdp->udp_fd, (struct sockaddr*)&ffrdp->server_addr, sizeof(ffrdp->server_addr)) == -1) {
-            printf("failed to bind !\n");
-            goto failed;
+// message mode: the frame is kept by stream instead of being copied, -1 if stream is full. a gap frame drops the partial
+// message before it and takes its place, ffrdp_msg_recv reports it. called with lock held
+static int stream_msg_put(FFRDPCONTEXT *ffrdp, FFRDP_STREAM *s, FFRDP_FRAME_NODE *node)
+{
+    FFRDP_FRAME_NODE *p, *next;
+    if (node->data[0] != FFRDP_FRAME_TYPE_GAP) {
+        if (s->msg_frames >= FFRDP_MSG_MAX_FRAMES) return -1;
+    } else {
+        for (p=s->msg_last ? s->msg_last->next : s->msg_head; p; p=next) {
+            next = p->next; frame_node_free(RX_POOL(ffrdp), p); s->msg_frames--;
         }
+        if (s->msg_last) s->msg_last->next = NULL; else s->msg_head = NULL;
+        s->msg_tail = s->msg_last;
     }
+    node->next = NULL;
+    if (s->msg_tail) s->msg_tail->next = node; else s->msg_head = node;
+    s->msg_tail = node; s->msg_frames++;
+    if (node->data[0] == FFRDP_FRAME_TYPE_GAP || (node->data[5] & FFRDP_SFLAG_END)) s->msg_last = node;
+    return 0;
+}
 
-    if (txkey) {
-#ifdef CONFIG_ENABLE_AES256
-        ffrdp->flags |= FLAG_TX_AES256;
-        AES_set_encrypt_key((uint8_t*)txkey, 256, &ffrdp->aes_encrypt_key);
-#endif
+static int recv_sack_blocks(FFRDPCONTEXT *ffrdp, uint8_t *buf) // ranges of frames received after recv_seq: u16 offset from recv_seq, u16 length
+{
+    uint32_t off, bits, i;
+    int      n = 0, start = 0;
+    for (off=1; off<FFRDP_RECV_RING && n<FFRDP_SACK_BLOCKS; off+=32) {
+        bits = recv_bits_get(ffrdp, ffrdp->recv_seq + off);
+        if (off + 32 > FFRDP_RECV_RING) bits &= (1u << (FFRDP_RECV_RING - off)) - 1; // recv_seq itself comes again at the end
+        if (bits == (start ? 0xFFFFFFFF : 0)) continue;
+        for (i=0; i<32 && n<FFRDP_SACK_BLOCKS; i++) {
+            if (!start && (bits & (1u << i))) start = off + i;
+            else if (start && !(bits & (1u << i))) {
+                *(uint16_t*)(buf + n * 4 + 0) = start;
+                *(uint16_t*)(buf + n * 4 + 2) = off + i - start;
+                n++; start = 0;
+            }
+        }
     }
-    if (rxkey) {
-#ifdef CONFIG_ENABLE_AES256
-        ffrdp->flags |= FLAG_RX_AES256;
-        AES_set_decrypt_key((uint8_t*)rxkey, 256, &ffrdp->aes_decrypt_key);
-#endif
+    if (start && n < FFRDP_SACK_BLOCKS) {
+        *(uint16_t*)(buf + n * 4 + 0) = start;
+        *(uint16_t*)(buf + n * 4 + 2) = FFRDP_RECV_RING - start;
+        n++;
     }
-    pthread_mutex_init(&ffrdp->lock, NULL);
-    return ffrdp;
+    return n;
+}
 
-failed:
-    if (ffrdp->udp_fd > 0) closesocket(ffrdp->udp_fd);
-    free(ffrdp);
-    return NULL;
+static void ffrdp_ext_enable(FFRDPCONTEXT *ffrdp, int flag) // extended mode is negotiated, socket buffers follow the larger window
+{
+    unsigned long opt = FFRDP_EXT_UDPBUF_SIZE;
+    if (!(ffrdp->flags & (FLAG_EXT_TX|FLAG_EXT_RX))) {
+        setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_SNDBUF, (char*)&opt, sizeof(int));
+        setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_RCVBUF, (char*)&opt, sizeof(int));
+    }
+    ffrdp->flags |= flag;
 }
 
-void ffrdp_free(void *ctxt)
+static void ffrdp_send_query(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr) // query carries our capabilities, old peers ignore the extra byte
+{
+    uint8_t data[2] = { FFRDP_FRAME_TYPE_QUERY, 0 };
+    if (!(ffrdp->flags & FLAG_EXT_OFF)) data[1] |= FFRDP_CAP_EXT;
+    ffrdp_sendto(ffrdp, data, sizeof(data), dstaddr);
+}
+
+static void ffrdp_set_df(FFRDPCONTEXT *ffrdp, int on) // probes must not be fragmented, data frames go as the system likes
 {
-    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
-    if (!ctxt) return;
-    if (ffrdp->udp_fd > 0) closesocket(ffrdp->udp_fd);
-    if (ffrdp->cur_new_node) free(ffrdp->cur_new_node);
-    list_free(&ffrdp->send_list_head, &ffrdp->send_list_tail);
-    list_free(&ffrdp->recv_list_head, &ffrdp->recv_list_tail);
-    pthread_mutex_destroy(&ffrdp->lock);
-    free(ffrdp);
 #ifdef WIN32
-    WSACleanup();
-    timeEndPeriod(1);
+    DWORD opt = on;
+    setsockopt(ffrdp->udp_fd, IPPROTO_IP, IP_DONTFRAGMENT, (char*)&opt, sizeof(opt));
+#elif defined(IP_MTU_DISCOVER)
+    int opt = on ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT; // probe ignores the path mtu cached by kernel
+    setsockopt(ffrdp->udp_fd, IPPROTO_IP, IP_MTU_DISCOVER, (char*)&opt, sizeof(opt));
+#elif defined(IP_DONTFRAG)
+    int opt = on;
+    setsockopt(ffrdp->udp_fd, IPPROTO_IP, IP_DONTFRAG, (char*)&opt, sizeof(opt));
 #endif
 }
 
-int ffrdp_send(void *ctxt, char *buf, int len)
+static void ffrdp_pmtu_set(FFRDPCONTEXT *ffrdp, uint32_t size) // new frames are made for datagrams of size, queued ones keep theirs
 {
-    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
-    int           n = len, size;
-    if (  !ffrdp || ((ffrdp->flags & FLAG_SERVER) && (ffrdp->flags & FLAG_CONNECTED) == 0)
-        || ((len + ffrdp->smss - 1) / ffrdp->smss + ffrdp->wait_snd > FFRDP_MAX_WAITSND)) {
-        if (ffrdp) ffrdp->counter_send_failed++;
-        return -1;
-    }
+    uint32_t mss = MIN(size, ffrdp->pmtu_max) - FFRDP_FRAME_OVERHEAD(ffrdp);
+    if (mss == ffrdp->smss) return;
     pthread_mutex_lock(&ffrdp->lock);
-    while (n > 0) {
-        if (!ffrdp->cur_new_node) ffrdp->cur_new_node = frame_node_new(ffrdp->fec_txredundancy, ffrdp->smss);
-        if (!ffrdp->cur_new_node) break;
-        else SET_FRAME_SEQ(ffrdp->cur_new_node, ffrdp->send_seq);
-        size = MIN(n, (int)(ffrdp->smss - ffrdp->cur_new_size));
-        memcpy(ffrdp->cur_new_node->data + 4 + ffrdp->cur_new_size, buf, size);
-        ffrdp->cur_new_size += size; buf += size; n -= size;
-        if (ffrdp->cur_new_size == ffrdp->smss) {
-#ifdef CONFIG_ENABLE_AES256
-            if ((ffrdp->flags & FLAG_TX_AES256)) frame_node_encrypt(ffrdp->cur_new_node, &ffrdp->aes_encrypt_key, AES_ENCRYPT);
-#endif
-            list_enqueue(&ffrdp->send_list_head, &ffrdp->send_list_tail, ffrdp->cur_new_node);
-            ffrdp->send_seq++; ffrdp->wait_snd++;
-            ffrdp->cur_new_node = NULL;
-            ffrdp->cur_new_size = 0;
-        } else ffrdp->cur_new_tick = get_tick_count();
-    }
+    send_close_tail(ffrdp); // the partial frame was made for the old size
+    ffrdp->smss = mss;
     pthread_mutex_unlock(&ffrdp->lock);
-    return len - n;
 }
 
-int ffrdp_recv(void *ctxt, char *buf, int len)
+static void ffrdp_pmtu_reset(FFRDPCONTEXT *ffrdp, int state) // search again from base, or PMTU_OFF for the max size
 {
-    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
-    int           ret;
-    if (!ctxt) return -1;
-    pthread_mutex_lock(&ffrdp->lock);
-    ret = MIN(len, ffrdp->recv_size);
-    if (ret > 0) {
-        ffrdp->recv_head = ringbuf_read(ffrdp->recv_buff, sizeof(ffrdp->recv_buff), ffrdp->recv_head, (uint8_t*)buf, ret);
-        ffrdp->recv_size-= ret; ffrdp->counter_recv_bytes += ret;
+    ffrdp->pmtu_state = ffrdp->pmtu_max >= FFRDP_PMTU_BASE ? state : PMTU_OFF;
+    ffrdp->pmtu_low   = FFRDP_PMTU_BASE;
+    ffrdp->pmtu_high  = (uint32_t)-1;
+    ffrdp->pmtu_probe = ffrdp->pmtu_tries = ffrdp->pmtu_lost = 0;
+    ffrdp->tick_pmtu  = get_tick_count();
+    ffrdp_pmtu_set(ffrdp, ffrdp->pmtu_state == PMTU_OFF ? ffrdp->pmtu_max : FFRDP_PMTU_BASE);
+}
+
+static uint32_t ffrdp_pmtu_next(FFRDPCONTEXT *ffrdp) // size of next probe, 0 when search is done
+{
+    static const uint32_t steps[] = { 1500 - 28, 9000 - 28 }; // ethernet and jumbo frames less ipv4 and udp headers
+    uint32_t high = MIN(ffrdp->pmtu_high, ffrdp->pmtu_max + 1), i;
+    for (i=0; i<sizeof(steps)/sizeof(steps[0]); i++) {
+        if (steps[i] > ffrdp->pmtu_low && steps[i] < high) return steps[i];
     }
-    pthread_mutex_unlock(&ffrdp->lock);
-    return ret;
+    if (ffrdp->pmtu_max > ffrdp->pmtu_low && ffrdp->pmtu_max < high) return ffrdp->pmtu_max;
+    return high - ffrdp->pmtu_low > FFRDP_PMTU_STEP ? (ffrdp->pmtu_low + high) / 2 & ~3 : 0;
 }
 
-int ffrdp_isdead(void *ctxt)
+static void ffrdp_pmtu_update(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr, uint32_t now) // called by update thread
 {
-    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
-    if (!ctxt) return -1;
-    if (!ffrdp->send_list_head) return 0;
-    if (ffrdp->send_list_head->flags & FLAG_FIRST_SEND) {
-        return (int32_t)get_tick_count() - (int32_t)ffrdp->send_list_head->tick_1sts > FFRDP_DEAD_TIMEOUT;
-    } else {
-        return (int32_t)ffrdp->tick_send_query - (int32_t)ffrdp->tick_recv_ack > FFRDP_DEAD_TIMEOUT || ffrdp->counter_udpsenderr > DEADLINK_SENDERR_THRESHOLD;
+    uint8_t buf[4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER];
+    int     ret;
+    if (ffrdp->pmtu_state == PMTU_OFF || !(ffrdp->flags & FLAG_CONNECTED) || (int32_t)now - (int32_t)ffrdp->tick_pmtu < 0) return;
+    if (ffrdp->pmtu_state == PMTU_DONE) { ffrdp->pmtu_state = PMTU_SEARCH; ffrdp->pmtu_high = (uint32_t)-1; } // raise timer
+    if (ffrdp->pmtu_probe && ffrdp->pmtu_tries >= FFRDP_PMTU_TRIES) { // size lost
+        if (ffrdp->pmtu_state == PMTU_BASE) { // remote does not answer probes, or even base does not get through
+            if (!(ffrdp->flags & FLAG_PMTU_ACK)) ffrdp_pmtu_reset(ffrdp, PMTU_OFF);
+            else { ffrdp->pmtu_state = PMTU_DONE; ffrdp->tick_pmtu = now + FFRDP_PMTU_RAISE; }
+            return;
+        }
+        ffrdp->pmtu_high  = ffrdp->pmtu_probe;
+        ffrdp->pmtu_probe = 0;
     }
+    if (!ffrdp->pmtu_probe) {
+        if (!(ffrdp->pmtu_probe = ffrdp->pmtu_state == PMTU_BASE ? FFRDP_PMTU_BASE : ffrdp_pmtu_next(ffrdp))) {
+            ffrdp->pmtu_state = PMTU_DONE; ffrdp->tick_pmtu = now + FFRDP_PMTU_RAISE;
+            return;
+        }
+        ffrdp->pmtu_tries = 0;
+    }
+    memset(buf, 0, ffrdp->pmtu_probe);
+    buf[0] = FFRDP_FRAME_TYPE_PROBE; *(uint16_t*)(buf + 2) = ffrdp->pmtu_probe; // datagram size, seal included
+    ffrdp_set_df(ffrdp, 1);
+    ret = ffrdp_sendto(ffrdp, buf, ffrdp->pmtu_probe - FFRDP_SEAL_SIZE(ffrdp), dstaddr);
+    ffrdp_set_df(ffrdp, 0);
+    ffrdp->pmtu_tries++; ffrdp->pace_tokens -= ffrdp->pmtu_probe;
+    if (ret != (int)ffrdp->pmtu_probe) { ffrdp->pmtu_tries = FFRDP_PMTU_TRIES; ffrdp->tick_pmtu = now; } // larger than mtu of local interface
+    else ffrdp->tick_pmtu = now + (ffrdp->rtts == (uint32_t)-1 ? FFRDP_PMTU_TIMEOUT * 5 : ffrdp->rtts + FFRDP_PMTU_TIMEOUT);
 }
 
-static void ffrdp_recvdata_and_sendack(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr)
+static void ffrdp_pmtu_ack(FFRDPCONTEXT *ffrdp, uint32_t size, uint32_t rxmax)
 {
-    FFRDP_FRAME_NODE *p;
-    int32_t dist, recv_mack, recv_wnd, size, i;
-    uint8_t data[8];
-    pthread_mutex_lock(&ffrdp->lock);
-    while (ffrdp->recv_list_head) {
-        dist = seq_distance(GET_FRAME_SEQ(ffrdp->recv_list_head), ffrdp->recv_seq);
-        if (dist == 0 && (size = frame_payload_size(ffrdp->recv_list_head)) <= (int)(sizeof(ffrdp->recv_buff) - ffrdp->recv_size)) {
-#ifdef CONFIG_ENABLE_AES256
-            if ((ffrdp->flags & FLAG_RX_AES256)) frame_node_encrypt(ffrdp->recv_list_head, &ffrdp->aes_decrypt_key, AES_DECRYPT);
-#endif
-            ffrdp->recv_tail = ringbuf_write(ffrdp->recv_buff, sizeof(ffrdp->recv_buff), ffrdp->recv_tail, ffrdp->recv_list_head->data + 4, size);
-            ffrdp->recv_size+= size;
-            ffrdp->recv_seq++; ffrdp->recv_seq &= 0xFFFFFF;
-            list_remove(&ffrdp->recv_list_head, &ffrdp->recv_list_tail, ffrdp->recv_list_head);
-        } else break;
-    }
-    for (recv_mack=0,i=0,p=ffrdp->recv_list_head; i<=24&&p; i++,p=p->next) {
-        dist = seq_distance(GET_FRAME_SEQ(p), ffrdp->recv_seq);
-        if (dist <= 24) recv_mack |= 1 << (dist - 1); // dist is obviously > 0
-    }
-    recv_wnd = (sizeof(ffrdp->recv_buff) - ffrdp->recv_size) / ffrdp->rmss;
-    recv_wnd = MIN(recv_wnd, 255);
-    *(uint32_t*)(data + 0) = (FFRDP_FRAME_TYPE_ACK << 0) | (ffrdp->recv_seq << 8);
-    *(uint32_t*)(data + 4) = (recv_mack <<  0);
-    *(uint32_t*)(data + 4)|= (recv_wnd  << 24);
-    pthread_mutex_unlock(&ffrdp->lock);
-    sendto(ffrdp->udp_fd, data, sizeof(data), 0, (struct sockaddr*)dstaddr, sizeof(struct sockaddr_in)); // send ack frame
+    ffrdp->flags   |= FLAG_PMTU_ACK;
+    ffrdp->pmtu_max = MIN(ffrdp->pmtu_max, MAX(rxmax, FFRDP_PMTU_BASE));
+    if (ffrdp->pmtu_state == PMTU_OFF || size > ffrdp->pmtu_max || (size <= ffrdp->pmtu_low && ffrdp->pmtu_state != PMTU_BASE)) return;
+    if (ffrdp->pmtu_state == PMTU_BASE) ffrdp->pmtu_state = PMTU_SEARCH;
+    if (size >= ffrdp->pmtu_high) ffrdp->pmtu_high = (uint32_t)-1; // late ack of a size taken as lost
+    if (size == ffrdp->pmtu_probe) { ffrdp->pmtu_probe = 0; ffrdp->tick_pmtu = get_tick_count(); } // next probe at once
+    ffrdp->pmtu_low = MAX(ffrdp->pmtu_low, size);
+    ffrdp_pmtu_set(ffrdp, ffrdp->pmtu_low);
 }
 
-enum { CEVENT_ACK_OK, CEVENT_ACK_TIMEOUT, CEVENT_FAST_RESEND, CEVENT_SEND_FAILED };
-static void ffrdp_congestion_control(FFRDPCONTEXT *ffrdp, int event)
+static int ffrdp_sleep(FFRDPCONTEXT *ffrdp, int flag)
 {
-    switch (event) {
-    case CEVENT_ACK_OK:
+    FFRDPCONTEXT *peer;
+    int           flush = ffrdp->flags & FLAG_FLUSH, wait;
+    for (peer=ffrdp->peer_next; peer; peer=peer->peer_next) flush |= peer->flags & FLAG_FLUSH;
+    if (flush) {
+        for (peer=ffrdp; peer; peer=peer->peer_next) peer->flags &= ~FLAG_FLUSH;
+        return 0;
+    }
+    if (flag) {
+        struct timeval tv;
+        fd_set  rs;
+        wait = MIN((int)ffrdp->update_wait, ffrdp_next_timeout(ffrdp)); // wake up for the next timer, not at a fixed cycle
+        FD_ZERO(&rs);
+        FD_SET(ffrdp->udp_fd, &rs);
+        tv.tv_sec  = wait / 1000;
+        tv.tv_usec = wait % 1000 * 1000;
+        if (select((int)ffrdp->udp_fd + 1, &rs, NULL, NULL, &tv) <= 0) return -1;
+    } else usleep(FFRDP_USLEEP_TIMEOUT);
+    return 0;
+}
+
+enum { CEVENT_ACK_TIMEOUT, CEVENT_FAST_RESEND, CEVENT_SEND_FAILED };
+
+// aimd: cwnd doubles per ack in slow start and grows by one after, timeout and send failure restart from one frame,
+// fast resend halves it. pacing spreads cwnd over srtt with a little headroom (2x in slow start).
+static void aimd_pacing(FFRDPCONTEXT *ffrdp)
+{
+    if (ffrdp->rtts == (uint32_t)-1) { ffrdp->pace_rate = 0; return; }
+    // cwnd still limits the inflight, so the rtt is capped to keep timeout inflated rtts from starving the pacer
+    ffrdp->pace_rate = (uint32_t)MIN((uint64_t)ffrdp->cwnd * (ffrdp->smss + 8) * 1000 / MAX(MIN(ffrdp->rtts, FFRDP_MIN_RTO * 2), 1) * (ffrdp->cwnd < ffrdp->ssthresh ? 200 : 125) / 100, 0xFFFFFFFF);
+}
+
+static void aimd_init(FFRDPCONTEXT *ffrdp)
+{
+    ffrdp->cwnd     = FFRDP_DEF_CWND_SIZE;
+    ffrdp->ssthresh = FFRDP_DEF_CWND_SIZE;
+    aimd_pacing(ffrdp);
+}
+
+static void aimd_on_ack(FFRDPCONTEXT *ffrdp, int frames, int rtt, uint32_t rate)
+{
+    while (frames-- > 0) {
         if (ffrdp->cwnd < ffrdp->ssthresh) ffrdp->cwnd *= 2;
         else ffrdp->cwnd++;
-        ffrdp->cwnd = MIN(ffrdp->cwnd, FFRDP_MAX_CWND_SIZE);
+        ffrdp->cwnd = MIN(ffrdp->cwnd, (ffrdp->flags & FLAG_EXT_TX) ? FFRDP_EXT_MAX_CWND : FFRDP_MAX_CWND_SIZE);
         ffrdp->cwnd = MAX(ffrdp->cwnd, FFRDP_MIN_CWND_SIZE);
-        break;
+    }
+    aimd_pacing(ffrdp);
+}
+
+static uint32_t aimd_bwe(FFRDPCONTEXT *ffrdp)
+{
+    return ffrdp->rtts == (uint32_t)-1 ? 0 : (uint32_t)MIN((uint64_t)ffrdp->cwnd * (ffrdp->smss + 8) * 1000 / MAX(ffrdp->rtts, 1), 0xFFFFFFFF);
+}
+
+static void aimd_on_event(FFRDPCONTEXT *ffrdp, int event)
+{
+    switch (event) {
     case CEVENT_ACK_TIMEOUT:
     case CEVENT_SEND_FAILED:
         ffrdp->ssthresh = MAX(ffrdp->cwnd / 2, FFRDP_MIN_CWND_SIZE);
@@ -503,58 +931,1117 @@ static void ffrdp_congestion_control(FFRDPCONTEXT *ffrdp, int event)
         ffrdp->cwnd     = ffrdp->ssthresh;
         break;
     }
+    aimd_pacing(ffrdp);
 }
 
-void ffrdp_update(void *ctxt)
+// bbr: a model of the path instead of reacting to loss. bottleneck bandwidth is the max delivery rate of last rounds
+// (a round is one min rtt), propagation delay is the min rtt of last 10s. delivery rate of a frame is the bytes acked
+// between its send and its ack over the time since the ack before its send, so it always spans at least one rtt.
+// pacing rate is gain * btlbw, cwnd is gain * bdp. startup probes with gain 2.89 until btlbw stops growing by 25%
+// for 3 rounds (or 3 losses), drain empties the queue built by startup, then probe_bw cycles the pacing gain
+// 1.25, 0.75, 1 x 6. rounds in which the sender ran out of data give a low rate, they only count if it is higher.
+static const int s_bbr_cycle[8] = { 125, 75, 100, 100, 100, 100, 100, 100 };
+
+static void bbr_init(FFRDPCONTEXT *ffrdp)
 {
-    FFRDPCONTEXT       *ffrdp   = (FFRDPCONTEXT*)ctxt;
-    FFRDP_FRAME_NODE   *node    = NULL, *p = NULL, *t = NULL;
-    struct sockaddr_in *dstaddr = NULL, srcaddr;
-    uint32_t addrlen = sizeof(srcaddr);
-    int32_t  una, mack, ret, got_data = 0, got_query = 0, send_una, send_mack = 0, recv_una, dist, maxack, i;
-    uint8_t  data[8];
+    memset(ffrdp->bbr_bw, 0, sizeof(ffrdp->bbr_bw));
+    ffrdp->bbr_bwidx   = ffrdp->bbr_btlbw = 0;
+    ffrdp->bbr_full_bw = ffrdp->bbr_full_cnt = 0;
+    ffrdp->bbr_state   = BBR_STARTUP;
+    ffrdp->bbr_round_tick  = get_tick_count();
+    ffrdp->bbr_round_bw    = 0;
+    ffrdp->cwnd        = FFRDP_DEF_CWND_SIZE;
+    ffrdp->pace_rate   = 0;
+}
 
-    if (!ctxt) return;
-    if (!(ffrdp->flags & FLAG_SERVER) && !(ffrdp->flags & FLAG_CONNECTED)) dstaddr = &ffrdp->server_addr;
-    send_una = ffrdp->send_list_head ? GET_FRAME_SEQ(ffrdp->send_list_head) : 0;
-    recv_una = ffrdp->recv_seq;
+static void bbr_on_ack(FFRDPCONTEXT *ffrdp, int frames, int rtt, uint32_t rate)
+{
+    uint32_t now = get_tick_count(), round, bw, bdp, i;
+    int      pgain, cgain;
+    round = ffrdp->rtt_min == (uint32_t)-1 ? 10 : MAX(ffrdp->rtt_min, 5);
+    ffrdp->bbr_round_bw = MAX(ffrdp->bbr_round_bw, rate);
+    if ((uint32_t)((int32_t)now - (int32_t)ffrdp->bbr_round_tick) >= round) { // round end, take max delivery rate of the round
+        bw = ffrdp->bbr_round_bw;
+        if (bw && (!ffrdp->bbr_round_applimited || bw > ffrdp->bbr_btlbw)) {
+            ffrdp->bbr_bw[ffrdp->bbr_bwidx++ % FFRDP_BBR_BW_WIN] = bw;
+            for (ffrdp->bbr_btlbw=0,i=0; i<FFRDP_BBR_BW_WIN; i++) ffrdp->bbr_btlbw = MAX(ffrdp->bbr_btlbw, ffrdp->bbr_bw[i]);
+        }
+        if (ffrdp->bbr_state == BBR_STARTUP && !ffrdp->bbr_round_applimited) {
+            if (ffrdp->bbr_btlbw >= ffrdp->bbr_full_bw * 5 / 4) { ffrdp->bbr_full_bw = ffrdp->bbr_btlbw; ffrdp->bbr_full_cnt = 0; }
+            else if (++ffrdp->bbr_full_cnt >= 3) ffrdp->bbr_state = BBR_DRAIN;
+        }
+        ffrdp->bbr_round_tick  = now;
+        ffrdp->bbr_round_bw    = 0;
+        ffrdp->bbr_round_applimited = ffrdp->app_limited;
+    } else ffrdp->bbr_round_applimited |= ffrdp->app_limited;
+    if (ffrdp->bbr_btlbw == 0) { // no model yet, pace initial cwnd over the first rtt sample
+        if (ffrdp->rtt_min != (uint32_t)-1) ffrdp->pace_rate = (uint32_t)((uint64_t)ffrdp->cwnd * (ffrdp->smss + 8) * 289 * 10 / MAX(ffrdp->rtt_min, 2));
+        return;
+    }
+
+    bdp = (uint32_t)((uint64_t)ffrdp->bbr_btlbw * MAX(ffrdp->rtt_min, 2) / 1000);
+    if (ffrdp->bbr_state == BBR_DRAIN && ffrdp->inflight * (ffrdp->smss + 8) <= bdp) {
+        ffrdp->bbr_state = BBR_PROBE_BW; ffrdp->bbr_cycle = 0; ffrdp->bbr_cycle_tick = now;
+    }
+    if (ffrdp->bbr_state == BBR_PROBE_BW && (uint32_t)((int32_t)now - (int32_t)ffrdp->bbr_cycle_tick) >= round) {
+        ffrdp->bbr_cycle = (ffrdp->bbr_cycle + 1) % 8; ffrdp->bbr_cycle_tick = now;
+    }
+    switch (ffrdp->bbr_state) {
+    case BBR_STARTUP: pgain = 289; cgain = 289; break;
+    case BBR_DRAIN  : pgain = 35 ; cgain = 289; break;
+    default         : pgain = s_bbr_cycle[ffrdp->bbr_cycle]; cgain = 200; break;
+    }
+    ffrdp->pace_rate = (uint32_t)MIN((uint64_t)ffrdp->bbr_btlbw * pgain / 100, 0xFFFFFFFF);
+    ffrdp->cwnd      = (uint32_t)((uint64_t)bdp * cgain / 100 / (ffrdp->smss + 8)) + 3;
+    ffrdp->cwnd      = MAX(MIN(ffrdp->cwnd, (ffrdp->flags & FLAG_EXT_TX) ? FFRDP_EXT_MAX_CWND : FFRDP_BBR_MAX_CWND), 4);
+}
+
+static void bbr_on_event(FFRDPCONTEXT *ffrdp, int event)
+{
+    if (event == CEVENT_SEND_FAILED) ffrdp->cwnd = MAX(ffrdp->cwnd / 2, 4); // socket buffer full, next ack restores it
+    else if (ffrdp->bbr_state == BBR_STARTUP && ffrdp->bbr_btlbw && ++ffrdp->bbr_full_cnt >= 3) ffrdp->bbr_state = BBR_DRAIN; // startup overflows the queue
+}
+
+static uint32_t bbr_bwe(FFRDPCONTEXT *ffrdp)
+{
+    return ffrdp->bbr_btlbw;
+}
+
+static FFRDP_CC s_ffrdp_cc[] = {
+    { "aimd", aimd_init, aimd_on_ack, aimd_on_event, aimd_bwe },
+    { "bbr" , bbr_init , bbr_on_ack , bbr_on_event , bbr_bwe  },
+};
+
+static void ffrdp_congestion_control(FFRDPCONTEXT *ffrdp, int event)
+{
+    ffrdp->cc->on_event(ffrdp, event);
+}
+
+#ifdef __linux__
+// consecutive frames of the same size (only the last one may be shorter) are sent as one UDP_SEGMENT message,
+// frames not accepted by the socket are marked as not sent, so they go again in next update like a failed sendto.
+// when sendmmsg stops early its error is lost, so the rest is sent again to learn it, a gso message the nic or route
+// refuses turns gso off
+static void ffrdp_udp_flush(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr)
+{
+    struct mmsghdr  msgs[FFRDP_BATCH_SIZE];
+    struct cmsghdr *cmsg;
+    char     ctrl[FFRDP_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+    int      first[FFRDP_BATCH_SIZE + 1], start = 0, nmsg, size, total, ret, i, j;
+    if (ffrdp->txb_num == 0) return;
+
+    while (1) {
+        memset(msgs, 0, sizeof(msgs));
+        for (nmsg=0,i=start; i<ffrdp->txb_num; i=j,nmsg++) {
+            size = total = ffrdp->txb_len[i];
+            for (j=i+1; ffrdp->txb_gso && j<ffrdp->txb_num && j-i<FFRDP_GSO_MAX_SEGS && ffrdp->txb_len[j]<=size && total+ffrdp->txb_len[j]<=FFRDP_GSO_MAX_SIZE; ) {
+                total += ffrdp->txb_len[j];
+                if (ffrdp->txb_len[j++] < size) break;
+            }
+            first[nmsg] = i;
+            msgs[nmsg].msg_hdr.msg_name    = dstaddr;
+            msgs[nmsg].msg_hdr.msg_namelen = dstaddr ? sizeof(struct sockaddr_in) : 0;
+            msgs[nmsg].msg_hdr.msg_iov     = ffrdp->txb_iov + ffrdp->txb_iovi[i]; // iovs of consecutive datagrams are consecutive
+            msgs[nmsg].msg_hdr.msg_iovlen  = (j < ffrdp->txb_num ? ffrdp->txb_iovi[j] : ffrdp->txb_niov) - ffrdp->txb_iovi[i];
+            if (j - i > 1) {
+                msgs[nmsg].msg_hdr.msg_control    = ctrl[nmsg];
+                msgs[nmsg].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsg = CMSG_FIRSTHDR(&msgs[nmsg].msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type  = UDP_SEGMENT;
+                cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t*)CMSG_DATA(cmsg) = size;
+            }
+        }
+        first[nmsg] = ffrdp->txb_num;
+        ret = sendmmsg(ffrdp->udp_fd, msgs, nmsg, 0);
+        if (ret >= nmsg) break;
+        if (ret > 0) { start = first[ret]; continue; }
+        if (!ffrdp->txb_gso || !msgs[0].msg_hdr.msg_controllen || (errno != EIO && errno != EINVAL)) break;
+        ffrdp->txb_gso = 0; // no gso support of nic or route, send them again one by one
+    }
+
+    if (ret < nmsg) {
+        for (i=first[ret < 0 ? 0 : ret]; i<ffrdp->txb_num; i++) {
+            if (!ffrdp->txb_node[i]) continue;
+            ffrdp->txb_node[i]->flags &= ~FLAG_FIRST_SEND;
+            ffrdp->swnd++; ffrdp->inflight--; ffrdp->counter_send_1sttime--;
+        }
+        ffrdp->counter_udpsenderr++;
+        ffrdp_congestion_control(ffrdp, CEVENT_SEND_FAILED);
+    } else ffrdp->counter_udpsenderr = 0;
+    ffrdp->txb_num = ffrdp->txb_niov = ffrdp->txb_used = 0;
+}
+#endif
+
+// sends the datagram made of iov, copy for memory reused before the batch of this update is flushed (fec parity)
+static int ffrdp_udp_send(FFRDPCONTEXT *ffrdp, FFRDP_IOVEC *iov, int niov, struct sockaddr_in *dstaddr, FFRDP_FRAME_NODE *first, int copy)
+{
+#ifdef __linux__
+    uint8_t *dst;
+    int      len, i;
+    if (ffrdp->txb_num == FFRDP_BATCH_SIZE) ffrdp_udp_flush(ffrdp, dstaddr);
+    dst = ffrdp->txb_data + ffrdp->txb_used;
+    ffrdp->txb_iovi[ffrdp->txb_num] = ffrdp->txb_niov;
+    if ((len = ffrdp_seal(ffrdp, dst, iov, niov)) < 0) return -1;
+    if (len == 0 && copy) {
+        for (i=0; i<niov; i++) { memcpy(dst + len, iov[i].buf, iov[i].len); len += iov[i].len; }
+    }
+    if (len > 0) {
+        ffrdp->txb_iov[ffrdp->txb_niov  ].iov_base = dst;
+        ffrdp->txb_iov[ffrdp->txb_niov++].iov_len  = len;
+        ffrdp->txb_used += len;
+    } else {
+        for (i=0; i<niov; i++) {
+            ffrdp->txb_iov[ffrdp->txb_niov  ].iov_base = iov[i].buf;
+            ffrdp->txb_iov[ffrdp->txb_niov++].iov_len  = iov[i].len;
+            len += iov[i].len;
+        }
+    }
+    ffrdp->txb_len [ffrdp->txb_num] = len;
+    ffrdp->txb_node[ffrdp->txb_num] = first;
+    ffrdp->txb_num++;
+    return 0;
+#else
+    uint8_t       buf[4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER + FFRDP_AEAD_OVERHEAD];
+    FFRDP_IOVEC   sealed;
+    int           len, ret, i;
+#ifdef WIN32
+    WSABUF        bufs[3];
+    DWORD         sent = 0;
+#else
+    struct iovec  iovs[3];
+    struct msghdr msg = {0};
+#endif
+    if ((len = ffrdp_seal(ffrdp, buf, iov, niov)) < 0) return -1;
+    if (len > 0) { sealed.buf = buf; sealed.len = len; iov = &sealed; niov = 1; }
+    for (len=0,i=0; i<niov; i++) len += iov[i].len;
+#ifdef WIN32
+    for (i=0; i<niov; i++) { bufs[i].buf = iov[i].buf; bufs[i].len = iov[i].len; }
+    ret = WSASendTo(ffrdp->udp_fd, bufs, niov, &sent, 0, (struct sockaddr*)dstaddr, dstaddr ? sizeof(struct sockaddr_in) : 0, NULL, NULL) == 0 ? (int)sent : -1;
+#else
+    for (i=0; i<niov; i++) { iovs[i].iov_base = iov[i].buf; iovs[i].iov_len = iov[i].len; }
+    msg.msg_name    = dstaddr;
+    msg.msg_namelen = dstaddr ? sizeof(struct sockaddr_in) : 0;
+    msg.msg_iov     = iovs;
+    msg.msg_iovlen  = niov;
+    ret = sendmsg(ffrdp->udp_fd, &msg, 0);
+#endif
+    if (ret != len) { ffrdp->counter_udpsenderr++; return -1; }
+    ffrdp->counter_udpsenderr = 0;
+    return 0;
+#endif
+}
+
+static void ffrdp_fec_flush(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr) // close current tx group, send its parity frames
+{
+    FFRDP_IOVEC iov;
+    uint8_t    *trailer;
+    int         j;
+    if (ffrdp->fec_txidx == 0) return;
+    for (j=0; j<ffrdp->fec_m; j++) {
+        trailer = ffrdp->fec_txbuf[j] + ffrdp->fec_txsize - FFRDP_FEC_TRAILER;
+        ffrdp->fec_txbuf[j][0] = FFRDP_FRAME_TYPE_FEC;
+        *(uint16_t*)trailer = ffrdp->fec_txgroup;
+        trailer[2] = ffrdp->fec_txidx + j;
+        trailer[3] = (ffrdp->fec_txidx - 1) | (ffrdp->fec_m << 5);
+        iov.buf = ffrdp->fec_txbuf[j]; iov.len = ffrdp->fec_txsize;
+        ffrdp_udp_send(ffrdp, &iov, 1, dstaddr, NULL, 1);
+        ffrdp->pace_tokens -= ffrdp->fec_txsize;
+        memset(ffrdp->fec_txbuf[j], 0, ffrdp->fec_txsize); // trailer too, next group may be larger
+        ffrdp->counter_fec_tx++;
+    }
+    ffrdp->fec_txgroup++; ffrdp->fec_txidx = 0;
+}
+
+static int ffrdp_send_data_frame(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *frame, struct sockaddr_in *dstaddr)
+{
+    FFRDP_IOVEC iov[3];
+    uint8_t    *trailer;
+    int         niov, j;
+    switch (frame->data[0]) {
+    case FFRDP_FRAME_TYPE_SHORT: ffrdp->counter_txshort++; break; // tx short frame
+    case FFRDP_FRAME_TYPE_GAP  : break;
+    case FFRDP_FRAME_TYPE_FEC  : // tx fec frame
+        if (ffrdp->fec_txidx && frame->size != ffrdp->fec_txsize) ffrdp_fec_flush(ffrdp, dstaddr); // frame of the old smss
+        if (ffrdp->fec_txidx == 0) { ffrdp->fec_m = ffrdp->fec_mnext; ffrdp->fec_txsize = frame->size; } // m only changes between groups
+        trailer = frame->data + frame->size - frame->ref_len - FFRDP_FEC_TRAILER;
+        *(uint16_t*)trailer = ffrdp->fec_txgroup;
+        trailer[2] = (uint8_t)ffrdp->fec_txidx;
+        trailer[3] = (ffrdp->fec_k - 1) | (ffrdp->fec_m << 5);
+        // fall through
+    default: ffrdp->counter_txfull++; break; // tx full frame
+    }
+    niov = frame_iov(frame, iov);
+    if (ffrdp_udp_send(ffrdp, iov, niov, dstaddr, (frame->flags & FLAG_FIRST_SEND) ? NULL : frame, 0) != 0) return -1;
+    frame->tx_order = ++ffrdp->tx_count;
+    if (frame->data[0] == FFRDP_FRAME_TYPE_FEC) { // parity of bytes [1, size - trailer)
+        for (j=0; j<ffrdp->fec_m; j++) {
+            rsfec_muladd(ffrdp->fec_txbuf[j] + 1, frame->data + 1, rsfec_coef(j, ffrdp->fec_txidx), iov[0].len - 1);
+            if (frame->ref_len) rsfec_muladd(ffrdp->fec_txbuf[j] + iov[0].len, frame->ref_data, rsfec_coef(j, ffrdp->fec_txidx), frame->ref_len);
+        }
+        if (++ffrdp->fec_txidx == ffrdp->fec_k) ffrdp_fec_flush(ffrdp, dstaddr);
+    }
+    return 0;
+}
+
+static int ffrdp_recv_enqueue(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *node) // put data frame to recv_ring, returns 0 if taken
+{
+    uint32_t seq  = GET_FRAME_SEQ(node);
+    int32_t  dist = seq_distance(seq, ffrdp->recv_seq);
+    if (dist < 0 || dist >= FFRDP_RECV_RING || (recv_bits_get(ffrdp, seq) & 1)) return -1; // streams mode keeps the bit of frames delivered out of order
+    RECV_SLOT(ffrdp, seq) = node; recv_bits_set(ffrdp, seq, 1);
+    if (seq_distance(seq, ffrdp->recv_max) >= 0) ffrdp->recv_max = (seq + 1) & 0xFFFFFF;
+    return 0;
+}
+
+static void ffrdp_fec_decode(FFRDPCONTEXT *ffrdp)
+{
+    FFRDP_FRAME_NODE *node;
+    uint8_t *shards[RSFEC_MAX_K + RSFEC_MAX_M];
+    uint64_t datamask = ((uint64_t)1 << ffrdp->fec_rxk) - 1, mask;
+    int      n, i;
+    for (i=0; i<ffrdp->fec_rxk; i++) shards[i] = ffrdp->fec_rxbuf[i] + 1;
+    for (i=0; i<ffrdp->fec_rxm; i++) shards[ffrdp->fec_rxk + i] = ffrdp->fec_rxbuf[RSFEC_MAX_K + i] + 1;
+    mask = (ffrdp->fec_rxmask & datamask) | ((ffrdp->fec_rxmask >> RSFEC_MAX_K) << ffrdp->fec_rxk);
+    n    = rsfec_decode(ffrdp->fec_rxk, ffrdp->fec_rxm, shards, mask, ffrdp->fec_rxsize - 1);
+    ffrdp->fec_rxdone = 1;
+    if (n < 0) { ffrdp->counter_fec_failed++; return; }
+    for (i=0; i<ffrdp->fec_rxk; i++) {
+        if ((ffrdp->fec_rxmask & ((uint64_t)1 << i)) || !(node = frame_node_new(RX_POOL(ffrdp), FFRDP_FRAME_TYPE_FEC, ffrdp->fec_rxsize - 4))) continue;
+        memcpy(node->data + 1, ffrdp->fec_rxbuf[i] + 1, ffrdp->fec_rxsize - 1);
+        if (ffrdp_recv_enqueue(ffrdp, node) != 0) frame_node_free(RX_POOL(ffrdp), node); // already got it by resend
+        ffrdp->counter_fec_ok++;
+    }
+}
+
+static void ffrdp_fec_account(FFRDPCONTEXT *ffrdp) // loss statistics of current rx group, called when it is closed
+{
+    int n, k, lost, i;
+    if (!ffrdp->fec_rxseen) return;
+    if (ffrdp->fec_rxk) k = ffrdp->fec_rxk;
+    else for (k=RSFEC_MAX_K; !(ffrdp->fec_rxseen & ((uint64_t)1 << (k - 1))); k--); // no parity received, data after the last one seen is unknown
+    n = k + ffrdp->fec_rxm;
+    for (lost=0,i=0; i<n; i++) {
+        if (ffrdp->fec_rxseen & ((uint64_t)1 << i)) continue;
+        lost++;
+        if (i == 0 || (ffrdp->fec_rxseen & ((uint64_t)1 << (i - 1)))) ffrdp->loss_bursts++;
+    }
+    for (i=0; i<k && (ffrdp->fec_rxseen & ((uint64_t)1 << i)); i++);
+    if (i < k && !ffrdp->fec_rxdone) { ffrdp->loss_failed++; ffrdp->counter_fec_failed++; }
+    ffrdp->loss_groups++; ffrdp->loss_total += n; ffrdp->loss_lost += lost;
+}
+
+static int ffrdp_recv_data_frame(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *frame)
+{
+    uint8_t *trailer;
+    uint64_t datamask;
+    int      size, group, idx, k, m, cnt, dist, i;
+    switch (frame->data[0]) {
+    case FFRDP_FRAME_TYPE_SHORT: ffrdp->counter_rxshort++; return 0; // short frame
+    case FFRDP_FRAME_TYPE_FULL : ffrdp->counter_rxfull ++; ffrdp->rmss = frame->size - 4; return 0; // full frame
+    case FFRDP_FRAME_TYPE_GAP  : // gap frame, a late one still drops the rest of its message
+        if (frame->size < 8 + FFRDP_STREAM_HDR(ffrdp)) return -1;
+        if (ffrdp->flags & FLAG_STREAMS) return 0; // frames of the message after recv_seq are skipped by their stream
+        if (seq_distance(GET_FRAME_SEQ(frame), ffrdp->recv_seq) < 0 && seq_distance(FFRDP_GAP_LAST(ffrdp, frame) & 0xFFFFFF, ffrdp->recv_seq) >= 0) {
+            if (RECV_SLOT(ffrdp, ffrdp->recv_seq)) {
+                frame_node_free(RX_POOL(ffrdp), RECV_SLOT(ffrdp, ffrdp->recv_seq));
+                RECV_SLOT(ffrdp, ffrdp->recv_seq) = NULL; recv_bits_set(ffrdp, ffrdp->recv_seq, 0);
+            }
+            SET_FRAME_SEQ(frame, ffrdp->recv_seq);
+        }
+        return 0;
+    }
+    if (frame->size <= 4 + FFRDP_FEC_TRAILER) return -1;
+    size    = frame->size - FFRDP_FEC_TRAILER;
+    trailer = frame->data + size;
+    group   = *(uint16_t*)trailer; idx = trailer[2];
+    k       = (trailer[3] & 31) + 1; m = trailer[3] >> 5;
+    if (idx >= k + m) return -1;
+    dist = (int16_t)(group - ffrdp->fec_rxgroup);
+    if (dist != 0 || size != ffrdp->fec_rxsize) { // new group
+        if (dist < 0 && dist > -64 && ffrdp->fec_rxseen && size == ffrdp->fec_rxsize) { // late frame of an old group, only deliver it
+            if (idx >= k) return -1;
+            ffrdp->counter_rxfull++;
+            return 0;
+        }
+        ffrdp_fec_account(ffrdp);
+        if (ffrdp->fec_rxseen && dist > 1 && dist < 64) { // whole groups lost
+            ffrdp->loss_groups += dist - 1; ffrdp->loss_total += (dist - 1) * (k + m); ffrdp->loss_lost += (dist - 1) * (k + m);
+            ffrdp->loss_bursts++; ffrdp->loss_failed += dist - 1;
+        }
+        ffrdp->fec_rxgroup = group; ffrdp->fec_rxsize = size;
+        ffrdp->fec_rxmask  = ffrdp->fec_rxseen = 0; ffrdp->fec_rxk = ffrdp->fec_rxm = 0; ffrdp->fec_rxdone = 0;
+    }
+    ffrdp->fec_rxseen |= (uint64_t)1 << idx;
+    if (idx < k) { // data frame, it is delivered as usual, and kept for recovery of others
+        ffrdp->counter_rxfull++; ffrdp->rmss = size - 4;
+        if (!ffrdp->fec_rxk) ffrdp->fec_rxm = m;
+        if (!ffrdp->fec_rxdone && m && !(ffrdp->fec_rxmask & ((uint64_t)1 << idx))) {
+            memcpy(ffrdp->fec_rxbuf[idx], frame->data, size);
+            ffrdp->fec_rxmask |= (uint64_t)1 << idx;
+        }
+    } else { // parity frame, tells the real k of the group
+        ffrdp->counter_fec_rx++;
+        ffrdp->fec_rxk = k; ffrdp->fec_rxm = m;
+        if (!ffrdp->fec_rxdone && !(ffrdp->fec_rxmask & ((uint64_t)1 << (RSFEC_MAX_K + idx - k)))) {
+            memcpy(ffrdp->fec_rxbuf[RSFEC_MAX_K + idx - k], frame->data, size);
+            ffrdp->fec_rxmask |= (uint64_t)1 << (RSFEC_MAX_K + idx - k);
+        }
+    }
+    if (ffrdp->fec_rxk && !ffrdp->fec_rxdone) {
+        datamask = ((uint64_t)1 << ffrdp->fec_rxk) - 1;
+        for (cnt=0,i=0; i<RSFEC_MAX_K+RSFEC_MAX_M; i++) cnt += (int)(ffrdp->fec_rxmask >> i) & 1;
+        if ((ffrdp->fec_rxmask & datamask) == datamask) ffrdp->fec_rxdone = 1; // nothing lost
+        else if (cnt >= ffrdp->fec_rxk) ffrdp_fec_decode(ffrdp);
+    }
+    return idx < k ? 0 : -1;
+}
+
+static double binomial_tail(int n, double p, int x) // probability of more than x successes in n trials
+{
+    double term = 1, sum = 0, q = 1 - p;
+    int    i;
+    if (x >= n) return 0;
+    for (i=0; i<n; i++) term *= q; // i = 0
+    for (i=0; i<=x; i++) {
+        sum += term;
+        term = term * (n - i) / (i + 1) * p / q;
+    }
+    return MAX(0, 1 - sum);
+}
+
+static void ffrdp_fec_adapt(FFRDPCONTEXT *ffrdp, uint8_t *report) // handle loss report from receiver
+{
+    int    groups = *(uint16_t*)(report + 2), total = *(uint16_t*)(report + 4), lost = *(uint16_t*)(report + 6);
+    int    bursts = *(uint16_t*)(report + 8), failed = *(uint16_t*)(report + 10), m;
+    double p, b;
+    if (total == 0 || groups == 0) return;
+    ffrdp->fec_lossppm = (7 * ffrdp->fec_lossppm + (uint32_t)((int64_t)1000000 * lost / total)) / 8;
+    if (bursts) ffrdp->fec_burst = (7 * ffrdp->fec_burst + 100 * lost / bursts) / 8;
+    ffrdp->fec_burst = MAX(ffrdp->fec_burst, 100);
+    if ((int64_t)1000000 * failed / groups > ffrdp->fec_target) ffrdp->fec_bias = MIN(ffrdp->fec_bias + 1, 3); // model too optimistic
+    else if (failed == 0 && ffrdp->fec_bias > 0 && ffrdp->fec_lossppm < 1000) ffrdp->fec_bias--;
+    if (!ffrdp->fec_auto) return;
+
+    p = ffrdp->fec_lossppm / 1000000.0;
+    b = ffrdp->fec_burst   / 100.0;
+    for (m=0; m<FFRDP_FEC_MAX_M; m++) { // loss bursts start with probability p / b, each one takes b frames
+        if (binomial_tail(ffrdp->fec_k + m, MIN(p / b, 0.99), (int)(m / b)) * 1000000 <= ffrdp->fec_target) break;
+    }
+    ffrdp->fec_mnext = MIN(m + ffrdp->fec_bias, FFRDP_FEC_MAX_M);
+}
+
+static FFRDPCONTEXT* ffrdp_new(int smss, int sfec)
+{
+    FFRDPCONTEXT *ffrdp = calloc(1, sizeof(FFRDPCONTEXT));
+    if (!ffrdp) return NULL;
+    if (!(ffrdp->rx[0].buff = malloc(FFRDP_RECVBUF_SIZE))) { free(ffrdp); return NULL; }
+    ffrdp->rx[0].bsize= FFRDP_RECVBUF_SIZE;
+    ffrdp->swnd     = FFRDP_DEF_CWND_SIZE;
+    ffrdp->rtts     = (uint32_t) -1;
+    ffrdp->rtt_min  = (uint32_t) -1;
+    ffrdp->cc       = &s_ffrdp_cc[FFRDP_CC_AIMD];
+    ffrdp->cc->init(ffrdp);
+    ffrdp->rto      = FFRDP_MIN_RTO;
+    ffrdp->rmss     = FFRDP_MAX_MSS;
+    ffrdp->smss     = MAX(1, MIN(smss, FFRDP_MAX_MSS));
+    if (sfec >= 256) { // FFRDP_FEC(k, m)
+        ffrdp->fec_k = MAX(1, MIN(sfec & 0xFF, RSFEC_MAX_K));
+        ffrdp->fec_m = MAX(1, MIN(sfec >> 8  , FFRDP_FEC_MAX_M));
+    } else if (sfec >= 2) { // old xor fec redundancy, sfec - 1 data frames and 1 parity frame
+        ffrdp->fec_k = MIN(sfec - 1, RSFEC_MAX_K);
+        ffrdp->fec_m = 1;
+    }
+    if (ffrdp->fec_k) rsfec_init();
+    ffrdp->fec_mnext  = ffrdp->fec_m;
+    ffrdp->fec_auto   = 1;
+    ffrdp->fec_target = FFRDP_FEC_TARGET;
+    ffrdp->fec_burst  = 100;
+    ffrdp->tick_recv  = ffrdp->tick_create = get_tick_count();
+    ffrdp->update_wait= FFRDP_SELECT_TIMEOUT;
+    ffrdp->coalesce_us= FFRDP_FLUSH_TIMEOUT * 1000;
+    ffrdp->tick_ffrdp_dump  = get_tick_count();
+    return ffrdp;
+}
+
+// ffrdp has no connection id, a session is known by its source address. the shard of ffrdp_listen_shard is this hash
+// mod nshards (the bpf program of ffrdp_steering does the same), the bucket of peer_hash is taken from the quotient
+static uint32_t ffrdp_addr_hash(struct sockaddr_in *addr)
+{
+    return ((ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port)) * 0x9E3779B1) >> 16;
+}
+#define PEER_BUCKET(listener, addr) (ffrdp_addr_hash(addr) / MAX((listener)->nshards, 1) & (FFRDP_PEER_HASH - 1))
+
+// find the peer of srcaddr, a new peer is created for an unknown address and waits for ffrdp_accept. only a data frame,
+// which is authenticated if rx key is set, creates it, so stray acks and queries or forged frames do not take peer slots
+static FFRDPCONTEXT* ffrdp_peer_get(FFRDPCONTEXT *listener, struct sockaddr_in *srcaddr, uint8_t type)
+{
+    FFRDPCONTEXT *peer, **bucket = &listener->peer_hash[PEER_BUCKET(listener, srcaddr)];
+    for (peer=*bucket; peer; peer=peer->peer_hnext) {
+        if (peer->server_addr.sin_addr.s_addr == srcaddr->sin_addr.s_addr && peer->server_addr.sin_port == srcaddr->sin_port) return peer;
+    }
+    if (type > FFRDP_FRAME_TYPE_GAP || listener->peer_num >= FFRDP_MAX_PEERS || !(peer = ffrdp_new(listener->smss, 0))) return NULL;
+    peer->flags       = FLAG_SERVER|FLAG_CONNECTED|FLAG_PEER|FLAG_ACCEPT|(listener->flags & (FLAG_TX_AES256|FLAG_RX_AES256));
+    peer->udp_fd      = listener->udp_fd;
+    peer->server_addr = *srcaddr;
+    peer->listener    = listener;
+    peer->fec_k       = listener->fec_k;
+    peer->fec_m       = peer->fec_mnext = listener->fec_m;
+    peer->fec_auto    = listener->fec_auto;
+    peer->fec_target  = listener->fec_target;
+    peer->flags      |= listener->flags & (FLAG_NO_PACING|FLAG_EXT_OFF|FLAG_STREAMS);
+    peer->coalesce_us = listener->coalesce_us;
+    peer->msg_streams = listener->msg_streams;
+    peer->cc          = listener->cc;
+    peer->cc->init(peer);
+#ifdef __linux__
+    peer->txb_gso     = listener->txb_gso;
+#endif
+    pthread_mutex_init(&peer->lock, NULL);
+    peer->pmtu_max    = listener->pmtu_max;
+    ffrdp_pmtu_reset(peer, listener->pmtu_state == PMTU_OFF ? PMTU_OFF : PMTU_BASE);
+    peer->peer_next     = listener->peer_next;
+    listener->peer_next = peer;
+    peer->peer_hnext    = *bucket;
+    *bucket             = peer;
+    listener->peer_num++;
+    return peer;
+}
+
+#ifdef __linux__
+// classic bpf program of the SO_REUSEPORT group, runs on the udp payload with the ip header at SKF_NET_OFF and
+// returns the index of the socket, which is the order of bind, so shard i must be bound i-th
+static int ffrdp_steering(SOCKET fd, int nshards)
+{
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, SKF_NET_OFF),      // X = ip header len
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, SKF_NET_OFF),      // A = udp source port
+        BPF_STMT(BPF_MISC| BPF_TAX, 0),
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_NET_OFF + 12), // A = ip source address
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)nshards),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+#endif
+
+static FFRDPCONTEXT* ffrdp_open(char *ip, int port, char *txkey, char *rxkey, int server, int smss, int sfec, int nshards)
+{
+    FFRDPCONTEXT *ffrdp = NULL;
+    unsigned long opt;
+#ifdef __linux__
+    socklen_t optlen;
+    int       gso;
+#endif
+#ifdef WIN32
+    WSADATA wsaData;
+    timeBeginPeriod(1);
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed !\n");
+        return NULL;
+    }
+#endif
+
+    if (!(ffrdp = ffrdp_new(smss, sfec))) return NULL;
+
+    ffrdp->server_addr.sin_family      = AF_INET;
+    ffrdp->server_addr.sin_port        = htons(port);
+    ffrdp->server_addr.sin_addr.s_addr = inet_addr(ip);
+    ffrdp->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ffrdp->udp_fd < 0) {
+        printf("failed to open socket !\n");
+        goto failed;
+    }
+
+#ifdef WIN32
+    opt = 1; ioctlsocket(ffrdp->udp_fd, FIONBIO, &opt); // setup non-block io mode
+#else
+    fcntl(ffrdp->udp_fd, F_SETFL, fcntl(ffrdp->udp_fd, F_GETFL, 0) | O_NONBLOCK);  // setup non-block io mode
+#endif
+    opt = FFRDP_UDPSBUF_SIZE; setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_SNDBUF   , (char*)&opt, sizeof(int)); // setup udp send buffer size
+    opt = FFRDP_UDPRBUF_SIZE; setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_RCVBUF   , (char*)&opt, sizeof(int)); // setup udp recv buffer size
+    opt = 1; if (server)      setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(int)); // setup reuse addr, clients would share ephemeral ports with it
+#ifdef __linux__
+    if (nshards > 1 && setsockopt(ffrdp->udp_fd, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(int)) != 0) {
+        printf("failed to setup SO_REUSEPORT !\n");
+        goto failed;
+    }
+    optlen = sizeof(gso); ffrdp->txb_gso = getsockopt(ffrdp->udp_fd, SOL_UDP, UDP_SEGMENT, (char*)&gso, &optlen) == 0; // kernel supports udp gso
+#endif
+
+    if (server) {
+        ffrdp->flags |= FLAG_SERVER;
+        if (bind(ffrdp->udp_fd, (struct sockaddr*)&ffrdp->server_addr, sizeof(ffrdp->server_addr)) == -1) {
+            printf("failed to bind !\n");
+            goto failed;
+        }
+#ifdef __linux__ // without the program sessions still stay on one shard, the kernel hashes their addresses
+        if (nshards > 1 && !(ffrdp->steering = ffrdp_steering(ffrdp->udp_fd, nshards))) printf("failed to attach reuseport steering, kernel hash is used !\n");
+#endif
+    }
+
+    if (txkey) {
+#ifdef CONFIG_ENABLE_AES256
+        ffrdp->flags |= FLAG_TX_AES256;
+        ffrdp->smss   = MIN(ffrdp->smss, FFRDP_MAX_MSS - FFRDP_AEAD_OVERHEAD); // sealed frames keep the max datagram size
+        if (!(ffrdp->aead_tx = aead_new(txkey, 1)) || RAND_bytes((uint8_t*)&ffrdp->aead_nonce, sizeof(ffrdp->aead_nonce)) != 1) {
+            printf("failed to setup aes-256-gcm !\n");
+            goto failed;
+        }
+#endif
+    }
+    if (rxkey) {
+#ifdef CONFIG_ENABLE_AES256
+        ffrdp->flags |= FLAG_RX_AES256;
+        if (!(ffrdp->aead_rx = aead_new(rxkey, 0))) {
+            printf("failed to setup aes-256-gcm !\n");
+            goto failed;
+        }
+#endif
+    }
+    pthread_mutex_init(&ffrdp->lock, NULL);
+    ffrdp->pmtu_max = FFRDP_FRAME_OVERHEAD(ffrdp) + ffrdp->smss;
+    ffrdp_pmtu_reset(ffrdp, PMTU_BASE);
+    return ffrdp;
 
+failed:
+    if (ffrdp->udp_fd > 0) closesocket(ffrdp->udp_fd);
+#ifdef CONFIG_ENABLE_AES256
+    EVP_CIPHER_CTX_free(ffrdp->aead_tx);
+    EVP_CIPHER_CTX_free(ffrdp->aead_rx);
+#endif
+    free(ffrdp->rx[0].buff);
+    free(ffrdp);
+    return NULL;
+}
+
+void* ffrdp_init(char *ip, int port, char *txkey, char *rxkey, int server, int smss, int sfec)
+{
+    return ffrdp_open(ip, port, txkey, rxkey, server, smss, sfec, 1);
+}
+
+void ffrdp_free(void *ctxt)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt, **pp;
+    FFRDP_FRAME_NODE *p;
+    uint32_t      i;
+    if (!ctxt) return;
+    if (ffrdp->flags & FLAG_PEER) { // unlink from listener, socket belongs to listener
+        for (pp=&ffrdp->listener->peer_next; *pp && *pp != ffrdp; pp=&(*pp)->peer_next);
+        if (*pp) { *pp = ffrdp->peer_next; ffrdp->listener->peer_num--; }
+        for (pp=&ffrdp->listener->peer_hash[PEER_BUCKET(ffrdp->listener, &ffrdp->server_addr)]; *pp && *pp != ffrdp; pp=&(*pp)->peer_hnext);
+        if (*pp) *pp = ffrdp->peer_hnext;
+    } else {
+        while (ffrdp->peer_next) ffrdp_free(ffrdp->peer_next);
+        if (ffrdp->udp_fd > 0) closesocket(ffrdp->udp_fd);
+#ifdef CONFIG_ENABLE_AES256
+        EVP_CIPHER_CTX_free(ffrdp->aead_tx);
+        EVP_CIPHER_CTX_free(ffrdp->aead_rx);
+#endif
+    }
+    if (ffrdp->cur_new_node) frame_node_free(&ffrdp->tx_pool, ffrdp->cur_new_node);
+    for (i=ffrdp->send_una; i!=ffrdp->send_seq; i++) {
+        if (SEND_SLOT(ffrdp, i)) frame_node_free(&ffrdp->tx_pool, SEND_SLOT(ffrdp, i));
+    }
+    for (i=0; i<FFRDP_RECV_RING; i++) {
+        if (ffrdp->recv_ring[i]) frame_node_free(RX_POOL(ffrdp), ffrdp->recv_ring[i]);
+    }
+    for (i=0; i<FFRDP_MAX_STREAMS; i++) { // messages not freed by application are gone with the pool
+        while ((p = ffrdp->rx[i].msg_head)) { ffrdp->rx[i].msg_head = p->next; frame_node_free(RX_POOL(ffrdp), p); }
+    }
+    while ((p = ffrdp->msg_freed)) { ffrdp->msg_freed = p->next; frame_node_free(RX_POOL(ffrdp), p); }
+    node_pool_free(&ffrdp->tx_pool);
+    node_pool_free(&ffrdp->rx_pool);
+    pthread_mutex_destroy(&ffrdp->lock);
+    if (!(ffrdp->flags & FLAG_PEER)) {
+#ifdef WIN32
+        WSACleanup();
+        timeEndPeriod(1);
+#endif
+    }
+    for (i=0; i<FFRDP_MAX_STREAMS; i++) free(ffrdp->rx[i].buff);
+    free(ffrdp);
+}
+
+void* ffrdp_listen(char *ip, int port, char *txkey, char *rxkey, int smss, int sfec)
+{
+    return ffrdp_listen_shard(ip, port, txkey, rxkey, smss, sfec, 0, 1);
+}
+
+void* ffrdp_listen_shard(char *ip, int port, char *txkey, char *rxkey, int smss, int sfec, int shard, int nshards)
+{
+    FFRDPCONTEXT *ffrdp;
+    if (shard < 0 || shard >= nshards) return NULL;
+#ifndef __linux__
+    if (nshards > 1) { printf("ffrdp shards need SO_REUSEPORT of linux !\n"); return NULL; }
+#endif
+    ffrdp = ffrdp_open(ip, port, txkey, rxkey, 1, smss, sfec, nshards);
+    if (ffrdp) {
+        ffrdp->flags  |= FLAG_LISTEN|FLAG_CONNECTED; // never connect() the shared socket
+        ffrdp->shard   = shard;
+        ffrdp->nshards = nshards;
+    }
+    return ffrdp;
+}
+
+void* ffrdp_accept(void *ctxt)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt, *peer;
+    if (!ctxt) return NULL;
+    for (peer=ffrdp->peer_next; peer && !(peer->flags & FLAG_ACCEPT); peer=peer->peer_next);
+    if (peer) peer->flags &= ~FLAG_ACCEPT;
+    return peer;
+}
+
+void ffrdp_buf_ref(FFRDP_BUF *buf)
+{
+    if (buf) atomic_add(&buf->refs, 1);
+}
+
+void ffrdp_buf_unref(FFRDP_BUF *buf)
+{
+    if (buf && atomic_add(&buf->refs, -1) == 0 && buf->release) buf->release(buf);
+}
+
+// called with lock held, the partial frame is of stream 0. bytes of ref fill the rest of a frame without copy,
+// the frame is full then. the part smaller than the space left is copied, so frames are never cut short
+static int ffrdp_send_data(FFRDPCONTEXT *ffrdp, int stream, char *buf, int len, FFRDP_BUF *ref)
+{
+    int n = len, size;
+    while (n > 0) {
+        if (!ffrdp->cur_new_node) {
+            if (!(ffrdp->cur_new_node = frame_node_new(&ffrdp->tx_pool, ffrdp->fec_k ? FFRDP_FRAME_TYPE_FEC : FFRDP_FRAME_TYPE_FULL, ffrdp->smss))) break;
+            SET_FRAME_SEQ(ffrdp->cur_new_node, ffrdp->send_seq);
+            ffrdp->cur_new_us = get_tick_us();
+            if ((ffrdp->cur_new_size = FFRDP_STREAM_HDR(ffrdp))) {
+                ffrdp->cur_new_node->data[4] = stream; ffrdp->cur_new_node->data[5] = 0;
+                *(uint16_t*)(ffrdp->cur_new_node->data + 6) = ffrdp->tx_sseq[stream]++;
+            }
+        }
+        size = MIN(n, (int)(ffrdp->smss - ffrdp->cur_new_size));
+        if (ref && size == (int)(ffrdp->smss - ffrdp->cur_new_size) && size >= FFRDP_MIN_REF) {
+            ffrdp_buf_ref(ref);
+            ffrdp->cur_new_node->ref      = ref;
+            ffrdp->cur_new_node->ref_data = (uint8_t*)buf;
+            ffrdp->cur_new_node->ref_len  = size;
+        } else memcpy(ffrdp->cur_new_node->data + 4 + ffrdp->cur_new_size, buf, size);
+        ffrdp->cur_new_size += size; buf += size; n -= size;
+        if (ffrdp->cur_new_size == ffrdp->smss) {
+            send_enqueue(ffrdp, ffrdp->cur_new_node);
+            ffrdp->cur_new_node = NULL;
+            ffrdp->cur_new_size = 0;
+        }
+    }
+    return len - n;
+}
+
+#define FRAME_CAPACITY(ffrdp) ((int)(ffrdp)->smss - FFRDP_STREAM_HDR(ffrdp)) // payload bytes of a full frame
+
+static int ffrdp_send_check(FFRDPCONTEXT *ffrdp, int frames)
+{
+    if (  !ffrdp || ((ffrdp->flags & FLAG_SERVER) && (ffrdp->flags & FLAG_CONNECTED) == 0) || (ffrdp->flags & FLAG_LISTEN)
+        || (frames + ffrdp->wait_snd > FFRDP_MAX_WAITSND) || (frames + 1 + (int)(ffrdp->send_seq - ffrdp->send_una) > FFRDP_SEND_RING)) { // frames acked after a lost one do not free its slot
+        if (ffrdp) ffrdp->counter_send_failed++;
+        return -1;
+    }
+    return 0;
+}
+
+static int iov_total(FFRDP_IOVEC *iov, int n)
+{
+    int len = 0, i;
+    for (i=0; i<n; i++) len += iov[i].len;
+    return len;
+}
+
+static int ffrdp_send_iov(FFRDPCONTEXT *ffrdp, int stream, FFRDP_IOVEC *iov, int n) // called with lock held
+{
+    int ret = 0, i;
+    for (i=0; i<n; i++) ret += ffrdp_send_data(ffrdp, stream, iov[i].buf, iov[i].len, iov[i].ref);
+    return ret;
+}
+
+int ffrdp_sendv(void *ctxt, FFRDP_IOVEC *iov, int n)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    int           len   = iov_total(iov, n), ret;
+    if (!ffrdp) return -1;
+    pthread_mutex_lock(&ffrdp->lock); // smss is changed by path mtu discovery
+    if ((ret = ffrdp_send_check(ffrdp, (len + FRAME_CAPACITY(ffrdp) - 1) / FRAME_CAPACITY(ffrdp))) == 0) {
+        ret = ffrdp_send_iov(ffrdp, 0, iov, n);
+        if (ffrdp->coalesce_us == 0) send_close_tail(ffrdp); // message mode, its tail goes with next update
+    }
+    pthread_mutex_unlock(&ffrdp->lock);
+    return ret;
+}
+
+int ffrdp_send(void *ctxt, char *buf, int len)
+{
+    FFRDP_IOVEC iov = { buf, len };
+    return ffrdp_sendv(ctxt, &iov, 1);
+}
+
+int ffrdp_stream_sendv(void *ctxt, int stream, FFRDP_IOVEC *iov, int n, int deadline, int prio)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    uint32_t      first, seq, tick;
+    int           len   = iov_total(iov, n), ret;
+    if (!ffrdp || stream < 0 || stream >= FFRDP_MAX_STREAMS || (stream && !(ffrdp->flags & FLAG_STREAMS))) return -1;
+    pthread_mutex_lock(&ffrdp->lock); // smss is changed by path mtu discovery
+    if (ffrdp_send_check(ffrdp, (len + FRAME_CAPACITY(ffrdp) - 1) / FRAME_CAPACITY(ffrdp) + 1) != 0) { // and the tail before it
+        pthread_mutex_unlock(&ffrdp->lock);
+        return -1;
+    }
+    send_close_tail(ffrdp); // message starts in a new frame
+    first = ffrdp->send_seq;
+    ret   = ffrdp_send_iov(ffrdp, stream, iov, n);
+    send_close_tail(ffrdp);
+    if (FFRDP_STREAM_HDR(ffrdp) && first != ffrdp->send_seq) SEND_SLOT(ffrdp, ffrdp->send_seq - 1)->data[5] |= FFRDP_SFLAG_END;
+    if (deadline > 0 && prio != FFRDP_PRIO_HIGH) {
+        tick = get_tick_count() + deadline;
+        for (seq=first; seq!=ffrdp->send_seq; seq++) {
+            SEND_SLOT(ffrdp, seq)->flags        |= FLAG_DROPPABLE;
+            SEND_SLOT(ffrdp, seq)->tick_deadline = tick;
+            SEND_SLOT(ffrdp, seq)->msg_last      = ffrdp->send_seq - 1;
+        }
+    }
+    if (prio == FFRDP_PRIO_URGENT && first != ffrdp->send_seq) {
+        for (seq=first; seq!=ffrdp->send_seq; seq++) SEND_SLOT(ffrdp, seq)->flags |= FLAG_URGENT;
+        ffrdp->urgent_end = ffrdp->send_seq;
+    }
+    pthread_mutex_unlock(&ffrdp->lock);
+    return ret;
+}
+
+int ffrdp_stream_send(void *ctxt, int stream, char *buf, int len, int deadline, int prio)
+{
+    FFRDP_IOVEC iov = { buf, len };
+    return ffrdp_stream_sendv(ctxt, stream, &iov, 1, deadline, prio);
+}
+
+int ffrdp_sendmsg(void *ctxt, char *buf, int len, int deadline, int prio)
+{
+    return ffrdp_stream_send(ctxt, 0, buf, len, deadline, prio);
+}
+
+int ffrdp_stream_recv(void *ctxt, int stream, char *buf, int len)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    FFRDP_STREAM *s;
+    int           ret;
+    if (!ctxt || stream < 0 || stream >= FFRDP_MAX_STREAMS) return -1;
     pthread_mutex_lock(&ffrdp->lock);
-    if (ffrdp->cur_new_node && ((int32_t)get_tick_count() - (int32_t)ffrdp->cur_new_tick > FFRDP_FLUSH_TIMEOUT || ffrdp->flags & FLAG_FLUSH)) {
-        ffrdp->cur_new_node->data[0] = FFRDP_FRAME_TYPE_SHORT;
-        ffrdp->cur_new_node->size    = 4 + ffrdp->cur_new_size;
-        list_enqueue(&ffrdp->send_list_head, &ffrdp->send_list_tail, ffrdp->cur_new_node);
-        ffrdp->send_seq++; ffrdp->wait_snd++;
-        ffrdp->cur_new_node = NULL;
-        ffrdp->cur_new_size = 0;
+    s   = &ffrdp->rx[stream];
+    ret = MIN(len, s->size);
+    if (s->gap_num) { // stop at the next gap, report it when it is reached
+        if (s->gaps[s->gap_head] == s->rpos) {
+            s->gap_head = (s->gap_head + 1) % FFRDP_MAX_GAPS; s->gap_num--;
+            ret = FFRDP_RECV_GAP;
+        } else ret = MIN(ret, (int)(s->gaps[s->gap_head] - s->rpos));
+    }
+    if (ret > 0) {
+        s->head  = ringbuf_read(s->buff, s->bsize, s->head, (uint8_t*)buf, ret);
+        s->size -= ret; s->rpos += ret; ffrdp->counter_recv_bytes += ret;
     }
     pthread_mutex_unlock(&ffrdp->lock);
+    return ret;
+}
+
+int ffrdp_recv(void *ctxt, char *buf, int len)
+{
+    return ffrdp_stream_recv(ctxt, 0, buf, len);
+}
+
+int ffrdp_msg_recv(void *ctxt, int stream, FFRDP_MSG *msg)
+{
+    FFRDPCONTEXT     *ffrdp = (FFRDPCONTEXT*)ctxt;
+    FFRDP_FRAME_NODE *p, *next;
+    FFRDP_STREAM     *s;
+    int               ret = 0;
+    if (!ctxt || !msg || stream < 0 || stream >= FFRDP_MAX_STREAMS) return -1;
+    memset(msg, 0, sizeof(FFRDP_MSG));
+    pthread_mutex_lock(&ffrdp->lock);
+    s = &ffrdp->rx[stream];
+    if (s->msg_last) {
+        for (p=s->msg_head; p->data[0] != FFRDP_FRAME_TYPE_GAP && !(p->data[5] & FFRDP_SFLAG_END); p=p->next) {
+            ret += frame_payload_size(ffrdp, p); msg->nseg++;
+        }
+        next = p->next;
+        if (p->data[0] != FFRDP_FRAME_TYPE_GAP) {
+            ret += frame_payload_size(ffrdp, p); msg->nseg++;
+            msg->ctxt   = ffrdp;
+            msg->frames = s->msg_head;
+            msg->len    = ret;
+            ffrdp->counter_recv_bytes += ret;
+            p->next = NULL;
+        } else { // gap frames are not part of messages
+            p->next = ffrdp->msg_freed; ffrdp->msg_freed = p; s->msg_frames--;
+            ret = FFRDP_RECV_GAP;
+        }
+        if (p == s->msg_last) s->msg_last = NULL; // frames after it are of a partial message
+        if (!(s->msg_head = next)) s->msg_tail = NULL;
+    }
+    pthread_mutex_unlock(&ffrdp->lock);
+    return ret;
+}
+
+int ffrdp_msg_iov(FFRDP_MSG *msg, FFRDP_IOVEC *iov, int n)
+{
+    FFRDP_FRAME_NODE *p;
+    int               i;
+    if (!msg || !msg->frames) return 0;
+    for (p=msg->frames,i=0; p && i<n; p=p->next,i++) {
+        iov[i].buf = p->data + 8;
+        iov[i].len = frame_payload_size(msg->ctxt, p);
+        iov[i].ref = NULL;
+    }
+    return msg->nseg;
+}
 
-    for (i=0,p=ffrdp->send_list_head; i<(int32_t)ffrdp->cwnd&&p; i++,p=p->next) {
+int ffrdp_msg_read(FFRDP_MSG *msg, int off, char *buf, int len)
+{
+    FFRDP_FRAME_NODE *p;
+    int               size, n, ret = 0;
+    if (!msg || !msg->frames) return 0;
+    for (p=msg->frames; p && len>0; p=p->next) {
+        size = frame_payload_size(msg->ctxt, p);
+        if (off >= size) { off -= size; continue; }
+        n = MIN(len, size - off);
+        memcpy(buf + ret, p->data + 8 + off, n);
+        ret += n; len -= n; off = 0;
+    }
+    return ret;
+}
+
+void ffrdp_msg_free(FFRDP_MSG *msg)
+{
+    FFRDPCONTEXT     *ffrdp;
+    FFRDP_FRAME_NODE *p;
+    if (!msg || !msg->frames) return;
+    ffrdp = (FFRDPCONTEXT*)msg->ctxt;
+    p     = msg->frames;
+    pthread_mutex_lock(&ffrdp->lock); // frames go back to pool in ffrdp_update, the pool belongs to its thread
+    ffrdp->rx[p->data[4] % FFRDP_MAX_STREAMS].msg_frames -= msg->nseg;
+    while (p->next) p = p->next;
+    p->next = ffrdp->msg_freed; ffrdp->msg_freed = msg->frames;
+    pthread_mutex_unlock(&ffrdp->lock);
+    msg->frames = NULL;
+}
+
+int ffrdp_isdead(void *ctxt)
+{
+    FFRDPCONTEXT     *ffrdp = (FFRDPCONTEXT*)ctxt;
+    FFRDP_FRAME_NODE *head;
+    if (!ctxt) return -1;
+    if (!(ffrdp->flags & FLAG_LISTEN) && (ffrdp->flags & (FLAG_SERVER|FLAG_CONNECTED)) != FLAG_SERVER // not a server waiting for its client
+        && (int32_t)get_tick_count() - (int32_t)ffrdp->tick_recv > FFRDP_DEAD_TIMEOUT) return 1; // idle ones get keepalive acks
+    if (!(head = send_head(ffrdp))) return 0;
+    if (head->flags & FLAG_FIRST_SEND) {
+        return (int32_t)get_tick_count() - (int32_t)head->tick_1sts > FFRDP_DEAD_TIMEOUT;
+    } else {
+        return (int32_t)ffrdp->tick_send_query - (int32_t)ffrdp->tick_recv_ack > FFRDP_DEAD_TIMEOUT || ffrdp->counter_udpsenderr > DEADLINK_SENDERR_THRESHOLD;
+    }
+}
+
+// streams mode: frames of [recv_seq, recv_max) are delivered as soon as they are next of their stream, their slots
+// become NULL with received bits kept for selective ack, recv_seq then moves over them. called with lock held
+static void ffrdp_stream_deliver(FFRDPCONTEXT *ffrdp)
+{
+    FFRDP_FRAME_NODE *p;
+    FFRDP_STREAM     *s;
+    uint32_t seq, cov;
+    int32_t  dist, msg, n;
+    for (seq=ffrdp->recv_seq; seq_distance(seq, ffrdp->recv_max) < 0; seq=(seq+1)&0xFFFFFF) {
+        if (!(p = RECV_SLOT(ffrdp, seq))) continue;
+        s    = &ffrdp->rx[p->data[4] % FFRDP_MAX_STREAMS];
+        msg  = ffrdp->msg_streams & (1 << (p->data[4] % FFRDP_MAX_STREAMS));
+        dist = (int16_t)(*(uint16_t*)(p->data + 6) - s->next);
+        if (dist > 0) continue; // waits for an older frame of its stream
+        if (dist == 0 && p->data[0] == FFRDP_FRAME_TYPE_GAP) { // a dropped message, its other frames are taken as received
+            if (msg ? stream_msg_put(ffrdp, s, p) != 0 : stream_gap(s) != 0) continue;
+            n = seq_distance(FFRDP_GAP_LAST(ffrdp, p) & 0xFFFFFF, seq);
+            n = n < 0 || n + seq_distance(seq, ffrdp->recv_seq) >= FFRDP_RECV_RING ? 0 : n;
+            for (cov=(seq+1)&0xFFFFFF; cov!=((seq+n+1)&0xFFFFFF); cov=(cov+1)&0xFFFFFF) {
+                if (RECV_SLOT(ffrdp, cov)) { frame_node_free(RX_POOL(ffrdp), RECV_SLOT(ffrdp, cov)); RECV_SLOT(ffrdp, cov) = NULL; }
+                recv_bits_set(ffrdp, cov, 1);
+            }
+            if (seq_distance(cov, ffrdp->recv_max) > 0) ffrdp->recv_max = cov;
+            s->next += n + 1;
+        } else if (dist == 0) {
+            if (msg ? stream_msg_put(ffrdp, s, p) != 0 : stream_write(ffrdp, s, p->data + 8, frame_payload_size(ffrdp, p)) != 0) continue; // only this stream waits
+            s->next++;
+        } else msg = 0; // dist < 0, late frame of a dropped message
+        RECV_SLOT(ffrdp, seq) = NULL;
+        if (!msg) frame_node_free(RX_POOL(ffrdp), p); // frames of message mode are kept by stream
+    }
+    while (ffrdp->recv_seq != ffrdp->recv_max && !RECV_SLOT(ffrdp, ffrdp->recv_seq) && (recv_bits_get(ffrdp, ffrdp->recv_seq) & 1)) {
+        recv_bits_set(ffrdp, ffrdp->recv_seq, 0);
+        ffrdp->recv_seq++; ffrdp->recv_seq &= 0xFFFFFF;
+    }
+}
+
+static void ffrdp_recvdata_and_sendack(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr)
+{
+    FFRDP_FRAME_NODE *p;
+    int32_t recv_mack, recv_wnd, skip, dist, len = 8, i;
+    uint8_t data[8 + FFRDP_SACK_BLOCKS * 4];
+    pthread_mutex_lock(&ffrdp->lock);
+    while ((p = ffrdp->msg_freed)) { ffrdp->msg_freed = p->next; frame_node_free(RX_POOL(ffrdp), p); }
+    for (;;) {
+        if (ffrdp->flags & FLAG_STREAMS) { ffrdp_stream_deliver(ffrdp); break; }
+        p    = RECV_SLOT(ffrdp, ffrdp->recv_seq);
+        skip = (ffrdp->flags & FLAG_RECV_SKIP) && seq_distance(ffrdp->recv_seq, ffrdp->recv_skip_end) <= 0;
+        if (!skip && p && p->data[0] == FFRDP_FRAME_TYPE_GAP) { // a dropped message, frames up to its last one may never come
+            if (stream_gap(&ffrdp->rx[0]) != 0) break; // wait for application to read the gaps
+            ffrdp->recv_skip_end = FFRDP_GAP_LAST(ffrdp, p) & 0xFFFFFF;
+            dist = seq_distance(ffrdp->recv_skip_end, ffrdp->recv_seq);
+            if (dist < 0 || dist >= FFRDP_MAX_WAITSND) ffrdp->recv_skip_end = ffrdp->recv_seq;
+            ffrdp->flags |= FLAG_RECV_SKIP; skip = 1;
+        }
+        if (skip) {
+            if (ffrdp->recv_seq == ffrdp->recv_skip_end) ffrdp->flags &= ~FLAG_RECV_SKIP;
+        } else if (!p || stream_write(ffrdp, &ffrdp->rx[0], p->data + 4, frame_payload_size(ffrdp, p)) != 0) break;
+        if (p) {
+            RECV_SLOT(ffrdp, ffrdp->recv_seq) = NULL; recv_bits_set(ffrdp, ffrdp->recv_seq, 0);
+            frame_node_free(RX_POOL(ffrdp), p);
+        }
+        ffrdp->recv_seq++; ffrdp->recv_seq &= 0xFFFFFF;
+    }
+    for (recv_wnd=0x7FFFFFFF,i=0; i<FFRDP_MAX_STREAMS; i++) { // the fullest stream limits all of them
+        if (ffrdp->msg_streams & (1 << i)) recv_wnd = MIN(recv_wnd, MAX(FFRDP_MSG_MAX_FRAMES - ffrdp->rx[i].msg_frames, 0));
+        else if (ffrdp->rx[i].buff) recv_wnd = MIN(recv_wnd, (ffrdp->rx[i].bsize - ffrdp->rx[i].size) / (int32_t)ffrdp->rmss);
+    }
+    if (ffrdp->flags & FLAG_EXT_RX) { // extended ack: u16 window, u8 number of blocks, u8 reserved, blocks
+        recv_wnd = MIN(recv_wnd, FFRDP_RECV_RING);
+        *(uint32_t*)(data + 0) = (FFRDP_FRAME_TYPE_ACKX << 0) | (ffrdp->recv_seq << 8);
+        *(uint16_t*)(data + 4) = recv_wnd;
+        data[6] = recv_sack_blocks(ffrdp, data + 8); data[7] = 0;
+        len    += data[6] * 4;
+    } else {
+        recv_mack = recv_bits_get(ffrdp, ffrdp->recv_seq + 1) & 0xFFFFFF;
+        recv_wnd  = MIN(recv_wnd, 255);
+        *(uint32_t*)(data + 0) = (FFRDP_FRAME_TYPE_ACK << 0) | (ffrdp->recv_seq << 8);
+        *(uint32_t*)(data + 4) = (recv_mack <<  0);
+        *(uint32_t*)(data + 4)|= (recv_wnd  << 24);
+        if (!(ffrdp->flags & FLAG_EXT_OFF)) data[len++] = FFRDP_CAP_EXT; // old senders only read 8 bytes
+    }
+    pthread_mutex_unlock(&ffrdp->lock);
+    ffrdp_sendto(ffrdp, data, len, dstaddr); // send ack frame
+}
+
+static void ffrdp_send_loss_report(FFRDPCONTEXT *ffrdp, struct sockaddr_in *dstaddr)
+{
+    uint8_t data[12];
+    if (ffrdp->loss_groups == 0 || (int32_t)get_tick_count() - (int32_t)ffrdp->tick_loss_report < FFRDP_LOSS_CYCLE) return;
+    data[0] = FFRDP_FRAME_TYPE_LOSS; data[1] = 0;
+    *(uint16_t*)(data + 2) = ffrdp->loss_groups;
+    *(uint16_t*)(data + 4) = ffrdp->loss_total;
+    *(uint16_t*)(data + 6) = ffrdp->loss_lost;
+    *(uint16_t*)(data + 8) = ffrdp->loss_bursts;
+    *(uint16_t*)(data +10) = ffrdp->loss_failed;
+    ffrdp_sendto(ffrdp, data, sizeof(data), dstaddr);
+    ffrdp->loss_groups = ffrdp->loss_total = ffrdp->loss_lost = ffrdp->loss_bursts = ffrdp->loss_failed = 0;
+    ffrdp->tick_loss_report = get_tick_count();
+}
+
+static struct sockaddr_in* ffrdp_dstaddr(FFRDPCONTEXT *ffrdp)
+{ // peers and unconnected client use sendto, others have connected socket
+    return (ffrdp->flags & FLAG_PEER) || !(ffrdp->flags & (FLAG_SERVER|FLAG_CONNECTED)) ? &ffrdp->server_addr : NULL;
+}
+
+static int ffrdp_send_new_frame(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *p, struct sockaddr_in *dstaddr) // first send of a data frame
+{
+    if (ffrdp_send_data_frame(ffrdp, p, dstaddr) != 0) { ffrdp_congestion_control(ffrdp, CEVENT_SEND_FAILED); return -1; }
+    p->tick_1sts = p->tick_send = p->tick_last = get_tick_count();
+    p->tick_timeout = p->tick_send + ffrdp->rto;
+    p->flags       |= FLAG_FIRST_SEND;
+    p->wire_size   += p->size;
+    p->delivered    = ffrdp->delivered;
+    p->tick_delivered = ffrdp->inflight ? ffrdp->tick_delivered : p->tick_send; // idle link, rate starts from now
+    ffrdp->swnd--; ffrdp->inflight++; ffrdp->counter_send_1sttime++;
+    ffrdp->pace_tokens -= p->size;
+    return 0;
+}
+
+static void ffrdp_send_frames(FFRDPCONTEXT *ffrdp)
+{
+    struct sockaddr_in *dstaddr = ffrdp_dstaddr(ffrdp);
+    FFRDP_FRAME_NODE   *p;
+    uint32_t seq, end, uend, now = get_tick_count();
+    int32_t  i, backoff = 0, bigloss = 0;
+    int64_t  tokens;
+
+    ffrdp->ack_una    = ffrdp->send_una & 0xFFFFFF;
+    ffrdp->ack_maxack = ffrdp->send_una - 1;
+    ffrdp->flags   &= ~(FLAG_GOT_DATA|FLAG_GOT_QUERY|FLAG_PACED);
+    if (ffrdp->pace_rate && !(ffrdp->flags & FLAG_NO_PACING)) { // token bucket, holds at most 2ms of data
+        tokens = ffrdp->pace_tokens + (int64_t)ffrdp->pace_rate * (uint32_t)((int32_t)now - (int32_t)ffrdp->pace_tick) / 1000;
+        ffrdp->pace_tokens = (int32_t)MIN(tokens, (int64_t)MAX(4 * (ffrdp->smss + 8), ffrdp->pace_rate / 500));
+    } else ffrdp->pace_tokens = 0x7FFFFFFF;
+    ffrdp->pace_tick = now;
+    if ((ffrdp->flags & (FLAG_SERVER|FLAG_CONNECTED)) != FLAG_SERVER && (int32_t)now - (int32_t)ffrdp->tick_recv > FFRDP_KEEPALIVE
+        && (int32_t)now - (int32_t)ffrdp->tick_send_query > FFRDP_QUERY_CYCLE) { // nothing from remote, the ack of a query tells it is alive
+        ffrdp_send_query(ffrdp, dstaddr);
+        ffrdp->tick_send_query = now; ffrdp->counter_send_query++;
+    }
+
+    pthread_mutex_lock(&ffrdp->lock);
+    if (ffrdp->cur_new_node && (get_tick_us() - ffrdp->cur_new_us >= ffrdp->coalesce_us || ffrdp->flags & FLAG_FLUSH)) send_close_tail(ffrdp);
+    end = ffrdp->send_seq; uend = ffrdp->urgent_end;
+    pthread_mutex_unlock(&ffrdp->lock);
+
+    // urgent frames go first, out of the cwnd but within the receive window and the pacer, the receiver takes them as long as
+    // they are in its recv ring. frames acked after older ones are not sent yet are fine for ffrdp_process_ack
+    seq = (int32_t)(ffrdp->urgent_scan - ffrdp->send_una) > 0 ? ffrdp->urgent_scan : ffrdp->send_una;
+    for (; (int32_t)(uend - seq) > 0 && seq - ffrdp->send_una < FFRDP_RECV_RING; seq++) {
+        if (!(p = SEND_SLOT(ffrdp, seq)) || !(p->flags & FLAG_URGENT) || (p->flags & FLAG_FIRST_SEND)) continue;
+        if (ffrdp->swnd == 0 || ffrdp->pace_tokens <= 0 || ffrdp_send_new_frame(ffrdp, p, dstaddr) != 0) break;
+    }
+    ffrdp->urgent_scan = seq;
+
+    for (i=0,seq=ffrdp->send_una; i<(int32_t)ffrdp->cwnd&&seq!=end; seq++) {
+        if (!(p = SEND_SLOT(ffrdp, seq)) || (p->flags & (FLAG_COVERED|FLAG_SACKED))) continue; // acked by selective ack, or nothing to send
+        i++;
+        if ((p->flags & FLAG_DROPPABLE) && (int32_t)now - (int32_t)p->tick_deadline > 0 // stale, not worth resending
+            && (!(p->flags & FLAG_FIRST_SEND) || (p->flags & FLAG_FAST_RESEND) || (int32_t)now - (int32_t)p->tick_timeout > 0)) { // one in flight has its rto to be acked
+#ifdef __linux__
+            ffrdp_udp_flush(ffrdp, dstaddr); // batched datagrams may point into the frames and buffers of the message
+#endif
+            send_drop_msg(ffrdp, seq);
+        }
         if (!(p->flags & FLAG_FIRST_SEND)) { // first send
             if (ffrdp->swnd > 0) {
-                if (ffrdp_send_data_frame(ffrdp, p, dstaddr) != 0) { ffrdp_congestion_control(ffrdp, CEVENT_SEND_FAILED); break; }
-                p->tick_1sts = p->tick_send = get_tick_count();
-                p->tick_timeout = p->tick_send + ffrdp->rto;
-                p->flags       |= FLAG_FIRST_SEND;
-                ffrdp->swnd--; ffrdp->counter_send_1sttime++;
+                if (ffrdp->pace_tokens <= 0) { ffrdp->flags |= FLAG_PACED; break; }
+                if (ffrdp_send_new_frame(ffrdp, p, dstaddr) != 0) break;
             } else if (ffrdp->tick_send_query == 0 || (int32_t)get_tick_count() - (int32_t)ffrdp->tick_send_query > FFRDP_QUERY_CYCLE) { // query remote receive window size
-                data[0] = FFRDP_FRAME_TYPE_QUERY; sendto(ffrdp->udp_fd, data, 1, 0, (struct sockaddr*)dstaddr, sizeof(struct sockaddr_in));
+                ffrdp_send_query(ffrdp, dstaddr);
                 ffrdp->tick_send_query = get_tick_count(); ffrdp->counter_send_query++;
                 break;
             }
-        } else if ((p->flags & FLAG_FIRST_SEND) && ((int32_t)get_tick_count() - (int32_t)p->tick_timeout > 0 || (p->flags & FLAG_FAST_RESEND))) { // resend
+        } else if ((p->flags & FLAG_FAST_RESEND) || ((int32_t)get_tick_count() - (int32_t)p->tick_timeout > 0 && seq - ffrdp->send_una <= (uint32_t)SACK_SPAN(ffrdp))) { // resend, frames beyond the selective ack range wait until una moves
+            if (ffrdp->pace_tokens <= 0) { ffrdp->flags |= FLAG_PACED; break; }
             ffrdp_congestion_control(ffrdp, CEVENT_ACK_TIMEOUT);
             if (ffrdp_send_data_frame(ffrdp, p, dstaddr) != 0) break;
+            ffrdp->pace_tokens -= p->size;
+            p->flags |= FLAG_RESENT; p->tick_last = get_tick_count();
             if (!(p->flags & FLAG_FAST_RESEND)) {
                 if (ffrdp->rto == FFRDP_MAX_RTO) {
                     p->tick_send = get_tick_count();
                     p->flags    &=~FLAG_TIMEOUT_RESEND;
                     ffrdp->counter_reach_maxrto++;
                 } else p->flags |= FLAG_TIMEOUT_RESEND;
-                ffrdp->rto += ffrdp->rto / 2;
-                ffrdp->rto  = MIN(ffrdp->rto, FFRDP_MAX_RTO);
+                if (!backoff) { // back off once per pass, a burst of timeouts is one loss event
+                    ffrdp->rto += ffrdp->rto / 2;
+                    ffrdp->rto  = MIN(ffrdp->rto, FFRDP_MAX_RTO);
+                    backoff     = 1;
+                }
                 ffrdp->counter_resend_rto++;
+                bigloss |= FRAME_WIRE_SIZE(ffrdp, p) > FFRDP_PMTU_BASE;
             } else {
                 p->flags &= ~(FLAG_FAST_RESEND|FLAG_TIMEOUT_RESEND);
                 ffrdp->counter_resend_fast++;
@@ -562,72 +2049,270 @@ void ffrdp_update(void *ctxt)
             p->tick_timeout+= ffrdp->rto;
         }
     }
+    ffrdp->app_limited = seq == end;
+    if (seq == end) ffrdp_fec_flush(ffrdp, dstaddr); // nothing more to send, do not hold the parity of a partial group
+#ifdef __linux__
+    ffrdp_udp_flush(ffrdp, dstaddr);
+#endif
+    if (bigloss && ffrdp->pmtu_state != PMTU_OFF && ++ffrdp->pmtu_lost >= FFRDP_PMTU_BLACKHOLE) ffrdp_pmtu_reset(ffrdp, PMTU_BASE); // black hole
+    ffrdp_pmtu_update(ffrdp, dstaddr, now);
+}
 
-    if (ffrdp_sleep(ffrdp, FFRDP_SELECT_SLEEP) != 0) return;
-    for (node=NULL;;) { // receive data
-        if (!node && !(node = frame_node_new(FFRDP_FRAME_TYPE_FEC2, FFRDP_MAX_MSS))) break;;
-        if ((ffrdp->flags & FLAG_CONNECTED) == 0) {
+static void ffrdp_input(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE **pnode, int size)
+{
+    FFRDP_FRAME_NODE *node = *pnode;
+    int32_t  una, mack, dist, n, i;
+#ifdef CONFIG_ENABLE_AES256
+    uint64_t nonce;
+    if (ffrdp->flags & FLAG_RX_AES256) {
+        memcpy(&nonce, node->data + size, sizeof(nonce)); // left by frame_open
+        if (ffrdp_replayed(ffrdp, nonce)) { ffrdp->counter_rxreplay++; return; }
+    }
+#endif
+    ffrdp->tick_recv = get_tick_count();
+    if (node->data[0] <= FFRDP_FRAME_TYPE_GAP) { // data frame
+        node->size = size; // frame size is the return size of recv
+        if (ffrdp_recv_data_frame(ffrdp, node) == 0) {
+            if (ffrdp_recv_enqueue(ffrdp, node) == 0) *pnode = NULL;
+        }
+        ffrdp->flags |= FLAG_GOT_DATA; // recovered frames need ack too
+    } else if (node->data[0] == FFRDP_FRAME_TYPE_ACK ) {
+        una  = *(uint32_t*)(node->data + 0) >> 8;
+        mack = *(uint32_t*)(node->data + 4) & 0xFFFFFF;
+        dist = seq_distance(una, ffrdp->ack_una);
+        for (i=0; i<24; i++) {
+            if (mack & (1 << i)) send_sack(ffrdp, una + 1 + i, 1);
+        }
+        if (dist >= 0) {
+            ffrdp->ack_una  = una;
+            ffrdp->swnd     = node->data[7]; ffrdp->tick_recv_ack = get_tick_count();
+        }
+        if (size > 8 && (node->data[8] & FFRDP_CAP_EXT) && !(ffrdp->flags & (FLAG_EXT_OFF|FLAG_EXT_TX))) ffrdp->flags |= FLAG_EXT_ASK;
+    } else if (node->data[0] == FFRDP_FRAME_TYPE_ACKX && size >= 8) {
+        una  = *(uint32_t*)(node->data + 0) >> 8;
+        dist = seq_distance(una, ffrdp->ack_una);
+        n    = MIN(node->data[6], (size - 8) / 4);
+        for (i=0; i<n; i++) send_sack(ffrdp, una + *(uint16_t*)(node->data + 8 + i * 4), *(uint16_t*)(node->data + 10 + i * 4));
+        if (dist >= 0) {
+            ffrdp->ack_una  = una;
+            ffrdp->swnd     = *(uint16_t*)(node->data + 4); ffrdp->tick_recv_ack = get_tick_count();
+        }
+        if (!(ffrdp->flags & FLAG_EXT_TX)) ffrdp_ext_enable(ffrdp, FLAG_EXT_TX);
+    } else if (node->data[0] == FFRDP_FRAME_TYPE_QUERY) {
+        ffrdp->flags |= FLAG_GOT_QUERY;
+        if (size >= 2 && (node->data[1] & FFRDP_CAP_EXT) && !(ffrdp->flags & (FLAG_EXT_OFF|FLAG_EXT_RX))) ffrdp_ext_enable(ffrdp, FLAG_EXT_RX);
+    }
+    else if (node->data[0] == FFRDP_FRAME_TYPE_LOSS && size >= 12) ffrdp_fec_adapt(ffrdp, node->data);
+    else if (node->data[0] == FFRDP_FRAME_TYPE_PROBE && size >= 4 && *(uint16_t*)(node->data + 2) == size + FFRDP_OPEN_SIZE(ffrdp)) { // not truncated
+        uint8_t ack[6] = { FFRDP_FRAME_TYPE_PROBEACK, 0 };
+        *(uint16_t*)(ack + 2) = size + FFRDP_OPEN_SIZE(ffrdp);
+        *(uint16_t*)(ack + 4) = 4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER; // size of rx frame buffer
+        ffrdp_sendto(ffrdp, ack, sizeof(ack), ffrdp_dstaddr(ffrdp));
+    }
+    else if (node->data[0] == FFRDP_FRAME_TYPE_PROBEACK && size >= 6) ffrdp_pmtu_ack(ffrdp, *(uint16_t*)(node->data + 2), *(uint16_t*)(node->data + 4));
+}
+
+// frames are opened before they go to their peer, so a forged one neither creates a peer nor resets its timers.
+// with rx key every frame must be sealed, control frames included. returns the plain size, -1 if dropped
+static int ffrdp_unseal(FFRDPCONTEXT *ffrdp, FFRDP_FRAME_NODE *node, int size)
+{
+    if (size <= 0) return -1;
+#ifdef CONFIG_ENABLE_AES256
+    if ((ffrdp->flags & FLAG_RX_AES256) && (size = frame_open(ffrdp->aead_rx, node->data, size)) < 0) ffrdp->counter_rxforged++;
+#endif
+    return size;
+}
+
+#ifdef __linux__
+static void ffrdp_recv_frames(FFRDPCONTEXT *ffrdp) // receive with recvmmsg straight into pool nodes
+{
+    FFRDP_FRAME_NODE  *nodes[FFRDP_BATCH_SIZE] = {0};
+    struct mmsghdr     msgs [FFRDP_BATCH_SIZE];
+    struct iovec       iovs [FFRDP_BATCH_SIZE];
+    struct sockaddr_in addrs[FFRDP_BATCH_SIZE];
+    FFRDPCONTEXT      *peer;
+    int                n, size, i;
+    do {
+        for (i=0; i<FFRDP_BATCH_SIZE; i++) {
+            if (!nodes[i] && !(nodes[i] = frame_node_new(&ffrdp->rx_pool, FFRDP_FRAME_TYPE_FEC, FFRDP_MAX_MSS))) break;
+            iovs[i].iov_base = nodes[i]->data;
+            iovs[i].iov_len  = 4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+        if (i == 0 || (n = recvmmsg(ffrdp->udp_fd, msgs, i, MSG_DONTWAIT, NULL)) <= 0) break;
+        for (i=0; i<n; i++) {
+            peer = ffrdp;
+            if ((size = ffrdp_unseal(ffrdp, nodes[i], msgs[i].msg_len)) < 0) continue;
+            if (ffrdp->flags & FLAG_LISTEN) { // demultiplex by source address
+                if (!(peer = ffrdp_peer_get(ffrdp, &addrs[i], nodes[i]->data[0]))) continue;
+            } else if ((ffrdp->flags & FLAG_CONNECTED) == 0) {
+                connect(ffrdp->udp_fd, (struct sockaddr*)&addrs[i], sizeof(addrs[i])); ffrdp->flags |= FLAG_CONNECTED;
+            }
+            ffrdp_input(peer, &nodes[i], size);
+        }
+    } while (n == FFRDP_BATCH_SIZE);
+    for (i=0; i<FFRDP_BATCH_SIZE; i++) {
+        if (nodes[i]) frame_node_free(&ffrdp->rx_pool, nodes[i]);
+    }
+}
+#else
+static void ffrdp_recv_frames(FFRDPCONTEXT *ffrdp)
+{
+    FFRDP_FRAME_NODE  *node = NULL;
+    FFRDPCONTEXT      *peer = ffrdp;
+    struct sockaddr_in srcaddr;
+    uint32_t addrlen;
+    int32_t  ret;
+    for (;;) {
+        if (!node && !(node = frame_node_new(&ffrdp->rx_pool, FFRDP_FRAME_TYPE_FEC, FFRDP_MAX_MSS))) break;
+        node->size = 4 + FFRDP_MAX_MSS + FFRDP_FEC_TRAILER;
+        addrlen    = sizeof(srcaddr);
+        if (ffrdp->flags & FLAG_LISTEN) { // demultiplex by source address
+            if ((ret = recvfrom(ffrdp->udp_fd, node->data, node->size, 0, (struct sockaddr*)&srcaddr, &addrlen)) <= 0) break;
+            if ((ret = ffrdp_unseal(ffrdp, node, ret)) < 0 || !(peer = ffrdp_peer_get(ffrdp, &srcaddr, node->data[0]))) continue;
+        } else if ((ffrdp->flags & FLAG_CONNECTED) == 0) {
             if ((ret = recvfrom(ffrdp->udp_fd, node->data, node->size, 0, (struct sockaddr*)&srcaddr, &addrlen)) <= 0) break;
+            if ((ret = ffrdp_unseal(ffrdp, node, ret)) < 0) continue;
             connect(ffrdp->udp_fd, (struct sockaddr*)&srcaddr, addrlen); ffrdp->flags |= FLAG_CONNECTED;
         } else if ((ret = recv(ffrdp->udp_fd, node->data, node->size, 0)) <= 0) break;
+        else if ((ret = ffrdp_unseal(ffrdp, node, ret)) < 0) continue;
+        ffrdp_input(peer, &node, ret);
+    }
+    if (node) frame_node_free(&ffrdp->rx_pool, node);
+}
+#endif
 
-        if (node->data[0] <= FFRDP_FRAME_TYPE_FEC32) { // data frame
-            node->size = ret; // frame size is the return size of recv
-            if (ffrdp_recv_data_frame(ffrdp, node) == 0) {
-                dist = seq_distance(GET_FRAME_SEQ(node), recv_una);
-                if (dist == 0) { recv_una++; }
-                if (dist >= 0) { list_enqueue(&ffrdp->recv_list_head, &ffrdp->recv_list_tail, node); node = NULL; }
-                got_data = 1;
-            }
-        } else if (node->data[0] == FFRDP_FRAME_TYPE_ACK ) {
-            una  = *(uint32_t*)(node->data + 0) >> 8;
-            mack = *(uint32_t*)(node->data + 4) & 0xFFFFFF;
-            dist = seq_distance(una, send_una);
-            if (dist >= 0) {
-                send_una    = una;
-                send_mack   = (send_mack >> dist) | mack;
-                ffrdp->swnd = node->data[7]; ffrdp->tick_recv_ack = get_tick_count();
+static void ffrdp_process_ack(FFRDPCONTEXT *ffrdp)
+{
+    FFRDP_FRAME_NODE *p;
+    uint32_t send_una, maxack, seq;
+    uint32_t now = get_tick_count(), rate = 0;
+    int32_t  dist, frames = 0, rtt = -1;
+
+    if (ffrdp->flags & (FLAG_GOT_DATA|FLAG_GOT_QUERY)) ffrdp_recvdata_and_sendack(ffrdp, ffrdp_dstaddr(ffrdp)); // send ack frame
+    ffrdp_send_loss_report(ffrdp, ffrdp_dstaddr(ffrdp));
+    if ((ffrdp->flags & FLAG_EXT_ASK) && (int32_t)now - (int32_t)ffrdp->tick_ext_query >= (int32_t)ffrdp->rto) { // until it sends extended acks
+        ffrdp_send_query(ffrdp, ffrdp_dstaddr(ffrdp));
+        ffrdp->tick_ext_query = now;
+    }
+    ffrdp->flags &= ~FLAG_EXT_ASK;
+    dist = seq_distance(ffrdp->ack_una, ffrdp->send_una & 0xFFFFFF);
+    if (!send_head(ffrdp) || dist < 0 || (dist == 0 && ffrdp->ack_maxack == ffrdp->send_una - 1)) return; // no new ack, selective acks count even if una is stuck on a lost frame
+    send_una = ffrdp->send_una + dist;
+    maxack   = (int32_t)(ffrdp->ack_maxack - send_una) >= 0 ? ffrdp->ack_maxack : send_una - 1; // highest seq acked
+
+    pthread_mutex_lock(&ffrdp->lock);
+    for (seq=ffrdp->send_una; seq!=send_una; seq++) {
+        if ((p = SEND_SLOT(ffrdp, seq)) && (p->flags & FLAG_FIRST_SEND) && (int32_t)(p->tx_order - ffrdp->ack_maxorder) > 0) ffrdp->ack_maxorder = p->tx_order;
+    }
+    for (seq=ffrdp->send_una; seq!=ffrdp->send_seq && (int32_t)(seq - maxack) <= 0; seq++) { // nothing after maxack is acked or lost
+        if (!(p = SEND_SLOT(ffrdp, seq)) || !(p->flags & FLAG_FIRST_SEND)) continue;
+        dist = (int32_t)(seq - send_una);
+        if (dist < 0 || (p->flags & FLAG_SACKED)) { // this frame got ack
+            ffrdp->counter_send_bytes += frame_payload_size(ffrdp, p); ffrdp->wait_snd--; ffrdp->inflight -= !(p->flags & FLAG_COVERED);
+            ffrdp->delivered += p->wire_size; ffrdp->tick_delivered = now; frames++;
+            if (FRAME_WIRE_SIZE(ffrdp, p) > FFRDP_PMTU_BASE) ffrdp->pmtu_lost = 0;
+            if (!(p->flags & FLAG_RESENT)) { // samples for congestion control
+                rtt  = rtt < 0 ? (int32_t)now - (int32_t)p->tick_send : MIN(rtt, (int32_t)now - (int32_t)p->tick_send);
+                rate = MAX(rate, (uint32_t)((uint64_t)(ffrdp->delivered - p->delivered) * 1000 / MAX((int32_t)now - (int32_t)p->tick_delivered, 1)));
             }
-        } else if (node->data[0] == FFRDP_FRAME_TYPE_QUERY) got_query = 1;
-    }
-    if (node) free(node);
-
-    if (got_data || got_query) ffrdp_recvdata_and_sendack(ffrdp, dstaddr); // send ack frame
-    if (ffrdp->send_list_head && seq_distance(send_una, GET_FRAME_SEQ(ffrdp->send_list_head)) > 0) { // got ack frame
-        for (p=ffrdp->send_list_head; p;) {
-            dist = seq_distance(GET_FRAME_SEQ(p), send_una);
-            for (i=23; i>=0 && !(send_mack&(1<<i)); i--);
-            if (i < 0) maxack = (send_una - 1) & 0xFFFFFF;
-            else maxack = (send_una + i + 1) & 0xFFFFFF;
-
-            if (dist > 24 || !(p->flags & FLAG_FIRST_SEND)) break;
-            else if (dist < 0 || (dist > 0 && (send_mack & (1 << (dist-1))))) { // this frame got ack
-                ffrdp->counter_send_bytes += frame_payload_size(p); ffrdp->wait_snd--;
-                ffrdp_congestion_control(ffrdp, CEVENT_ACK_OK);
-                if (!(p->flags & FLAG_TIMEOUT_RESEND)) {
-                    ffrdp->rttm = (int32_t)get_tick_count() - (int32_t)p->tick_send;
-                    if (ffrdp->rtts == (uint32_t)-1) {
-                        ffrdp->rtts = ffrdp->rttm;
-                        ffrdp->rttd = ffrdp->rttm / 2;
-                    } else {
-                        ffrdp->rtts = (7 * ffrdp->rtts + 1 * ffrdp->rttm) / 8;
-                        ffrdp->rttd = (3 * ffrdp->rttd + 1 * abs((int)ffrdp->rttm - (int)ffrdp->rtts)) / 4;
-                    }
-                    ffrdp->rto = ffrdp->rtts + 4 * ffrdp->rttd;
-                    ffrdp->rto = MAX(FFRDP_MIN_RTO, ffrdp->rto);
-                    ffrdp->rto = MIN(FFRDP_MAX_RTO, ffrdp->rto);
+            if (!(p->flags & (FLAG_TIMEOUT_RESEND|FLAG_COVERED))) { // covered frames may never have been sent
+                ffrdp->rttm = (int32_t)get_tick_count() - (int32_t)p->tick_send;
+                if (ffrdp->rtts == (uint32_t)-1) {
+                    ffrdp->rtts = ffrdp->rttm;
+                    ffrdp->rttd = ffrdp->rttm / 2;
+                } else {
+                    ffrdp->rtts = (7 * ffrdp->rtts + 1 * ffrdp->rttm) / 8;
+                    ffrdp->rttd = (3 * ffrdp->rttd + 1 * abs((int)ffrdp->rttm - (int)ffrdp->rtts)) / 4;
                 }
-                pthread_mutex_lock(&ffrdp->lock);
-                t = p; p = p->next; list_remove(&ffrdp->send_list_head, &ffrdp->send_list_tail, t);
-                pthread_mutex_unlock(&ffrdp->lock);
-                continue;
-            } else if (seq_distance(maxack, GET_FRAME_SEQ(p)) > 0) {
-                ffrdp_congestion_control(ffrdp, CEVENT_FAST_RESEND);
-                p->flags |= FLAG_FAST_RESEND;
+                ffrdp->rto = ffrdp->rtts + MAX(4 * ffrdp->rttd, ffrdp->rtts / 4); // paced frames have a very stable rtt, keep some margin
+                ffrdp->rto = MAX(FFRDP_MIN_RTO, ffrdp->rto);
+                ffrdp->rto = MIN(FFRDP_MAX_RTO, ffrdp->rto);
             }
-            p = p->next;
+            SEND_SLOT(ffrdp, seq) = NULL;
+            frame_node_free(&ffrdp->tx_pool, p);
+        } else if ((int32_t)(ffrdp->ack_maxorder - p->tx_order) > 0 && (!(p->flags & FLAG_RESENT) || (int32_t)now - (int32_t)p->tick_last >= (int32_t)MIN(ffrdp->rtts, FFRDP_MAX_RTO))) {
+            ffrdp_congestion_control(ffrdp, CEVENT_FAST_RESEND);
+            p->flags |= FLAG_FAST_RESEND;
+        }
+    }
+    while (ffrdp->send_una != ffrdp->send_seq && !SEND_SLOT(ffrdp, ffrdp->send_una)) ffrdp->send_una++;
+    if ((p = SEND_SLOT(ffrdp, ffrdp->send_una)) && (p->flags & FLAG_COVERED)) { // its gap frame got the ack of the old data frame, so it carries the gap now
+        p->flags &= ~(FLAG_COVERED|FLAG_FIRST_SEND|FLAG_SACKED);
+    }
+    pthread_mutex_unlock(&ffrdp->lock);
+    if (rtt >= 0 && (ffrdp->rtt_min == (uint32_t)-1 || (uint32_t)rtt <= ffrdp->rtt_min || (int32_t)now - (int32_t)ffrdp->rtt_min_tick > FFRDP_RTT_MIN_WIN)) {
+        ffrdp->rtt_min = rtt; ffrdp->rtt_min_tick = now;
+    }
+    if (frames) ffrdp->cc->on_ack(ffrdp, frames, rtt, rate);
+}
+
+void ffrdp_update(void *ctxt)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt, *peer, **pp;
+    if (!ctxt || (ffrdp->flags & FLAG_PEER)) return; // peers are updated by their listener
+    if (ffrdp->flags & FLAG_LISTEN) {
+        for (pp=&ffrdp->peer_next; (peer=*pp);) { // peers not taken by ffrdp_accept in time are freed here
+            if ((peer->flags & FLAG_ACCEPT) && (int32_t)get_tick_count() - (int32_t)peer->tick_create > FFRDP_DEAD_TIMEOUT) { ffrdp_free(peer); continue; }
+            ffrdp_send_frames(peer);
+            pp = &peer->peer_next;
+        }
+    } else ffrdp_send_frames(ffrdp);
+    if (ffrdp_sleep(ffrdp, FFRDP_SELECT_SLEEP) != 0) return;
+    ffrdp_recv_frames(ffrdp);
+    if (ffrdp->flags & FLAG_LISTEN) {
+        for (peer=ffrdp->peer_next; peer; peer=peer->peer_next) ffrdp_process_ack(peer);
+    } else ffrdp_process_ack(ffrdp);
+}
+
+int ffrdp_next_timeout(void *ctxt)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt, *peer;
+    uint32_t      now   = get_tick_count();
+    int           wait;
+    if (!ctxt) return FFRDP_MAX_TIMEOUT;
+    if (!(ffrdp->flags & FLAG_LISTEN)) return ffrdp_timeout(ffrdp, now);
+    for (wait=FFRDP_MAX_TIMEOUT,peer=ffrdp->peer_next; peer && wait>0; peer=peer->peer_next) wait = MIN(wait, ffrdp_timeout(peer, now));
+    return wait;
+}
+
+int ffrdp_get_fd(void *ctxt)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    return ffrdp ? (int)ffrdp->udp_fd : -1; // peers share the socket of listener
+}
+
+int ffrdp_setopt(void *ctxt, int opt, int val)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt, *peer;
+    if (!ctxt) return -1;
+    for (peer=ffrdp; peer; peer=peer->peer_next) { // listener passes options to its peers
+        switch (opt) {
+        case FFRDP_OPT_FEC_AUTO  : peer->fec_auto   = val; if (!val) peer->fec_mnext = peer->fec_m; break;
+        case FFRDP_OPT_FEC_TARGET: peer->fec_target = MAX(1, val); break;
+        case FFRDP_OPT_CC        :
+            if (val < 0 || val >= (int)(sizeof(s_ffrdp_cc) / sizeof(s_ffrdp_cc[0]))) return -1;
+            peer->cc = &s_ffrdp_cc[val]; peer->cc->init(peer);
+            break;
+        case FFRDP_OPT_PACING    : if (val) peer->flags &= ~FLAG_NO_PACING; else peer->flags |= FLAG_NO_PACING; break;
+        case FFRDP_OPT_WAIT      : peer->update_wait = MAX(0, val); break;
+        case FFRDP_OPT_EXTENDED  : if (val) peer->flags &= ~FLAG_EXT_OFF; else peer->flags |= FLAG_EXT_OFF; break;
+        case FFRDP_OPT_COALESCE  : peer->coalesce_us = MAX(0, val); break;
+        case FFRDP_OPT_PMTUD     : ffrdp_pmtu_reset(peer, val ? PMTU_BASE : PMTU_OFF); break;
+        case FFRDP_OPT_STREAMS   :
+            if (val && peer->smss <= 8) return -1; // no room for stream header
+            if (val) peer->flags |= FLAG_STREAMS; else peer->flags &= ~FLAG_STREAMS;
+            break;
+        case FFRDP_OPT_RECVMSG   : peer->msg_streams = val & ((1 << FFRDP_MAX_STREAMS) - 1); break;
+        default: return -1;
         }
+        if (!(ffrdp->flags & FLAG_LISTEN)) break;
     }
+    return 0;
 }
 
 void ffrdp_flush(void *ctxt)
@@ -638,27 +2323,46 @@ void ffrdp_flush(void *ctxt)
 
 void ffrdp_dump(void *ctxt, int clearhistory)
 {
-    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt; int secs;
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt; int secs, i;
     if (!ctxt) return;
     secs = ((int32_t)get_tick_count() - (int32_t)ffrdp->tick_ffrdp_dump) / 1000;
     secs = secs ? secs : 1;
-    printf("rttm: %u, rtts: %u, rttd: %u, rto: %u\n", ffrdp->rttm, ffrdp->rtts, ffrdp->rttd, ffrdp->rto);
+    printf("rttm: %u, rtts: %u, rttd: %u, rto: %u, min: %d\n", ffrdp->rttm, ffrdp->rtts, ffrdp->rttd, ffrdp->rto, (int)ffrdp->rtt_min);
     printf("total_send, total_recv: %.2fMB, %.2fMB\n"    , ffrdp->counter_send_bytes / (1024.0 * 1024), ffrdp->counter_recv_bytes / (1024.0 * 1024));
     printf("averg_send, averg_recv: %.2fKB/s, %.2fKB/s\n", ffrdp->counter_send_bytes / (1024.0 * secs), ffrdp->counter_recv_bytes / (1024.0 * secs));
-    printf("recv_size           : %d\n"  , ffrdp->recv_size           );
+    for (i=0; i<((ffrdp->flags & FLAG_STREAMS) ? FFRDP_MAX_STREAMS : 1); i++) {
+        printf("recv%d size, bsize   : %d, %d, dropped %u, msg frames %d\n", i, ffrdp->rx[i].size, ffrdp->rx[i].bsize, ffrdp->tx_dropped[i], ffrdp->rx[i].msg_frames);
+    }
     printf("flags               : %x\n"  , ffrdp->flags               );
+    if (ffrdp->flags & FLAG_LISTEN) printf("shard, peers        : %d/%d, %d%s\n", ffrdp->shard, ffrdp->nshards, ffrdp->peer_num, ffrdp->nshards > 1 ? (ffrdp->steering ? " (bpf steering)" : " (kernel hash)") : "");
     printf("send_seq            : %u\n"  , ffrdp->send_seq            );
     printf("recv_seq            : %u\n"  , ffrdp->recv_seq            );
     printf("wait_snd            : %u\n"  , ffrdp->wait_snd            );
+    printf("coalesce            : %uus\n", ffrdp->coalesce_us         );
+    printf("tx_pool free, total : %u, %u\n", ffrdp->tx_pool.free_num, ffrdp->tx_pool.node_num);
+    printf("rx_pool free, total : %u, %u\n", RX_POOL(ffrdp)->free_num, RX_POOL(ffrdp)->node_num);
     printf("rmss, smss          : %u, %u\n"    , ffrdp->rmss, ffrdp->smss);
+    printf("pmtu, probe, max    : %u, %u, %u (%s)\n", ffrdp->pmtu_state == PMTU_OFF ? FFRDP_FRAME_OVERHEAD(ffrdp) + ffrdp->smss : ffrdp->pmtu_low, ffrdp->pmtu_probe, ffrdp->pmtu_max,
+        ffrdp->pmtu_state == PMTU_OFF ? "off" : ffrdp->pmtu_state == PMTU_BASE ? "base" : ffrdp->pmtu_state == PMTU_SEARCH ? "search" : "done");
     printf("swnd, cwnd, ssthresh: %u, %u, %u\n", ffrdp->swnd, ffrdp->cwnd, ffrdp->ssthresh);
-    printf("fec_txredundancy    : %d\n"  , ffrdp->fec_txredundancy    );
-    printf("fec_rxredundancy    : %d\n"  , ffrdp->fec_rxredundancy    );
-    printf("fec_txseq           : %d\n"  , ffrdp->fec_txseq           );
-    printf("fec_rxseq           : %d\n"  , ffrdp->fec_rxseq           );
-    printf("fec_rxmask          : %08x\n", ffrdp->fec_rxmask          );
+    printf("extended tx, rx     : %d, %d%s\n", !!(ffrdp->flags & FLAG_EXT_TX), !!(ffrdp->flags & FLAG_EXT_RX), (ffrdp->flags & FLAG_EXT_OFF) ? " (off)" : "");
+    printf("cc, inflight        : %s, %u\n", ffrdp->cc->name, ffrdp->inflight);
+    printf("pace_rate, tokens   : %.2fKB/s, %d%s\n", ffrdp->pace_rate / 1024.0, ffrdp->pace_tokens, (ffrdp->flags & FLAG_NO_PACING) ? " (off)" : "");
+    if (ffrdp->cc == &s_ffrdp_cc[FFRDP_CC_BBR]) {
+        printf("bbr state, cycle    : %s, %d\n", ffrdp->bbr_state == BBR_STARTUP ? "startup" : ffrdp->bbr_state == BBR_DRAIN ? "drain" : "probe_bw", ffrdp->bbr_cycle);
+        printf("bbr btlbw           : %.2fKB/s\n", ffrdp->bbr_btlbw / 1024.0);
+    }
+    printf("fec_k, fec_m        : %d, %d\n", ffrdp->fec_k, ffrdp->fec_m);
+    printf("fec_rxk, fec_rxm    : %d, %d\n", ffrdp->fec_rxk, ffrdp->fec_rxm);
+    printf("fec_txgroup, txidx  : %d, %d\n", ffrdp->fec_txgroup, ffrdp->fec_txidx);
+    printf("fec_rxgroup         : %d\n"  , ffrdp->fec_rxgroup         );
+    printf("fec_auto, mnext     : %d, %d\n", ffrdp->fec_auto, ffrdp->fec_mnext);
+    printf("fec_loss, burst     : %.2f%%, %.2f\n", ffrdp->fec_lossppm / 10000.0, ffrdp->fec_burst / 100.0);
+    printf("fec_bias, target    : %d, %.2f%%\n", ffrdp->fec_bias, ffrdp->fec_target / 10000.0);
+    printf("fec_rxmask          : %02x%08x\n", (uint32_t)(ffrdp->fec_rxmask >> 32), (uint32_t)ffrdp->fec_rxmask);
     printf("counter_send_1sttime: %u\n"  , ffrdp->counter_send_1sttime);
     printf("counter_send_failed : %u\n"  , ffrdp->counter_send_failed );
+    printf("counter_msg_dropped : %u\n"  , ffrdp->counter_msg_dropped );
     printf("counter_send_query  : %u\n"  , ffrdp->counter_send_query  );
     printf("counter_resend_rto  : %u\n"  , ffrdp->counter_resend_rto  );
     printf("counter_resend_fast : %u\n"  , ffrdp->counter_resend_fast );
@@ -671,22 +2375,65 @@ void ffrdp_dump(void *ctxt, int clearhistory)
     printf("counter_fec_tx      : %u\n"  , ffrdp->counter_fec_tx      );
     printf("counter_fec_rx      : %u\n"  , ffrdp->counter_fec_rx      );
     printf("counter_fec_ok      : %u\n"  , ffrdp->counter_fec_ok      );
-    printf("counter_fec_failed  : %u\n\n", ffrdp->counter_fec_failed  );
+    printf("counter_fec_failed  : %u\n"  , ffrdp->counter_fec_failed  );
+    printf("counter_rxforged    : %u\n"  , ffrdp->counter_rxforged    );
+    printf("counter_rxreplay    : %u\n\n", ffrdp->counter_rxreplay    );
     if (secs > 1 && clearhistory) {
         ffrdp->tick_ffrdp_dump = get_tick_count();
         memset(&ffrdp->counter_send_bytes, 0, (uint8_t*)&ffrdp->reserved - (uint8_t*)&ffrdp->counter_send_bytes);
     }
 }
 
-int ffrdp_qos(void *ctxt)
+uint32_t ffrdp_dropped(void *ctxt)
 {
-    int resend_ratio;
     FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
-    if (!ctxt) return 0;
-    resend_ratio = 100 * (ffrdp->counter_resend_rto + ffrdp->counter_resend_fast) / MAX(ffrdp->counter_send_1sttime, 1);
-    ffrdp->counter_resend_rto = ffrdp->counter_resend_fast = ffrdp->counter_reach_maxrto = 0;
-    if (ffrdp->rto > 100 && ffrdp->wait_snd > 25) return -1;
-    if (ffrdp->rto < 55  && ffrdp->wait_snd < 3  && resend_ratio < 5) return  1;
-    return 0;
+    return ffrdp ? ffrdp->counter_msg_dropped : 0;
+}
+
+uint32_t ffrdp_stream_dropped(void *ctxt, int stream)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    return ffrdp && stream >= 0 && stream < FFRDP_MAX_STREAMS ? ffrdp->tx_dropped[stream] : 0;
+}
+
+uint32_t ffrdp_bwe(void *ctxt, int *qdelay)
+{
+    FFRDPCONTEXT *ffrdp = (FFRDPCONTEXT*)ctxt;
+    uint32_t wire, queued, delay = 0;
+    uint64_t bwe;
+    if (qdelay) *qdelay = 0;
+    if (!ctxt || !(wire = ffrdp->cc->bwe(ffrdp))) return 0;
+    queued = (ffrdp->wait_snd > ffrdp->inflight ? ffrdp->wait_snd - ffrdp->inflight : 0) * (ffrdp->smss + 8) + ffrdp->cur_new_size; // not sent yet
+    delay  = (uint32_t)((uint64_t)queued * 1000 / wire);
+    if (ffrdp->rtt_min != (uint32_t)-1 && ffrdp->rtts != (uint32_t)-1 && ffrdp->rtts > ffrdp->rtt_min) delay += ffrdp->rtts - ffrdp->rtt_min;
+    if (qdelay) *qdelay = (int)MIN(delay, 0x7FFFFFFF);
+    bwe = (uint64_t)wire * ffrdp->smss / (ffrdp->smss + 8 + (ffrdp->fec_k ? FFRDP_FEC_TRAILER : 0) + (ffrdp->flags & FLAG_TX_AES256 ? FFRDP_AEAD_OVERHEAD : 0)) * 8; // payload bits
+    if (ffrdp->fec_k) bwe = bwe * ffrdp->fec_k / (ffrdp->fec_k + ffrdp->fec_m);
+    return (uint32_t)MIN(bwe, 0xFFFFFFFF);
 }
 
+
+#ifdef CONFIG_FFRDP_BENCH
+// microbenchmark of ffrdpbench --pool: takes a window of frame nodes and gives them back rounds times, from a node pool
+// or with malloc/free as frame nodes were allocated before the pools. returns the nodes taken, the caller times it
+int ffrdp_bench_nodes(int rounds, int pool)
+{
+    FFRDP_NODE_POOL   nodepool = {0};
+    FFRDP_FRAME_NODE *nodes[FFRDP_MAX_CWND_SIZE];
+    int               total = 0, r, i;
+    for (r=0; r<rounds; r++) {
+        for (i=0; i<FFRDP_MAX_CWND_SIZE; i++) {
+            if (pool) nodes[i] = frame_node_new(&nodepool, FFRDP_FRAME_TYPE_FULL, FFRDP_MAX_MSS);
+            else if ((nodes[i] = malloc(sizeof(FFRDP_FRAME_NODE) + 4 + FFRDP_MAX_MSS))) memset(nodes[i], 0, sizeof(FFRDP_FRAME_NODE));
+            if (!nodes[i]) break;
+        }
+        total += i;
+        while (--i >= 0) {
+            if (pool) frame_node_free(&nodepool, nodes[i]);
+            else free(nodes[i]);
+        }
+    }
+    node_pool_free(&nodepool);
+    return total;
+}
+#endif
@@ -1,15 +1,119 @@
 #ifndef __FFRDP_H__
 #define __FFRDP_H__
 
+// sfec: 0 for no fec, FFRDP_FEC(k, m) for k data frames + m reed-solomon parity frames per group (k <= 32, m <= 7),
+// any m frames lost in a group are recovered. values 2 ~ 255 keep the old meaning: sfec - 1 data frames + 1 parity frame.
+// m is only the initial value, it is adapted to the loss reported by receiver unless FFRDP_OPT_FEC_AUTO is 0
+#define FFRDP_FEC(k, m) (((m) << 8) | (k))
+
+// smss is the max payload of a frame, capped at 1492 (8964 if built with CONFIG_FFRDP_JUMBO). path mtu discovery
+// finds the largest frame the path takes without ip fragmentation, ffrdp_dump shows it
+
 void* ffrdp_init  (char *ip, int port, char *txkey, char *rxkey, int server, int smss, int sfec);
 void  ffrdp_free  (void *ctxt);
+
+// a listener serves many peers on one udp port, peers are told apart by source address. ffrdp_accept returns
+// a new peer (or NULL), a peer works like a normal context but is updated by ffrdp_update of its listener.
+// peers can be freed from the thread calling ffrdp_update of listener, the remaining ones are freed with their listener.
+// only a data frame (authenticated if rxkey is set) from a new address creates a peer, one not accepted in 5s is freed.
+void* ffrdp_listen(char *ip, int port, char *txkey, char *rxkey, int smss, int sfec);
+void* ffrdp_accept(void *ctxt);
+
+// sharded listener: nshards listeners of the same ip and port, each one for its own worker thread with its own socket,
+// peers, pools and ffrdp_update loop, nothing is shared between them. on linux their sockets join one SO_REUSEPORT
+// group and a bpf program steers every datagram by its source address (ffrdp knows sessions by it), so all datagrams
+// of a session go to the same shard. create shards 0 .. nshards-1 in this order and free them together, the kernel
+// picks sockets by bind order. ffrdp_listen is shard 0 of 1. other systems only support nshards 1
+void* ffrdp_listen_shard(char *ip, int port, char *txkey, char *rxkey, int smss, int sfec, int shard, int nshards);
+
 int   ffrdp_send  (void *ctxt, char *buf, int len);
 int   ffrdp_recv  (void *ctxt, char *buf, int len);
-int   ffrdp_isdead(void *ctxt);
+
+// message send: the message starts in a new frame and its tail is queued at once. a FFRDP_PRIO_LOW message that is
+// not acked deadline ms (0 for none) after sending is dropped instead of being resent (a frame in flight keeps its
+// rto to be acked), only tiny gap frames take its place. at its position ffrdp_recv of the receiver returns
+// FFRDP_RECV_GAP once, bytes of it that were already received come before the gap, so the application drops the
+// partial message it holds. peers must support gap frames.
+// a FFRDP_PRIO_URGENT message is sent before the frames queued earlier and not sent yet, its deadline works like a low one
+enum { FFRDP_PRIO_LOW, FFRDP_PRIO_HIGH, FFRDP_PRIO_URGENT };
+#define FFRDP_RECV_GAP -2
+int   ffrdp_sendmsg(void *ctxt, char *buf, int len, int deadline, int prio);
+uint32_t ffrdp_dropped(void *ctxt); // number of messages dropped by deadline so far
+
+// streams: with FFRDP_OPT_STREAMS 1 on both sides (set before anything is sent), every data frame carries a stream id
+// and a frame counter of its stream, each stream is delivered in its own order into its own receive queue, so a frame
+// lost in one stream does not hold back the others. ffrdp_send, ffrdp_sendmsg and ffrdp_recv work on stream 0.
+// messages of other streams always start in a new frame, deadline and prio work like ffrdp_sendmsg
+#define FFRDP_MAX_STREAMS 4
+int   ffrdp_stream_send(void *ctxt, int stream, char *buf, int len, int deadline, int prio);
+int   ffrdp_stream_recv(void *ctxt, int stream, char *buf, int len);
+
+// scatter/gather send: the message is made of n parts. the bytes of a part with ref are not copied, frames point into
+// them until acked, ffrdp takes one reference per frame and calls release when the last one is gone, from any thread.
+// the caller must not change the bytes before that. parts without ref (and small tails of the others) are copied.
+// refs of a new buffer is 1 for the caller, which drops it with ffrdp_buf_unref after ffrdp_sendv
+typedef struct tagFFRDP_BUF {
+    volatile long refs;
+    void (*release)(struct tagFFRDP_BUF *buf);
+} FFRDP_BUF;
+typedef struct {
+    void      *buf;
+    int        len;
+    FFRDP_BUF *ref;
+} FFRDP_IOVEC;
+void  ffrdp_buf_ref  (FFRDP_BUF *buf);
+void  ffrdp_buf_unref(FFRDP_BUF *buf);
+int   ffrdp_sendv       (void *ctxt, FFRDP_IOVEC *iov, int n); // like ffrdp_send
+int   ffrdp_stream_sendv(void *ctxt, int stream, FFRDP_IOVEC *iov, int n, int deadline, int prio); // like ffrdp_stream_send
+
+// message receive: streams set in FFRDP_OPT_RECVMSG (streams mode, before anything is received) keep the received frames
+// instead of copying them into the receive queue. ffrdp_msg_recv returns a whole message of ffrdp_stream_send/ffrdp_sendmsg
+// of the peer as views of its frames, valid until ffrdp_msg_free, which can be called from any thread before ffrdp_free.
+// frames held count against the receive window. peer must be of this version, older ones do not mark message ends
+typedef struct {
+    void *ctxt;
+    void *frames;
+    int   len;  // bytes of message
+    int   nseg; // frames of message
+} FFRDP_MSG;
+int   ffrdp_msg_recv(void *ctxt, int stream, FFRDP_MSG *msg); // len of msg, 0 if no message complete, FFRDP_RECV_GAP for a dropped one
+int   ffrdp_msg_iov (FFRDP_MSG *msg, FFRDP_IOVEC *iov, int n); // up to n views of the message, returns nseg
+int   ffrdp_msg_read(FFRDP_MSG *msg, int off, char *buf, int len); // copies len bytes at off, for headers across views
+void  ffrdp_msg_free(FFRDP_MSG *msg);
+uint32_t ffrdp_stream_dropped(void *ctxt, int stream);
+int   ffrdp_isdead(void *ctxt); // unacked frames or nothing received for 5s, idle contexts send keepalive queries
 void  ffrdp_update(void *ctxt);
+
+// event loop support: ffrdp_update has timer work (pacing, resend, flush, deadline) in ffrdp_next_timeout ms, 0 for now,
+// and input when the socket of ffrdp_get_fd is readable (peers share the one of listener). with FFRDP_OPT_WAIT 0 the
+// caller waits on both in its own poll/select, then ffrdp_update never blocks. call them from the ffrdp_update thread
+int   ffrdp_next_timeout(void *ctxt);
+int   ffrdp_get_fd(void *ctxt);
 void  ffrdp_flush (void *ctxt);
 void  ffrdp_dump  (void *ctxt, int clearhistory);
-int   ffrdp_qos   (void *ctxt);
+
+// bandwidth estimate of congestion control in payload bits per second, 0 if not known yet. qdelay gets the queuing
+// delay in ms: data not sent yet at the estimated rate plus smoothed rtt above the min rtt of the path
+uint32_t ffrdp_bwe(void *ctxt, int *qdelay);
+
+enum {
+    FFRDP_OPT_FEC_AUTO,   // 1: adapt fec parity frames to reported loss (default), 0: keep m of sfec
+    FFRDP_OPT_FEC_TARGET, // max probability of unrecoverable fec group in ppm, default 1000
+    FFRDP_OPT_CC,         // congestion control, FFRDP_CC_AIMD (default) or FFRDP_CC_BBR
+    FFRDP_OPT_PACING,     // 1: spread frames over rtt at the rate given by congestion control (default), 0: send in bursts
+    FFRDP_OPT_WAIT,       // max ms ffrdp_update waits for data, it wakes up earlier for its timers, default 10
+    FFRDP_OPT_EXTENDED,   // 1: negotiate extended mode with peer, larger windows and ranged selective acks (default), 0: old acks only
+    FFRDP_OPT_STREAMS,    // 1: frames carry stream ids, see ffrdp_stream_send, 0: one byte stream (default)
+    FFRDP_OPT_COALESCE,   // us the partial last frame of ffrdp_send waits for more data, 0: sent at the end of each ffrdp_send, default 500000
+    FFRDP_OPT_PMTUD,      // 1: path mtu discovery, frames grow from 1200 bytes datagrams up to smss (default), 0: frames of smss
+    FFRDP_OPT_RECVMSG,    // bit mask of streams received with ffrdp_msg_recv instead of ffrdp_stream_recv, default 0
+};
+enum { FFRDP_CC_AIMD, FFRDP_CC_BBR };
+int   ffrdp_setopt(void *ctxt, int opt, int val); // options of a listener also go to its current peers and the new ones
+
+#ifdef CONFIG_FFRDP_BENCH
+int   ffrdp_bench_nodes(int rounds, int pool); // for ffrdpbench --pool
+#endif
 
 #endif
 
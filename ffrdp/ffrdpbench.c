@@ -0,0 +1,644 @@
+// ffrdpbench: loopback benchmark of ffrdp and ffrdpc. a server thread sends packets the way ffrdps does (audio every
+// 20ms, video at --fps with a key frame every --gop frames), a relay thread between it and ffrdpc emulates the network,
+// the callback of ffrdpc checks every frame and measures when it is played against its pts. server and client share
+// one clock, so this is the glass-to-glass latency without capture, encoding, decoding and display.
+//
+// with --sessions it is a load test of ffrdp_listen_shard instead: --shards worker threads each run one shard with its
+// own event loop, client threads run the sessions straight on loopback, every session gets video at --vbitrate, the
+// goodput of all of them and the cpu time of the workers are reported. linux only, as the shards are.
+//
+// with --pool it measures the frame node pool of ffrdp: a window of nodes taken and given back --pool times, from the
+// pool and with malloc/free, then a bulk send of --secs on loopback, ffrdp_dump shows how many nodes the pools got.
+// it needs ffrdp.c built with CONFIG_FFRDP_BENCH
+//
+// build: gcc -O2 -DCONFIG_FFRDP_BENCH -o ffrdpbench ffrdpbench.c ffrdpc.c ffrdp.c rsfec.c -lpthread
+// run  : ffrdpbench --secs=20 --loss=0.02 --burst=2 --delay=20 --jitter=10 --rate=8000 --qlen=200 --streams=1
+//        the same with --deadline=150 drops late delta frames like --ffrdpsdeadline, latency of both is in readme.txt
+//        ffrdpbench --secs=10 --sessions=200 --shards=4 --clients=4 --vbitrate=2000
+//        ffrdpbench --secs=4 --pool=200000
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "ffrdp.h"
+#include "ffrdpc.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+#pragma warning(disable:4996) // disable warnings
+#define usleep(t) Sleep((t) / 1000)
+#define get_tick_count GetTickCount
+typedef int socklen_t;
+static int64_t get_tick_us(void)
+{
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter  (&count);
+    return count.QuadPart / freq.QuadPart * 1000000 + count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
+#else
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#define SOCKET int
+#define closesocket close
+static int64_t get_tick_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static uint32_t get_tick_count()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define BENCH_AUDIO_PERIOD  20 // ms
+#define BENCH_AUDIO_SIZE   160
+#define BENCH_MAX_FRAMES  (1 << 16)
+#define BENCH_MAX_VIDEO   (1024 * 1024)
+#define LOAD_MAX_PEERS     256 // sessions of a worker, FFRDP_MAX_PEERS of its shard
+#define LOAD_MAX_SESSIONS 1000 // client sockets of all client threads, select takes FD_SETSIZE
+#define LOAD_MAX_THREADS    64
+#define LOAD_JOIN_TIMEOUT 5000 // ms, session without hello is freed like ffrdps does
+
+typedef struct tagRELAY_PKT {
+    struct tagRELAY_PKT *next;
+    int64_t  due; // us
+    int      len;
+    uint8_t  data[1];
+} RELAY_PKT;
+
+typedef struct { // one direction of emulated link
+    RELAY_PKT *head, *tail;
+    int64_t    tick_free; // us, link is busy sending until then
+    int        burst;     // in a loss burst
+    uint32_t   lost, qdrops;
+} RELAY_LINK;
+
+typedef struct {
+    int      exit;
+    int      port; // of server, relay listens on port + 1
+    int      secs, fps, gop, vbitrate, streams, deadline, sfec, jbmin, jbmax;
+    double   loss, burst;
+    int      delay, jitter, rate, qlen;
+    int      sessions, shards, clients, pool;
+    uint64_t pool_bytes;
+    RELAY_LINK down, up;
+
+    uint32_t asent, vsent, keysent;
+    uint32_t aplay, vplay, bad, skipped, vseq_next;
+    int64_t  alat_sum;
+    int32_t  vlat[BENCH_MAX_FRAMES];
+    uint32_t tick_vout;
+    int      freeze_max;
+} BENCH;
+
+static void relay_put(BENCH *bench, RELAY_LINK *link, uint8_t *buf, int len, int ratelimit)
+{
+    RELAY_PKT *pkt;
+    int64_t    now = get_tick_us(), due = now;
+    if (link->burst) { // gilbert model, bursts of --burst packets on average, --loss of all
+        if (rand() < RAND_MAX / MAX(bench->burst, 1.0)) link->burst = 0;
+        link->lost++; return;
+    }
+    if (rand() < RAND_MAX * bench->loss / MAX(bench->burst, 1.0)) {
+        link->burst = bench->burst > 1.0;
+        link->lost++; return;
+    }
+    if (ratelimit && bench->rate) {
+        if (bench->qlen && link->tick_free - now > (int64_t)bench->qlen * 1000) { link->qdrops++; return; }
+        link->tick_free = due = MAX(link->tick_free, now) + (int64_t)len * 8000 / bench->rate;
+    }
+    due += (int64_t)(bench->delay + (bench->jitter ? rand() % (bench->jitter + 1) : 0)) * 1000;
+    if (link->tail && due < link->tail->due) due = link->tail->due; // jitter does not reorder
+    if (!(pkt = malloc(sizeof(RELAY_PKT) + len))) return;
+    pkt->next = NULL;
+    pkt->due  = due;
+    pkt->len  = len;
+    memcpy(pkt->data, buf, len);
+    if (link->tail) link->tail->next = pkt; else link->head = pkt;
+    link->tail = pkt;
+}
+
+static int64_t relay_out(RELAY_LINK *link, SOCKET fd, struct sockaddr_in *addr) // sends what is due, returns us to next one
+{
+    RELAY_PKT *pkt;
+    int64_t    now = get_tick_us();
+    while ((pkt = link->head) && pkt->due <= now) {
+        sendto(fd, (char*)pkt->data, pkt->len, 0, (struct sockaddr*)addr, sizeof(*addr));
+        if (!(link->head = pkt->next)) link->tail = NULL;
+        free(pkt);
+    }
+    return link->head ? link->head->due - now : 1000000;
+}
+
+static void* relay_thread_proc(void *argv)
+{
+    BENCH   *bench = (BENCH*)argv;
+    struct   sockaddr_in relayaddr, serveraddr, clientaddr, fromaddr;
+    socklen_t addrlen;
+    struct   timeval tv;
+    fd_set   rs;
+    uint8_t  buf[65536];
+    int64_t  wait;
+    int      len, gotclient = 0;
+    unsigned long opt;
+    SOCKET   fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&relayaddr, 0, sizeof(relayaddr));
+    relayaddr.sin_family      = AF_INET;
+    relayaddr.sin_port        = htons(bench->port + 1);
+    relayaddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    serveraddr = relayaddr;
+    serveraddr.sin_port       = htons(bench->port);
+    memset(&clientaddr, 0, sizeof(clientaddr));
+    opt = 4*1024*1024; setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char*)&opt, sizeof(int));
+    if (bind(fd, (struct sockaddr*)&relayaddr, sizeof(relayaddr)) != 0) { printf("relay failed to bind port %d !\n", bench->port + 1); return NULL; }
+#ifdef WIN32
+    opt = 1; ioctlsocket(fd, FIONBIO, &opt);
+#else
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    while (!bench->exit) {
+        while (1) {
+            addrlen = sizeof(fromaddr);
+            if ((len = recvfrom(fd, (char*)buf, sizeof(buf), 0, (struct sockaddr*)&fromaddr, &addrlen)) <= 0) break;
+            if (fromaddr.sin_port == serveraddr.sin_port) {
+                if (gotclient) relay_put(bench, &bench->down, buf, len, 1);
+            } else {
+                clientaddr = fromaddr; gotclient = 1;
+                relay_put(bench, &bench->up, buf, len, 0);
+            }
+        }
+        wait = MIN(relay_out(&bench->down, fd, &clientaddr), relay_out(&bench->up, fd, &serveraddr));
+        wait = MAX(MIN(wait, 10000), 100);
+        FD_ZERO(&rs);
+        FD_SET(fd, &rs);
+        tv.tv_sec  = 0;
+        tv.tv_usec = (long)wait;
+        select((int)fd + 1, &rs, NULL, NULL, &tv);
+    }
+    closesocket(fd);
+    return NULL;
+}
+
+static int bench_send_packet(BENCH *bench, void *ffrdp, char type, uint8_t *buf, int len, uint32_t pts, int deadline) // like ffrdp_send_packet of ffrdps
+{
+    uint32_t hdr[2];
+    FFRDP_IOVEC iov[2];
+    hdr[0] = ('T'  << 0) | (pts << 8);
+    hdr[1] = (type << 0) | (len << 8);
+    iov[0].buf = hdr; iov[0].len = sizeof(hdr); iov[0].ref = NULL;
+    iov[1].buf = buf; iov[1].len = len;         iov[1].ref = NULL;
+    if (bench->streams) {
+        return ffrdp_stream_sendv(ffrdp, type == 'A' ? 1 : type == 'V' ? 2 : 0, iov, 2, deadline, type == 'A' ? FFRDP_PRIO_URGENT : FFRDP_PRIO_LOW) == len + (int)sizeof(hdr) ? 0 : -1;
+    } else if (deadline > 0) return ffrdp_stream_sendv(ffrdp, 0, iov, 2, deadline, FFRDP_PRIO_LOW) == len + (int)sizeof(hdr) ? 0 : -1;
+    else return ffrdp_sendv(ffrdp, iov, 2) == len + (int)sizeof(hdr) ? 0 : -1;
+}
+
+static void* server_thread_proc(void *argv)
+{
+    BENCH   *bench = (BENCH*)argv;
+    void    *ffrdp, *client = NULL, *peer;
+    uint8_t *vbuf = malloc(BENCH_MAX_VIDEO), abuf[BENCH_AUDIO_SIZE], buf[256];
+    char     info[] = "aenc=bench,channels=1,samprate=8000;venc=bench,width=1280,height=720,frate=30,vps=,sps=,pps=;";
+    uint32_t tick_start = 0, tick_audio = 0, tick_video = 0, tick_key_due = 0, now, dropped = 0;
+    int      vsize = bench->vbitrate * 1000 / 8 / bench->fps, size, key, resync = 0, wait, qdelay, fd;
+    struct   timeval tv;
+    fd_set   rs;
+
+    ffrdp = ffrdp_listen("127.0.0.1", bench->port, NULL, NULL, 9000, bench->sfec);
+    if (!ffrdp || !vbuf) { printf("failed to start server !\n"); free(vbuf); ffrdp_free(ffrdp); return NULL; }
+    ffrdp_setopt(ffrdp, FFRDP_OPT_CC, FFRDP_CC_BBR);
+    ffrdp_setopt(ffrdp, FFRDP_OPT_WAIT, 0);
+    ffrdp_setopt(ffrdp, FFRDP_OPT_STREAMS, bench->streams);
+    ffrdp_setopt(ffrdp, FFRDP_OPT_COALESCE, 1000);
+
+    while (!bench->exit) {
+        ffrdp_update(ffrdp);
+        while ((peer = ffrdp_accept(ffrdp))) {
+            if (client) ffrdp_free(peer); else client = peer;
+        }
+        now = get_tick_count();
+        if (client && !tick_start) {
+            if (ffrdp_recv(client, (char*)buf, sizeof(buf)) > 0) {
+                bench_send_packet(bench, client, 'I', (uint8_t*)info, sizeof(info), 0, 0);
+                tick_start = tick_audio = tick_video = now;
+            }
+        } else if (client && (int32_t)(now - tick_start) < bench->secs * 1000) {
+            while (ffrdp_recv(client, (char*)buf, sizeof(buf)) > 0); // input events are not used
+            if (dropped != ffrdp_stream_dropped(client, bench->streams ? 2 : 0)) { // like ffrdps_check_dropped, right after ffrdp_update
+                dropped = ffrdp_stream_dropped(client, bench->streams ? 2 : 0);
+                if ((int32_t)(now - tick_key_due - bench->deadline) > 0) resync = 1; // not a frame queued before the last key frame
+            }
+            while ((int32_t)(now - tick_audio) >= 0) {
+                memset(abuf, (uint8_t)bench->asent, sizeof(abuf));
+                if (bench_send_packet(bench, client, 'A', abuf, sizeof(abuf), now, bench->streams ? 200 : 0) == 0) bench->asent++;
+                tick_audio += BENCH_AUDIO_PERIOD;
+            }
+            if ((int32_t)(now - tick_video) >= 0) {
+                key  = resync || bench->vsent % bench->gop == 0;
+                size = MIN(key ? vsize * 4 : vsize * (bench->gop - 4) / bench->gop, BENCH_MAX_VIDEO); // key frames are 4 times bigger, bitrate stays
+                size = MAX(size, 16);
+                ((uint32_t*)vbuf)[0] = bench->vsent;
+                ((uint32_t*)vbuf)[1] = size;
+                memset(vbuf + 8, (uint8_t)bench->vsent, size - 8);
+                wait = (int32_t)(tick_key_due - now);
+                if (bench_send_packet(bench, client, 'V', vbuf, size, now, key || !bench->deadline ? 0 : bench->deadline + MAX(wait, 0)) == 0 && key) {
+                    resync = 0; bench->keysent++;
+                    ffrdp_bwe(client, &qdelay);
+                    if (wait < qdelay) tick_key_due = now + qdelay;
+                }
+                bench->vsent++; // a frame that could not be sent counts as skipped
+                tick_video = tick_start + (uint32_t)((uint64_t)bench->vsent * 1000 / bench->fps);
+            }
+        }
+
+        fd   = ffrdp_get_fd(ffrdp);
+        wait = MIN(ffrdp_next_timeout(ffrdp), 2);
+        if (wait <= 0) continue;
+        FD_ZERO(&rs);
+        FD_SET((SOCKET)fd, &rs);
+        tv.tv_sec  = 0;
+        tv.tv_usec = wait * 1000;
+        select(fd + 1, &rs, NULL, NULL, &tv);
+    }
+    if (client) { printf("\nserver:\n"); ffrdp_dump(client, 0); }
+    ffrdp_free(ffrdp);
+    free(vbuf);
+    return NULL;
+}
+
+typedef struct {
+    BENCH    *bench;
+    pthread_t thread;
+    void     *ffrdp;   // listener shard of worker
+    int       first, num; // sessions of client thread
+    uint32_t  sessions;   // peers accepted by worker, or sessions that got data for client thread
+    uint64_t  bytes;      // sent by worker, received by client thread
+    double    cpu;        // seconds of thread
+} LOAD_THREAD;
+
+static double thread_cpu_time(void)
+{
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return 0;
+#endif
+}
+
+static void load_wait(void **ffrdp, int n, int maxwait)
+{
+    struct timeval tv;
+    fd_set rs;
+    int    wait = maxwait, maxfd = 0, fd, i;
+    FD_ZERO(&rs);
+    for (i=0; i<n; i++) {
+        if (!ffrdp[i]) continue;
+        wait = MIN(wait, ffrdp_next_timeout(ffrdp[i]));
+        fd   = ffrdp_get_fd(ffrdp[i]);
+        FD_SET((SOCKET)fd, &rs);
+        maxfd = MAX(maxfd, fd);
+    }
+    if (wait <= 0) return;
+    tv.tv_sec  = 0;
+    tv.tv_usec = wait * 1000;
+    select(maxfd + 1, &rs, NULL, NULL, &tv);
+}
+
+static void* load_worker_proc(void *argv) // one shard, the event loop of ffrdps for many sessions
+{
+    LOAD_THREAD *worker = (LOAD_THREAD*)argv;
+    BENCH       *bench  = worker->bench;
+    void        *peers[LOAD_MAX_PEERS], *peer;
+    uint32_t     tick_next[LOAD_MAX_PEERS], tick_join[LOAD_MAX_PEERS], tick_end = 0, now, period = 1000 / bench->fps;
+    uint32_t     hdr[2];
+    uint8_t     *vbuf = calloc(1, BENCH_MAX_VIDEO), buf[256];
+    FFRDP_IOVEC  iov[2];
+    int          size = MAX(MIN(bench->vbitrate * 1000 / 8 / bench->fps, BENCH_MAX_VIDEO), 16), n = 0, i;
+    double       cpu = thread_cpu_time();
+
+    hdr[0] = 'T'; hdr[1] = 'V' | (size << 8);
+    iov[0].buf = hdr ; iov[0].len = sizeof(hdr); iov[0].ref = NULL;
+    iov[1].buf = vbuf; iov[1].len = size;        iov[1].ref = NULL;
+    while (!bench->exit && vbuf) {
+        ffrdp_update(worker->ffrdp);
+        while ((peer = ffrdp_accept(worker->ffrdp))) {
+            if (n == LOAD_MAX_PEERS) { ffrdp_free(peer); continue; }
+            tick_next[n] = 0; tick_join[n] = get_tick_count(); peers[n++] = peer;
+            worker->sessions++;
+        }
+        now = get_tick_count();
+        for (i=0; i<n; i++) {
+            if (!tick_next[i]) { // waits for hello
+                if (ffrdp_recv(peers[i], (char*)buf, sizeof(buf)) > 0) tick_next[i] = now;
+                tick_end = tick_end ? tick_end : now + bench->secs * 1000;
+                continue;
+            }
+            if ((int32_t)(now - tick_next[i]) >= 0 && (int32_t)(now - tick_end) < 0) {
+                if (ffrdp_stream_sendv(peers[i], 0, iov, 2, 0, FFRDP_PRIO_LOW) == size + (int)sizeof(hdr)) worker->bytes += size + sizeof(hdr);
+                tick_next[i] = (int32_t)(now - tick_next[i]) > (int32_t)period ? now + period : tick_next[i] + period; // a session that fell behind skips frames
+                tick_next[i] = tick_next[i] ? tick_next[i] : 1;
+            }
+        }
+        for (i=0; i<n; i++) {
+            if (!ffrdp_isdead(peers[i]) && (tick_next[i] || (int32_t)(now - tick_join[i]) < LOAD_JOIN_TIMEOUT)) continue;
+            ffrdp_free(peers[i]);
+            peers[i] = peers[--n]; tick_next[i] = tick_next[n]; tick_join[i] = tick_join[n]; i--;
+        }
+        load_wait(&worker->ffrdp, 1, 2);
+    }
+    worker->cpu = thread_cpu_time() - cpu;
+    free(vbuf);
+    return NULL;
+}
+
+static void* load_client_proc(void *argv) // sessions of one client thread
+{
+    LOAD_THREAD *client = (LOAD_THREAD*)argv;
+    BENCH       *bench  = client->bench;
+    void        *ffrdp[LOAD_MAX_SESSIONS];
+    uint8_t      got[LOAD_MAX_SESSIONS], buf[65536];
+    int          ret, i;
+    double       cpu = thread_cpu_time();
+
+    for (i=0; i<client->num; i++) {
+        if (!(ffrdp[i] = ffrdp_init("127.0.0.1", bench->port, NULL, NULL, 0, 1500, 0))) continue;
+        ffrdp_setopt(ffrdp[i], FFRDP_OPT_WAIT, 0);
+        ffrdp_sendmsg(ffrdp[i], "hello", 6, 0, FFRDP_PRIO_HIGH);
+        got[i] = 0;
+    }
+    while (!bench->exit) {
+        for (i=0; i<client->num; i++) {
+            if (!ffrdp[i]) continue;
+            ffrdp_update(ffrdp[i]);
+            while ((ret = ffrdp_recv(ffrdp[i], (char*)buf, sizeof(buf))) > 0) {
+                client->bytes += ret;
+                if (!got[i]) { got[i] = 1; client->sessions++; }
+            }
+        }
+        load_wait(ffrdp, client->num, 2);
+    }
+    for (i=0; i<client->num; i++) ffrdp_free(ffrdp[i]);
+    client->cpu = thread_cpu_time() - cpu;
+    return NULL;
+}
+
+static int load_test(BENCH *bench)
+{
+    static LOAD_THREAD workers[LOAD_MAX_THREADS], clients[LOAD_MAX_THREADS];
+    uint64_t sent = 0, recv = 0;
+    uint32_t accepted = 0, served = 0;
+    double   cpu = 0;
+    int      i;
+
+    bench->shards   = MAX(MIN(bench->shards , LOAD_MAX_THREADS), 1);
+    bench->clients  = MAX(MIN(bench->clients, LOAD_MAX_THREADS), 1);
+    bench->sessions = MIN(bench->sessions, MIN(LOAD_MAX_SESSIONS, bench->shards * LOAD_MAX_PEERS));
+    for (i=0; i<bench->shards; i++) { // bind order is shard order
+        workers[i].bench = bench;
+        if (!(workers[i].ffrdp = ffrdp_listen_shard("127.0.0.1", bench->port, NULL, NULL, 1500, bench->sfec, i, bench->shards))) {
+            printf("failed to create shard %d !\n", i);
+            while (--i >= 0) ffrdp_free(workers[i].ffrdp);
+            return -1;
+        }
+        ffrdp_setopt(workers[i].ffrdp, FFRDP_OPT_CC, FFRDP_CC_BBR);
+        ffrdp_setopt(workers[i].ffrdp, FFRDP_OPT_WAIT, 0);
+    }
+    for (i=0; i<bench->shards ; i++) pthread_create(&workers[i].thread, NULL, load_worker_proc, &workers[i]);
+    for (i=0; i<bench->clients; i++) {
+        clients[i].bench = bench;
+        clients[i].first = bench->sessions * i / bench->clients;
+        clients[i].num   = bench->sessions * (i + 1) / bench->clients - clients[i].first;
+        pthread_create(&clients[i].thread, NULL, load_client_proc, &clients[i]);
+    }
+    usleep((bench->secs + 2) * 1000 * 1000);
+    bench->exit = 1;
+    for (i=0; i<bench->clients; i++) pthread_join(clients[i].thread, NULL);
+    for (i=0; i<bench->shards ; i++) pthread_join(workers[i].thread, NULL);
+
+    printf("\nshard  sessions  sent(Mbps)  cpu(s)\n");
+    for (i=0; i<bench->shards; i++) {
+        printf("%5d  %8u  %10.1f  %6.2f\n", i, workers[i].sessions, workers[i].bytes * 8.0 / bench->secs / 1e6, workers[i].cpu);
+        accepted += workers[i].sessions; sent += workers[i].bytes; cpu += workers[i].cpu;
+        ffrdp_free(workers[i].ffrdp);
+    }
+    for (i=0; i<bench->clients; i++) { served += clients[i].sessions; recv += clients[i].bytes; }
+    printf("sessions: %d, accepted %u (more means a session reached two shards), served %u\n", bench->sessions, accepted, served);
+    printf("goodput : sent %.1fMbps, received %.1fMbps, offered %.1fMbps\n", sent * 8.0 / bench->secs / 1e6, recv * 8.0 / bench->secs / 1e6, bench->sessions * bench->vbitrate / 1000.0);
+    printf("workers : %.2f cpu seconds, %.1fMB per cpu second\n", cpu, cpu > 0 ? sent / cpu / 1e6 : 0);
+    return 0;
+}
+
+#ifdef CONFIG_FFRDP_BENCH
+static void* pool_client_proc(void *argv)
+{
+    BENCH *bench = (BENCH*)argv;
+    void  *ffrdp = ffrdp_init("127.0.0.1", bench->port, NULL, NULL, 0, 1500, 0);
+    char   buf[65536];
+    int    ret;
+    if (!ffrdp) return NULL;
+    ffrdp_send(ffrdp, "x", 1); // server learns the address of client
+    while (!bench->exit) {
+        while ((ret = ffrdp_recv(ffrdp, buf, sizeof(buf))) > 0) bench->pool_bytes += ret;
+        ffrdp_update(ffrdp);
+    }
+    ffrdp_free(ffrdp);
+    return NULL;
+}
+
+static int pool_test(BENCH *bench) // frame node pool of ffrdp: cost per node, then the pool sizes after a bulk send
+{
+    static char chunk[100000];
+    pthread_t client;
+    void     *ffrdp;
+    int64_t   tick;
+    double    ns[2];
+    char      buf[16];
+    int       n, i;
+
+    for (i=0; i<2; i++) {
+        tick  = get_tick_us();
+        n     = ffrdp_bench_nodes(bench->pool, !i);
+        ns[i] = n ? (get_tick_us() - tick) * 1000.0 / n : 0;
+    }
+    printf("nodes   : %.1fns with pool, %.1fns with malloc/free, per node taken and given back\n", ns[0], ns[1]);
+
+    if (!(ffrdp = ffrdp_init("127.0.0.1", bench->port, NULL, NULL, 1, 1500, 0))) { printf("failed to start server !\n"); return -1; }
+    pthread_create(&client, NULL, pool_client_proc, bench);
+    while (ffrdp_recv(ffrdp, buf, sizeof(buf)) <= 0) ffrdp_update(ffrdp);
+    tick = get_tick_us();
+    while (get_tick_us() - tick < (int64_t)bench->secs * 1000000) {
+        ffrdp_send(ffrdp, chunk, sizeof(chunk));
+        ffrdp_update(ffrdp);
+    }
+    bench->exit = 1;
+    pthread_join(client, NULL);
+    printf("bulk    : %.1fMB/s received in %ds, pools grow by one window of nodes per malloc:\n", bench->pool_bytes / 1e6 / bench->secs, bench->secs);
+    ffrdp_dump(ffrdp, 0);
+    ffrdp_free(ffrdp);
+    return 0;
+}
+#endif
+
+static void bench_callback(void *cbctxt, int type, uint8_t *buf, int len, uint32_t pts)
+{
+    BENCH   *bench = (BENCH*)cbctxt;
+    uint32_t now = get_tick_count(), seq;
+    int32_t  lat = (int32_t)((now - pts) & 0xFFFFFF); // pts is the 24 bits server tick
+    int      i;
+    switch (type) {
+    case 'A':
+        bench->aplay++; bench->alat_sum += lat;
+        break;
+    case 'V':
+        seq = ((uint32_t*)buf)[0];
+        if (len < 8 || (int)((uint32_t*)buf)[1] != len) { bench->bad++; break; }
+        for (i=8; i<len && buf[i] == (uint8_t)seq; i++);
+        if (i < len) bench->bad++;
+        if (seq != bench->vseq_next) bench->skipped += seq - bench->vseq_next;
+        bench->vseq_next = seq + 1;
+        if (bench->vplay < BENCH_MAX_FRAMES) bench->vlat[bench->vplay] = lat;
+        if (bench->vplay) bench->freeze_max = MAX(bench->freeze_max, (int32_t)(now - bench->tick_vout));
+        bench->tick_vout = now;
+        bench->vplay++;
+        break;
+    }
+}
+
+static int cmp_int32(const void *a, const void *b)
+{
+    return *(int32_t*)a - *(int32_t*)b;
+}
+
+int main(int argc, char *argv[])
+{
+    static BENCH bench;
+    FFRDPC_STATS stats;
+    pthread_t    relay, server;
+    void        *ffrdpc;
+    int64_t      sum = 0;
+    int          n, i;
+#ifdef WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    bench.port     = 9100;
+    bench.secs     = 10;
+    bench.fps      = 30;
+    bench.gop      = 60;
+    bench.vbitrate = 4000; // kbps
+    bench.burst    = 1;
+    bench.delay    = 10;
+    bench.jbmin    = -1;
+    for (i=1; i<argc; i++) {
+        if (strstr(argv[i], "--port=") == argv[i]) {
+            bench.port = atoi(argv[i] + 7);
+        } else if (strstr(argv[i], "--secs=") == argv[i]) {
+            bench.secs = atoi(argv[i] + 7);
+        } else if (strstr(argv[i], "--fps=") == argv[i]) {
+            bench.fps = MAX(1, atoi(argv[i] + 6));
+        } else if (strstr(argv[i], "--gop=") == argv[i]) {
+            bench.gop = MAX(5, atoi(argv[i] + 6));
+        } else if (strstr(argv[i], "--vbitrate=") == argv[i]) {
+            bench.vbitrate = atoi(argv[i] + 11);
+        } else if (strstr(argv[i], "--streams=") == argv[i]) {
+            bench.streams = atoi(argv[i] + 10);
+        } else if (strstr(argv[i], "--deadline=") == argv[i]) {
+            bench.deadline = atoi(argv[i] + 11);
+        } else if (strstr(argv[i], "--fec=") == argv[i]) {
+            int k = 0, m = 0; sscanf(argv[i] + 6, "%d,%d", &k, &m); bench.sfec = k > 0 && m > 0 ? FFRDP_FEC(k, m) : 0;
+        } else if (strstr(argv[i], "--loss=") == argv[i]) {
+            bench.loss = atof(argv[i] + 7);
+        } else if (strstr(argv[i], "--burst=") == argv[i]) {
+            bench.burst = atof(argv[i] + 8);
+        } else if (strstr(argv[i], "--delay=") == argv[i]) {
+            bench.delay = atoi(argv[i] + 8);
+        } else if (strstr(argv[i], "--jitter=") == argv[i]) {
+            bench.jitter = atoi(argv[i] + 9);
+        } else if (strstr(argv[i], "--rate=") == argv[i]) {
+            bench.rate = atoi(argv[i] + 7);
+        } else if (strstr(argv[i], "--qlen=") == argv[i]) {
+            bench.qlen = atoi(argv[i] + 7);
+        } else if (strstr(argv[i], "--jitterbuf=") == argv[i]) {
+            sscanf(argv[i] + 12, "%d,%d", &bench.jbmin, &bench.jbmax);
+        } else if (strstr(argv[i], "--sessions=") == argv[i]) {
+            bench.sessions = atoi(argv[i] + 11);
+        } else if (strstr(argv[i], "--shards=") == argv[i]) {
+            bench.shards = atoi(argv[i] + 9);
+        } else if (strstr(argv[i], "--clients=") == argv[i]) {
+            bench.clients = atoi(argv[i] + 10);
+        } else if (strstr(argv[i], "--pool=") == argv[i]) {
+            bench.pool = atoi(argv[i] + 7);
+        } else {
+            printf("usage: ffrdpbench [options]\n");
+            printf("  --port=9100      server port, relay is on port + 1\n");
+            printf("  --secs=10        seconds of sending\n");
+            printf("  --fps=30 --gop=60 --vbitrate=4000 (kbps)\n");
+            printf("  --streams=0      1: ffrdp streams like --ffrdpsstreams=1\n");
+            printf("  --deadline=0     ms deadline of delta frames like --ffrdpsdeadline\n");
+            printf("  --fec=k,m        fec of server\n");
+            printf("  --loss=0 --burst=1 (mean packets of a loss burst)\n");
+            printf("  --delay=10 --jitter=0 (ms, one way, no reordering)\n");
+            printf("  --rate=0         kbps of server to client link, 0 for unlimited\n");
+            printf("  --qlen=0         ms of queue of rate limited link, 0 for unlimited\n");
+            printf("  --jitterbuf=min,max ms of playout delay of ffrdpc\n");
+            printf("  --sessions=0     load test of this many sessions instead\n");
+            printf("  --shards=1       worker threads of load test, one ffrdp_listen_shard each\n");
+            printf("  --clients=1      client threads of load test\n");
+            printf("  --pool=0         frame node pool test of this many rounds instead, needs CONFIG_FFRDP_BENCH\n");
+            return 0;
+        }
+    }
+    if (bench.sessions > 0) return load_test(&bench);
+#ifdef CONFIG_FFRDP_BENCH
+    if (bench.pool > 0) return pool_test(&bench);
+#endif
+
+    pthread_create(&relay , NULL, relay_thread_proc , &bench);
+    pthread_create(&server, NULL, server_thread_proc, &bench);
+    usleep(100*1000);
+    ffrdpc = ffrdpc_init("127.0.0.1", bench.port + 1, NULL, NULL, bench.streams, bench_callback, &bench);
+    if (bench.jbmin >= 0) ffrdpc_set_jitter(ffrdpc, bench.jbmin, bench.jbmax);
+    usleep((bench.secs + 2) * 1000 * 1000);
+    printf("\nclient:\n");
+    ffrdpc_dump(ffrdpc, 0);
+    ffrdpc_stats(ffrdpc, &stats, 0);
+    ffrdpc_exit(ffrdpc);
+    bench.exit = 1;
+    pthread_join(server, NULL);
+    pthread_join(relay , NULL);
+
+    n = MIN(bench.vplay, BENCH_MAX_FRAMES);
+    for (i=0; i<n; i++) sum += bench.vlat[i];
+    qsort(bench.vlat, n, sizeof(int32_t), cmp_int32);
+    printf("\nnetwork : loss %.3f burst %.1f delay %dms jitter %dms rate %dkbps qlen %dms, lost %u/%u, queue drops %u\n",
+        bench.loss, bench.burst, bench.delay, bench.jitter, bench.rate, bench.qlen, bench.down.lost, bench.up.lost, bench.down.qdrops);
+    printf("video   : sent %u (key %u), played %u, skipped %u, corrupt %u\n", bench.vsent, bench.keysent, bench.vplay, bench.skipped, bench.bad);
+    printf("latency : avg %dms, p50 %dms, p95 %dms, p99 %dms, max %dms\n", n ? (int)(sum / n) : 0,
+        n ? bench.vlat[n / 2] : 0, n ? bench.vlat[n * 95 / 100] : 0, n ? bench.vlat[n * 99 / 100] : 0, n ? bench.vlat[n - 1] : 0);
+    printf("audio   : sent %u, played %u, avg latency %dms\n", bench.asent, bench.aplay, bench.aplay ? (int)(bench.alat_sum / bench.aplay) : 0);
+    printf("playout : delay audio %dms video %dms, late %u, gaps %u, stalls %u (%ums), longest freeze %dms\n",
+        stats.delay[0], stats.delay[1], stats.late, stats.gaps, stats.stalls, stats.stall_ms, bench.freeze_max);
+#ifdef WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
@@ -0,0 +1,479 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "ffrdp.h"
+#include "ffrdpc.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+#pragma warning(disable:4996) // disable warnings
+#define usleep(t) Sleep((t) / 1000)
+#define get_tick_count GetTickCount
+#else
+#include <unistd.h>
+#include <time.h>
+#include <sys/select.h>
+#define SOCKET int
+static uint32_t get_tick_count()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define FFRDPC_MOUSE_EVENT_MSG  (('M' << 0) | ('E' << 8) | ('V' << 16) | ('T' << 24))
+#define FFRDPC_KEYBD_EVENT_MSG  (('K' << 0) | ('E' << 8) | ('V' << 16) | ('T' << 24))
+#define FFRDPC_EVENT_LEN         8
+
+// streams of ffrdps (see FFRDPS_STREAM_*)
+#define FFRDPC_STREAM_CTRL       0
+#define FFRDPC_STREAM_AUDIO      1
+#define FFRDPC_STREAM_VIDEO      2
+#define FFRDPC_STREAM_INPUT      3
+
+#define FFRDPC_MAX_PACKET   (2 * 1024 * 1024) // payload of one packet, as big as the video buffer of ffrdps
+#define FFRDPC_SMSS          1500
+#define FFRDPC_MAX_HELD       512 // ffrdp frames the jitter buffer keeps in streams mode, more are copied so the receive window stays open
+#define FFRDPC_INPUT_BUF      512 // bytes of input events queued for the client thread
+#define FFRDPC_INPUT_POLL       2 // ms, input events of other threads wait at most this long while connected
+#define FFRDPC_MAX_WAIT       100 // ms
+#define FFRDPC_TRANSIT_WIN  10000 // ms of min transit filter
+#define FFRDPC_MIN_DELAY       20 // ms, default playout delay bounds
+#define FFRDPC_MAX_DELAY      500
+#define FFRDPC_AUDIO_LEAD      40 // ms audio may be played ahead of the playout clock of video, for a steadier audio path
+
+// packet waiting in jitter buffer, its payload is either copied into data or still in the ffrdp frames of msg
+typedef struct tagFFRDPC_FRAME {
+    struct tagFFRDPC_FRAME *next;
+    int       type;
+    int       len;
+    uint32_t  pts;
+    uint32_t  tick_play;
+    FFRDP_MSG msg;
+    uint8_t   data[1];
+} FFRDPC_FRAME;
+
+typedef struct {
+    #define TS_EXIT       (1 << 0)
+    #define TS_START      (1 << 1)
+    #define TS_CONNECTED  (1 << 2) // 'I' received, input goes to server
+    #define TS_PTS_VALID  (1 << 3)
+    #define TS_MIN_VALID  (1 << 4)
+    #define TS_VOUT_VALID (1 << 5)
+    #define TS_PLAY_AUDIO (1 << 6) // play_last of audio and video are set
+    #define TS_PLAY_VIDEO (1 << 7)
+    uint32_t  status;
+    pthread_t pthread;
+    void     *ffrdp;
+    char      ip[32];
+    int       port;
+    char      txkey[32];
+    char      rxkey[32];
+    int       streams;
+
+    PFN_FFRDPC_CB callback;
+    void         *cbctxt;
+
+    // input events of ffrdpc_send_mouse/keybd, sent by the client thread which owns ffrdp
+    pthread_mutex_t lock;
+    uint8_t   input_buf[FFRDPC_INPUT_BUF];
+    int       input_len;
+
+    // jitter buffer: transit (local arrival tick - pts) has an unknown clock offset, its min over FFRDPC_TRANSIT_WIN ms
+    // is taken as the fastest path, the smoothed mean and deviation of what is above it give the playout delay.
+    // audio and video share one delay, the larger of their own, audio may lead it by FFRDPC_AUDIO_LEAD at most.
+    // mean and deviation are in 1/16 ms
+    FFRDPC_FRAME *jb_head;
+    int       held; // ffrdp frames held by jb_head list
+    uint32_t  pts_last;
+    int32_t   transit_min;
+    uint32_t  tick_transit_min;
+    int       jit_avg[2], jit_dev[2]; // of audio and video
+    int       delay_min, delay_max;
+    uint32_t  play_last[2]; // tick_play of last audio and video frame, each type is played in order
+    uint32_t  vout_tick, vout_pts;
+    FFRDPC_STATS stats;
+    uint32_t  tick_dump;
+
+    int       rhead, rtail; // packets of the byte stream are reassembled in rbuf
+    uint8_t   rbuf[FFRDPC_MAX_PACKET + 2 * sizeof(uint32_t)];
+    uint8_t   pbuf[FFRDPC_MAX_PACKET]; // payload of a packet held in several ffrdp frames is gathered here to be played
+} FFRDPC;
+
+static void ffrdpc_frame_free(FFRDPC *ffrdpc, FFRDPC_FRAME *frame)
+{
+    if (frame->msg.nseg) {
+        ffrdpc->held -= frame->msg.nseg;
+        ffrdp_msg_free(&frame->msg);
+    }
+    free(frame);
+}
+
+static void ffrdpc_reset(FFRDPC *ffrdpc)
+{
+    FFRDPC_FRAME *frame;
+    while ((frame = ffrdpc->jb_head)) { // frames held go back to ffrdp before it is freed
+        ffrdpc->jb_head = frame->next;
+        ffrdpc_frame_free(ffrdpc, frame);
+    }
+    ffrdp_free(ffrdpc->ffrdp); ffrdpc->ffrdp = NULL;
+    ffrdpc->rhead = ffrdpc->rtail = 0;
+    ffrdpc->input_len = 0;
+    ffrdpc->status &= (TS_EXIT|TS_START);
+}
+
+static void ffrdpc_play(FFRDPC *ffrdpc, FFRDPC_FRAME *frame)
+{
+    FFRDP_IOVEC iov;
+    uint8_t    *buf = frame->data;
+    uint32_t    now = get_tick_count();
+    int32_t     excess;
+    if (frame->msg.nseg) {
+        if (ffrdp_msg_iov(&frame->msg, &iov, 1) == 1) buf = (uint8_t*)iov.buf + 2 * sizeof(uint32_t);
+        else { ffrdp_msg_read(&frame->msg, 2 * sizeof(uint32_t), (char*)ffrdpc->pbuf, frame->len); buf = ffrdpc->pbuf; }
+    }
+    switch (frame->type) {
+    case 'A': ffrdpc->stats.audio++; break;
+    case 'V':
+        if (ffrdpc->status & TS_VOUT_VALID) { // video was held back longer than the pts interval of the frames
+            excess = (int32_t)(now - ffrdpc->vout_tick) - (int32_t)(frame->pts - ffrdpc->vout_pts);
+            if (excess > FFRDPC_STALL_MS) { ffrdpc->stats.stalls++; ffrdpc->stats.stall_ms += excess; }
+        }
+        ffrdpc->vout_tick = now;
+        ffrdpc->vout_pts  = frame->pts;
+        ffrdpc->status   |= TS_VOUT_VALID;
+        ffrdpc->stats.video++;
+        break;
+    }
+    if (ffrdpc->callback) ffrdpc->callback(ffrdpc->cbctxt, frame->type, frame->len ? buf : NULL, frame->len, frame->pts);
+    ffrdpc_frame_free(ffrdpc, frame);
+}
+
+static void ffrdpc_jbuf_put(FFRDPC *ffrdpc, FFRDPC_FRAME *frame)
+{
+    FFRDPC_FRAME **pp;
+    uint32_t now = get_tick_count(), bit;
+    int32_t  transit;
+    int      video = frame->type != 'A', d, da, dv;
+
+    if (frame->type != FFRDPC_GAP) {
+        if (!(ffrdpc->status & TS_PTS_VALID)) { ffrdpc->pts_last = frame->pts; ffrdpc->status |= TS_PTS_VALID; }
+        ffrdpc->pts_last += (int32_t)((frame->pts - ffrdpc->pts_last) << 8) >> 8; // pts is 24 bits on the wire
+        frame->pts = ffrdpc->pts_last;
+
+        transit = (int32_t)(now - frame->pts);
+        if (!(ffrdpc->status & TS_MIN_VALID) || transit - ffrdpc->transit_min <= 0 || (int32_t)now - (int32_t)ffrdpc->tick_transit_min > FFRDPC_TRANSIT_WIN) {
+            ffrdpc->transit_min      = transit;
+            ffrdpc->tick_transit_min = now;
+            ffrdpc->status          |= TS_MIN_VALID;
+        }
+        d = (transit - ffrdpc->transit_min) * 16;
+        ffrdpc->jit_avg[video] += (d - ffrdpc->jit_avg[video]) / 8;
+        ffrdpc->jit_dev[video] += (abs(d - ffrdpc->jit_avg[video]) - ffrdpc->jit_dev[video]) / 4;
+        da = MAX(ffrdpc->delay_min, MIN((ffrdpc->jit_avg[0] + 4 * ffrdpc->jit_dev[0]) / 16, ffrdpc->delay_max));
+        dv = MAX(ffrdpc->delay_min, MIN((ffrdpc->jit_avg[1] + 4 * ffrdpc->jit_dev[1]) / 16, ffrdpc->delay_max));
+        ffrdpc->stats.delay[1] = MAX(da, dv); // one playout clock keeps lip sync
+        ffrdpc->stats.delay[0] = MAX(da, ffrdpc->stats.delay[1] - FFRDPC_AUDIO_LEAD);
+        frame->tick_play = frame->pts + ffrdpc->transit_min + ffrdpc->stats.delay[video];
+    } else frame->tick_play = now; // gap goes after the video frames before it
+
+    bit = video ? TS_PLAY_VIDEO : TS_PLAY_AUDIO;
+    if ((ffrdpc->status & bit) && (int32_t)(frame->tick_play - ffrdpc->play_last[video]) < 0) frame->tick_play = ffrdpc->play_last[video];
+    ffrdpc->play_last[video] = frame->tick_play;
+    ffrdpc->status |= bit;
+    if (frame->type != FFRDPC_GAP && (int32_t)(frame->tick_play - now) < 0) ffrdpc->stats.late++;
+
+    for (pp=&ffrdpc->jb_head; *pp && (int32_t)((*pp)->tick_play - frame->tick_play) <= 0; pp=&(*pp)->next);
+    frame->next = *pp; *pp = frame;
+}
+
+static void ffrdpc_packet(FFRDPC *ffrdpc, FFRDPC_FRAME *frame) // control packets are played at once, audio and video go through jitter buffer
+{
+    if (frame->type == 'I') ffrdpc->status |= TS_CONNECTED;
+    if (frame->type == 'A' || frame->type == 'V' || frame->type == FFRDPC_GAP) ffrdpc_jbuf_put(ffrdpc, frame);
+    else ffrdpc_play(ffrdpc, frame);
+}
+
+static void ffrdpc_gap(FFRDPC *ffrdpc, int video)
+{
+    FFRDPC_FRAME *frame;
+    ffrdpc->stats.gaps++;
+    if (!video || !(frame = calloc(1, sizeof(FFRDPC_FRAME)))) return; // lost audio frame is just missing
+    frame->type = FFRDPC_GAP;
+    ffrdpc_packet(ffrdpc, frame);
+}
+
+static int ffrdpc_recv_stream(FFRDPC *ffrdpc) // byte stream of ffrdp, 0 or -1 if it can't be parsed
+{
+    FFRDPC_FRAME *frame;
+    uint32_t hdr[2];
+    int      ret, len;
+    while ((ret = ffrdp_recv(ffrdpc->ffrdp, (char*)ffrdpc->rbuf + ffrdpc->rtail, sizeof(ffrdpc->rbuf) - ffrdpc->rtail)) != 0) {
+        if (ret == FFRDP_RECV_GAP) { // a video frame was dropped, so is the part of it received
+            ffrdpc->rhead = ffrdpc->rtail = 0;
+            ffrdpc_gap(ffrdpc, 1);
+            continue;
+        }
+        if (ret < 0) break;
+        ffrdpc->rtail += ret;
+        while (ffrdpc->rtail - ffrdpc->rhead >= (int)sizeof(hdr)) {
+            memcpy(hdr, ffrdpc->rbuf + ffrdpc->rhead, sizeof(hdr));
+            len = hdr[1] >> 8;
+            if ((hdr[0] & 0xFF) != 'T' || len > FFRDPC_MAX_PACKET) { printf("ffrdpc invalid packet !\n"); return -1; }
+            if (ffrdpc->rtail - ffrdpc->rhead < (int)sizeof(hdr) + len) break;
+            if ((frame = malloc(sizeof(FFRDPC_FRAME) + len))) {
+                memset(frame, 0, sizeof(FFRDPC_FRAME));
+                frame->type = hdr[1] & 0xFF;
+                frame->len  = len;
+                frame->pts  = hdr[0] >> 8;
+                memcpy(frame->data, ffrdpc->rbuf + ffrdpc->rhead + sizeof(hdr), len);
+                ffrdpc_packet(ffrdpc, frame);
+            }
+            ffrdpc->rhead += sizeof(hdr) + len;
+        }
+        if (ffrdpc->rhead == ffrdpc->rtail) ffrdpc->rhead = ffrdpc->rtail = 0;
+        else if (ffrdpc->rtail == sizeof(ffrdpc->rbuf)) { // the partial packet is moved to the front for the rest of it
+            memmove(ffrdpc->rbuf, ffrdpc->rbuf + ffrdpc->rhead, ffrdpc->rtail - ffrdpc->rhead);
+            ffrdpc->rtail -= ffrdpc->rhead; ffrdpc->rhead = 0;
+        }
+    }
+    return 0;
+}
+
+static void ffrdpc_recv_msgs(FFRDPC *ffrdpc, int stream) // streams mode, every packet is one message
+{
+    FFRDPC_FRAME *frame;
+    FFRDP_MSG msg;
+    uint32_t  hdr[2];
+    int       ret, len;
+    while ((ret = ffrdp_msg_recv(ffrdpc->ffrdp, stream, &msg)) != 0) {
+        if (ret == FFRDP_RECV_GAP) { ffrdpc_gap(ffrdpc, stream == FFRDPC_STREAM_VIDEO); continue; }
+        if (ret < 0) break;
+        len = ret - (int)sizeof(hdr);
+        if (len < 0 || ffrdp_msg_read(&msg, 0, (char*)hdr, sizeof(hdr)) != sizeof(hdr) || (hdr[0] & 0xFF) != 'T' || (int)(hdr[1] >> 8) != len || len > FFRDPC_MAX_PACKET) {
+            printf("ffrdpc invalid packet !\n");
+            ffrdp_msg_free(&msg); continue;
+        }
+        if (ffrdpc->held + msg.nseg <= FFRDPC_MAX_HELD) { // played from the frames of ffrdp
+            if (!(frame = calloc(1, sizeof(FFRDPC_FRAME)))) { ffrdp_msg_free(&msg); continue; }
+            frame->msg    = msg;
+            ffrdpc->held += msg.nseg;
+        } else {
+            if (!(frame = malloc(sizeof(FFRDPC_FRAME) + len))) { ffrdp_msg_free(&msg); continue; }
+            memset(frame, 0, sizeof(FFRDPC_FRAME));
+            ffrdp_msg_read(&msg, sizeof(hdr), (char*)frame->data, len);
+            ffrdp_msg_free(&msg);
+        }
+        frame->type = hdr[1] & 0xFF;
+        frame->len  = len;
+        frame->pts  = hdr[0] >> 8;
+        ffrdpc_packet(ffrdpc, frame);
+    }
+}
+
+static int is_null_key(char key[32])
+{
+    int  i;
+    for (i=0; i<32; i++) {
+        if (key[i]) return 0;
+    }
+    return 1;
+}
+
+static int ffrdpc_connect(FFRDPC *ffrdpc)
+{
+    ffrdpc->ffrdp = ffrdp_init(ffrdpc->ip, ffrdpc->port,
+        is_null_key(ffrdpc->txkey) ? NULL : ffrdpc->txkey,
+        is_null_key(ffrdpc->rxkey) ? NULL : ffrdpc->rxkey,
+        0, FFRDPC_SMSS, 0);
+    if (!ffrdpc->ffrdp) return -1;
+    ffrdp_setopt(ffrdpc->ffrdp, FFRDP_OPT_WAIT, 0); // ffrdpc_wait does the waiting
+    ffrdp_setopt(ffrdpc->ffrdp, FFRDP_OPT_STREAMS, ffrdpc->streams);
+    if (ffrdpc->streams) ffrdp_setopt(ffrdpc->ffrdp, FFRDP_OPT_RECVMSG, (1 << FFRDPC_STREAM_CTRL) | (1 << FFRDPC_STREAM_AUDIO) | (1 << FFRDPC_STREAM_VIDEO));
+    ffrdp_sendmsg(ffrdpc->ffrdp, "hello", 6, 0, FFRDP_PRIO_HIGH); // server takes any data on stream 0 as join
+    return 0;
+}
+
+static void ffrdpc_wait(FFRDPC *ffrdpc)
+{
+    struct timeval tv;
+    fd_set rs;
+    int    fd = ffrdp_get_fd(ffrdpc->ffrdp), wait = MIN(ffrdp_next_timeout(ffrdpc->ffrdp), FFRDPC_MAX_WAIT);
+    if (ffrdpc->jb_head) wait = MIN(wait, (int32_t)(ffrdpc->jb_head->tick_play - get_tick_count()));
+    if (ffrdpc->status & TS_CONNECTED) wait = MIN(wait, FFRDPC_INPUT_POLL);
+    if (wait <= 0) return;
+    FD_ZERO(&rs);
+    FD_SET((SOCKET)fd, &rs);
+    tv.tv_sec  = wait / 1000;
+    tv.tv_usec = wait % 1000 * 1000;
+    select(fd + 1, &rs, NULL, NULL, &tv);
+}
+
+static void* ffrdpc_thread_proc(void *argv)
+{
+    FFRDPC       *ffrdpc = (FFRDPC*)argv;
+    FFRDPC_FRAME *frame;
+    uint8_t       input[FFRDPC_INPUT_BUF];
+    int           len;
+    while (!(ffrdpc->status & TS_EXIT)) {
+        if (!(ffrdpc->status & TS_START)) { if (ffrdpc->ffrdp) ffrdpc_reset(ffrdpc); usleep(100*1000); continue; }
+        if (!ffrdpc->ffrdp && ffrdpc_connect(ffrdpc) != 0) { usleep(100*1000); continue; }
+
+        pthread_mutex_lock(&ffrdpc->lock);
+        memcpy(input, ffrdpc->input_buf, len = ffrdpc->input_len);
+        ffrdpc->input_len = 0;
+        pthread_mutex_unlock(&ffrdpc->lock);
+        if (len > 0) {
+            if (ffrdpc->streams) ffrdp_stream_send(ffrdpc->ffrdp, FFRDPC_STREAM_INPUT, (char*)input, len, 0, FFRDP_PRIO_URGENT);
+            else ffrdp_sendmsg(ffrdpc->ffrdp, (char*)input, len, 0, FFRDP_PRIO_HIGH);
+        }
+
+        ffrdp_update(ffrdpc->ffrdp); // send what is due, take in what arrived
+        if (ffrdpc->streams) {
+            ffrdpc_recv_msgs(ffrdpc, FFRDPC_STREAM_CTRL );
+            ffrdpc_recv_msgs(ffrdpc, FFRDPC_STREAM_AUDIO);
+            ffrdpc_recv_msgs(ffrdpc, FFRDPC_STREAM_VIDEO);
+        } else if (ffrdpc_recv_stream(ffrdpc) != 0) { ffrdpc_reset(ffrdpc); continue; }
+
+        while ((frame = ffrdpc->jb_head) && (int32_t)(frame->tick_play - get_tick_count()) <= 0) {
+            ffrdpc->jb_head = frame->next;
+            ffrdpc_play(ffrdpc, frame);
+        }
+
+        if (ffrdp_isdead(ffrdpc->ffrdp)) {
+            printf("ffrdpc disconnect !\n");
+            ffrdpc_reset(ffrdpc);
+            continue;
+        }
+        ffrdpc_wait(ffrdpc);
+    }
+    if (ffrdpc->ffrdp) ffrdpc_reset(ffrdpc);
+    return NULL;
+}
+
+void* ffrdpc_init(char *ip, int port, char *txkey, char *rxkey, int streams, PFN_FFRDPC_CB callback, void *cbctxt)
+{
+    FFRDPC *ffrdpc = calloc(1, sizeof(FFRDPC));
+    if (!ffrdpc) {
+        printf("failed to allocate memory for ffrdpc !\n");
+        return NULL;
+    }
+
+    strncpy(ffrdpc->ip, ip, sizeof(ffrdpc->ip) - 1);
+    if (txkey) memcpy(ffrdpc->txkey, txkey, MIN(strlen(txkey), sizeof(ffrdpc->txkey))); // 32 key bytes, not a string
+    if (rxkey) memcpy(ffrdpc->rxkey, rxkey, MIN(strlen(rxkey), sizeof(ffrdpc->rxkey)));
+    ffrdpc->port      = port;
+    ffrdpc->streams   = streams;
+    ffrdpc->callback  = callback;
+    ffrdpc->cbctxt    = cbctxt;
+    ffrdpc->delay_min = FFRDPC_MIN_DELAY;
+    ffrdpc->delay_max = FFRDPC_MAX_DELAY;
+    ffrdpc->tick_dump = get_tick_count();
+    pthread_mutex_init(&ffrdpc->lock, NULL);
+
+    // create client thread
+    pthread_create(&ffrdpc->pthread, NULL, ffrdpc_thread_proc, ffrdpc);
+    ffrdpc_start(ffrdpc, 1);
+    return ffrdpc;
+}
+
+void ffrdpc_exit(void *ctxt)
+{
+    FFRDPC *ffrdpc = ctxt;
+    if (!ctxt) return;
+    ffrdpc->status |= TS_EXIT;
+    pthread_join(ffrdpc->pthread, NULL);
+    pthread_mutex_destroy(&ffrdpc->lock);
+    free(ctxt);
+}
+
+void ffrdpc_start(void *ctxt, int start)
+{
+    FFRDPC *ffrdpc = ctxt;
+    if (!ctxt) return;
+    if (start) {
+        ffrdpc->status |= TS_START;
+    } else {
+        ffrdpc->status &=~TS_START;
+    }
+}
+
+void ffrdpc_set_jitter(void *ctxt, int mindelay, int maxdelay)
+{
+    FFRDPC *ffrdpc = ctxt;
+    if (!ctxt) return;
+    ffrdpc->delay_min = MAX(0, mindelay);
+    ffrdpc->delay_max = MAX(ffrdpc->delay_min, maxdelay);
+}
+
+static int ffrdpc_send_event(FFRDPC *ffrdpc, uint32_t event[2])
+{
+    int ret = -1;
+    if (!ffrdpc || !(ffrdpc->status & TS_CONNECTED)) return -1;
+    pthread_mutex_lock(&ffrdpc->lock);
+    if (ffrdpc->input_len + FFRDPC_EVENT_LEN <= FFRDPC_INPUT_BUF) {
+        memcpy(ffrdpc->input_buf + ffrdpc->input_len, event, FFRDPC_EVENT_LEN);
+        ffrdpc->input_len += FFRDPC_EVENT_LEN;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&ffrdpc->lock);
+    return ret;
+}
+
+int ffrdpc_send_mouse(void *ctxt, int dx, int dy, int btns, int wheel)
+{
+    uint32_t event[2];
+    event[0] = FFRDPC_MOUSE_EVENT_MSG;
+    ((int8_t*)&event[1])[0] = (int8_t)dx;
+    ((int8_t*)&event[1])[1] = (int8_t)dy;
+    ((int8_t*)&event[1])[2] = (int8_t)btns;
+    ((int8_t*)&event[1])[3] = (int8_t)wheel;
+    return ffrdpc_send_event(ctxt, event);
+}
+
+int ffrdpc_send_keybd(void *ctxt, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2)
+{
+    uint32_t event[2];
+    event[0] = FFRDPC_KEYBD_EVENT_MSG;
+    ((uint8_t*)&event[1])[0] = key;
+    ((uint8_t*)&event[1])[1] = scancode;
+    ((uint8_t*)&event[1])[2] = flags1;
+    ((uint8_t*)&event[1])[3] = flags2;
+    return ffrdpc_send_event(ctxt, event);
+}
+
+void ffrdpc_stats(void *ctxt, FFRDPC_STATS *stats, int clearhistory)
+{
+    FFRDPC *ffrdpc = ctxt;
+    if (!ctxt) return;
+    *stats = ffrdpc->stats;
+    if (clearhistory) {
+        memset(&ffrdpc->stats, 0, sizeof(ffrdpc->stats));
+        ffrdpc->stats.delay[0] = stats->delay[0];
+        ffrdpc->stats.delay[1] = stats->delay[1];
+    }
+}
+
+void ffrdpc_dump(void *ctxt, int clearhistory)
+{
+    FFRDPC      *ffrdpc = ctxt;
+    FFRDPC_STATS stats;
+    int          secs;
+    if (!ctxt) return;
+    secs = ((int32_t)get_tick_count() - (int32_t)ffrdpc->tick_dump) / 1000;
+    secs = secs ? secs : 1;
+    ffrdpc_stats(ffrdpc, &stats, clearhistory);
+    printf("connected           : %d\n", !!(ffrdpc->status & TS_CONNECTED));
+    printf("audio, video        : %u, %u (%u fps)\n", stats.audio, stats.video, stats.video / secs);
+    printf("playout delay       : audio %dms (jitter avg %dms, dev %dms), video %dms (jitter avg %dms, dev %dms)\n",
+        stats.delay[0], ffrdpc->jit_avg[0] / 16, ffrdpc->jit_dev[0] / 16, stats.delay[1], ffrdpc->jit_avg[1] / 16, ffrdpc->jit_dev[1] / 16);
+    printf("late, gaps          : %u, %u\n", stats.late, stats.gaps);
+    printf("stalls, stall time  : %u, %ums\n", stats.stalls, stats.stall_ms);
+    printf("frames held         : %d\n", ffrdpc->held);
+    if (clearhistory) ffrdpc->tick_dump = get_tick_count();
+}
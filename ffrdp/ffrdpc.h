@@ -0,0 +1,40 @@
+#ifndef __FFRDPC_H__
+#define __FFRDPC_H__
+
+#include <stdint.h>
+
+// packets of ffrdps go to callback from the client thread: 'I' av info string, 'C' cursor shape and 'P' cursor position
+// at once, 'A' audio and 'V' video frames when the jitter buffer plays them, FFRDPC_GAP (no data) in place of video
+// frames dropped by the deadline of server, the decoder waits for the next key frame. buf is valid during the callback
+// only. pts is in ms of server clock, for audio and video its low 24 bits are the ones on the wire and the higher ones
+// count their wraps
+#define FFRDPC_GAP 'G'
+typedef void (*PFN_FFRDPC_CB)(void *cbctxt, int type, uint8_t *buf, int len, uint32_t pts);
+
+// streams: 1 if ffrdps runs with ffrdps_set_streams 1, both sides must agree
+void* ffrdpc_init (char *ip, int port, char *txkey, char *rxkey, int streams, PFN_FFRDPC_CB callback, void *cbctxt);
+void  ffrdpc_exit (void *ctxt);
+void  ffrdpc_start(void *ctxt, int start);
+void  ffrdpc_dump (void *ctxt, int clearhistory);
+
+// input events for ffrdps, sent at once (urgent in streams mode)
+int   ffrdpc_send_mouse(void *ctxt, int dx, int dy, int btns, int wheel);
+int   ffrdpc_send_keybd(void *ctxt, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2);
+
+// jitter buffer: frames are played at pts + lowest transit seen + playout delay, the delay follows the transit jitter
+// of audio and video frames (smoothed mean + 4 deviations) within [mindelay, maxdelay] ms, default 20 and 500. both
+// play on one clock for lip sync, audio with a steadier path than video may lead it by 40ms at most
+void  ffrdpc_set_jitter(void *ctxt, int mindelay, int maxdelay);
+
+typedef struct {
+    uint32_t audio, video; // frames played
+    uint32_t late;     // frames that came after their playout time, played at once
+    uint32_t gaps;     // frames dropped by server deadline
+    uint32_t stalls;   // video stopped for FFRDPC_STALL_MS more than its pts interval
+    uint32_t stall_ms; // total of those extra ms
+    int      delay[2]; // current playout delay of audio and video in ms
+} FFRDPC_STATS;
+#define FFRDPC_STALL_MS 100
+void  ffrdpc_stats(void *ctxt, FFRDPC_STATS *stats, int clearhistory);
+
+#endif
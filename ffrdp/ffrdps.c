@@ -24,11 +24,61 @@
 #define FFRDPC_KEYBD_EVENT_MSG  (('K' << 0) | ('E' << 8) | ('V' << 16) | ('T' << 24))
 #define FFRDPC_KEYBD_EVENT_LEN   8
 
+#define FFRDPS_MAX_CLIENTS  8
+#define FFRDPS_JOIN_TIMEOUT 5000 // ms, accepted client that sends nothing in this time gives its slot back
+#define CURSOR_UPDATE_PERIOD  10 // ms
+#define ENCODER_POLL_PERIOD    2 // ms, encoders have nothing to wait on, they are polled while clients are connected
+#define CURSOR_SENT_CACHE     16
+#define ABR_CHECK_PERIOD     100 // ms, adaptive bitrate follows the bandwidth estimate of ffrdp at this period
+#define ABR_QDELAY_MAX       100 // ms, queuing delay above this means congestion
+#define ABR_HOLD_TIME        200 // ms, no increase after a decrease
+#define FFRDPS_COALESCE_US  1000 // packets of one loop share frames, the last one is not held for the next video frame
+#define FFRDPS_MAX_MSS      9000 // ffrdp caps it to what it is built for, path mtu discovery finds the size in use
+#define FFRDPS_INPUT_BATCH    64 // INPUT records of one SendInput
+#define FFRDPS_INPUT_BUF    2048 // bytes of events read at once
+#define VIDEO_BUF_NUM          8 // encoded frames in flight, their frames point into them until every client acked them
+#define VIDEO_BUF_SIZE     (2 * 1024 * 1024)
+
+// ffrdp streams of clients that support them (ffrdps_set_streams), so a lost part of a big key frame holds back neither audio nor input
+#define FFRDPS_STREAM_CTRL     0 // 'I', 'C', 'P' packets, and input events of the client before it knows about streams
+#define FFRDPS_STREAM_AUDIO    1 // urgent with a short deadline, fec is its redundancy
+#define FFRDPS_STREAM_VIDEO    2 // reliable, delta frames follow --ffrdpsdeadline
+#define FFRDPS_STREAM_INPUT    3 // input events of client, sent urgent
+#define FFRDPS_AUDIO_DEADLINE  200 // ms
+
+// every client is a peer of the listening ffrdp, they all get the same encoded stream,
+// but each one has its own congestion control and key frame state, so a slow viewer does not stall the others
+typedef struct {
+    void     *ffrdp;
+    #define CS_CONNECTED        (1 << 0)
+    #define CS_STREAMS          (1 << 1)
+    uint32_t  status;
+    uint32_t  key_wait; // bit per tile of video (bit 0 if not tiled) waiting for its key frame, its delta frames are not sent
+    uint32_t  cursor_sent_ids[CURSOR_SENT_CACHE]; // shapes already sent to client, client keeps them by id
+    int       cursor_sent_idx;
+    uint32_t  cursor_last_id;
+    int32_t   cursor_last_x, cursor_last_y;
+    uint32_t  msg_dropped; // ffrdp_stream_dropped of video at last check
+    uint32_t  tick_accept;
+    uint32_t  tick_key_due; // last key frame is expected to be sent by then, deadline of delta frames after it starts there
+    uint8_t   input_tail[2][FFRDPC_MOUSE_EVENT_LEN]; // partial event at the end of what was read from stream 0 and input stream
+    int       input_tail_len[2];
+} FFRDPS_CLIENT;
+#define VIDEO_STREAM(c) ((c)->status & CS_STREAMS ? FFRDPS_STREAM_VIDEO : 0)
+
+// encoded video frame sent without copy by ffrdp_sendv, it goes back to free list when ffrdp releases it.
+// ffrdp only releases buffers in ffrdp_update and ffrdp_free, both called by the server thread, so no lock is needed
+typedef struct tagVIDEO_BUF {
+    FFRDP_BUF             ref;
+    struct tagVIDEO_BUF  *next;
+    struct tagVIDEO_BUF **free_list;
+    uint8_t               data[VIDEO_BUF_SIZE];
+} VIDEO_BUF;
+
 typedef struct {
     #define TS_EXIT             (1 << 0)
     #define TS_START            (1 << 1)
-    #define TS_CLIENT_CONNECTED (1 << 2)
-    #define TS_KEYFRAME_DROPPED (1 << 3)
+    #define TS_CLIENT_CONNECTED (1 << 2) // at least one client connected, devices and encoders are running
     #define TS_ADAPTIVE_BITRATE (1 << 4)
     uint32_t  status;
     pthread_t pthread;
@@ -37,38 +87,140 @@ typedef struct {
 
     void     *mouse;
     void     *keybd;
-    void     *ffrdp;
+    void     *ffrdp; // listener
+    FFRDPS_CLIENT clients[FFRDPS_MAX_CLIENTS];
+    int       client_num;
     void     *adev;
     void     *vdev;
     CODEC    *aenc;
     CODEC    *venc;
+    uint32_t  tiles_mask; // bits of key_wait, one per tile of venc
     int       port;
+    int       sfec;
+    int       deadline; // ms, video frames other than key frames not acked in time are dropped, 0 to disable
+    int       streams;  // clients use ffrdp streams
 
-    char      avinfostr[256];
+    char      avinfostr[1024]; // vps/sps/pps hex strings and tiles layout
     uint8_t   buff[2 * 1024 * 1024];
+    VIDEO_BUF *vbuf_free; // video buffers not referred by ffrdp
+    int       vbuf_num;
     char      txkey[32];
     char      rxkey[32];
 
-    #define MAX_BITRATE_LIST_SIZE  100
-    int       bitrate_list_buf[MAX_BITRATE_LIST_SIZE];
-    int       bitrate_list_size;
-    int       bitrate_cur_idx;
-    uint32_t  cnt_qos_increase;
+    int       bitrate_min;
+    int       bitrate_max;
+    int       bitrate_cur;
     uint32_t  tick_qos_check;
+    uint32_t  tick_qos_hold;  // last decrease
+
+    uint32_t  tick_cursor_check;
+    uint8_t   cursor[2 * sizeof(uint32_t) + VDEV_CURSOR_BUF_SIZE];
+
+    // input events of all clients read in one pass are injected by one SendInput, relative moves between button
+    // and wheel changes are summed into one move. latency is from ffrdps_wait returning to SendInput
+    INPUT     input_batch[FFRDPS_INPUT_BATCH];
+    int       input_num;
+    int       input_btns; // buttons after the events batched so far
+    int       move_dx, move_dy;
+    int64_t   tick_wake; // us
+    uint32_t  input_events, input_injected, input_calls;
+    int64_t   input_lat_sum, input_lat_max;
 } FFRDPS;
 
-static int ffrdp_send_packet(FFRDPS *ffrdps, char type, uint8_t *buf, int len, uint32_t pts)
+static int64_t get_tick_us(void)
+{
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter  (&count);
+    return count.QuadPart / freq.QuadPart * 1000000 + count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
+
+static void video_buf_release(FFRDP_BUF *ref)
+{
+    VIDEO_BUF *vbuf = (VIDEO_BUF*)ref;
+    vbuf->next = *vbuf->free_list; *vbuf->free_list = vbuf;
+}
+
+static VIDEO_BUF* video_buf_get(FFRDPS *ffrdps) // NULL when all are in flight, the frame is copied from buff then
 {
-    int ret;
-    ((uint32_t*)buf)[0] = ('T'  << 0) | (pts << 8);
-    ((uint32_t*)buf)[1] = (type << 0) | (len << 8);
-    ret = ffrdp_send(ffrdps->ffrdp, buf, len + 2 * sizeof(uint32_t));
+    VIDEO_BUF *vbuf = ffrdps->vbuf_free;
+    if (vbuf) ffrdps->vbuf_free = vbuf->next;
+    else if (ffrdps->vbuf_num < VIDEO_BUF_NUM && (vbuf = malloc(sizeof(VIDEO_BUF)))) {
+        vbuf->ref.release = video_buf_release;
+        vbuf->free_list   = &ffrdps->vbuf_free;
+        ffrdps->vbuf_num++;
+    }
+    if (vbuf) vbuf->ref.refs = 1;
+    return vbuf;
+}
+
+// buf has 8 bytes room for the packet header before the len bytes of payload, which is not copied by ffrdp if ref is set
+static int ffrdp_send_packet(FFRDPS_CLIENT *client, char type, uint8_t *buf, int len, uint32_t pts, int deadline, FFRDP_BUF *ref)
+{
+    uint32_t    hdr[2];
+    FFRDP_IOVEC iov[2];
+    int         ret;
+    hdr[0] = ('T'  << 0) | (pts << 8);
+    hdr[1] = (type << 0) | (len << 8);
+    iov[0].buf = hdr; iov[0].len = sizeof(hdr); iov[0].ref = NULL;
+    iov[1].buf = buf + sizeof(hdr); iov[1].len = len; iov[1].ref = ref;
+    if (client->status & CS_STREAMS) {
+        ret = ffrdp_stream_sendv(client->ffrdp, type == 'A' ? FFRDPS_STREAM_AUDIO : type == 'V' ? FFRDPS_STREAM_VIDEO : FFRDPS_STREAM_CTRL,
+            iov, 2, deadline, type == 'A' ? FFRDP_PRIO_URGENT : FFRDP_PRIO_LOW);
+    } else if (deadline > 0) ret = ffrdp_stream_sendv(client->ffrdp, 0, iov, 2, deadline, FFRDP_PRIO_LOW);
+    else ret = ffrdp_sendv(client->ffrdp, iov, 2);
     if (ret != len + 2 * sizeof(int32_t)) {
         printf("ffrdp_send_packet send packet failed ! %d %d\n", ret, len + 2 * sizeof(uint32_t));
         return -1;
     } else return 0;
 }
 
+// cursor is sent as metadata instead of being drawn into video frames, so moving it does not cost any video bits,
+// 'C' packet carries a cursor shape (see vdev_cursor_shape), 'P' packet: int16_t x, y, screen w, h, uint32_t shape id
+static void ffrdps_send_cursor(FFRDPS *ffrdps)
+{
+    FFRDPS_CLIENT *client;
+    int      x = 0, y = 0, w = 0, h = 0, len = 0, i, j;
+    uint32_t id;
+    if ((int32_t)get_tick_count() - (int32_t)ffrdps->tick_cursor_check < CURSOR_UPDATE_PERIOD) return;
+    ffrdps->tick_cursor_check = get_tick_count();
+
+    id = vdev_cursor_pos(ffrdps->vdev, &x, &y, &w, &h);
+    for (j=0; j<ffrdps->client_num; j++) {
+        client = &ffrdps->clients[j];
+        if (!(client->status & CS_CONNECTED) || (id == client->cursor_last_id && x == client->cursor_last_x && y == client->cursor_last_y)) continue;
+
+        if (id) {
+            for (i=0; i<CURSOR_SENT_CACHE && client->cursor_sent_ids[i] != id; i++);
+            if (i == CURSOR_SENT_CACHE) {
+                if (len <= 0) len = vdev_cursor_shape(ffrdps->vdev, id, ffrdps->cursor + 2 * sizeof(uint32_t), VDEV_CURSOR_BUF_SIZE);
+                if (len <= 0) return;
+                if (ffrdp_send_packet(client, 'C', ffrdps->cursor, len, get_tick_count(), 0, NULL) != 0) continue;
+                client->cursor_sent_ids[client->cursor_sent_idx++ % CURSOR_SENT_CACHE] = id;
+            }
+        }
+    }
+
+    ((int16_t *)(ffrdps->cursor + 2 * sizeof(uint32_t)))[0] = x;
+    ((int16_t *)(ffrdps->cursor + 2 * sizeof(uint32_t)))[1] = y;
+    ((int16_t *)(ffrdps->cursor + 2 * sizeof(uint32_t)))[2] = w;
+    ((int16_t *)(ffrdps->cursor + 2 * sizeof(uint32_t)))[3] = h;
+    ((uint32_t*)(ffrdps->cursor + 2 * sizeof(uint32_t)))[2] = id;
+    for (j=0; j<ffrdps->client_num; j++) {
+        client = &ffrdps->clients[j];
+        if (!(client->status & CS_CONNECTED) || (id == client->cursor_last_id && x == client->cursor_last_x && y == client->cursor_last_y)) continue;
+        if (id) { // shape must reach client first
+            for (i=0; i<CURSOR_SENT_CACHE && client->cursor_sent_ids[i] != id; i++);
+            if (i == CURSOR_SENT_CACHE) continue;
+        }
+        if (ffrdp_send_packet(client, 'P', ffrdps->cursor, 12, get_tick_count(), 0, NULL) == 0) {
+            client->cursor_last_id = id;
+            client->cursor_last_x  = x;
+            client->cursor_last_y  = y;
+        }
+    }
+}
+
 static void buf2hexstr(char *str, int len, uint8_t *buf, int size)
 {
     char tmp[3];
@@ -88,123 +240,279 @@ static int is_null_key(char key[32])
     return 1;
 }
 
+static void ffrdps_client_join(FFRDPS *ffrdps, FFRDPS_CLIENT *client)
+{
+    if ((ffrdps->status & TS_CLIENT_CONNECTED) == 0) { // first client starts devices and encoders
+        char vpsstr[256] = "", spsstr[256] = "", ppsstr[256] = "";
+        codec_reset(ffrdps->aenc, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF|CODEC_REQUEST_IDR);
+        codec_reset(ffrdps->venc, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF|CODEC_REQUEST_IDR);
+        codec_start(ffrdps->aenc, 1);
+        codec_start(ffrdps->venc, 1);
+        adev_start (ffrdps->adev, 1);
+        vdev_start (ffrdps->vdev, 1);
+        buf2hexstr(vpsstr, sizeof(vpsstr), ffrdps->venc->vpsinfo + 1, ffrdps->venc->vpsinfo[0]);
+        buf2hexstr(spsstr, sizeof(spsstr), ffrdps->venc->spsinfo + 1, ffrdps->venc->spsinfo[0]);
+        buf2hexstr(ppsstr, sizeof(ppsstr), ffrdps->venc->ppsinfo + 1, ffrdps->venc->ppsinfo[0]);
+        snprintf(ffrdps->avinfostr + 2 * sizeof(uint32_t), sizeof(ffrdps->avinfostr) - 2 * sizeof(uint32_t),
+            "aenc=%s,channels=%d,samprate=%d;venc=%s,width=%d,height=%d,frate=%d,vps=%s,sps=%s,pps=%s%s%s;",
+            ffrdps->aenc->name, ffrdps->channels, ffrdps->samprate, ffrdps->venc->name, ffrdps->width, ffrdps->height, ffrdps->frate, vpsstr, spsstr, ppsstr,
+            ffrdps->venc->tiles[0] ? ",tiles=" : "", ffrdps->venc->tiles);
+        ffrdps->status |= TS_CLIENT_CONNECTED;
+    } else codec_reset(ffrdps->venc, CODEC_REQUEST_IDR); // other viewers keep their stream, new one only needs a key frame
+    if (ffrdp_send_packet(client, 'I', ffrdps->avinfostr, (int)strlen(ffrdps->avinfostr + 2 * sizeof(uint32_t)) + 1, 0, 0, NULL) == 0) {
+        memset(client->cursor_sent_ids, 0, sizeof(client->cursor_sent_ids));
+        client->cursor_last_id = 0; client->cursor_last_x = client->cursor_last_y = -1;
+        client->msg_dropped    = ffrdp_stream_dropped(client->ffrdp, VIDEO_STREAM(client));
+        client->key_wait = ffrdps->tiles_mask; // wait for key frame of every tile
+        client->status  |= CS_CONNECTED;
+        printf("client %d connected !\n", (int)(client - ffrdps->clients));
+    }
+}
+
+static void ffrdps_input_commit(FFRDPS *ffrdps) // inject the batch
+{
+    int64_t lat;
+    if (ffrdps->input_num == 0) return;
+    SendInput(ffrdps->input_num, ffrdps->input_batch, sizeof(INPUT));
+    lat = get_tick_us() - ffrdps->tick_wake;
+    ffrdps->input_injected += ffrdps->input_num; ffrdps->input_calls++;
+    ffrdps->input_lat_sum  += lat; ffrdps->input_lat_max = MAX(ffrdps->input_lat_max, lat);
+    ffrdps->input_num = 0;
+}
+
+static void ffrdps_input_move(FFRDPS *ffrdps) // batch the summed move
+{
+    if (!ffrdps->move_dx && !ffrdps->move_dy) return;
+    if (ffrdps->input_num == FFRDPS_INPUT_BATCH) ffrdps_input_commit(ffrdps);
+    ffrdps->input_num += ffmouse_input(ffrdps->mouse, ffrdps->move_dx, ffrdps->move_dy, ffrdps->input_btns, 0, &ffrdps->input_batch[ffrdps->input_num]);
+    ffrdps->move_dx = ffrdps->move_dy = 0;
+}
+
+static int ffrdps_client_event(FFRDPS *ffrdps, int8_t *event, int ret) // batch the events, returns bytes taken, a partial event is left
+{
+    int8_t *start = event;
+    while (ret >= (int)sizeof(uint32_t)) {
+        switch (*(uint32_t*)event) {
+        case FFRDPC_MOUSE_EVENT_MSG:
+            if (ret < FFRDPC_MOUSE_EVENT_LEN) return (int)(event - start);
+            ffrdps->input_events++;
+            if (!event[7] && (uint8_t)event[6] == ffrdps->input_btns) { // only a move, it goes with the moves around it
+                ffrdps->move_dx += event[4]; ffrdps->move_dy += event[5];
+            } else {
+                ffrdps_input_move(ffrdps); // moves before a click or wheel go first
+                if (ffrdps->input_num == FFRDPS_INPUT_BATCH) ffrdps_input_commit(ffrdps);
+                ffrdps->input_num += ffmouse_input(ffrdps->mouse, event[4], event[5], event[6], event[7], &ffrdps->input_batch[ffrdps->input_num]);
+                ffrdps->input_btns = (uint8_t)event[6];
+            }
+            event += FFRDPC_MOUSE_EVENT_LEN;
+            ret   -= FFRDPC_MOUSE_EVENT_LEN;
+            break;
+        case FFRDPC_KEYBD_EVENT_MSG:
+            if (ret < FFRDPC_KEYBD_EVENT_LEN) return (int)(event - start);
+            ffrdps->input_events++;
+            ffrdps_input_move(ffrdps);
+            if (ffrdps->input_num == FFRDPS_INPUT_BATCH) ffrdps_input_commit(ffrdps);
+            ffrdps->input_num += ffkeybd_input(ffrdps->keybd, event[4], event[5], event[6], event[7], &ffrdps->input_batch[ffrdps->input_num]);
+            event += FFRDPC_KEYBD_EVENT_LEN;
+            ret   -= FFRDPC_KEYBD_EVENT_LEN;
+            break;
+        default:
+            event += sizeof(uint32_t);
+            ret   -= sizeof(uint32_t);
+            break;
+        }
+    }
+    return (int)(event - start);
+}
+
+static void ffrdps_client_input(FFRDPS *ffrdps, FFRDPS_CLIENT *client, int stream, int idx) // all events the client stream has
+{
+    uint8_t buf[FFRDPS_INPUT_BUF];
+    int     len, ret, used;
+    for (;;) {
+        len = client->input_tail_len[idx];
+        memcpy(buf, client->input_tail[idx], len);
+        if ((ret = ffrdp_stream_recv(client->ffrdp, stream, (char*)buf + len, sizeof(buf) - len)) <= 0) break; // input is never dropped, no gap
+        len += ret;
+        used = ffrdps_client_event(ffrdps, (int8_t*)buf, len);
+        client->input_tail_len[idx] = MIN(len - used, (int)sizeof(client->input_tail[idx]));
+        memcpy(client->input_tail[idx], buf + used, client->input_tail_len[idx]);
+    }
+}
+
+// checked right after ffrdp_update, which is where late frames are dropped. frames queued before the last key frame expire
+// by tick_key_due + deadline and the ones after it not before, so drops until then need no other key frame: one per resync
+static int ffrdps_check_dropped(FFRDPS *ffrdps, FFRDPS_CLIENT *client)
+{
+    uint32_t dropped = ffrdp_stream_dropped(client->ffrdp, VIDEO_STREAM(client));
+    if (client->msg_dropped == dropped) return 0;
+    client->msg_dropped = dropped;
+    if ((int32_t)get_tick_count() - (int32_t)(client->tick_key_due + ffrdps->deadline) <= 0) return 0;
+    if (client->key_wait == ffrdps->tiles_mask) return 0; // key frames requested already
+    client->key_wait = ffrdps->tiles_mask; // a late frame was dropped, it may be of any tile
+    return 1;
+}
+
+static void ffrdps_send_video(FFRDPS *ffrdps, uint8_t *buf, FFRDP_BUF *ref, int framesize, int keyframe, uint32_t pts)
+{
+    FFRDPS_CLIENT *client;
+    uint32_t tile = ffrdps->venc->tiles[0] ? 1 << buf[2 * sizeof(uint32_t)] : 1; // tileenc frames start with tile index
+    int32_t  wait;
+    int ret, resync = 0, qdelay, i;
+    for (i=0; i<ffrdps->client_num; i++) {
+        client = &ffrdps->clients[i];
+        if (!(client->status & CS_CONNECTED)) continue;
+        if ((client->key_wait & tile) && !keyframe) continue; // wait for key frame of this tile
+        wait = (int32_t)client->tick_key_due - (int32_t)get_tick_count(); // delta frames queued behind the key frame wait for it
+        ret  = ffrdp_send_packet(client, 'V', buf, framesize, pts, keyframe || !ffrdps->deadline ? 0 : ffrdps->deadline + MAX(wait, 0), ref);
+        if (ret == 0 && keyframe) {
+            client->key_wait &= ~tile;
+            ffrdp_bwe(client->ffrdp, &qdelay); // queued data ends with the key frame
+            if (wait < qdelay) client->tick_key_due = get_tick_count() + qdelay;
+        }
+        if (ret != 0 && keyframe) client->key_wait |=  tile;
+        if (ret != 0 && !keyframe && strcmp(ffrdps->venc->name, "scrnenc") == 0) { // scrnenc delta frames can't be skipped, resync with a key frame
+            client->key_wait |= tile;
+            resync = 1;
+        }
+    }
+    if (resync) codec_reset(ffrdps->venc, CODEC_REQUEST_IDR);
+}
+
+// one wait for client input and ffrdp timers (pacing, resend, flush), instead of a fixed ffrdp_update cycle
+static void ffrdps_wait(FFRDPS *ffrdps)
+{
+    struct timeval tv;
+    fd_set rs;
+    int    fd = ffrdp_get_fd(ffrdps->ffrdp), wait = ffrdp_next_timeout(ffrdps->ffrdp);
+    if (ffrdps->status & TS_CLIENT_CONNECTED) wait = MIN(wait, ENCODER_POLL_PERIOD);
+    if (wait <= 0) { ffrdps->tick_wake = get_tick_us(); return; }
+    FD_ZERO(&rs);
+    FD_SET((SOCKET)fd, &rs);
+    tv.tv_sec  = wait / 1000;
+    tv.tv_usec = wait % 1000 * 1000;
+    select(fd + 1, &rs, NULL, NULL, &tv);
+    ffrdps->tick_wake = get_tick_us(); // input that woke it up is injected right after ffrdp_update
+}
+
 static void* ffrdps_thread_proc(void *argv)
 {
-    FFRDPS  *ffrdps = (FFRDPS*)argv;
-    uint8_t  buffer[256];
-    int      ret;
+    FFRDPS        *ffrdps = (FFRDPS*)argv;
+    FFRDPS_CLIENT *client;
+    VIDEO_BUF     *vbuf;
+    uint8_t        buffer[256];
+    void          *peer;
+    int            ret, resync, i;
     while (!(ffrdps->status & TS_EXIT)) {
         if (!(ffrdps->status & TS_START)) { usleep(100*1000); continue; }
 
         if (!ffrdps->ffrdp) {
-            ffrdps->ffrdp = ffrdp_init("0.0.0.0", ffrdps->port,
+            ffrdps->ffrdp = ffrdp_listen("0.0.0.0", ffrdps->port,
                 is_null_key(ffrdps->txkey) ? NULL : ffrdps->txkey,
                 is_null_key(ffrdps->rxkey) ? NULL : ffrdps->rxkey,
-                1, 1500, 0);
+                FFRDPS_MAX_MSS, ffrdps->sfec);
             if (!ffrdps->ffrdp) { usleep(100*1000); continue; }
+            ffrdp_setopt(ffrdps->ffrdp, FFRDP_OPT_CC, FFRDP_CC_BBR); // video needs low queueing delay, clients inherit it
+            ffrdp_setopt(ffrdps->ffrdp, FFRDP_OPT_WAIT, 0); // ffrdps_wait does the waiting
+            ffrdp_setopt(ffrdps->ffrdp, FFRDP_OPT_STREAMS, ffrdps->streams);
+            ffrdp_setopt(ffrdps->ffrdp, FFRDP_OPT_COALESCE, FFRDPS_COALESCE_US);
         }
 
-        ret = ffrdp_recv(ffrdps->ffrdp, (char*)buffer, sizeof(buffer));
-        if (ret > 0) {
-            if ((ffrdps->status & TS_CLIENT_CONNECTED) == 0) {
-                char vpsstr[256] = "", spsstr[256] = "", ppsstr[256] = "";
-                codec_reset(ffrdps->aenc, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF|CODEC_REQUEST_IDR);
-                codec_reset(ffrdps->venc, CODEC_CLEAR_INBUF|CODEC_CLEAR_OUTBUF|CODEC_REQUEST_IDR);
-                codec_start(ffrdps->aenc, 1);
-                codec_start(ffrdps->venc, 1);
-                adev_start (ffrdps->adev, 1);
-                vdev_start (ffrdps->vdev, 1);
-                buf2hexstr(vpsstr, sizeof(vpsstr), ffrdps->venc->vpsinfo + 1, ffrdps->venc->vpsinfo[0]);
-                buf2hexstr(spsstr, sizeof(spsstr), ffrdps->venc->spsinfo + 1, ffrdps->venc->spsinfo[0]);
-                buf2hexstr(ppsstr, sizeof(ppsstr), ffrdps->venc->ppsinfo + 1, ffrdps->venc->ppsinfo[0]);
-                snprintf(ffrdps->avinfostr + 2 * sizeof(uint32_t), sizeof(ffrdps->avinfostr) - 2 * sizeof(uint32_t),
-                    "aenc=%s,channels=%d,samprate=%d;venc=%s,width=%d,height=%d,frate=%d,vps=%s,sps=%s,pps=%s;",
-                    ffrdps->aenc->name, ffrdps->channels, ffrdps->samprate, ffrdps->venc->name, ffrdps->width, ffrdps->height, ffrdps->frate, vpsstr, spsstr, ppsstr);
-                ret = ffrdp_send_packet(ffrdps, 'I', ffrdps->avinfostr, (int)strlen(ffrdps->avinfostr + 2 * sizeof(uint32_t)) + 1, 0);
-                if (ret == 0) {
-                    ffrdps->status |= TS_CLIENT_CONNECTED;
-                    printf("client connected !\n");
-                }
-            } else {
-                int8_t *event = (int8_t*)buffer;
-                while (ret >= (int)sizeof(uint32_t)) {
-                    switch (*(uint32_t*)event) {
-                    case FFRDPC_MOUSE_EVENT_MSG:
-                        if (ret >= FFRDPC_MOUSE_EVENT_LEN) {
-                            ffmouse_event(ffrdps->mouse, event[4], event[5], event[6], event[7]);
-                        }
-                        event += FFRDPC_MOUSE_EVENT_LEN;
-                        ret   -= FFRDPC_MOUSE_EVENT_LEN;
-                        break;
-                    case FFRDPC_KEYBD_EVENT_MSG:
-                        if (ret >= FFRDPC_KEYBD_EVENT_LEN) {
-                            ffkeybd_event(ffrdps->keybd, event[4], event[5], event[6], event[7]);
-                        }
-                        event += FFRDPC_KEYBD_EVENT_LEN;
-                        ret   -= FFRDPC_KEYBD_EVENT_LEN;
-                        break;
-                    default:
-                        ret -= sizeof(uint32_t);
-                        break;
-                    }
-                }
+        ffrdp_update(ffrdps->ffrdp); // send what is due, take in what arrived
+
+        while ((peer = ffrdp_accept(ffrdps->ffrdp))) {
+            if (ffrdps->client_num == FFRDPS_MAX_CLIENTS) { printf("too many clients !\n"); ffrdp_free(peer); continue; }
+            memset(&ffrdps->clients[ffrdps->client_num], 0, sizeof(FFRDPS_CLIENT));
+            ffrdps->clients[ffrdps->client_num  ].status = ffrdps->streams ? CS_STREAMS : 0;
+            ffrdps->clients[ffrdps->client_num  ].tick_accept = get_tick_count();
+            ffrdps->clients[ffrdps->client_num++].ffrdp  = peer;
+        }
+
+        for (i=0,resync=0; i<ffrdps->client_num; i++) { // input first, before encoded frames are sent
+            client = &ffrdps->clients[i];
+            if ((client->status & CS_CONNECTED) == 0) {
+                ret = ffrdp_recv(client->ffrdp, (char*)buffer, sizeof(buffer));
+                if (ret > 0) ffrdps_client_join(ffrdps, client);
+                continue;
             }
+            resync |= ffrdps_check_dropped(ffrdps, client);
+            ffrdps_client_input(ffrdps, client, FFRDPS_STREAM_CTRL, 0);
+            if (client->status & CS_STREAMS) ffrdps_client_input(ffrdps, client, FFRDPS_STREAM_INPUT, 1);
         }
+        if (resync) codec_reset(ffrdps->venc, CODEC_REQUEST_IDR);
+        ffrdps_input_move(ffrdps);
+        ffrdps_input_commit(ffrdps);
 
-        if ((ffrdps->status & TS_CLIENT_CONNECTED)) {
-            int readsize, framesize, keyframe; uint32_t pts;
+        if ((ffrdps->status & TS_CLIENT_CONNECTED)) { // encoded frames are read once and sent to every client
+            int readsize, framesize, keyframe; uint32_t pts; VIDEO_BUF *vbuf; uint8_t *vdata;
+            ffrdps_send_cursor(ffrdps); // before the frames, so pointer does not wait for them
             readsize = codec_read(ffrdps->aenc, ffrdps->buff + 2 * sizeof(int32_t), sizeof(ffrdps->buff) - 2 * sizeof(int32_t), &framesize, &keyframe, &pts, 0);
             if (readsize > 0 && readsize == framesize && readsize <= 0xFFFFFF) {
-                ret = ffrdp_send_packet(ffrdps, 'A', ffrdps->buff, framesize, pts);
+                for (i=0; i<ffrdps->client_num; i++) {
+                    if (ffrdps->clients[i].status & CS_CONNECTED) ffrdp_send_packet(&ffrdps->clients[i], 'A', ffrdps->buff, framesize, pts, (ffrdps->clients[i].status & CS_STREAMS) ? FFRDPS_AUDIO_DEADLINE : 0, NULL);
+                }
             }
-            readsize = codec_read(ffrdps->venc, ffrdps->buff + 2 * sizeof(int32_t), sizeof(ffrdps->buff) - 2 * sizeof(int32_t), &framesize, &keyframe, &pts, 0);
+            vbuf     = video_buf_get(ffrdps); // encoded straight into a buffer that frames of all clients refer to
+            vdata    = vbuf ? vbuf->data : ffrdps->buff;
+            readsize = codec_read(ffrdps->venc, vdata + 2 * sizeof(int32_t), VIDEO_BUF_SIZE - 2 * sizeof(int32_t), &framesize, &keyframe, &pts, 0);
             if (readsize > 0 && readsize == framesize && readsize <= 0xFFFFFF) {
-                if ((ffrdps->status & TS_KEYFRAME_DROPPED) && !keyframe) {
-                    printf("ffrdp key frame has dropped, and current frame is non-key frame, so drop it !\n");
-                } else {
-                    ret = ffrdp_send_packet(ffrdps, 'V', ffrdps->buff, framesize, pts);
-                    if (ret == 0 && keyframe) ffrdps->status &=~TS_KEYFRAME_DROPPED;
-                    if (ret != 0 && keyframe) ffrdps->status |= TS_KEYFRAME_DROPPED;
-                }
+                ffrdps_send_video(ffrdps, vdata, vbuf ? &vbuf->ref : NULL, framesize, keyframe, pts);
             }
+            if (vbuf) ffrdp_buf_unref(&vbuf->ref); // back to free list if no frame refers to it
         }
 
-        ffrdp_update(ffrdps->ffrdp);
-        if ((ffrdps->status & TS_CLIENT_CONNECTED) && ffrdp_isdead(ffrdps->ffrdp)) {
-            printf("client lost !\n");
+        for (i=0; i<ffrdps->client_num; i++) {
+            client = &ffrdps->clients[i];
+            if (!ffrdp_isdead(client->ffrdp) && ((client->status & CS_CONNECTED) || (int32_t)get_tick_count() - (int32_t)client->tick_accept < FFRDPS_JOIN_TIMEOUT)) continue;
+            printf("client %d lost !\n", i);
+            ffrdp_free(client->ffrdp);
+            *client = ffrdps->clients[--ffrdps->client_num];
+            i--;
+        }
+        for (i=0; i<ffrdps->client_num && !(ffrdps->clients[i].status & CS_CONNECTED); i++);
+        if ((ffrdps->status & TS_CLIENT_CONNECTED) && i == ffrdps->client_num) { // last client left
             codec_start(ffrdps->aenc, 0);
             codec_start(ffrdps->venc, 0);
             adev_start (ffrdps->adev, 0);
             vdev_start (ffrdps->vdev, 0);
-            ffrdp_free(ffrdps->ffrdp); ffrdps->ffrdp = NULL;
             ffrdps->status &= ~TS_CLIENT_CONNECTED;
         }
 
-        if ((ffrdps->status & TS_CLIENT_CONNECTED) && (ffrdps->status & TS_ADAPTIVE_BITRATE) && (int32_t)get_tick_count() - (int32_t)ffrdps->tick_qos_check > 1000) {
-            int last_idx = ffrdps->bitrate_cur_idx, qos = ffrdp_qos(ffrdps->ffrdp);
-            if (qos < 0) {
-                ffrdps->bitrate_cur_idx = MAX(ffrdps->bitrate_cur_idx - 1, 0);
-                ffrdps->cnt_qos_increase= 0;
-            } else if (qos > 0) {
-                if (ffrdps->cnt_qos_increase == 3) {
-                    ffrdps->bitrate_cur_idx  = MIN(ffrdps->bitrate_cur_idx + 1, ffrdps->bitrate_list_size - 1);
-                    ffrdps->cnt_qos_increase = 0;
-                } else ffrdps->cnt_qos_increase++;
+        if ((ffrdps->status & TS_CLIENT_CONNECTED) && (ffrdps->status & TS_ADAPTIVE_BITRATE) && (int32_t)get_tick_count() - (int32_t)ffrdps->tick_qos_check >= ABR_CHECK_PERIOD) {
+            uint32_t now = get_tick_count(), bwe = 0xFFFFFFFF, cbwe;
+            int      qdelay = 0, cdelay, target = ffrdps->bitrate_cur;
+            for (i=0; i<ffrdps->client_num; i++) { // bitrate follows the worst connected client
+                if (!(ffrdps->clients[i].status & CS_CONNECTED)) continue;
+                cbwe = ffrdp_bwe(ffrdps->clients[i].ffrdp, &cdelay);
+                bwe  = MIN(bwe, cbwe); qdelay = MAX(qdelay, cdelay);
             }
-            if (ffrdps->bitrate_cur_idx != last_idx) {
-                ffrdps_reconfig_bitrate(ffrdps, ffrdps->bitrate_list_buf[ffrdps->bitrate_cur_idx]);
+            bwe = bwe == 0xFFFFFFFF ? 0 : bwe - bwe / 8; // leave room for audio, headers and resends
+            if (qdelay >= ABR_QDELAY_MAX) { // queue builds, go below the estimate at once, not above current rate as the estimate lags a link drop
+                if (!bwe || bwe > (uint32_t)ffrdps->bitrate_cur) bwe = ffrdps->bitrate_cur;
+                target = (int)((uint64_t)bwe * (1000 - MIN(qdelay, 375) * 2) / 1000);
+                ffrdps->tick_qos_hold = now;
+            } else if ((int32_t)now - (int32_t)ffrdps->tick_qos_hold >= ABR_HOLD_TIME && (uint32_t)ffrdps->bitrate_cur < bwe) { // half way to the estimate per check
+                target = (int)MIN((uint32_t)ffrdps->bitrate_cur + MAX((bwe - ffrdps->bitrate_cur) / 2, (uint32_t)ffrdps->bitrate_cur / 8), bwe);
             }
-            ffrdps->tick_qos_check = get_tick_count();
+            target = MAX(MIN(target, ffrdps->bitrate_max), ffrdps->bitrate_min);
+            if (target != ffrdps->bitrate_cur) {
+                ffrdps->bitrate_cur = target;
+                ffrdps_reconfig_bitrate(ffrdps, target);
+            }
+            ffrdps->tick_qos_check = now;
         }
+        ffrdps_wait(ffrdps);
     }
 
-    ffrdp_free(ffrdps->ffrdp);
+    ffrdp_free(ffrdps->ffrdp); // peers are freed with listener, they release all video buffers
+    while ((vbuf = ffrdps->vbuf_free)) { ffrdps->vbuf_free = vbuf->next; free(vbuf); }
     return NULL;
 }
 
-void* ffrdps_init(int port, char *txkey, char *rxkey, int channels, int samprate, int width, int height, int frate, void *adev, void *vdev, CODEC *aenc, CODEC *venc)
+void* ffrdps_init(int port, char *txkey, char *rxkey, int sfec, int channels, int samprate, int width, int height, int frate, void *adev, void *vdev, CODEC *aenc, CODEC *venc)
 {
     FFRDPS *ffrdps = calloc(1, sizeof(FFRDPS));
+    char   *p;
     if (!ffrdps) {
         printf("failed to allocate memory for ffrdps !\n");
         return NULL;
@@ -216,7 +524,10 @@ void* ffrdps_init(int port, char *txkey, char *rxkey, int channels, int samprate
     ffrdps->vdev     = vdev;
     ffrdps->aenc     = aenc;
     ffrdps->venc     = venc;
+    ffrdps->tiles_mask = 1;
+    for (p=venc->tiles; *p; p++) if (*p == '+') ffrdps->tiles_mask = (ffrdps->tiles_mask << 1) | 1; // "1920+1920"
     ffrdps->port     = port;
+    ffrdps->sfec     = sfec;
     ffrdps->channels = channels;
     ffrdps->samprate = samprate;
     ffrdps->width    = width;
@@ -224,6 +535,7 @@ void* ffrdps_init(int port, char *txkey, char *rxkey, int channels, int samprate
     ffrdps->frate    = frate;
     if (txkey) strncpy(ffrdps->txkey, txkey, sizeof(ffrdps->txkey));
     if (rxkey) strncpy(ffrdps->rxkey, rxkey, sizeof(ffrdps->rxkey));
+    vdev_draw_cursor(vdev, 0);
 
     // create server thread
     pthread_create(&ffrdps->pthread, NULL, ffrdps_thread_proc, ffrdps);
@@ -260,8 +572,18 @@ void ffrdps_start(void *ctxt, int start)
 void ffrdps_dump(void *ctxt, int clearhistory)
 {
     FFRDPS *ffrdps = ctxt;
+    int     i;
     if (!ctxt) return;
-    ffrdp_dump(ffrdps->ffrdp, clearhistory);
+    for (i=0; i<ffrdps->client_num; i++) {
+        printf("client %d:\n", i);
+        ffrdp_dump(ffrdps->clients[i].ffrdp, clearhistory);
+    }
+    printf("input events, injected, calls: %u, %u, %u\n", ffrdps->input_events, ffrdps->input_injected, ffrdps->input_calls);
+    printf("input latency avg, max      : %dus, %dus\n", ffrdps->input_calls ? (int)(ffrdps->input_lat_sum / ffrdps->input_calls) : 0, (int)ffrdps->input_lat_max);
+    if (clearhistory) {
+        ffrdps->input_events = ffrdps->input_injected = ffrdps->input_calls = 0;
+        ffrdps->input_lat_sum = ffrdps->input_lat_max = 0;
+    }
 }
 
 void ffrdps_reconfig_bitrate(void *ctxt, int bitrate)
@@ -271,23 +593,38 @@ void ffrdps_reconfig_bitrate(void *ctxt, int bitrate)
     codec_reconfig(ffrdps->venc, bitrate);
 }
 
-void ffrdps_adaptive_bitrate_setup(void *ctxt, int *blist, int n)
+void ffrdps_set_deadline(void *ctxt, int deadline)
+{
+    FFRDPS *ffrdps = ctxt;
+    if (!ctxt) return;
+    ffrdps->deadline = deadline;
+}
+
+void ffrdps_set_streams(void *ctxt, int en)
+{
+    FFRDPS *ffrdps = ctxt;
+    if (!ctxt) return;
+    ffrdps->streams = en;
+    ffrdp_setopt(ffrdps->ffrdp, FFRDP_OPT_STREAMS, en); // before any client connects
+}
+
+void ffrdps_adaptive_bitrate_setup(void *ctxt, int minrate, int maxrate)
 {
     FFRDPS *ffrdps = ctxt;
     if (!ctxt) return;
-    ffrdps->bitrate_list_size = MIN(n, MAX_BITRATE_LIST_SIZE);
-    memcpy(ffrdps->bitrate_list_buf, blist, ffrdps->bitrate_list_size * sizeof(int));
+    ffrdps->bitrate_min = MIN(minrate, maxrate);
+    ffrdps->bitrate_max = MAX(minrate, maxrate);
 }
 
 void ffrdps_adaptive_bitrate_enable(void *ctxt, int en)
 {
     FFRDPS *ffrdps = ctxt;
     if (!ctxt) return;
-    ffrdps->bitrate_cur_idx= ffrdps->bitrate_list_size / 2;
-    codec_reconfig(ffrdps->venc, ffrdps->bitrate_list_buf[ffrdps->bitrate_cur_idx]);
-    if (en && ffrdps->bitrate_list_size > 0) {
-        ffrdps->tick_qos_check = get_tick_count();
-        ffrdps->status |= TS_ADAPTIVE_BITRATE;
+    if (en && ffrdps->bitrate_max > 0) {
+        ffrdps->bitrate_cur    = MAX(ffrdps->bitrate_max / 4, ffrdps->bitrate_min);
+        ffrdps->tick_qos_check = ffrdps->tick_qos_hold = get_tick_count();
+        ffrdps->status        |= TS_ADAPTIVE_BITRATE;
+        codec_reconfig(ffrdps->venc, ffrdps->bitrate_cur);
     } else {
         ffrdps->status &=~TS_ADAPTIVE_BITRATE;
     }
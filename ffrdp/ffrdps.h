@@ -1,12 +1,14 @@
 #ifndef __FFRDPS_H__
 #define __FFRDPS_H__
 
-void* ffrdps_init (int port, char *txkey, char *rxkey, int channels, int samprate, int width, int height, int frate, void *adev, void *vdev, CODEC *aenc, CODEC *venc);
+void* ffrdps_init (int port, char *txkey, char *rxkey, int sfec, int channels, int samprate, int width, int height, int frate, void *adev, void *vdev, CODEC *aenc, CODEC *venc);
 void  ffrdps_exit (void *ctxt);
 void  ffrdps_start(void *ctxt, int start);
 void  ffrdps_dump (void *ctxt, int clearhistory);
 void  ffrdps_reconfig_bitrate(void *ctxt, int bitrate);
-void  ffrdps_adaptive_bitrate_setup (void *ctxt, int *blist, int n);
+void  ffrdps_set_deadline    (void *ctxt, int deadline); // ms, late video frames other than key frames are dropped, clients must support ffrdp gap frames
+void  ffrdps_set_streams     (void *ctxt, int en); // audio, video and input in their own ffrdp streams, call it before clients connect, clients must use ffrdp streams too
+void  ffrdps_adaptive_bitrate_setup (void *ctxt, int minrate, int maxrate); // bits per second, bitrate follows the bandwidth estimate within this range
 void  ffrdps_adaptive_bitrate_enable(void *ctxt, int en);
 
 #endif
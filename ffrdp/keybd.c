@@ -1,12 +1,24 @@
 #include <windows.h>
+#include <string.h>
 #include "keybd.h"
 
 void* ffkeybd_init(char *dev) { return (void*)1; }
 void  ffkeybd_exit(void *ctx) {}
 
+int ffkeybd_input(void *ctx, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2, void *input)
+{
+    INPUT *in = (INPUT*)input;
+    memset(in, 0, sizeof(INPUT));
+    in->type       = INPUT_KEYBOARD;
+    in->ki.wVk     = key;
+    in->ki.wScan   = (WORD)MapVirtualKey(key, 0);
+    in->ki.dwFlags = ((flags1 & (1 << 0)) ? KEYEVENTF_EXTENDEDKEY : 0)
+                   | ((flags1 & (1 << 7)) ? KEYEVENTF_KEYUP       : 0);
+    return 1;
+}
+
 void ffkeybd_event(void *ctx, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2)
 {
-    DWORD dwFlags = ((flags1 & (1 << 0)) ? KEYEVENTF_EXTENDEDKEY : 0)
-                  | ((flags1 & (1 << 7)) ? KEYEVENTF_KEYUP       : 0);
-    keybd_event(key, MapVirtualKey(key, 0), dwFlags, 0);
+    INPUT in;
+    if (ffkeybd_input(ctx, key, scancode, flags1, flags2, &in)) SendInput(1, &in, sizeof(INPUT));
 }
@@ -6,5 +6,6 @@
 void* ffkeybd_init (char *dev);
 void  ffkeybd_exit (void *ctx);
 void  ffkeybd_event(void *ctx, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2);
+int   ffkeybd_input(void *ctx, uint8_t key, uint8_t scancode, uint8_t flags1, uint8_t flags2, void *input); // like ffmouse_input
 
 #endif
@@ -20,9 +20,10 @@ void ffmouse_exit(void *ctx)
     if (ctx) free(ctx);
 }
 
-void ffmouse_event(void *ctx, int dx, int dy, int btns, int wheel)
+int ffmouse_input(void *ctx, int dx, int dy, int btns, int wheel, void *input)
 {
     MOUSE *mouse = (MOUSE*)ctx;
+    INPUT *in    = (INPUT*)input;
     DWORD  flags = 0;
     if (dx || dy) flags |= MOUSEEVENTF_MOVE ;
     if (wheel   ) flags |= MOUSEEVENTF_WHEEL;
@@ -39,5 +40,17 @@ void ffmouse_event(void *ctx, int dx, int dy, int btns, int wheel)
         else                 flags |= MOUSEEVENTF_MIDDLEUP;
     }
     mouse->btns = btns;
-    mouse_event(flags, dx, dy, (DWORD)(wheel * 120), (ULONG_PTR)NULL);
+    memset(in, 0, sizeof(INPUT));
+    in->type         = INPUT_MOUSE;
+    in->mi.dx        = dx;
+    in->mi.dy        = dy;
+    in->mi.mouseData = (DWORD)(wheel * 120);
+    in->mi.dwFlags   = flags;
+    return 1;
+}
+
+void ffmouse_event(void *ctx, int dx, int dy, int btns, int wheel)
+{
+    INPUT in;
+    if (ffmouse_input(ctx, dx, dy, btns, wheel, &in)) SendInput(1, &in, sizeof(INPUT));
 }
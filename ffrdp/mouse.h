@@ -5,4 +5,8 @@ void* ffmouse_init (char *dev);
 void  ffmouse_exit (void *ctx);
 void  ffmouse_event(void *ctx, int dx, int dy, int btns, int wheel);
 
+// fills one INPUT of SendInput for the event instead of injecting it, returns the number filled. events of mouse
+// and keyboard are injected in order by one SendInput then. input is INPUT*, windows.h is not needed here
+int   ffmouse_input(void *ctx, int dx, int dy, int btns, int wheel, void *input);
+
 #endif
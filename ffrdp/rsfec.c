@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string.h>
+#include "rsfec.h"
+
+// GF(256) with polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d), c * x is done with two 16 entry tables
+// (c * low nibble, c * high nibble), which is one pshufb per nibble on ssse3/avx2. msvc builds use the scalar kernel.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RSFEC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static uint8_t s_gf_exp[512];
+static uint8_t s_gf_log[256];
+static int     s_inited = 0;
+static void  (*s_muladd)(uint8_t *dst, uint8_t *src, uint8_t tlo[16], uint8_t thi[16], int len);
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return a && b ? s_gf_exp[s_gf_log[a] + s_gf_log[b]] : 0;
+}
+
+static uint8_t gf_inv(uint8_t a)
+{
+    return s_gf_exp[255 - s_gf_log[a]]; // a != 0
+}
+
+static void muladd_scalar(uint8_t *dst, uint8_t *src, uint8_t tlo[16], uint8_t thi[16], int len)
+{
+    int i;
+    for (i=0; i<len; i++) dst[i] ^= tlo[src[i] & 15] ^ thi[src[i] >> 4];
+}
+
+#ifdef RSFEC_X86_SIMD
+__attribute__((target("ssse3")))
+static void muladd_ssse3(uint8_t *dst, uint8_t *src, uint8_t tlo[16], uint8_t thi[16], int len)
+{
+    __m128i lo = _mm_loadu_si128((__m128i*)tlo), hi = _mm_loadu_si128((__m128i*)thi), mask = _mm_set1_epi8(15), s, d;
+    int     i;
+    for (i=0; i+16<=len; i+=16) {
+        s = _mm_loadu_si128((__m128i*)(src + i));
+        d = _mm_loadu_si128((__m128i*)(dst + i));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(lo, _mm_and_si128(s, mask)));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+    }
+    muladd_scalar(dst + i, src + i, tlo, thi, len - i);
+}
+
+__attribute__((target("avx2")))
+static void muladd_avx2(uint8_t *dst, uint8_t *src, uint8_t tlo[16], uint8_t thi[16], int len)
+{
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)tlo));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)thi));
+    __m256i mask = _mm256_set1_epi8(15), s, d;
+    int     i;
+    for (i=0; i+32<=len; i+=32) {
+        s = _mm256_loadu_si256((__m256i*)(src + i));
+        d = _mm256_loadu_si256((__m256i*)(dst + i));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        _mm256_storeu_si256((__m256i*)(dst + i), d);
+    }
+    muladd_scalar(dst + i, src + i, tlo, thi, len - i);
+}
+#endif
+
+void rsfec_init(void)
+{
+    int i, x;
+    if (s_inited) return;
+    for (i=0,x=1; i<255; i++) {
+        s_gf_exp[i] = x;
+        s_gf_log[x] = i;
+        x <<= 1; if (x & 0x100) x ^= 0x11d;
+    }
+    for (i=255; i<512; i++) s_gf_exp[i] = s_gf_exp[i - 255];
+    s_muladd = muladd_scalar;
+#ifdef RSFEC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) s_muladd = muladd_ssse3;
+    if (__builtin_cpu_supports("avx2" )) s_muladd = muladd_avx2;
+#endif
+    s_inited = 1;
+}
+
+uint8_t rsfec_coef(int row, int col)
+{
+    return gf_inv((uint8_t)((RSFEC_MAX_K + row) ^ col)); // cauchy matrix 1 / (x_row + y_col), x = 32 + row and y = col are all distinct
+}
+
+void rsfec_muladd(uint8_t *dst, uint8_t *src, uint8_t c, int len)
+{
+    uint8_t tlo[16], thi[16];
+    int     i;
+    if (c == 0) return;
+    for (i=0; i<16; i++) {
+        tlo[i] = gf_mul(c, (uint8_t)i);
+        thi[i] = gf_mul(c, (uint8_t)(i << 4));
+    }
+    s_muladd(dst, src, tlo, thi, len);
+}
+
+static int gf_invert_matrix(uint8_t *a, uint8_t *b, int n) // b = inverse of a (n x n), a is destroyed
+{
+    uint8_t t, c;
+    int     i, j, r;
+    memset(b, 0, n * n);
+    for (i=0; i<n; i++) b[i * n + i] = 1;
+    for (i=0; i<n; i++) {
+        for (r=i; r<n && !a[r * n + i]; r++);
+        if (r == n) return -1;
+        if (r != i) {
+            for (j=0; j<n; j++) {
+                t = a[r * n + j]; a[r * n + j] = a[i * n + j]; a[i * n + j] = t;
+                t = b[r * n + j]; b[r * n + j] = b[i * n + j]; b[i * n + j] = t;
+            }
+        }
+        c = gf_inv(a[i * n + i]);
+        for (j=0; j<n; j++) { a[i * n + j] = gf_mul(a[i * n + j], c); b[i * n + j] = gf_mul(b[i * n + j], c); }
+        for (r=0; r<n; r++) {
+            if (r == i || !(c = a[r * n + i])) continue;
+            for (j=0; j<n; j++) { a[r * n + j] ^= gf_mul(a[i * n + j], c); b[r * n + j] ^= gf_mul(b[i * n + j], c); }
+        }
+    }
+    return 0;
+}
+
+int rsfec_decode(int k, int m, uint8_t **shards, uint64_t mask, int len)
+{
+    uint8_t a[RSFEC_MAX_M * RSFEC_MAX_M], b[RSFEC_MAX_M * RSFEC_MAX_M];
+    int     lost[RSFEC_MAX_M], rows[RSFEC_MAX_M], nlost = 0, nrows = 0, i, j;
+    for (i=0; i<k; i++) {
+        if (mask & ((uint64_t)1 << i)) continue;
+        if (nlost == m) return -1;
+        lost[nlost++] = i;
+    }
+    if (nlost == 0) return 0;
+    for (i=0; i<m && nrows<nlost; i++) {
+        if (mask & ((uint64_t)1 << (k + i))) rows[nrows++] = i;
+    }
+    if (nrows < nlost) return -1;
+
+    for (i=0; i<nrows; i++) { // remove present data shards from parity shards, what remains only depends on the lost ones
+        for (j=0; j<k; j++) {
+            if (mask & ((uint64_t)1 << j)) rsfec_muladd(shards[k + rows[i]], shards[j], rsfec_coef(rows[i], j), len);
+        }
+        for (j=0; j<nlost; j++) a[i * nlost + j] = rsfec_coef(rows[i], lost[j]);
+    }
+    if (gf_invert_matrix(a, b, nlost) != 0) return -1;
+    for (i=0; i<nlost; i++) {
+        memset(shards[lost[i]], 0, len);
+        for (j=0; j<nrows; j++) rsfec_muladd(shards[lost[i]], shards[k + rows[j]], b[i * nlost + j], len);
+    }
+    return nlost;
+}
@@ -0,0 +1,20 @@
+#ifndef __RSFEC_H__
+#define __RSFEC_H__
+
+#include <stdint.h>
+
+// systematic reed-solomon erasure code over GF(256) with a cauchy generator matrix,
+// k data shards + m parity shards, any k of them recover the k data shards
+#define RSFEC_MAX_K  32
+#define RSFEC_MAX_M  8
+
+void    rsfec_init  (void); // build tables and select simd kernel, can be called many times
+uint8_t rsfec_coef  (int row, int col); // coefficient of data shard col in parity shard row, does not depend on k,
+                                         // so a group can be closed before k data shards with the parity already computed
+void    rsfec_muladd(uint8_t *dst, uint8_t *src, uint8_t c, int len); // dst ^= c * src
+
+// shards[0, k) are data shards, shards[k, k + m) are parity shards, mask bit i set if shard i is present,
+// missing data shards are rebuilt in place (parity shards are destroyed), returns the number of rebuilt shards or -1
+int     rsfec_decode(int k, int m, uint8_t **shards, uint64_t mask, int len);
+
+#endif